@@ -17,80 +17,82 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "allocators.h"
-#include "concurrent_hashtable.h"
-#include "crc64.h"
+#include "flat_map.h"
 #include "log.h"
 
-static hashtable_t* g_alloc_ht = NULL;
+// the live allocations of debug builds keyed by pointer, the info is stored inline in the map
+static flat_map_t* g_alloc_map = NULL;
+static pthread_mutex_t g_alloc_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+// every zalloc/zrealloc call since the start, it's cheap enough to keep in release builds
+static atomic_u64 g_alloc_count = 0;
 
 typedef struct alloc_info {
-    u64 ptr;
     u64 size;
     u64 allocated;
 } alloc_info_t;
 
-static void common_release_cb(void* p) {
-    free(p);
-}
-
-static inline u64 crc64i(u64* i) {
-    return crc64(0, (uint8_t*)i, 8);
-}
-
-static inline u64 ht_hasher_u64(void* i) {
-    return crc64i((u64*)i);
-}
-
 static inline ret_t alloc_set_info(void* p, u64 size, u64 allocated) {
-    alloc_info_t* info = (alloc_info_t*)calloc(1, sizeof(alloc_info_t));
-    info->allocated = allocated;
-    info->ptr = PTR_TO_U64(p);
-    info->size = size;
+    alloc_info_t info;
+    info.allocated = allocated;
+    info.size = size;
 
-    u64* key = (u64*)calloc(1, sizeof(u64));
-    *key = PTR_TO_U64(p);
+    pthread_mutex_lock(&g_alloc_mtx);
+    ret_t ret = flat_map_put(g_alloc_map, PTR_TO_U64(p), &info);
+    pthread_mutex_unlock(&g_alloc_mtx);
 
-    return ht_set(g_alloc_ht, key, info);
+    return ret;
 }
 
 static inline ret_t alloc_del_info(void* p) {
-    u64 pi = PTR_TO_U64(p);
+    pthread_mutex_lock(&g_alloc_mtx);
+    ret_t ret = flat_map_del(g_alloc_map, PTR_TO_U64(p));
+    pthread_mutex_unlock(&g_alloc_mtx);
 
-    return ht_del(g_alloc_ht, &pi);
+    return ret;
 }
 
-static void alloc_summary_cb(u64 hash, void* key, void* value, void* ctx) {
+static void alloc_summary_cb(u64 ptr, void* value, void* ctx) {
     u64* allocated = (u64*)ctx;
 
     *allocated += ((alloc_info_t*)value)->allocated;
 }
 
+u64 alloc_count(void) {
+    return atomic_load_explicit(&g_alloc_count, memory_order_relaxed);
+}
+
 void alloc_dump_summary() {
     u64 allocated = 0;
 
-    ht_foreach(g_alloc_ht, &alloc_summary_cb, &allocated);
+    pthread_mutex_lock(&g_alloc_mtx);
 
-    LOG_DEBUG("Current allocated memory %lu bytes in %lu elements", allocated, ht_size(g_alloc_ht));
+    flat_map_foreach(g_alloc_map, &alloc_summary_cb, &allocated);
 
-    ht_hist_dump_csv(g_alloc_ht, "alloc_ht_hist.csv");
+    LOG_DEBUG("Current allocated memory %lu bytes in %lu elements", allocated, flat_map_size(g_alloc_map));
+
+    flat_map_hist_dump_csv(g_alloc_map, "alloc_ht_hist.csv");
+
+    pthread_mutex_unlock(&g_alloc_mtx);
 }
 
 ret_t init_allocators() {
-    ht_init(&g_alloc_ht, 256, &ht_hasher_u64, &common_release_cb, &common_release_cb);
-
-    return ST_OK;
+    return flat_map_init(&g_alloc_map, sizeof(alloc_info_t), 256);
 }
 
 void shutdown_allocators(void)
 {
-    ht_destroy(g_alloc_ht);
-    g_alloc_ht = NULL;
+    flat_map_release(g_alloc_map);
+    g_alloc_map = NULL;
 }
 
 #ifdef NDEBUG
 
 void* zalloc(u64 size) {
+    atomic_fetch_add_explicit(&g_alloc_count, 1, memory_order_relaxed);
+
     void* v = malloc(size);
     if (v == NULL) {
         LOG_ERROR("malloc returns null pointer [size=%lu]. Trying again...", size);
@@ -103,9 +105,17 @@ void* zalloc(u64 size) {
 
 }
 
+void* zrealloc(void* p, u64 size) {
+    atomic_fetch_add_explicit(&g_alloc_count, 1, memory_order_relaxed);
+
+    return realloc(p, size);
+}
+
 #else
 
 void* _zalloc(u64 size, u64 line, const char* fun) {
+    atomic_fetch_add_explicit(&g_alloc_count, 1, memory_order_relaxed);
+
     void* v = malloc(size);
     if (v == NULL) {
         LOG_ERROR("malloc returns null pointer [size=%lu]. Trying again...", size);
@@ -125,6 +135,8 @@ void* _zalloc(u64 size, u64 line, const char* fun) {
 }
 
 void* _zrealloc(void* p, u64 size, u64 line, const char* fun) {
+    atomic_fetch_add_explicit(&g_alloc_count, 1, memory_order_relaxed);
+
     void* v = realloc(p, size);
 
     if (p != v) {
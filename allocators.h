@@ -25,6 +25,9 @@
 
 void alloc_dump_summary(void);
 
+/// number of zalloc/zrealloc calls so far
+u64 alloc_count(void);
+
 ret_t init_allocators(void);
 
 void shutdown_allocators(void);
@@ -33,8 +36,9 @@ void shutdown_allocators(void);
 
 void* zalloc(u64 size);
 
+void* zrealloc(void* p, u64 size);
+
 #define zfree(p) free(p)
-#define zrealloc(p, size) realloc((p), (size))
 
 #else
 
@@ -0,0 +1,206 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "arena.h"
+#include "allocators.h"
+#include "log.h"
+
+#define ARENA_MIN_CHUNK_SIZE 1024UL
+
+static inline u64 arena_round(u64 size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static arena_chunk_t* arena_chunk_alloc(arena_t* a, u64 size) {
+    arena_chunk_t* c = zalloc(sizeof(arena_chunk_t) + size);
+    c->size = size;
+    ++a->refills;
+
+    return c;
+}
+
+static void arena_enter(arena_t* a, arena_chunk_t* c) {
+    a->cur = c;
+    a->pos = c->data;
+    a->end = c->data + c->size;
+}
+
+ret_t arena_init(arena_t** a, u64 chunk_size) {
+    *a = zalloc(sizeof(arena_t));
+    arena_t* pa = *a;
+
+    pa->chunk_size = arena_round(MAX(chunk_size, ARENA_MIN_CHUNK_SIZE));
+    pa->head = arena_chunk_alloc(pa, pa->chunk_size);
+    arena_enter(pa, pa->head);
+
+    return ST_OK;
+}
+
+void arena_release(arena_t* a) {
+    if (!a)
+        return;
+
+    arena_chunk_t* c = a->head;
+    while (c) {
+        arena_chunk_t* next = c->next;
+        zfree(c);
+        c = next;
+    }
+
+    zfree(a);
+}
+
+/// moves on to the next chunk that can hold @size, the chunks kept by a reset come first
+static void arena_refill(arena_t* a, u64 size) {
+    arena_chunk_t* next = a->cur->next;
+
+    if (!next || next->size < size) {
+        arena_chunk_t* c = arena_chunk_alloc(a, MAX(a->chunk_size, size));
+        c->next = next;
+        a->cur->next = c;
+        next = c;
+    }
+
+    arena_enter(a, next);
+}
+
+void* arena_alloc(arena_t* a, u64 size) {
+    size = arena_round(size);
+
+    if ((u64)(a->end - a->pos) < size)
+        arena_refill(a, size);
+
+    void* p = a->pos;
+    a->last = a->pos;
+    a->pos += size;
+
+    memset(p, 0, size);
+
+    return p;
+}
+
+void* arena_realloc(arena_t* a, void* p, u64 old_size, u64 size) {
+    if (!p)
+        return arena_alloc(a, size);
+
+    if (size <= old_size)
+        return p;
+
+    if ((u8*)p == a->last && (u64)(a->end - a->last) >= arena_round(size)) {
+        a->pos = a->last + arena_round(size);
+        return p;
+    }
+
+    void* np = arena_alloc(a, size);
+    memcpy(np, p, old_size);
+
+    return np;
+}
+
+void arena_reset(arena_t* a) {
+    arena_enter(a, a->head);
+    a->last = NULL;
+}
+
+u64 arena_refills(arena_t* a) {
+    return a->refills;
+}
+
+//============================================================================================================
+// TESTS
+//============================================================================================================
+
+#ifndef NDEBUG
+
+#include "string.h"
+#include "double_linked_list.h"
+
+void test_arena(void) {
+    arena_t* a = NULL;
+    CHECK_RETURN(arena_init(&a, 4096));
+    ASSERT(arena_refills(a) == 1);
+
+    u8* p = arena_alloc(a, 3);
+    u8* q = arena_alloc(a, 5);
+    ASSERT(((u64)p % ARENA_ALIGN) == 0 && ((u64)q % ARENA_ALIGN) == 0 && q == p + ARENA_ALIGN);
+
+    // the latest allocation grows in place, an older one is copied
+    memset(q, 'q', 5);
+    ASSERT(arena_realloc(a, q, 5, 100) == q);
+    memset(p, 'p', 3);
+    u8* np = arena_realloc(a, p, 3, 64);
+    ASSERT(np != p && memcmp(np, "ppp", 3) == 0);
+
+    // bigger than a chunk
+    u8* big = arena_alloc(a, 10000);
+    ASSERT(big && big[9999] == 0 && arena_refills(a) == 2);
+
+    // after a reset the same work takes no new chunks
+    for (int round = 0; round < 3; ++round) {
+        arena_reset(a);
+
+        for (u64 i = 0; i < 1000; ++i)
+            ASSERT(arena_alloc(a, 24) != NULL);
+
+        ASSERT(arena_alloc(a, 10000) != NULL);
+    }
+
+    u64 refills = arena_refills(a);
+    arena_reset(a);
+    for (u64 i = 0; i < 1000; ++i)
+        arena_alloc(a, 24);
+    ASSERT(arena_refills(a) == refills);
+
+    // strings and lists drawn from the arena are released with it
+    arena_reset(a);
+
+    string* s = NULL;
+    CHECK_RETURN(string_init_arena(&s, a));
+    for (u64 i = 0; i < 100; ++i)
+        string_append(s, "sda");
+
+    ASSERT(string_size(s) == 300 && string_starts_with(s, "sdasda") == ST_OK);
+
+    string* d = NULL;
+    CHECK_RETURN(string_dub_arena(s, a, &d));
+    ASSERT(string_compare(s, d) == ST_OK);
+    string_release(s);
+
+    list_t* l = NULL;
+    list_init_arena(&l, a, NULL);
+    for (u64 i = 0; i < 100; ++i)
+        list_push(l, d);
+
+    list_iter_t it;
+    list_iter_begin(l, &it);
+    u64 n = 0;
+    while (list_iter_next(&it))
+        ++n;
+
+    ASSERT(n == 100 && list_pop_head(l) == d && l->size == 99);
+
+    u64 allocs = alloc_count();
+    list_release(l, false);
+    ASSERT(alloc_count() == allocs);
+
+    arena_release(a);
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// ARENA
+//============================================================================================================
+
+/// Bump allocator for memory that dies all at once, the scratch of a sample or a whole snapshot.
+/// An allocation is a pointer increment in the current chunk, a new chunk is only taken from the heap
+/// when the current one is full. Nothing is freed on its own, arena_reset rewinds to the first chunk
+/// and keeps the chunks for the next round, arena_release gives them back.
+///
+/// Not thread safe, an arena belongs to one collector at a time.
+
+#define ARENA_ALIGN 16UL
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    u64 size;
+    u8 data[];
+} arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t* head;
+    arena_chunk_t* cur;
+    u8* pos;
+    u8* end;
+    // the latest allocation, the only one that can grow in place
+    u8* last;
+    u64 chunk_size;
+    // chunks taken from the heap over the life of the arena
+    u64 refills;
+} arena_t;
+
+ret_t arena_init(arena_t** a, u64 chunk_size);
+
+void arena_release(arena_t* a);
+
+/// zeroed, aligned to ARENA_ALIGN
+void* arena_alloc(arena_t* a, u64 size);
+
+/// grows the latest allocation in place if the chunk has room, copies otherwise, bytes past
+/// @old_size are not zeroed
+void* arena_realloc(arena_t* a, void* p, u64 old_size, u64 size);
+
+/// O(1), every pointer taken from the arena is invalid afterwards
+void arena_reset(arena_t* a);
+
+u64 arena_refills(arena_t* a);
+
+#ifndef NDEBUG
+
+void test_arena(void);
+
+#endif
@@ -0,0 +1,885 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <stdio.h>
+#include <dirent.h>
+#include <memory.h>
+#include <sys/param.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "allocators.h"
+#include "timer.h"
+#include "utils.h"
+#include "string.h"
+#include "cpu_dev.h"
+#include "mem_dev.h"
+#include "blk_dev.h"
+#include "blk_topo.h"
+#include "arena.h"
+#include "concurrent_hashtable.h"
+#include "crc64.h"
+#include "hash.h"
+#include "fifo.h"
+#include "mpsc_queue.h"
+#include "spsc_ring.h"
+
+#ifdef HW_BENCH
+
+#define BENCH_ITERATIONS 20000UL
+
+// keeps the measured loops from being optimized away
+static volatile u64 bench_sink;
+
+typedef void(* bench_cb)(void* ctx);
+
+static void bench(const char* name, bench_cb cb, void* ctx) {
+    // warm up the descriptor cache and the allocator
+    cb(ctx);
+
+    u64 allocs = alloc_count();
+    struct timespec start = timer_start();
+
+    for (u64 i = 0; i < BENCH_ITERATIONS; ++i)
+        cb(ctx);
+
+    double ms = timer_end_ms(start);
+    allocs = alloc_count() - allocs;
+
+    printf("%-36s %10.1f ns/op %8.2f allocs/op\n", name,
+           ms * NANOSEC_IN_MILLISEC / BENCH_ITERATIONS,
+           (double)allocs / BENCH_ITERATIONS);
+}
+
+//============================================================================================================
+// SCANNER
+//============================================================================================================
+
+// the parsers the scanner has replaced, kept here as the reference
+
+static void bench_cpu_split(void* ctx) {
+    u64* fields = (u64*)ctx;
+    string* stat_s = NULL;
+    string_init(&stat_s);
+
+    file_read_line("/proc/stat", stat_s);
+    string_strip(stat_s);
+
+    list_t* cpu_stats = NULL;
+    string_split(stat_s, ' ', &cpu_stats);
+    string_release(stat_s);
+
+    list_iter_t* it = NULL;
+    list_iter_init(cpu_stats, &it);
+    list_iter_next(it);
+
+    string* stat;
+    u64 idx = 0;
+    while ((stat = list_iter_next(it)) && idx < CPU_STAT_COUNT)
+        string_to_u64(stat, &fields[idx++]);
+
+    list_iter_release(it);
+    list_release(cpu_stats, true);
+}
+
+typedef struct bench_cpu {
+    cpu_dev_ctx_t ctx;
+    cpu_dev_t* cpu;
+} bench_cpu_t;
+
+static void bench_cpu_scan(void* ctx) {
+    bench_cpu_t* b = (bench_cpu_t*)ctx;
+    cpu_dev_read(&b->ctx, b->cpu);
+}
+
+static void bench_cpu_freq(void* ctx) {
+    bench_cpu_t* b = (bench_cpu_t*)ctx;
+    cpu_dev_read_freq(&b->ctx, b->cpu);
+}
+
+static void bench_mem_regex(void* ctx) {
+    mem_info_t* m = (mem_info_t*)ctx;
+    string* mem_info_s = NULL;
+    string_init(&mem_info_s);
+    file_read_all_buffered_s("/proc/meminfo", mem_info_s);
+
+    list_t* pairs = NULL;
+    string_re_search(mem_info_s, "([a-zA-Z]+):\\s+([0-9]+)", &pairs);
+    string_release(mem_info_s);
+
+    string* key;
+    while ((key = list_pop_head(pairs))) {
+        string* val = list_pop_head(pairs);
+
+        if (string_comparez(key, "MemTotal") == ST_OK)
+            string_to_u64(val, &m->mem_total);
+
+        string_release(key);
+        string_release(val);
+    }
+
+    list_release(pairs, true);
+}
+
+static void bench_mem_scan(void* ctx) {
+    mem_info_read((mem_info_t*)ctx);
+}
+
+static void bench_blk_split(void* ctx) {
+    blk_dev_t* dev = (blk_dev_t*)ctx;
+    string* stat_s = NULL;
+    string_init(&stat_s);
+
+    string* stat_filename = NULL;
+    string_dub(dev->sysfolder, &stat_filename);
+    string_append(stat_filename, "stat");
+
+    char* stat_filename_c = string_makez(stat_filename);
+    file_read_all_s(stat_filename_c, stat_s);
+    string_strip(stat_s);
+
+    zfree(stat_filename_c);
+    string_release(stat_filename);
+
+    list_t* lstat_s = NULL;
+    string_split(stat_s, ' ', &lstat_s);
+    string_release(stat_s);
+
+    list_iter_t* it = NULL;
+    list_iter_init(lstat_s, &it);
+
+    string* s;
+    u64 n = 0;
+    while ((s = list_iter_next(it)) && n < 11)
+        string_to_u64(s, &dev->stat[n++]);
+
+    list_iter_release(it);
+    list_release(lstat_s, true);
+}
+
+static void bench_blk_scan(void* ctx) {
+    blk_dev_read_stat((blk_dev_t*)ctx);
+}
+
+static string* bench_first_block_device(void) {
+    DIR* d = opendir("/sys/block/");
+    if (!d)
+        return NULL;
+
+    string* sysfolder = NULL;
+    struct dirent* dir;
+    while ((dir = readdir(d))) {
+        if (dir->d_name[0] == '.')
+            continue;
+
+        string_create(&sysfolder, "/sys/block/");
+        string_append(sysfolder, dir->d_name);
+        string_append(sysfolder, "/");
+        break;
+    }
+
+    closedir(d);
+
+    return sysfolder;
+}
+
+void bench_scanner(void) {
+    u64 fields[CPU_STAT_COUNT];
+    bench("/proc/stat string_split", &bench_cpu_split, fields);
+
+    bench_cpu_t cpu;
+    cpu_dev_ctx_init(&cpu.ctx);
+    cpu_dev_get(&cpu.ctx, &cpu.cpu);
+    bench("/proc/stat scanner, all cores", &bench_cpu_scan, &cpu);
+    bench("core clocks", &bench_cpu_freq, &cpu);
+    cpu_dev_release_cb(cpu.cpu);
+    cpu_dev_ctx_release(&cpu.ctx);
+
+    mem_info_t mem;
+    memset(&mem, 0, sizeof(mem));
+    bench("/proc/meminfo regex", &bench_mem_regex, &mem);
+    bench("/proc/meminfo scanner", &bench_mem_scan, &mem);
+
+    blk_dev_t dev;
+    memset(&dev, 0, sizeof(dev));
+    dev.sysfolder = bench_first_block_device();
+
+    if (dev.sysfolder) {
+        bench("/sys/block/<dev>/stat string_split", &bench_blk_split, &dev);
+        bench("/sys/block/<dev>/stat scanner", &bench_blk_scan, &dev);
+        string_release(dev.sysfolder);
+    }
+}
+
+//============================================================================================================
+// HASHTABLE
+//============================================================================================================
+
+// the keys are the integers themselves, so the numbers are the table and not the key allocations
+
+static u64 bench_ht_hasher(void* key) {
+    return (u64)key;
+}
+
+static bool bench_ht_comparator(void* a, void* b) {
+    return a == b;
+}
+
+static void bench_ht_release_cb(void* p) {
+}
+
+// small tables are filled over and over so every line covers at least this many operations
+#define BENCH_HT_MIN_OPS 1000000UL
+
+static void bench_ht_fill(const char* name, u64 n, u64 table_size) {
+    u64 reps = MAX(1, BENCH_HT_MIN_OPS / n);
+    u64 bins = 0;
+    u64 found = 0;
+    double set_ms = 0.0;
+    double get_ms = 0.0;
+
+    for (u64 r = 0; r < reps; ++r) {
+        hashtable_t* ht = NULL;
+        ht_init(&ht, table_size, &bench_ht_hasher, &bench_ht_comparator, &bench_ht_release_cb,
+                &bench_ht_release_cb);
+
+        struct timespec start = timer_start();
+
+        for (u64 i = 1; i <= n; ++i)
+            ht_set(ht, (void*)i, (void*)i);
+
+        set_ms += timer_end_ms(start);
+
+        void* value = NULL;
+        start = timer_start();
+
+        for (u64 i = 1; i <= n; ++i)
+            found += ht_get(ht, (void*)i, &value) == ST_OK;
+
+        get_ms += timer_end_ms(start);
+        bins = ht_table_size(ht);
+
+        ht_destroy(ht);
+    }
+
+    printf("hashtable %-9s %9lu entries %9lu bins   set %7.1f ns/op   get %7.1f ns/op%s\n",
+           name, n, bins, set_ms * NANOSEC_IN_MILLISEC / (n * reps), get_ms * NANOSEC_IN_MILLISEC / (n * reps),
+           found == n * reps ? "" : "   LOST KEYS");
+}
+
+void bench_hashtable(void) {
+    // presized is the same table without a single resize, the difference is what the migration costs
+    for (u64 n = 100; n <= 10000000; n *= 10) {
+        bench_ht_fill("growing", n, 256);
+        bench_ht_fill("presized", n, n);
+    }
+}
+
+//============================================================================================================
+// HASH
+//============================================================================================================
+
+#define BENCH_HASH_KEYS 65536UL
+#define BENCH_HASH_NAME_LEN 16UL
+#define BENCH_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct bench_hash_kernel {
+    const char* name;
+    // for the csv file name
+    const char* id;
+    hash_bytes_fn fn;
+} bench_hash_kernel_t;
+
+static u64 bench_hash_crc64_bytewise(const void* p, u64 len) {
+    return crc64_bytewise(0, (const u8*)p, len);
+}
+
+static u64 bench_hash_crc64(const void* p, u64 len) {
+    return crc64(0, (const u8*)p, len);
+}
+
+static u64 bench_hash_u64(const void* p, u64 len) {
+    u64 key;
+    memcpy(&key, p, sizeof(key));
+    return hash_u64(key);
+}
+
+static const bench_hash_kernel_t bench_hash_kernels[] = {
+    {"crc64 bytewise", "crc64b", &bench_hash_crc64_bytewise},
+    {"crc64 slice-by-8", "crc64", &bench_hash_crc64},
+    {"hash_bytes", "bytes", &hash_bytes},
+    {"hash_u64", "u64", &bench_hash_u64},
+};
+
+static u64 bench_hash_ht_hasher(void* key) {
+    return *(u64*)key;
+}
+
+static void bench_hash_ht_release_cb(void* p) {
+}
+
+/// the keys go into as many buckets as there are keys by the low bits, a perfect spread is a Poisson
+/// distribution, about 5.9 in the fullest bucket at 64K keys and chi2/df close to 1
+static void bench_hash_keys(const char* set, const bench_hash_kernel_t* k, const u8* keys, u64 key_size,
+                            const u64* key_len) {
+    u64* hashes = zalloc(BENCH_HASH_KEYS * sizeof(u64));
+    u64* buckets = zalloc(BENCH_HASH_KEYS * sizeof(u64));
+    u64 reps = BENCH_HT_MIN_OPS / BENCH_HASH_KEYS;
+    u64 sink = 0;
+
+    struct timespec start = timer_start();
+
+    for (u64 r = 0; r < reps; ++r) {
+        for (u64 i = 0; i < BENCH_HASH_KEYS; ++i)
+            sink += k->fn(keys + i * key_size, key_len[i]);
+    }
+
+    double ms = timer_end_ms(start);
+
+    bench_sink = sink;
+
+    for (u64 i = 0; i < BENCH_HASH_KEYS; ++i) {
+        hashes[i] = k->fn(keys + i * key_size, key_len[i]);
+        ++buckets[hashes[i] & (BENCH_HASH_KEYS - 1)];
+    }
+
+    u64 max = 0;
+    double chi2 = 0.0;
+    for (u64 i = 0; i < BENCH_HASH_KEYS; ++i) {
+        max = MAX(max, buckets[i]);
+        chi2 += ((double)buckets[i] - 1.0) * ((double)buckets[i] - 1.0);
+    }
+
+    printf("hash %-6s %-18s %7.1f ns/hash   fullest bucket %3lu   chi2/df %5.2f\n", set, k->name,
+           ms * NANOSEC_IN_MILLISEC / (reps * BENCH_HASH_KEYS), max, chi2 / (BENCH_HASH_KEYS - 1));
+
+    // the same hashes through the hashtable for tools/hist_ht
+    char filename[64];
+    snprintf(filename, sizeof(filename), "bench_hash_%s_%s.csv", set, k->id);
+
+    hashtable_t* ht = NULL;
+    ht_init(&ht, BENCH_HASH_KEYS, &bench_hash_ht_hasher, &ht_comparator_u64, &bench_hash_ht_release_cb,
+            &bench_hash_ht_release_cb);
+
+    for (u64 i = 0; i < BENCH_HASH_KEYS; ++i)
+        ht_set(ht, &hashes[i], NULL);
+
+    ht_hist_dump_csv(ht, filename);
+    ht_destroy(ht);
+
+    zfree(buckets);
+    zfree(hashes);
+}
+
+void bench_hash(void) {
+    u64* key_len = zalloc(BENCH_HASH_KEYS * sizeof(u64));
+    u64* ints = zalloc(BENCH_HASH_KEYS * sizeof(u64));
+    char* names = zalloc(BENCH_HASH_KEYS * BENCH_HASH_NAME_LEN);
+
+    // sequential integers, 64 byte aligned pointers and device names
+    const struct {
+        const char* name;
+        u64 stride;
+        u64 base;
+    } int_sets[] = {{"seq", 1, 0}, {"ptr", 64, 0x7f3a5c000000UL}};
+
+    for (u64 s = 0; s < BENCH_COUNT(int_sets); ++s) {
+        for (u64 i = 0; i < BENCH_HASH_KEYS; ++i) {
+            ints[i] = int_sets[s].base + i * int_sets[s].stride;
+            key_len[i] = sizeof(u64);
+        }
+
+        for (u64 k = 0; k < BENCH_COUNT(bench_hash_kernels); ++k)
+            bench_hash_keys(int_sets[s].name, &bench_hash_kernels[k], (const u8*)ints, sizeof(u64), key_len);
+    }
+
+    static const char* const name_fmt[] = {"sd%c%lu", "nvme%lun1p%c", "eth%lu.%c", "veth%c%05lx"};
+
+    for (u64 i = 0; i < BENCH_HASH_KEYS; ++i) {
+        char* name = names + i * BENCH_HASH_NAME_LEN;
+        u64 fmt = i % BENCH_COUNT(name_fmt);
+        u64 n = i / BENCH_COUNT(name_fmt) / 26;
+        char c = (char)('a' + i / BENCH_COUNT(name_fmt) % 26);
+
+        if (fmt == 1 || fmt == 2)
+            snprintf(name, BENCH_HASH_NAME_LEN, name_fmt[fmt], n, c);
+        else
+            snprintf(name, BENCH_HASH_NAME_LEN, name_fmt[fmt], c, n);
+
+        key_len[i] = strlen(name);
+    }
+
+    // hash_u64 only takes integers
+    for (u64 k = 0; k < BENCH_COUNT(bench_hash_kernels) - 1; ++k)
+        bench_hash_keys("name", &bench_hash_kernels[k], (const u8*)names, BENCH_HASH_NAME_LEN, key_len);
+
+    zfree(names);
+    zfree(ints);
+    zfree(key_len);
+}
+
+//============================================================================================================
+// STRING
+//============================================================================================================
+
+typedef struct bench_string_ctx {
+    string* name;
+    string* name2;
+    string* path;
+} bench_string_ctx_t;
+
+static void bench_string_create(void* ctx) {
+    string* s = NULL;
+    string_create(&s, "nvme0n1p1");
+    string_release(s);
+}
+
+static void bench_string_append(void* ctx) {
+    // a sysfs path built piece by piece like the collectors do
+    string* s = NULL;
+    string_init(&s);
+    string_append(s, "/sys/class/net/");
+    string_append(s, "enp0s31f6");
+    string_append(s, "/statistics/");
+    string_append(s, "rx_bytes");
+    string_release(s);
+}
+
+static void bench_string_append_long(void* ctx) {
+    string* s = NULL;
+    string_init(&s);
+
+    for (u64 i = 0; i < 64; ++i)
+        string_append(s, "cpu0 1 2 3 4 5 6 7 8 9\n");
+
+    string_release(s);
+}
+
+static void bench_string_dub(void* ctx) {
+    string* s = NULL;
+    string_dub(((bench_string_ctx_t*)ctx)->name, &s);
+    string_release(s);
+}
+
+static void bench_string_dub_long(void* ctx) {
+    string* s = NULL;
+    string_dub(((bench_string_ctx_t*)ctx)->path, &s);
+    string_release(s);
+}
+
+static void bench_string_compare(void* ctx) {
+    bench_string_ctx_t* c = (bench_string_ctx_t*)ctx;
+
+    for (u64 i = 0; i < 100; ++i)
+        bench_sink += string_compare(c->name, c->name2) == ST_OK;
+}
+
+void bench_string(void) {
+    bench_string_ctx_t ctx;
+    string_create(&ctx.name, "nvme0n1p1");
+    string_create(&ctx.name2, "nvme0n1p1");
+    string_create(&ctx.path, "/sys/devices/pci0000:00/0000:00:1d.0/0000:3d:00.0/nvme/nvme0/nvme0n1/nvme0n1p1/");
+
+    bench("string create 9 chars", &bench_string_create, &ctx);
+    bench("string append 4 pieces, 44 chars", &bench_string_append, &ctx);
+    bench("string append 64 pieces, 1.4 KiB", &bench_string_append_long, &ctx);
+    bench("string dub 9 chars", &bench_string_dub, &ctx);
+    bench("string dub 84 chars", &bench_string_dub_long, &ctx);
+    bench("string compare x100", &bench_string_compare, &ctx);
+
+    string_release(ctx.path);
+    string_release(ctx.name2);
+    string_release(ctx.name);
+}
+
+//============================================================================================================
+// QUEUES
+//============================================================================================================
+
+#define BENCH_QUEUE_ITEMS 400000UL
+#define BENCH_QUEUE_CAPACITY 1024
+#define BENCH_QUEUE_ROUND_TRIPS 20000UL
+#define BENCH_QUEUE_MAX_PRODUCERS 4
+
+typedef bool(* bench_queue_push_cb)(void* q, u64 v);
+
+typedef bool(* bench_queue_pop_cb)(void* q, u64* v);
+
+typedef struct bench_queue_kind {
+    const char* name;
+    void* (* init)(void);
+    void (* release)(void* q);
+    bench_queue_push_cb push;
+    bench_queue_pop_cb pop;
+    // how many threads may push at once
+    u64 max_producers;
+} bench_queue_kind_t;
+
+// what the queues replace: the fifo behind a mutex
+typedef struct bench_fifo_mtx {
+    pthread_mutex_t mtx;
+    fifo_t* fifo;
+} bench_fifo_mtx_t;
+
+static void* bench_fifo_mtx_init(void) {
+    bench_fifo_mtx_t* q = zalloc(sizeof(bench_fifo_mtx_t));
+    pthread_mutex_init(&q->mtx, NULL);
+    fifo_init(&q->fifo, NULL);
+
+    return q;
+}
+
+static void bench_fifo_mtx_release(void* p) {
+    bench_fifo_mtx_t* q = (bench_fifo_mtx_t*)p;
+    fifo_release(q->fifo, false);
+    pthread_mutex_destroy(&q->mtx);
+    zfree(q);
+}
+
+static bool bench_fifo_mtx_push(void* p, u64 v) {
+    bench_fifo_mtx_t* q = (bench_fifo_mtx_t*)p;
+
+    // NULL is an empty fifo
+    pthread_mutex_lock(&q->mtx);
+    fifo_push(q->fifo, (void*)(v + 1));
+    pthread_mutex_unlock(&q->mtx);
+
+    return true;
+}
+
+static bool bench_fifo_mtx_pop(void* p, u64* v) {
+    bench_fifo_mtx_t* q = (bench_fifo_mtx_t*)p;
+
+    pthread_mutex_lock(&q->mtx);
+    void* d = fifo_pop(q->fifo);
+    pthread_mutex_unlock(&q->mtx);
+
+    *v = PTR_TO_U64(d) - 1;
+
+    return d != NULL;
+}
+
+static void* bench_mpsc_init(void) {
+    mpsc_queue_t* q = NULL;
+    mpsc_init(&q, BENCH_QUEUE_CAPACITY);
+
+    return q;
+}
+
+static void bench_mpsc_release(void* q) {
+    mpsc_release((mpsc_queue_t*)q);
+}
+
+static bool bench_mpsc_push(void* q, u64 v) {
+    return mpsc_push((mpsc_queue_t*)q, v);
+}
+
+static bool bench_mpsc_pop(void* q, u64* v) {
+    return mpsc_pop((mpsc_queue_t*)q, v);
+}
+
+static void* bench_spsc_init(void) {
+    spsc_ring_t* r = NULL;
+    spsc_init(&r, BENCH_QUEUE_CAPACITY);
+
+    return r;
+}
+
+static void bench_spsc_release(void* r) {
+    spsc_release((spsc_ring_t*)r);
+}
+
+static bool bench_spsc_push(void* r, u64 v) {
+    return spsc_push((spsc_ring_t*)r, v);
+}
+
+static bool bench_spsc_pop(void* r, u64* v) {
+    return spsc_pop((spsc_ring_t*)r, v);
+}
+
+static const bench_queue_kind_t bench_queue_kinds[] = {
+    {"fifo+mutex", &bench_fifo_mtx_init, &bench_fifo_mtx_release, &bench_fifo_mtx_push, &bench_fifo_mtx_pop,
+     BENCH_QUEUE_MAX_PRODUCERS},
+    {"mpsc", &bench_mpsc_init, &bench_mpsc_release, &bench_mpsc_push, &bench_mpsc_pop,
+     BENCH_QUEUE_MAX_PRODUCERS},
+    {"spsc", &bench_spsc_init, &bench_spsc_release, &bench_spsc_push, &bench_spsc_pop, 1},
+};
+
+typedef struct bench_queue_worker {
+    const bench_queue_kind_t* k;
+    void* q;
+    void* back;
+    u64 count;
+} bench_queue_worker_t;
+
+static void* bench_queue_producer(void* p) {
+    bench_queue_worker_t* w = (bench_queue_worker_t*)p;
+
+    for (u64 i = 0; i < w->count; ++i) {
+        while (!w->k->push(w->q, i))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void bench_queue_throughput(const bench_queue_kind_t* k, u64 producers) {
+    void* q = k->init();
+    u64 allocs = alloc_count();
+    struct timespec start = timer_start();
+
+    pthread_t thrd[BENCH_QUEUE_MAX_PRODUCERS];
+    bench_queue_worker_t workers[BENCH_QUEUE_MAX_PRODUCERS];
+    for (u64 i = 0; i < producers; ++i) {
+        workers[i] = (bench_queue_worker_t){k, q, NULL, BENCH_QUEUE_ITEMS / producers};
+        pthread_create(&thrd[i], NULL, &bench_queue_producer, &workers[i]);
+    }
+
+    u64 v;
+    u64 sink = 0;
+    for (u64 n = 0; n < BENCH_QUEUE_ITEMS; ) {
+        if (k->pop(q, &v)) {
+            sink += v;
+            ++n;
+        } else {
+            sched_yield();
+        }
+    }
+
+    for (u64 i = 0; i < producers; ++i)
+        pthread_join(thrd[i], NULL);
+
+    double ms = timer_end_ms(start);
+    allocs = alloc_count() - allocs;
+    bench_sink = sink;
+
+    char name[64];
+    snprintf(name, sizeof(name), "queue %s %lu producer(s)", k->name, producers);
+    printf("%-36s %10.1f ns/op %8.2f allocs/op\n", name, ms * NANOSEC_IN_MILLISEC / BENCH_QUEUE_ITEMS,
+           (double)allocs / BENCH_QUEUE_ITEMS);
+
+    k->release(q);
+}
+
+static void* bench_queue_echo(void* p) {
+    bench_queue_worker_t* w = (bench_queue_worker_t*)p;
+
+    u64 v;
+    for (u64 i = 0; i < w->count; ++i) {
+        while (!w->k->pop(w->q, &v))
+            sched_yield();
+
+        while (!w->k->push(w->back, v))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+/// one value bounced between two threads, a round trip is two hand-offs
+static void bench_queue_latency(const bench_queue_kind_t* k) {
+    void* q = k->init();
+    void* back = k->init();
+
+    pthread_t thrd;
+    bench_queue_worker_t echo = {k, q, back, BENCH_QUEUE_ROUND_TRIPS};
+    pthread_create(&thrd, NULL, &bench_queue_echo, &echo);
+
+    struct timespec start = timer_start();
+
+    u64 v;
+    for (u64 i = 0; i < BENCH_QUEUE_ROUND_TRIPS; ++i) {
+        while (!k->push(q, i))
+            sched_yield();
+
+        while (!k->pop(back, &v))
+            sched_yield();
+    }
+
+    double ms = timer_end_ms(start);
+    pthread_join(thrd, NULL);
+
+    char name[64];
+    snprintf(name, sizeof(name), "queue %s hand-off", k->name);
+    printf("%-36s %10.1f ns/op\n", name, ms * NANOSEC_IN_MILLISEC / (2 * BENCH_QUEUE_ROUND_TRIPS));
+
+    k->release(back);
+    k->release(q);
+}
+
+void bench_queue(void) {
+    u64 nkinds = sizeof(bench_queue_kinds) / sizeof(bench_queue_kinds[0]);
+
+    for (u64 i = 0; i < nkinds; ++i) {
+        const bench_queue_kind_t* k = &bench_queue_kinds[i];
+
+        for (u64 p = 1; p <= k->max_producers; p *= 2)
+            bench_queue_throughput(k, p);
+
+        bench_queue_latency(k);
+    }
+}
+
+//============================================================================================================
+// BLOCK DEVICES
+//============================================================================================================
+
+#define BENCH_BLK_DEVICES 5000UL
+#define BENCH_BLK_ROUNDS 20UL
+
+typedef struct bench_blk {
+    char root[64];
+    blk_topo_t* topo;
+    dev_index_t* index;
+    string* diskstats;
+    // devices of the last sample that got a diskstats line
+    u64 matched;
+} bench_blk_t;
+
+static void bench_blk_path(char* path, u64 size, const char* root, const char* dir, u64 i, const char* file) {
+    snprintf(path, size, "%s/%s/sd%lu%s", root, dir, i, file);
+}
+
+/// a class directory of 5000 disks laid out like sysfs and the /proc/diskstats text of them
+static bool bench_blk_create(bench_blk_t* b) {
+    strcpy(b->root, "/tmp/hwmon_bench_blk_XXXXXX");
+    if (!mkdtemp(b->root))
+        return false;
+
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/class", b->root);
+    mkdir(path, 0700);
+    snprintf(path, sizeof(path), "%s/block", b->root);
+    mkdir(path, 0700);
+
+    string_init(&b->diskstats);
+
+    for (u64 i = 0; i < BENCH_BLK_DEVICES; ++i) {
+        bench_blk_path(path, sizeof(path), b->root, "block", i, "");
+        mkdir(path, 0700);
+
+        bench_blk_path(path, sizeof(path), b->root, "block", i, "/size");
+        FILE* f = fopen(path, "w");
+        if (!f)
+            return false;
+        fputs("2048\n", f);
+        fclose(f);
+
+        snprintf(target, sizeof(target), "../block/sd%lu", i);
+        bench_blk_path(path, sizeof(path), b->root, "class", i, "");
+        if (symlink(target, path) != 0)
+            return false;
+
+        char line[128];
+        snprintf(line, sizeof(line), "   8 %7lu sd%lu %lu 0 %lu 0 %lu 0 %lu 0 0 %lu %lu 0 0 0 0 0 0\n",
+                 i, i, i, i * 8, i, i * 8, i, i);
+        string_append(b->diskstats, line);
+    }
+
+    return true;
+}
+
+static void bench_blk_remove(bench_blk_t* b) {
+    char path[PATH_MAX];
+
+    for (u64 i = 0; i < BENCH_BLK_DEVICES; ++i) {
+        bench_blk_path(path, sizeof(path), b->root, "class", i, "");
+        unlink(path);
+        bench_blk_path(path, sizeof(path), b->root, "block", i, "/size");
+        unlink(path);
+        bench_blk_path(path, sizeof(path), b->root, "block", i, "");
+        rmdir(path);
+    }
+
+    snprintf(path, sizeof(path), "%s/class", b->root);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/block", b->root);
+    rmdir(path);
+    rmdir(b->root);
+
+    string_release(b->diskstats);
+}
+
+/// one sample the way blkdev_get takes it, without the filesystem and the metadata joins
+static void bench_blk_sample(bench_blk_t* b) {
+    arena_t* arena = NULL;
+    arena_init(&arena, 16 * KiB);
+
+    list_t* devs = NULL;
+    list_init_intrusive(&devs, arena, NULL);
+
+    blk_dev_scan(b->topo, devs);
+    dev_index_build(b->index, devs);
+    b->matched = blk_dev_parse_diskstats(b->index, string_cdata(b->diskstats), string_size(b->diskstats));
+
+    bench_sink += devs->size;
+
+    list_arena_release_cb(devs);
+}
+
+void bench_blk_devices(void) {
+    bench_blk_t b;
+    memset(&b, 0, sizeof(b));
+
+    if (!bench_blk_create(&b)) {
+        printf("can't create the block device tree in /tmp\n");
+        bench_blk_remove(&b);
+        return;
+    }
+
+    char classdir[128];
+    snprintf(classdir, sizeof(classdir), "%s/class/", b.root);
+    blk_topo_init(&b.topo, classdir);
+    dev_index_init(&b.index, &blk_dev_key_cb, &blk_dev_name_cb);
+
+    struct timespec start = timer_start();
+    for (u64 i = 0; i < BENCH_BLK_ROUNDS; ++i) {
+        blk_topo_invalidate(b.topo);
+        blk_topo_refresh(b.topo);
+    }
+    double rescan_ms = timer_end_ms(start) / BENCH_BLK_ROUNDS;
+
+    bench_blk_sample(&b);
+
+    u64 allocs = alloc_count();
+    start = timer_start();
+    for (u64 i = 0; i < BENCH_BLK_ROUNDS; ++i)
+        bench_blk_sample(&b);
+    double sample_ms = timer_end_ms(start) / BENCH_BLK_ROUNDS;
+    allocs = alloc_count() - allocs;
+
+    printf("%lu devices (%lu in diskstats): topology rescan %.2f ms, sample %.2f ms, %.1f allocs/sample\n",
+           b.topo->nodes.size, b.matched, rescan_ms, sample_ms, (double)allocs / BENCH_BLK_ROUNDS);
+
+    dev_index_release(b.index);
+    blk_topo_release(b.topo);
+    bench_blk_remove(&b);
+}
+
+void bench_run(void) {
+    bench_scanner();
+    bench_blk_devices();
+    bench_hashtable();
+    bench_hash();
+    bench_string();
+    bench_queue();
+}
+
+#endif
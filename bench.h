@@ -0,0 +1,53 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// BENCHMARKS
+//============================================================================================================
+
+#ifdef HW_BENCH
+
+/// runs every benchmark and prints the results to stdout
+void bench_run(void);
+
+/// /proc/stat, /sys/block/<dev>/stat and /proc/meminfo parsing, the former string_split/regex
+/// parsers against the in-place scanner
+void bench_scanner(void);
+
+/// topology rescan and sampling times of 5000 block devices, a synthetic /sys/class/block in /tmp
+/// and the /proc/diskstats lines of them
+void bench_blk_devices(void);
+
+/// set/get throughput of hashtable_t from 100 to 10M entries, starting from a small table every time
+void bench_hashtable(void);
+
+/// ns/hash and low bit bucket spread of the hash kernels over integer, pointer and device name keys,
+/// every run is also dumped as bench_hash_<keys>_<kernel>.csv for tools/hist_ht
+void bench_hash(void);
+
+/// create/append/dub/compare of short and long strings, with the allocations they take
+void bench_string(void);
+
+/// items/s of the fifo behind a mutex against the mpsc queue and the spsc ring with 1 to 4 producers,
+/// and the one-way hand-off time of a value bounced between two threads
+void bench_queue(void);
+
+#endif
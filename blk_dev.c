@@ -18,11 +18,21 @@
 #include <stdlib.h>
 #include <dirent.h>
 #include <stdatomic.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <memory.h>
+#include <limits.h>
 #include "blk_dev.h"
 #include "allocators.h"
 #include "utils.h"
 #include "log.h"
 #include "timer.h"
+#include "scanner.h"
 
 //============================================================================================================
 // BLOCK DEVICE MANAGMENT
@@ -51,417 +61,618 @@ void blk_dev_release_cb(void* p) {
     zfree(dev);
 }
 
-blk_dev_t* blk_dev_list_search(list_t* devs, string* name) {
-    list_iter_t* it = NULL;
-    list_iter_init(devs, &it);
-
-    blk_dev_t* dev;
-    while ((dev = list_iter_next(it))) {
-        string* dev_devname = NULL;
-        string_create(&dev_devname, "/dev/");
-        string_add(dev_devname, dev->name);
-
-        if (string_compare(dev_devname, name) == ST_OK) {
-            string_release(dev_devname);
-            break;
-        }
-
-        string_release(dev_devname);
-    }
-
-    list_iter_release(it);
-
-    return dev;
+u64 blk_dev_key_cb(void* p) {
+    return ((blk_dev_t*)p)->name_hash;
 }
 
-blk_dev_t* blk_dev_list_direct_search(list_t* devs, string* name) {
-    list_iter_t* it = NULL;
-    list_iter_init(devs, &it);
+string* blk_dev_name_cb(void* p) {
+    return ((blk_dev_t*)p)->name;
+}
 
-    blk_dev_t* dev;
-    while ((dev = list_iter_next(it))) {
+u64 blk_dev_devno_key_cb(void* p) {
+    return ((blk_dev_t*)p)->devno;
+}
 
-        if (string_compare(dev->name, name) == ST_OK)
-            break;
-    }
+void blk_delta_set(blk_delta_t* delta, const blk_dev_t* a, blk_dev_t* b) {
+    delta->dev = b;
 
-    list_iter_release(it);
+    for (u64 i = 0; i < BLK_STAT_FIELDS; ++i)
+        delta->d[i] = b->stat[i] >= a->stat[i] ? b->stat[i] - a->stat[i] : 0;
 
-    return dev;
+    // in flight is a gauge, not a counter
+    delta->d[IN_FLIGHT] = b->stat[IN_FLIGHT];
 }
 
-void blk_dev_diff(blk_dev_t* __restrict a, blk_dev_t* __restrict b, double sample_size) {
+void blk_iostat_batch(const blk_delta_t* deltas, u64 n, double sample_size) {
 // Unix block size
 #define BLOCK_SIZE 512.0
 
-    b->stat[WRITE_SECTORS] = b->stat[WRITE_SECTORS] - a->stat[WRITE_SECTORS];
-    b->stat[READ_SECTORS] = b->stat[READ_SECTORS] - a->stat[READ_SECTORS];
-
-    b->perf_read = b->stat[READ_SECTORS] * BLOCK_SIZE / sample_size;
-    b->perf_write = b->stat[WRITE_SECTORS] * BLOCK_SIZE / sample_size;
+    double per_sec = 1.0 / sample_size;
+    // the tick counters are in ms
+    double per_ms = per_sec / 1000.0;
+
+    for (u64 i = 0; i < n; ++i) {
+        const u64* d = deltas[i].d;
+        blk_dev_t* dev = deltas[i].dev;
+        blk_iostat_t* io = &dev->io;
+
+        double rios = (double)d[READ_IO];
+        double wios = (double)d[WRITE_IO];
+        double rticks = (double)d[READ_TICKS];
+        double wticks = (double)d[WRITE_TICKS];
+
+        dev->perf_read = (double)d[READ_SECTORS] * BLOCK_SIZE * per_sec;
+        dev->perf_write = (double)d[WRITE_SECTORS] * BLOCK_SIZE * per_sec;
+
+        io->rps = rios * per_sec;
+        io->wps = wios * per_sec;
+        io->rmerge = (double)d[READ_MERGE] * per_sec;
+        io->wmerge = (double)d[WRITE_MERGES] * per_sec;
+        io->r_await = d[READ_IO] ? rticks / rios : 0.0;
+        io->w_await = d[WRITE_IO] ? wticks / wios : 0.0;
+        io->await = d[READ_IO] + d[WRITE_IO] ? (rticks + wticks) / (rios + wios) : 0.0;
+        io->aqu = (double)d[TIME_IN_QUEUE] * per_ms;
+
+        // io_ticks may run a bit ahead of the wall clock between the reads
+        double util = (double)d[IO_TICKS] * per_ms * 100.0;
+        io->util = util < 100.0 ? util : 100.0;
+    }
 
 #undef BLOCK_SIZE
 }
 
+void blk_dev_diff(blk_dev_t* __restrict a, blk_dev_t* __restrict b, double sample_size) {
+    // b keeps its raw counters, it becomes the base of the next sample
+    blk_delta_t delta;
+    blk_delta_set(&delta, a, b);
+    blk_iostat_batch(&delta, 1, sample_size);
+}
+
 
 //============================================================================================================
-// DF UTILS
+// FILESYSTEM USAGE
 //============================================================================================================
 
-void df_init(list_t* devs, df_t** df) {
-    *df = zalloc(sizeof(df_t));
+void df_init(dev_index_t* devs, dev_index_t* by_devno, mnt_table_t* mounts, arena_t* arena, df_t** df) {
+    *df = arena ? arena_alloc(arena, sizeof(df_t)) : zalloc(sizeof(df_t));
     (*df)->devs = devs;
-    (*df)->skip_first = 1;
+    (*df)->by_devno = by_devno;
+    (*df)->mounts = mounts;
+    (*df)->arena = arena;
 }
 
-void df_callback(void* ctx, list_t* lines) {
-    df_t* df = (df_t*)ctx;
+static void df_fill(blk_dev_t* dev, const struct statvfs* st) {
+    u64 bsize = st->f_frsize ? st->f_frsize : st->f_bsize;
 
-    LOG_TRACE("------- LINES OF TOKENS -----------");
-    slist_fprintd(lines);
+    dev->size = st->f_blocks * bsize;
+    dev->used = (st->f_blocks - st->f_bfree) * bsize;
+    dev->avail = st->f_bavail * bsize;
 
-    string* tk = NULL;
-    list_iter_t* line_it = NULL;
-    list_iter_init(lines, &line_it);
-    while ((tk = slist_next(line_it))) {
+    if (dev->size)
+        dev->perc = dev->used / (double)dev->size * 100.0;
 
-        LOG_TRACE("------- TOKEN LINE-----------");
-        string_printt(tk);
+    // df rounds the use% up
+    u64 nonroot_total = dev->used + dev->avail;
+    dev->use = nonroot_total ? (dev->used * 100 + nonroot_total - 1) / nonroot_total : 0;
+}
 
-        if (!string_re_match(tk, ".*(sd.*).*"))
-            continue;
+void df_execute(df_t* dfs) {
+    mnt_table_update(dfs->mounts);
 
-        LOG_TRACE("------- TOKEN SPLIT-----------");
+    char target[PATH_MAX];
 
-        list_t* tokens = NULL;
-        string_split(tk, ' ', &tokens);
+    mnt_entry_t* mnt;
+    VECTOR_FOREACH(&dfs->mounts->entries, mnt) {
+        // /dev/mapper/<name>, /dev/md/<name> and /dev/root don't name the device, its dev_t does
+        blk_dev_t* dev = mnt->devno ? dev_index_get(dfs->by_devno, mnt->devno, NULL, 0) : NULL;
 
-        slist_fprintd(tokens);
+        // btrfs reports an anonymous dev_t, the source still names the device
+        if (dev == NULL && string_starts_with(mnt->source, "/dev/") == ST_OK) {
+            const char* name = string_cdata(mnt->source) + strlen("/dev/");
+            u64 len = string_size(mnt->source) - strlen("/dev/");
+            dev = dev_index_get(dfs->devs, dev_index_hash(name, len), name, len);
+        }
 
-        list_iter_t* tk_it = NULL;
-        list_iter_init(tokens, &tk_it);
+        // the first mount of a device is enough, the others report the same filesystem
+        if (dev == NULL || dev->size)
+            continue;
 
-        string* s = NULL;
-        u64 k = 0;
-        blk_dev_t* dev = NULL;
-        while ((s = slist_next(tk_it)) != NULL) {
+        u64 target_len = string_size(mnt->target);
+        if (target_len >= sizeof(target))
+            continue;
 
-            string_strip(s);
+        memcpy(target, string_cdata(mnt->target), target_len);
+        target[target_len] = '\0';
 
-            if (k == DFS_NAME) {
-                dev = blk_dev_list_search(df->devs, s);
-                if (dev == NULL)
-                    break;
-            }
+        struct statvfs st;
+        if (statvfs(target, &st) == 0)
+            df_fill(dev, &st);
+        else
+            LOG_WARN("statvfs %s failed", target);
 
-            switch (k) {
-                case DFS_TOTAL:
-                    string_to_u64(s, &dev->size);
-                    break;
-                case DFS_USED: {
-                    string_to_u64(s, &dev->used);
-                    if (dev->size)
-                        dev->perc = dev->used / (double)dev->size * 100.0;
-                    break;
-                }
-                case DFS_AVAIL:
-                    string_to_u64(s, &dev->avail);
-                    break;
-                case DFS_USE: {
-                    string_pop_head(s, 1);
-                    string_to_u64(s, &dev->use);
-                    break;
-                }
-
-                default:
-                    break;
-            }
+        if (!dev->mount)
+            string_dub_arena(mnt->target, dfs->arena, &dev->mount);
+    }
+}
 
-            ++k;
+//============================================================================================================
+// BLOCK DEVICE METADATA
+//============================================================================================================
 
-        }
+#define UDEV_DATA_DIR "/run/udev/data/"
+#define UEVENT_BUFFER_SIZE 8192
+// "libudev\0", magic, header_size, properties_off, properties_len, filter hashes
+#define UDEV_HEADER_SIZE 40
+#define UDEV_PROPERTIES_OFF 16
+
+void blk_meta_release_cb(void* p) {
+    blk_meta_t* meta = (blk_meta_t*)p;
+
+    if (meta->name)
+        string_release(meta->name);
+    if (meta->fs)
+        string_release(meta->fs);
+    if (meta->shed)
+        string_release(meta->shed);
+    if (meta->model)
+        string_release(meta->model);
+    if (meta->uuid)
+        string_release(meta->uuid);
+    if (meta->label)
+        string_release(meta->label);
+    if (meta->swap)
+        string_release(meta->swap);
+
+    zfree(meta);
+}
+
+static u64 blk_meta_key_cb(void* p) {
+    return ((blk_meta_t*)p)->name_hash;
+}
 
-        list_iter_release(tk_it);
-        list_release(tokens, true);
+static string* blk_meta_name_cb(void* p) {
+    return ((blk_meta_t*)p)->name;
+}
 
+ret_t blk_meta_cache_init(blk_meta_cache_t** cache) {
+    *cache = zalloc(sizeof(blk_meta_cache_t));
+    blk_meta_cache_t* c = *cache;
+    list_pool_init(&c->pool);
+    list_init_pool(&c->metas, c->pool, &blk_meta_release_cb);
+    dev_index_init(&c->index, &blk_meta_key_cb, &blk_meta_name_cb);
+
+    c->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (c->uevent_fd < 0) {
+        LOG_WARN("can't open uevent socket, metadata is refreshed on device changes only");
+        return ST_OK;
     }
 
-    list_iter_release(line_it);
-    list_release(lines, true);
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    // kernel events and the udev ones sent after the udev database has been updated
+    addr.nl_groups = 1 | 2;
 
+    if (bind(c->uevent_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        LOG_WARN("can't bind uevent socket, metadata is refreshed on device changes only");
+        close(c->uevent_fd);
+        c->uevent_fd = -1;
+    }
+
+    return ST_OK;
 }
 
-void df_execute(df_t* dfs) {
+void blk_meta_cache_release(blk_meta_cache_t* cache) {
+    if (!cache)
+        return;
+
+    if (cache->uevent_fd >= 0)
+        close(cache->uevent_fd);
 
-    const char* cmd = "df --block-size=1";
-    cmd_execute(cmd, dfs, &df_callback);
+    list_release(cache->metas, true);
+    list_pool_release(cache->pool);
+    dev_index_release(cache->index);
+    zfree(cache);
 }
 
-//============================================================================================================
-// BLK UTILS
-//============================================================================================================
+/// linear lookup for the uevent path, the index is only valid during blk_meta_apply
+static blk_meta_t* blk_meta_find(blk_meta_cache_t* cache, const char* name, u64 len) {
+    u64 hash = dev_index_hash(name, len);
 
-ret_t vector_add_kv(vector_t* vec, string* key, string* val) {
-    skey_value_t* kv = zalloc(sizeof(skey_value_t));
-    string_dub(key, &kv->key);
-    string_dub(val, &kv->value);
+    list_iter_t it;
+    list_iter_begin(cache->metas, &it);
 
-    vector_add(vec, kv);
+    blk_meta_t* meta;
+    while ((meta = list_iter_next(&it))) {
+        if (meta->name_hash == hash && string_size(meta->name) == len &&
+            memcmp(string_cdata(meta->name), name, len) == 0)
+            break;
+    }
 
-    return ST_OK;
+    return meta;
 }
 
-typedef struct string_string_pair {
-    string* key;
-    string* val;
-} ss_kv_t;
+static void blk_meta_drop(blk_meta_cache_t* cache, blk_meta_t* meta) {
+    list_t* kept = NULL;
+    list_init_pool(&kept, cache->pool, &blk_meta_release_cb);
+
+    blk_meta_t* m;
+    while ((m = list_pop_head(cache->metas))) {
+        if (m == meta)
+            blk_meta_release_cb(m);
+        else
+            list_push(kept, m);
+    }
+
+    list_release(cache->metas, false);
+    cache->metas = kept;
+}
 
-static void ss_kv_release_cb(void* p) {
-    ss_kv_t* kv = (ss_kv_t*)p;
-    string_release(kv->key);
-    string_release(kv->val);
-    zfree(kv);
+static void blk_meta_drop_all(blk_meta_cache_t* cache) {
+    list_release(cache->metas, true);
+    list_init_pool(&cache->metas, cache->pool, &blk_meta_release_cb);
 }
 
-void sblk_callback(void* ctx, list_t* lines) {
+static void blk_meta_uevent(blk_meta_cache_t* cache, const char* msg, u64 size) {
+    const char* p = msg;
+    const char* end = msg + size;
+    const char* devname = NULL;
+    bool block = false;
 
-    sblkid_t* sys = (sblkid_t*)ctx;
+    // udev messages start with a binary header, the properties follow at properties_off
+    if (size >= UDEV_HEADER_SIZE && memcmp(msg, "libudev", sizeof("libudev")) == 0) {
+        u32 off;
+        memcpy(&off, msg + UDEV_PROPERTIES_OFF, sizeof(off));
+        if (off > size)
+            return;
 
-    string* tk = NULL;
-    list_iter_t* ln_it = NULL;
-    list_iter_init(lines, &ln_it);
+        p = msg + off;
+    }
 
-    while ((tk = slist_next(ln_it))) {
+    // the rest is NUL separated KEY=VALUE properties
+    while (p < end) {
+        u64 len = strnlen(p, (u64)(end - p));
 
-        LOG_DEBUG("------- TOKEN LINE-----------");
-        string_printt(tk);
+        if (len == strlen("SUBSYSTEM=block") && memcmp(p, "SUBSYSTEM=block", len) == 0)
+            block = true;
+        else if (len > strlen("DEVNAME=") && memcmp(p, "DEVNAME=", strlen("DEVNAME=")) == 0)
+            devname = p + strlen("DEVNAME=");
 
+        p += len + 1;
+    }
 
-        //====================================================================================================
-        regex_t re;
-        regex_compile(&re, "(\\w+)=\"([[:alnum:][:space:]/-]*)\"");
+    if (!block)
+        return;
 
-        char* tkp = NULL;
-        string_create_nt(tk, &tkp);
+    ++cache->invalidations;
 
-        blk_dev_t* dev = NULL;
-        list_t* pairs = NULL;
-        list_init(&pairs, &ss_kv_release_cb);
+    if (!devname) {
+        blk_meta_drop_all(cache);
+        return;
+    }
 
-        const char* p = tkp;
-        /* "N_matches" is the maximum number of matches allowed. */
-#define n_matches 5
-        /* "M" contains the matches found. */
-        regmatch_t m[n_matches];
-        while (1) {
-            int nomatch = regexec(&re, p, n_matches, m, 0);
-            if (nomatch) {
-                LOG_DEBUG("No more matches.");
-                break;
-            }
+    if (strncmp(devname, "/dev/", strlen("/dev/")) == 0)
+        devname += strlen("/dev/");
 
-            string* key = NULL;
-            string* val = NULL;
-            ss_kv_t* ss_kv = zalloc(sizeof(ss_kv_t));
-            for (int i = 0; i < n_matches; i++) {
-                int start;
-                int finish;
-                if (m[i].rm_so == -1) {
-                    break;
-                }
-#undef n_matches
-                start = (int)(m[i].rm_so + (p - tkp));
-                finish = (int)(m[i].rm_eo + (p - tkp));
-                if (i == 0) {
-                    continue;
-                }
-                if (i == 1) {
-                    string_init(&key);
-                    string_appendn(key, tkp + start, (u64)(finish - start));
-                    ss_kv->key = key;
-
-                } else if (i == 2) {
-
-                    if (finish - start != 0) {
-
-                        string_init(&val);
-                        string_appendn(val, tkp + start, (u64)(finish - start));
-                        ss_kv->val = val;
-
-                        list_push(pairs, ss_kv);
-                    } else {
-                        string_release(key);
-                        zfree(ss_kv);
-                    }
-                }
+    blk_meta_t* meta = blk_meta_find(cache, devname, strlen(devname));
+    if (meta)
+        blk_meta_drop(cache, meta);
+}
 
-            }
-            p += m[0].rm_eo;
-        }
+void blk_meta_cache_invalidate(blk_meta_cache_t* cache) {
+    if (cache->uevent_fd < 0)
+        return;
+
+    char buf[UEVENT_BUFFER_SIZE];
+
+    while (true) {
+        ssize_t n = recv(cache->uevent_fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
 
-        regfree(&re);
-        zfree(tkp);
-
-
-        //====================================================================================================
-        list_iter_t* kv_it = NULL;
-        list_iter_init(pairs, &kv_it);
-
-        ss_kv_t* kv;
-        while ((kv = list_iter_next(kv_it))) {
-
-            string_printd(kv->key);
-            string_printd(kv->val);
-
-            if (string_comparez(kv->key, "NAME") == ST_OK) {
-                dev = blk_dev_list_direct_search(sys->devs, kv->val);
-            } else if (string_comparez(kv->key, "SCHED") == ST_OK) {
-                if (dev)
-                    string_dub(kv->val, &dev->shed);
-
-            } else if (string_comparez(kv->key, "FSTYPE") == ST_OK) {
-                if (dev)
-                    string_dub(kv->val, &dev->fs);
-
-            } else if (string_comparez(kv->key, "MODEL") == ST_OK) {
-                if (dev) {
-                    string_strip(kv->val);
-                    string_dub(kv->val, &dev->model);
-                }
-            } else if (string_comparez(kv->key, "MOUNTPOINT") == ST_OK) {
-                if (dev)
-                    string_dub(kv->val, &dev->mount);
-            } else if (string_comparez(kv->key, "UUID") == ST_OK) {
-                if (dev)
-                    string_dub(kv->val, &dev->uuid);
-            } else if (string_comparez(kv->key, "LABEL") == ST_OK) {
-                if (dev)
-                    string_dub(kv->val, &dev->label);
-            } else if (string_comparez(kv->key, "SIZE") == ST_OK) {
-                if (dev && dev->size == 0) {
-                    string_to_u64(kv->val, &dev->size);
-                }
+            // ENOBUFS means we missed some events, nothing in the cache can be trusted
+            if (errno == ENOBUFS) {
+                blk_meta_drop_all(cache);
+                ++cache->invalidations;
             }
 
+            break;
         }
 
-        list_iter_release(kv_it);
-        list_release(pairs, true);
+        buf[n] = '\0';
+        blk_meta_uevent(cache, buf, (u64)n);
+    }
+}
+
+/// reads a small attribute file and returns its trimmed content, NULL if it's missing or empty
+static string* blk_meta_read(string* dir, const char* file) {
+    string* filename = NULL;
+    string_dub(dir, &filename);
+    string_append(filename, file);
+
+    char* filename_c = string_makez(filename);
+    string_release(filename);
 
-        //====================================================================================================
+    string* data = NULL;
+    string_init(&data);
+
+    ret_t ret = file_read_uncached(filename_c, data);
+    zfree(filename_c);
+
+    const char* b = string_cdata(data);
+    const char* e = b + string_size(data);
+    while (b < e && isspace((unsigned char)*b))
+        ++b;
+    while (e > b && (isspace((unsigned char)e[-1]) || e[-1] == '\0'))
+        --e;
+
+    string* value = NULL;
+    if (ret == ST_OK && b < e) {
+        string_init(&value);
+        string_append_se(value, b, e);
     }
 
-    list_iter_release(ln_it);
-    list_release(lines, true);
+    string_release(data);
+
+    return value;
+}
+
+static string* blk_meta_scheduler(string* sysdir) {
+    string* sched = blk_meta_read(sysdir, "queue/scheduler");
+
+    // partitions use the queue of their disk
+    if (!sched)
+        sched = blk_meta_read(sysdir, "../queue/scheduler");
+
+    if (!sched)
+        return NULL;
+
+    // "mq-deadline kyber [bfq] none"
+    const char* b = memchr(string_cdata(sched), '[', string_size(sched));
+    const char* e = b ? memchr(b, ']', string_size(sched) - (u64)(b - string_cdata(sched))) : NULL;
+
+    if (b && e) {
+        string* active = NULL;
+        string_init(&active);
+        string_append_se(active, b + 1, e);
+        string_release(sched);
+        sched = active;
+    }
 
+    return sched;
 }
 
-ret_t sblk_execute(sblkid_t* sblk) {
-    const char* options[] = {"NAME", "FSTYPE", "SCHED", "SIZE", "MODEL", "LABEL", "UUID",
-                             "MOUNTPOINT"};
+static void blk_meta_udev(blk_meta_t* meta, string* sysdir) {
+    string* devnum = blk_meta_read(sysdir, "dev");
+    if (!devnum)
+        return;
+
+    string* filename = NULL;
+    string_create(&filename, UDEV_DATA_DIR "b");
+    string_add(filename, devnum);
+    string_release(devnum);
+
+    char* filename_c = string_makez(filename);
+    string_release(filename);
+
+    string* db = NULL;
+    string_init(&db);
+
+    if (file_read_uncached(filename_c, db) == ST_OK) {
+        const char* p = string_cdata(db);
+        const char* end = p + string_size(db);
+
+        while (p < end) {
+            const char* eol = memchr(p, '\n', (u64)(end - p));
+            if (!eol)
+                eol = end;
+
+            string** field = NULL;
+            u64 key_len = 0;
+            if (eol - p > 14 && memcmp(p, "E:ID_FS_TYPE=", 13) == 0) {
+                field = &meta->fs;
+                key_len = 13;
+            } else if (eol - p > 14 && memcmp(p, "E:ID_FS_UUID=", 13) == 0) {
+                field = &meta->uuid;
+                key_len = 13;
+            } else if (eol - p > 15 && memcmp(p, "E:ID_FS_LABEL=", 14) == 0) {
+                field = &meta->label;
+                key_len = 14;
+            }
 
-    string* cmd = NULL;
-    string_create(&cmd, "lsblk -i -P -b -o ");
-    string_append(cmd, options[0]);
+            if (field && !*field) {
+                string_init(field);
+                string_append_se(*field, p + key_len, eol);
+            }
 
-    u64 opt_size = sizeof(options) / sizeof(char*);
-    for (u64 i = 1; i < opt_size; ++i) {
-        string_append(cmd, ",");
-        string_append(cmd, options[i]);
+            p = eol + 1;
+        }
     }
 
-    string_append(cmd, "");
+    string_release(db);
+    zfree(filename_c);
+}
 
-    char* ccmd = string_makez(cmd);
-    cmd_execute(ccmd, sblk, &sblk_callback);
+static void blk_meta_swap(blk_meta_t* meta) {
+    string* swaps = NULL;
+    string_init(&swaps);
+
+    if (file_read_uncached("/proc/swaps", swaps) == ST_OK) {
+        string* devname = NULL;
+        string_create(&devname, "\n/dev/");
+        string_add(devname, meta->name);
+        string_append(devname, " ");
+
+        if (memmem(string_cdata(swaps), string_size(swaps), string_cdata(devname), string_size(devname)))
+            string_create(&meta->swap, "[SWAP]");
+
+        string_release(devname);
+    }
+
+    string_release(swaps);
+}
+
+ret_t blk_meta_load(blk_dev_t* dev, blk_meta_t** meta) {
+    *meta = zalloc(sizeof(blk_meta_t));
+    blk_meta_t* m = *meta;
+
+    string_dub(dev->name, &m->name);
+    m->name_hash = dev->name_hash;
+
+    m->model = blk_meta_read(dev->sysfolder, "device/model");
+    m->shed = blk_meta_scheduler(dev->sysfolder);
+
+    string* size = blk_meta_read(dev->sysfolder, "size");
+    if (size) {
+        string_to_u64(size, &m->size);
+        m->size *= 512;
+        string_release(size);
+    }
+
+    blk_meta_udev(m, dev->sysfolder);
+    blk_meta_swap(m);
 
-    string_release(cmd);
-    zfree(ccmd);
     return ST_OK;
 }
 
+static void blk_meta_copy(string* from, arena_t* arena, string** to) {
+    if (from && !*to)
+        string_dub_arena(from, arena, to);
+}
+
+void blk_meta_apply(blk_meta_cache_t* cache, list_t* devs) {
+    ++cache->generation;
+    dev_index_build(cache->index, cache->metas);
+
+    list_iter_t it;
+    list_iter_begin(devs, &it);
+
+    blk_dev_t* dev;
+    while ((dev = list_iter_next(&it))) {
+        blk_meta_t* meta = dev_index_get(cache->index, dev->name_hash, string_cdata(dev->name), string_size(dev->name));
+
+        if (!meta) {
+            blk_meta_load(dev, &meta);
+            list_push(cache->metas, meta);
+        }
+
+        meta->seen = cache->generation;
+
+        blk_meta_copy(meta->fs, devs->arena, &dev->fs);
+        blk_meta_copy(meta->shed, devs->arena, &dev->shed);
+        blk_meta_copy(meta->model, devs->arena, &dev->model);
+        blk_meta_copy(meta->uuid, devs->arena, &dev->uuid);
+        blk_meta_copy(meta->label, devs->arena, &dev->label);
+        blk_meta_copy(meta->swap, devs->arena, &dev->mount);
+
+        if (dev->size == 0)
+            dev->size = meta->size;
+    }
+
+    // forget the devices that have been removed
+    if (cache->metas->size > devs->size) {
+        list_t* kept = NULL;
+        list_init_pool(&kept, cache->pool, &blk_meta_release_cb);
+
+        blk_meta_t* m;
+        while ((m = list_pop_head(cache->metas))) {
+            if (m->seen == cache->generation)
+                list_push(kept, m);
+            else
+                blk_meta_release_cb(m);
+        }
+
+        list_release(cache->metas, false);
+        cache->metas = kept;
+    }
+}
+
 //============================================================================================================
 // BLOCK DEVICE SCANNER
 //============================================================================================================
 
-void blk_dev_scan(string* basedir, list_t* devs) {
-    struct dirent* dir = NULL;
-
-    char* dir_c = string_makez(basedir);
-    DIR* d = opendir(dir_c);
-    zfree(dir_c);
+// 11 to 17 counters depending on the kernel
+#define BLK_STAT_BUFFER_SIZE 512
+#define DISKSTATS_PATH "/proc/diskstats"
 
-    if (d) {
-        while ((dir = readdir(d)) != NULL) {
+ret_t blk_dev_read_stat(blk_dev_t* dev) {
+    char path[PATH_MAX];
+    u64 dir_len = string_size(dev->sysfolder);
 
-            string* dir_name = NULL;
-            string_create(&dir_name, dir->d_name);
+    if (dir_len + sizeof("stat") > sizeof(path))
+        return ST_ERR;
 
-            bool match = string_re_match(dir_name, "sd.*");
+    memcpy(path, string_cdata(dev->sysfolder), dir_len);
+    memcpy(path + dir_len, "stat", sizeof("stat"));
 
-            if (match) {
+    char buf[BLK_STAT_BUFFER_SIZE];
+    u64 size = 0;
 
-                blk_dev_t* dev = zalloc(sizeof(blk_dev_t));
+    ret_t ret = fd_cache_read_buf(path, buf, sizeof(buf), &size);
+    if (ret != ST_OK)
+        return ret;
 
-                // create sysdir
-                string* sysdir = NULL;
-                string_init(&sysdir);
-                string_add(sysdir, basedir);
-                string_add(sysdir, dir_name);
-                string_append(sysdir, "/");
+    scanner_t sc;
+    scanner_init(&sc, buf, size);
+    scanner_u64s(&sc, dev->stat, sizeof(dev->stat) / sizeof(dev->stat[0]));
 
-                // set name and sysdir
-                string_dub(dir_name, &dev->name);
-                dev->sysfolder = sysdir;
-
-                // getting stat
-                string* stat_s = NULL;
-                string_init(&stat_s);
+    return ST_OK;
+}
 
-                string* stat_filename = NULL;
-                string_dub(sysdir, &stat_filename);
-                string_append(stat_filename, "stat");
+u64 blk_dev_parse_diskstats(dev_index_t* devs, const char* text, u64 size) {
+    scanner_t sc;
+    scanner_init(&sc, text, size);
 
-                char* stat_filename_c = string_makez(stat_filename);
-                file_read_all_s(stat_filename_c, stat_s);
-                string_strip(stat_s);
+    u64 matched = 0;
 
-                zfree(stat_filename_c);
-                string_release(stat_filename);
+    do {
+        const char* name;
+        u64 len;
 
-                list_t* lstat_s = NULL;
-                string_split(stat_s, ' ', &lstat_s);
+        // major minor name counters...
+        if (!scanner_skip_token(&sc) || !scanner_skip_token(&sc) || !scanner_token(&sc, &name, &len))
+            continue;
 
-                string_release(stat_s);
+        blk_dev_t* dev = dev_index_get(devs, dev_index_hash(name, len), name, len);
+        if (!dev)
+            continue;
 
-                list_iter_t* lstat_it = NULL;
-                list_iter_init(lstat_s, &lstat_it);
+        scanner_u64s(&sc, dev->stat, sizeof(dev->stat) / sizeof(dev->stat[0]));
 
-                string* s;
-                u64 stat_n = 0;
-                while ((s = (string*)list_iter_next(lstat_it)))
-                    string_to_u64(s, &dev->stat[stat_n++]);
+        matched += !dev->in_diskstats;
+        dev->in_diskstats = true;
+    } while (scanner_next_line(&sc));
 
-                list_iter_release(lstat_it);
-                list_release(lstat_s, true);
+    return matched;
+}
 
+ret_t blk_dev_read_diskstats(dev_index_t* devs, string* buf, u64* matched) {
+    *matched = 0;
 
-                // add dev to list
-                list_push(devs, dev);
+    ret_t ret = fd_cache_read(DISKSTATS_PATH, buf);
+    if (ret != ST_OK)
+        return ret;
 
-                string* subdir = NULL;
-                string_dub(sysdir, &subdir);
+    *matched = blk_dev_parse_diskstats(devs, string_cdata(buf), string_size(buf));
 
-                // recursive iterate
-                blk_dev_scan(subdir, devs);
+    return ST_OK;
+}
 
-                string_release(subdir);
-            }
+void blk_dev_scan(blk_topo_t* topo, list_t* devs) {
+    blk_node_t* node;
+    VECTOR_FOREACH(&topo->nodes, node) {
+        blk_dev_t* dev = devs->arena ? arena_alloc(devs->arena, sizeof(blk_dev_t)) : zalloc(sizeof(blk_dev_t));
 
-            string_release(dir_name);
-        }
+        string_dub_arena(node->name, devs->arena, &dev->name);
+        string_dub_arena(node->sysfolder, devs->arena, &dev->sysfolder);
+        dev->name_hash = node->name_hash;
+        dev->parent_hash = node->parent_hash;
+        dev->devno = node->devno;
+        dev->type = node->type;
+        dev->partno = node->partno;
 
-        closedir(d);
+        list_push_node(devs, &dev->link, dev);
     }
 }
 
@@ -469,32 +680,75 @@ void blk_dev_scan(string* basedir, list_t* devs) {
 // BLOCK DEVICE SAMPLING
 //============================================================================================================
 
-void blkdev_get(list_t** devs) {
-    string* basedir = NULL;
+// a snapshot of a dozen devices fits into one chunk
+#define BLK_ARENA_CHUNK_SIZE (16 * KiB)
+#define BLK_CLASS_DIR "/sys/class/block/"
+// without uevents a device change is only seen by rescanning every so often
+#define BLK_TOPO_RESCAN_SAMPLES 16
+
+void blkdev_ctx_release_cb(void* p) {
+    blkdev_ctx_t* ctx = (blkdev_ctx_t*)p;
+
+    blk_topo_release(ctx->topo);
+    string_release(ctx->diskstats);
+    blk_deltas_release(&ctx->deltas);
+    mnt_table_release(ctx->mounts);
+    blk_meta_cache_release(ctx->meta);
+    dev_index_release(ctx->index);
+    dev_index_release(ctx->by_devno);
+    zfree(ctx);
+}
+
+void blkdev_get(blkdev_ctx_t* ctx, list_t** devs) {
+    arena_t* arena = NULL;
+    arena_init(&arena, BLK_ARENA_CHUNK_SIZE);
+
+    // the devices go with the arena, there's nothing to release one by one
+    list_init_intrusive(devs, arena, NULL);
+
+    // the uevents that drop cached metadata are the ones that change the topology
+    blk_meta_cache_invalidate(ctx->meta);
+
+    if (ctx->meta->invalidations != ctx->invalidations) {
+        ctx->invalidations = ctx->meta->invalidations;
+        blk_topo_invalidate(ctx->topo);
+    } else if (ctx->meta->uevent_fd < 0 && ++ctx->unwatched >= BLK_TOPO_RESCAN_SAMPLES) {
+        ctx->unwatched = 0;
+        blk_topo_invalidate(ctx->topo);
+    }
+
+    blk_topo_refresh(ctx->topo);
+    blk_dev_scan(ctx->topo, *devs);
 
-    list_init(devs, &blk_dev_release_cb);
+    dev_index_build(ctx->index, *devs);
+    dev_index_build(ctx->by_devno, *devs);
 
-    string_create(&basedir, "/sys/block/");
+    // a device the topology knows of but diskstats doesn't list yet is read on its own
+    u64 matched = 0;
+    blk_dev_read_diskstats(ctx->index, ctx->diskstats, &matched);
 
-    blk_dev_scan(basedir, *devs);
+    if (matched < (*devs)->size) {
+        list_iter_t it;
+        list_iter_begin(*devs, &it);
 
-    string_release(basedir);
+        blk_dev_t* dev;
+        while ((dev = list_iter_next(&it)))
+            if (!dev->in_diskstats)
+                blk_dev_read_stat(dev);
+    }
 
     df_t* df;
-    df_init(*devs, &df);
+    df_init(ctx->index, ctx->by_devno, ctx->mounts, arena, &df);
     df_execute(df);
-    zfree(df);
 
-    sblkid_t blk;
-    blk.devs = *devs;
-    sblk_execute(&blk);
+    blk_meta_apply(ctx->meta, *devs);
 
 #ifndef NDEBUG
-    list_iter_t* list_it = NULL;
-    list_iter_init(*devs, &list_it);
+    list_iter_t list_it;
+    list_iter_begin(*devs, &list_it);
 
     blk_dev_t* dev;
-    while ((dev = (blk_dev_t*)list_iter_next(list_it))) {
+    while ((dev = (blk_dev_t*)list_iter_next(&list_it))) {
         char* name = string_makez(dev->name);
         char* syspath = string_makez(dev->sysfolder);
         char* fs = string_makez(dev->fs);
@@ -518,51 +772,280 @@ void blkdev_get(list_t** devs) {
         zfree(syspath);
         zfree(name);
     }
-
-    list_iter_release(list_it);
 #endif
 }
 
-typedef void(* sampled_device_cb)(list_t*);
-
-void blkdev_sample(double sample_size_sec, sampled_device_cb cb) {
-    list_t* devs_a = NULL;
-    list_t* devs_b = NULL;
+static void blkdev_scan_cb(void* ctx, void** snapshot) {
+    blkdev_get((blkdev_ctx_t*)ctx, (list_t**)snapshot);
+}
 
-    blkdev_get(&devs_a);
+void blkdev_diff(void* ctx, void* __restrict prev, void* __restrict cur, double sample_size_sec) {
+    blkdev_ctx_t* c = (blkdev_ctx_t*)ctx;
+    // the index has been built over cur by the scan that produced it
+    dev_index_t* index = c->index;
+    list_t* devs_a = (list_t*)prev;
 
-#ifndef HW_NO_SLEEP
-    nsleepd(sample_size_sec);
-#endif
+    // the join gathers the deltas, the metrics are computed over all of them at once
+    blk_deltas_clear(&c->deltas);
+    blk_deltas_reserve(&c->deltas, devs_a->size);
 
-    blkdev_get(&devs_b);
-
-    list_iter_t* it = NULL;
-    list_iter_init(devs_a, &it);
+    list_iter_t it;
+    list_iter_begin(devs_a, &it);
 
     blk_dev_t* dev_a;
-    blk_dev_t* dev_b;
-    while ((dev_a = list_iter_next(it))) {
-        list_iter_t* it2 = NULL;
-        list_iter_init(devs_b, &it2);
-
-        while ((dev_b = list_iter_next(it2))) {
-            if (string_compare(dev_a->name, dev_b->name) == ST_OK) {
-                blk_dev_diff(dev_a, dev_b, sample_size_sec);
-                break;
-            }
+    while ((dev_a = list_iter_next(&it))) {
+        blk_dev_t* dev_b = dev_index_get(index, dev_a->name_hash, string_cdata(dev_a->name), string_size(dev_a->name));
+        if (!dev_b)
+            continue;
 
-        }
+        blk_delta_t* delta = blk_deltas_emplace(&c->deltas);
+        if (!delta)
+            break;
 
-        list_iter_release(it2);
+        blk_delta_set(delta, dev_a, dev_b);
     }
 
-    list_iter_release(it);
+    blk_iostat_batch(c->deltas.data, c->deltas.size, sample_size_sec);
+}
 
-    list_release(devs_a, true);
+ret_t blkdev_sampler_init(sampler_t** s, sampler_publish_cb cb) {
+    blkdev_ctx_t* ctx = zalloc(sizeof(blkdev_ctx_t));
+    mnt_table_init(&ctx->mounts);
+    dev_index_init(&ctx->index, &blk_dev_key_cb, &blk_dev_name_cb);
+    dev_index_init(&ctx->by_devno, &blk_dev_devno_key_cb, NULL);
+    blk_meta_cache_init(&ctx->meta);
+    blk_topo_init(&ctx->topo, BLK_CLASS_DIR);
+    string_init(&ctx->diskstats);
 
-    if (cb)
-        cb(devs_b);
+    return sampler_init(s, ctx, &blkdev_ctx_release_cb, &blkdev_scan_cb, &blkdev_diff, cb, &list_arena_release_cb);
 }
 
+#ifndef NDEBUG
 
+static void test_blk_meta_add(blk_meta_cache_t* cache, const char* name) {
+    blk_meta_t* meta = zalloc(sizeof(blk_meta_t));
+    string_create(&meta->name, name);
+    meta->name_hash = dev_index_hash(name, strlen(name));
+    list_push(cache->metas, meta);
+}
+
+void test_blk_meta_uevent(void) {
+    blk_meta_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.uevent_fd = -1;
+    list_pool_init(&cache.pool);
+    list_init_pool(&cache.metas, cache.pool, &blk_meta_release_cb);
+
+    test_blk_meta_add(&cache, "sda");
+    test_blk_meta_add(&cache, "sda1");
+    test_blk_meta_add(&cache, "sdb");
+
+    const char net[] = "add@/devices/virtual/net/veth0\0ACTION=add\0SUBSYSTEM=net\0INTERFACE=veth0";
+    blk_meta_uevent(&cache, net, sizeof(net));
+    ASSERT(cache.metas->size == 3);
+    ASSERT(cache.invalidations == 0);
+
+    const char change[] = "change@/devices/pci0000:00/block/sda/sda1\0ACTION=change\0SUBSYSTEM=block\0DEVNAME=sda1";
+    blk_meta_uevent(&cache, change, sizeof(change));
+    ASSERT(cache.metas->size == 2);
+    ASSERT(blk_meta_find(&cache, "sda1", 4) == NULL);
+    ASSERT(blk_meta_find(&cache, "sda", 3) != NULL);
+
+    const char props[] = "ACTION=change\0DEVNAME=/dev/sdb\0SUBSYSTEM=block";
+    char udev[UDEV_HEADER_SIZE + sizeof(props)];
+    u32 off = UDEV_HEADER_SIZE;
+    memset(udev, 0xff, UDEV_HEADER_SIZE);
+    memcpy(udev, "libudev", sizeof("libudev"));
+    memcpy(udev + UDEV_PROPERTIES_OFF, &off, sizeof(off));
+    memcpy(udev + UDEV_HEADER_SIZE, props, sizeof(props));
+    blk_meta_uevent(&cache, udev, sizeof(udev));
+    ASSERT(cache.metas->size == 1);
+
+    const char noname[] = "change@/block\0ACTION=change\0SUBSYSTEM=block";
+    blk_meta_uevent(&cache, noname, sizeof(noname));
+    ASSERT(cache.metas->size == 0);
+    ASSERT(cache.invalidations == 3);
+
+    list_release(cache.metas, true);
+    list_pool_release(cache.pool);
+}
+
+static bool test_blk_near(double a, double b) {
+    return a - b < 1e-9 && b - a < 1e-9;
+}
+
+void test_blk_iostat(void) {
+    blk_dev_t a;
+    blk_dev_t b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+
+    const u64 before[BLK_STAT_FIELDS] = {100, 10, 800, 50, 200, 20, 1600, 400, 3, 1000, 2000};
+    const u64 after[BLK_STAT_FIELDS] = {300, 30, 2400, 450, 600, 20, 4800, 1200, 5, 2500, 5000};
+    memcpy(a.stat, before, sizeof(before));
+    memcpy(b.stat, after, sizeof(after));
+
+    // 2 seconds: 200 reads and 400 writes
+    blk_dev_diff(&a, &b, 2.0);
+
+    ASSERT(test_blk_near(b.perf_read, 1600 * 512 / 2.0));
+    ASSERT(test_blk_near(b.perf_write, 3200 * 512 / 2.0));
+    ASSERT(test_blk_near(b.io.rps, 100.0) && test_blk_near(b.io.wps, 200.0));
+    ASSERT(test_blk_near(b.io.rmerge, 10.0) && test_blk_near(b.io.wmerge, 0.0));
+    ASSERT(test_blk_near(b.io.r_await, 2.0) && test_blk_near(b.io.w_await, 2.0));
+    ASSERT(test_blk_near(b.io.await, 2.0));
+    ASSERT(test_blk_near(b.io.util, 75.0));
+    ASSERT(test_blk_near(b.io.aqu, 1.5));
+
+    // the raw counters are the base of the next sample
+    ASSERT(b.stat[READ_IO] == 300);
+
+    // a recreated device starts over, an idle one has no latency, a busy one caps at 100%
+    b.stat[READ_IO] = 50;
+    b.stat[IO_TICKS] = a.stat[IO_TICKS] + 2500;
+    blk_delta_t delta;
+    blk_delta_set(&delta, &a, &b);
+    ASSERT(delta.d[READ_IO] == 0 && delta.d[IN_FLIGHT] == 5);
+
+    blk_iostat_batch(&delta, 1, 2.0);
+    ASSERT(test_blk_near(b.io.rps, 0.0) && test_blk_near(b.io.r_await, 0.0));
+    ASSERT(test_blk_near(b.io.util, 100.0));
+}
+
+void test_blk_diskstats(void) {
+    blk_dev_t disk;
+    blk_dev_t part;
+    memset(&disk, 0, sizeof(disk));
+    memset(&part, 0, sizeof(part));
+    string_create(&disk.name, "nvme0n1");
+    string_create(&part.name, "nvme0n1p1");
+    disk.name_hash = dev_index_hash("nvme0n1", 7);
+    part.name_hash = dev_index_hash("nvme0n1p1", 9);
+
+    dev_index_t* index = NULL;
+    dev_index_init(&index, &blk_dev_key_cb, &blk_dev_name_cb);
+    dev_index_put(index, &disk);
+    dev_index_put(index, &part);
+
+    // 17 counters of a recent kernel, the first 11 are kept, and a device that's not sampled
+    const char text[] = " 259       0 nvme0n1 5 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16\n"
+                        "   7       0 loop0 100 0 0 0 0 0 0 0 0 0 0\n"
+                        " 259       1 nvme0n1p1 21 0 22 0 23 0 24 0 0 25 26";
+    ASSERT(blk_dev_parse_diskstats(index, text, sizeof(text) - 1) == 2);
+
+    ASSERT(disk.stat[READ_IO] == 5 && disk.stat[WRITE_SECTORS] == 6 && disk.stat[TIME_IN_QUEUE] == 10);
+    ASSERT(part.stat[READ_IO] == 21 && part.stat[IO_TICKS] == 25 && part.stat[TIME_IN_QUEUE] == 26);
+    ASSERT(disk.in_diskstats && part.in_diskstats);
+
+    // a device missing from diskstats is left for the per-device fallback
+    blk_dev_t late;
+    memset(&late, 0, sizeof(late));
+    string_create(&late.name, "nvme1n1");
+    late.name_hash = dev_index_hash("nvme1n1", 7);
+    dev_index_put(index, &late);
+    disk.in_diskstats = part.in_diskstats = false;
+
+    ASSERT(blk_dev_parse_diskstats(index, text, sizeof(text) - 1) == 2);
+    ASSERT(!late.in_diskstats && late.stat[READ_IO] == 0);
+
+    // a line whose name collides with the hash of a device is not that device
+    const char other[] = " 259       0 nvme9n9 7 7 7 7 7 7 7 7 7 7 7\n";
+    disk.in_diskstats = false;
+    disk.name_hash = dev_index_hash("nvme9n9", 7);
+    dev_index_clear(index);
+    dev_index_put(index, &disk);
+    ASSERT(blk_dev_parse_diskstats(index, other, sizeof(other) - 1) == 0);
+    ASSERT(!disk.in_diskstats && disk.stat[READ_IO] == 5);
+
+    string_release(late.name);
+    string_release(part.name);
+    string_release(disk.name);
+    dev_index_release(index);
+
+    // every device of the live topology has a line, however many pages diskstats takes
+    blk_topo_t* topo = NULL;
+    blk_topo_init(&topo, BLK_CLASS_DIR);
+    blk_topo_refresh(topo);
+
+    arena_t* arena = NULL;
+    arena_init(&arena, BLK_ARENA_CHUNK_SIZE);
+
+    list_t* devs = NULL;
+    list_init_intrusive(&devs, arena, NULL);
+    blk_dev_scan(topo, devs);
+
+    dev_index_init(&index, &blk_dev_key_cb, &blk_dev_name_cb);
+    dev_index_build(index, devs);
+
+    string* buf = NULL;
+    string_init(&buf);
+
+    u64 matched = 0;
+    CHECK_RETURN(blk_dev_read_diskstats(index, buf, &matched));
+    ASSERT(matched == devs->size);
+
+    string_release(buf);
+    list_arena_release_cb(devs);
+    blk_topo_release(topo);
+
+    dev_index_release(index);
+}
+
+void test_blk_df(void) {
+    // the dm device is mounted by its mapper name, btrfs reports an anonymous dev_t
+    const char text[] = "30 1 253:0 / / rw - ext4 /dev/mapper/vg-root rw\n"
+                        "31 30 0:45 / /proc rw - btrfs /dev/sdb1 rw\n"
+                        "32 30 8:33 / /mnt rw - ext4 /dev/sdc1 rw\n";
+
+    mnt_table_t* mounts = zalloc(sizeof(mnt_table_t));
+    mounts->fd = -1;
+    CHECK_RETURN(mnt_table_parse(mounts, text, sizeof(text) - 1));
+
+    blk_dev_t dm;
+    blk_dev_t sdb1;
+    blk_dev_t sdc1;
+    memset(&dm, 0, sizeof(dm));
+    memset(&sdb1, 0, sizeof(sdb1));
+    memset(&sdc1, 0, sizeof(sdc1));
+    string_create(&dm.name, "dm-0");
+    string_create(&sdb1.name, "sdb1");
+    string_create(&sdc1.name, "sdc2");
+    dm.name_hash = dev_index_hash("dm-0", 4);
+    dm.devno = makedev(253, 0);
+    sdb1.name_hash = dev_index_hash("sdb1", 4);
+    sdb1.devno = makedev(8, 17);
+    // mounted under another dev_t than its own and not named by the source
+    sdc1.name_hash = dev_index_hash("sdc2", 4);
+    sdc1.devno = makedev(8, 34);
+
+    dev_index_t* index = NULL;
+    dev_index_t* by_devno = NULL;
+    dev_index_init(&index, &blk_dev_key_cb, &blk_dev_name_cb);
+    dev_index_init(&by_devno, &blk_dev_devno_key_cb, NULL);
+
+    blk_dev_t* devs[] = {&dm, &sdb1, &sdc1};
+    for (u64 i = 0; i < sizeof(devs) / sizeof(devs[0]); ++i) {
+        dev_index_put(index, devs[i]);
+        dev_index_put(by_devno, devs[i]);
+    }
+
+    df_t* df = NULL;
+    df_init(index, by_devno, mounts, NULL, &df);
+    df_execute(df);
+
+    ASSERT(dm.size > 0 && dm.mount && string_comparez(dm.mount, "/") == ST_OK);
+    ASSERT(sdb1.mount && string_comparez(sdb1.mount, "/proc") == ST_OK);
+    ASSERT(sdc1.size == 0 && !sdc1.mount);
+
+    string_release(dm.mount);
+    string_release(sdb1.mount);
+    string_release(sdc1.name);
+    string_release(sdb1.name);
+    string_release(dm.name);
+    zfree(df);
+    dev_index_release(by_devno);
+    dev_index_release(index);
+    mnt_table_release(mounts);
+}
+
+#endif
@@ -21,6 +21,10 @@
 #include "string.h"
 #include "double_linked_list.h"
 #include "vector.h"
+#include "sampler.h"
+#include "mounts.h"
+#include "dev_index.h"
+#include "blk_topo.h"
 
 enum {
     /// These values increment when an I/O request completes.
@@ -79,18 +83,42 @@ enum {
     TIME_IN_QUEUE = 10UL /// milliseconds - total wait time for all requests
 };
 
+/// the fields of stat[], the newer kernels append discard and flush counters that aren't kept
+#define BLK_STAT_FIELDS (TIME_IN_QUEUE + 1)
+
 
 
 //============================================================================================================
 // BLOCK DEVICE MANAGEMENT
 //============================================================================================================
 
+/// iostat -x figures of a device over the last sample, derived from the stat[] deltas
+typedef struct blk_iostat {
+    // r/s and w/s, completed requests
+    double rps;
+    double wps;
+    // rrqm/s and wrqm/s, requests merged into queued ones
+    double rmerge;
+    double wmerge;
+    // ms a request took on average, time in the queue included
+    double r_await;
+    double w_await;
+    double await;
+    // %util, share of the time the device had requests in flight
+    double util;
+    // avgqu-sz, average number of requests in flight
+    double aqu;
+} blk_iostat_t;
+
+/// a scanned device and all of its strings live in the arena of the snapshot list
 typedef struct blk_dev {
     string* name;
+    u64 name_hash;
     //struct statvfs stats;
-    u64 stat[11];
+    u64 stat[BLK_STAT_FIELDS];
     double perf_read;
     double perf_write;
+    blk_iostat_t io;
     string* label;
     u64 size;
     u64 used;
@@ -103,88 +131,182 @@ typedef struct blk_dev {
     string* model;
     string* uuid;
     string* shed;
+    // copied from the topology node
+    u64 parent_hash;
+    u64 devno;
+    u32 type;
+    u32 partno;
+    // stat[] came from /proc/diskstats
+    bool in_diskstats;
+    u8 reserved[7];
+    // the device lists are intrusive
+    list_node_t link;
 } blk_dev_t;
 
 void blk_dev_release_cb(void* p);
 
-blk_dev_t* blk_dev_list_search(list_t* devs, string* name);
+u64 blk_dev_key_cb(void* p);
 
-blk_dev_t* blk_dev_list_direct_search(list_t* devs, string* name);
+string* blk_dev_name_cb(void* p);
 
-void blk_dev_diff(blk_dev_t* __restrict a, blk_dev_t* __restrict b, double sample_size);
+/// the dev_t key of a device, what the mounts are joined on
+u64 blk_dev_devno_key_cb(void* p);
 
+/// counter deltas of a device between two samples, the input of the metrics pass
+typedef struct blk_delta {
+    blk_dev_t* dev;
+    u64 d[BLK_STAT_FIELDS];
+} blk_delta_t;
 
-//============================================================================================================
-// DF UTILS
-//============================================================================================================
-enum {
-    DFS_NAME = 0,
-    DFS_TOTAL = 1,
-    DFS_USED = 2,
-    DFS_AVAIL = 3,
-    DFS_USE = 4
+VECTOR_DECLARE(blk_deltas, blk_delta_t)
 
-};
+/// the deltas of @b against @a, a counter that went backwards (the device was recreated) counts as 0
+void blk_delta_set(blk_delta_t* delta, const blk_dev_t* a, blk_dev_t* b);
 
-typedef struct df_stat {
-    string* dev;
+/// throughput and iostat figures of @n devices in one pass over their deltas, written to delta->dev
+void blk_iostat_batch(const blk_delta_t* deltas, u64 n, double sample_size);
 
-    u64 total;
-    u64 used;
-    u64 avail;
-    u64 use;
+void blk_dev_diff(blk_dev_t* __restrict a, blk_dev_t* __restrict b, double sample_size);
+
+#ifndef NDEBUG
 
-} df_stat_t;
+void test_blk_iostat(void);
+
+#endif
+
+
+//============================================================================================================
+// FILESYSTEM USAGE
+//============================================================================================================
 
 typedef struct {
-    list_t* devs;
-    u64 skip_first;
+    // index of the scanned devices
+    dev_index_t* devs;
+    // the same devices by dev_t
+    dev_index_t* by_devno;
+    mnt_table_t* mounts;
+    // where the mount points are copied to, the arena of the devices
+    arena_t* arena;
 } df_t;
 
-void df_init(list_t* devs, df_t** df);
-
-void df_callback(void* ctx, list_t* lines);
+/// @df itself is drawn from @arena (NULL is the heap)
+void df_init(dev_index_t* devs, dev_index_t* by_devno, mnt_table_t* mounts, arena_t* arena, df_t** df);
 
+/// fills size/used/avail/use/perc of the mounted devices the same way `df --block-size=1` reports them,
+/// a mount is matched to its device by the dev_t of mountinfo, by the source name if that fails
 void df_execute(df_t* dfs);
 
+#ifndef NDEBUG
+
+void test_blk_df(void);
+
+#endif
+
 //============================================================================================================
-// BLK UTILS
+// BLOCK DEVICE METADATA
 //============================================================================================================
 
-enum {
-    BLK_NAME = 0,
-    BLK_FSTYPE,
-    BLK_SCHED,
-    BLK_SIZE,
-    BLK_MODEL,
-    BLK_LABEL,
-    BLK_UUID,
-    BLK_MOUNTPOINT,
-    BLK_LAST
-};
+/// Static properties of a device, loaded once from sysfs and the udev database
+typedef struct blk_meta {
+    string* name;
+    u64 name_hash;
+    string* fs;
+    string* shed;
+    string* model;
+    string* uuid;
+    string* label;
+    string* swap;
+    u64 size;
+    u64 seen;
+} blk_meta_t;
+
+typedef struct blk_meta_cache {
+    list_t* metas;
+    // recycles the nodes of metas across the rebuilds
+    list_pool_t* pool;
+    dev_index_t* index;
+    u64 generation;
+    int uevent_fd;
+    // block uevents and socket overruns seen so far, each one may have changed the topology
+    u32 invalidations;
+} blk_meta_cache_t;
+
+void blk_meta_release_cb(void* p);
+
+ret_t blk_meta_cache_init(blk_meta_cache_t** cache);
+
+void blk_meta_cache_release(blk_meta_cache_t* cache);
 
-typedef struct sblkid {
-    list_t* devs;
-} sblkid_t;
+/// Drops the cached entries of the devices reported by netlink uevents since the last call
+void blk_meta_cache_invalidate(blk_meta_cache_t* cache);
 
-ret_t vector_add_kv(vector_t* vec, string* key, string* val);
+ret_t blk_meta_load(blk_dev_t* dev, blk_meta_t** meta);
 
-void sblk_callback(void* ctx, list_t* lines);
+/// Copies the cached metadata into @devs, only devices missing from the cache are read from the system.
+/// The copies are drawn from the arena of @devs, invalidate the cache first.
+void blk_meta_apply(blk_meta_cache_t* cache, list_t* devs);
 
-ret_t sblk_execute(sblkid_t* sblk);
+#ifndef NDEBUG
+
+void test_blk_meta_uevent(void);
+
+#endif
 
 //============================================================================================================
 // BLOCK DEVICE SCANNER
 //============================================================================================================
 
-void blk_dev_scan(string* basedir, list_t* devs);
+/// fills dev->stat[] from <sysfolder>/stat in place, nothing is allocated
+ret_t blk_dev_read_stat(blk_dev_t* dev);
+
+/// fills stat[] of the indexed devices from the lines of /proc/diskstats and marks them in_diskstats,
+/// the unknown names are skipped
+/// \return the number of indexed devices that got a line
+u64 blk_dev_parse_diskstats(dev_index_t* devs, const char* text, u64 size);
+
+/// the counters of all the devices with a single read of /proc/diskstats into @buf
+/// \param matched the number of indexed devices that got a line
+ret_t blk_dev_read_diskstats(dev_index_t* devs, string* buf, u64* matched);
+
+/// a device for every node of @topo, the devices are drawn from the arena of @devs and linked through
+/// their own node, @devs must be intrusive. The counters are left to the caller.
+void blk_dev_scan(blk_topo_t* topo, list_t* devs);
+
+#ifndef NDEBUG
+
+void test_blk_diskstats(void);
+
+#endif
 
 //============================================================================================================
 // BLOCK DEVICE SAMPLING
 //============================================================================================================
 
-void blkdev_get(list_t** devs);
-
-typedef void(* sampled_device_cb)(list_t*);
-
-void blkdev_sample(double sample_size_sec, sampled_device_cb cb);
+typedef struct blkdev_ctx {
+    mnt_table_t* mounts;
+    blk_meta_cache_t* meta;
+    // devices of the latest scan by name hash, shared by the filesystem, metadata and diff joins
+    dev_index_t* index;
+    // the same devices by dev_t, the mounts join
+    dev_index_t* by_devno;
+    // the devices to sample, rescanned on the uevents that invalidate the metadata
+    blk_topo_t* topo;
+    // the last read of /proc/diskstats
+    string* diskstats;
+    // the deltas of the devices of a diff, kept between the samples
+    blk_deltas_t deltas;
+    // meta->invalidations the topology was last invalidated at
+    u32 invalidations;
+    // samples since the last rescan when there are no uevents to watch
+    u32 unwatched;
+} blkdev_ctx_t;
+
+void blkdev_ctx_release_cb(void* p);
+
+/// the list, the devices and their strings are drawn from an arena of their own,
+/// list_arena_release_cb releases the lot
+void blkdev_get(blkdev_ctx_t* ctx, list_t** devs);
+
+void blkdev_diff(void* ctx, void* __restrict prev, void* __restrict cur, double sample_size_sec);
+
+ret_t blkdev_sampler_init(sampler_t** s, sampler_publish_cb cb);
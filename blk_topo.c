@@ -0,0 +1,427 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <limits.h>
+#include <memory.h>
+#include "blk_topo.h"
+#include "dev_index.h"
+#include "allocators.h"
+#include "log.h"
+
+// the node strings of a few thousand devices take a handful of chunks
+#define BLK_TOPO_ARENA_CHUNK_SIZE (16 * KiB)
+#define BLK_TOPO_ATTR_SIZE 32
+
+//============================================================================================================
+// DEVICE TYPES
+//============================================================================================================
+
+typedef struct blk_type_prefix {
+    const char* prefix;
+    u64 len;
+    blk_type_t type;
+    u32 reserved;
+} blk_type_prefix_t;
+
+#define BLK_TYPE_PREFIX(lit, type) {lit, sizeof(lit) - 1, type, 0}
+
+static const blk_type_prefix_t g_blk_type_prefixes[] = {
+        BLK_TYPE_PREFIX("nvme", BLK_TYPE_NVME),
+        BLK_TYPE_PREFIX("sd", BLK_TYPE_SD),
+        BLK_TYPE_PREFIX("vd", BLK_TYPE_VD),
+        BLK_TYPE_PREFIX("xvd", BLK_TYPE_XVD),
+        BLK_TYPE_PREFIX("mmcblk", BLK_TYPE_MMC),
+        BLK_TYPE_PREFIX("dm-", BLK_TYPE_DM),
+        BLK_TYPE_PREFIX("md", BLK_TYPE_MD),
+        BLK_TYPE_PREFIX("loop", BLK_TYPE_LOOP),
+        BLK_TYPE_PREFIX("zram", BLK_TYPE_ZRAM),
+        BLK_TYPE_PREFIX("ram", BLK_TYPE_RAM),
+        BLK_TYPE_PREFIX("sr", BLK_TYPE_SR),
+};
+
+static const char* const g_blk_type_names[BLK_TYPE_COUNT] = {
+        "other", "sd", "nvme", "vd", "xvd", "mmc", "dm", "md", "loop", "zram", "ram", "sr"
+};
+
+blk_type_t blk_type_classify(const char* name, u64 len) {
+    for (u64 i = 0; i < sizeof(g_blk_type_prefixes) / sizeof(g_blk_type_prefixes[0]); ++i) {
+        const blk_type_prefix_t* p = &g_blk_type_prefixes[i];
+        if (len > p->len && memcmp(name, p->prefix, p->len) == 0)
+            return p->type;
+    }
+
+    return BLK_TYPE_OTHER;
+}
+
+const char* blk_type_name(blk_type_t type) {
+    return type < BLK_TYPE_COUNT ? g_blk_type_names[type] : g_blk_type_names[BLK_TYPE_OTHER];
+}
+
+//============================================================================================================
+// TOPOLOGY
+//============================================================================================================
+
+ret_t blk_topo_init(blk_topo_t** topo, const char* classdir) {
+    *topo = zalloc(sizeof(blk_topo_t));
+    blk_topo_t* t = *topo;
+
+    string_create(&t->classdir, classdir);
+    arena_init(&t->arena, BLK_TOPO_ARENA_CHUNK_SIZE);
+    t->stale = true;
+
+    return ST_OK;
+}
+
+void blk_topo_release(blk_topo_t* topo) {
+    if (!topo)
+        return;
+
+    blk_nodes_release(&topo->nodes);
+    arena_release(topo->arena);
+    string_release(topo->classdir);
+    zfree(topo);
+}
+
+void blk_topo_invalidate(blk_topo_t* topo) {
+    topo->stale = true;
+}
+
+/// reads a short attribute of @dir into @buf, false if it's missing or empty
+static bool blk_topo_read_text(const char* dir, u64 dir_len, const char* attr, char* buf, u64 size) {
+    char path[PATH_MAX];
+    u64 attr_len = strlen(attr);
+
+    if (dir_len + attr_len + 1 > sizeof(path))
+        return false;
+
+    memcpy(path, dir, dir_len);
+    memcpy(path + dir_len, attr, attr_len + 1);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+
+    if (n <= 0)
+        return false;
+
+    buf[n] = '\0';
+
+    return true;
+}
+
+/// reads a small numeric attribute of @dir, 0 if it's missing
+static u64 blk_topo_read_attr(const char* dir, u64 dir_len, const char* attr) {
+    char buf[BLK_TOPO_ATTR_SIZE];
+
+    if (!blk_topo_read_text(dir, dir_len, attr, buf, sizeof(buf)))
+        return 0;
+
+    return strtoull(buf, NULL, 10);
+}
+
+/// the "major:minor" of the "dev" attribute of @dir as a dev_t, 0 if it's missing
+static u64 blk_topo_read_devno(const char* dir, u64 dir_len) {
+    char buf[BLK_TOPO_ATTR_SIZE];
+
+    if (!blk_topo_read_text(dir, dir_len, "dev", buf, sizeof(buf)))
+        return 0;
+
+    char* end;
+    unsigned long major = strtoul(buf, &end, 10);
+    if (*end != ':')
+        return 0;
+
+    unsigned long minor = strtoul(end + 1, NULL, 10);
+
+    return (u64)makedev((unsigned)major, (unsigned)minor);
+}
+
+/// The class entries link to .../block/<disk> for a whole disk and to .../block/<disk>/<part> for
+/// a partition, the component before the name tells them apart.
+/// \return the parent name inside @link, NULL for a whole disk
+static const char* blk_topo_parent(const char* link, u64 link_len, u64* parent_len) {
+    const char* end = link + link_len;
+
+    while (end > link && end[-1] == '/')
+        --end;
+
+    // skip the name itself
+    while (end > link && end[-1] != '/')
+        --end;
+
+    while (end > link && end[-1] == '/')
+        --end;
+
+    const char* start = end;
+    while (start > link && start[-1] != '/')
+        --start;
+
+    *parent_len = (u64)(end - start);
+
+    if (*parent_len == 0 || (*parent_len == strlen("block") && memcmp(start, "block", *parent_len) == 0))
+        return NULL;
+
+    return start;
+}
+
+static int blk_topo_node_cmp(const void* a, const void* b) {
+    string* na = ((const blk_node_t*)a)->name;
+    string* nb = ((const blk_node_t*)b)->name;
+    u64 la = string_size(na);
+    u64 lb = string_size(nb);
+
+    int r = memcmp(string_cdata(na), string_cdata(nb), la < lb ? la : lb);
+    if (r != 0)
+        return r;
+
+    return la < lb ? -1 : (int)(la > lb);
+}
+
+static void blk_topo_scan(blk_topo_t* topo) {
+    blk_nodes_clear(&topo->nodes);
+    arena_reset(topo->arena);
+
+    char path[PATH_MAX];
+    u64 dir_len = string_size(topo->classdir);
+
+    if (dir_len + 1 > sizeof(path))
+        return;
+
+    memcpy(path, string_cdata(topo->classdir), dir_len);
+    path[dir_len] = '\0';
+
+    DIR* d = opendir(path);
+    if (!d) {
+        LOG_WARN("can't open %s", path);
+        return;
+    }
+
+    struct dirent* dir;
+    while ((dir = readdir(d)) != NULL) {
+        if (dir->d_name[0] == '.')
+            continue;
+
+        u64 name_len = strlen(dir->d_name);
+        if (dir_len + name_len + 1 + BLK_TOPO_ATTR_SIZE > sizeof(path))
+            continue;
+
+        memcpy(path + dir_len, dir->d_name, name_len);
+        path[dir_len + name_len] = '/';
+        path[dir_len + name_len + 1] = '\0';
+        u64 sys_len = dir_len + name_len + 1;
+
+        if (blk_topo_read_attr(path, sys_len, "size") == 0)
+            continue;
+
+        blk_node_t* node = blk_nodes_emplace(&topo->nodes);
+        if (!node)
+            break;
+
+        string_create_arena(&node->name, topo->arena, dir->d_name);
+        string_init_arena(&node->sysfolder, topo->arena);
+        string_append_se(node->sysfolder, path, path + sys_len);
+        node->name_hash = dev_index_hash(dir->d_name, name_len);
+        node->type = blk_type_classify(dir->d_name, name_len);
+        node->devno = blk_topo_read_devno(path, sys_len);
+
+        // the link itself, without the trailing slash
+        path[sys_len - 1] = '\0';
+
+        char link[PATH_MAX];
+        ssize_t link_len = readlink(path, link, sizeof(link));
+
+        u64 parent_len = 0;
+        const char* parent = link_len > 0 ? blk_topo_parent(link, (u64)link_len, &parent_len) : NULL;
+
+        if (parent) {
+            node->parent_hash = dev_index_hash(parent, parent_len);
+            node->type = blk_type_classify(parent, parent_len);
+
+            path[sys_len - 1] = '/';
+            node->partno = (u32)blk_topo_read_attr(path, sys_len, "partition");
+        }
+    }
+
+    closedir(d);
+
+    qsort(topo->nodes.data, topo->nodes.size, sizeof(blk_node_t), &blk_topo_node_cmp);
+}
+
+bool blk_topo_refresh(blk_topo_t* topo) {
+    if (!topo->stale)
+        return false;
+
+    blk_topo_scan(topo);
+
+    topo->stale = false;
+    ++topo->generation;
+
+    LOG_INFO("block topology #%u: %lu devices", topo->generation, topo->nodes.size);
+
+    return true;
+}
+
+#ifndef NDEBUG
+
+#define TEST_BLK_TOPO_FILES 24
+
+typedef struct test_blk_topo_tree {
+    char root[64];
+    char paths[TEST_BLK_TOPO_FILES][PATH_MAX];
+    u64 count;
+} test_blk_topo_tree_t;
+
+static const char* test_blk_topo_path(test_blk_topo_tree_t* tree, const char* rel) {
+    ASSERT(tree->count < TEST_BLK_TOPO_FILES);
+
+    char* path = tree->paths[tree->count++];
+    snprintf(path, PATH_MAX, "%s/%s", tree->root, rel);
+
+    return path;
+}
+
+static void test_blk_topo_dir(test_blk_topo_tree_t* tree, const char* rel) {
+    ASSERT(mkdir(test_blk_topo_path(tree, rel), 0700) == 0);
+}
+
+static void test_blk_topo_file(test_blk_topo_tree_t* tree, const char* rel, const char* content) {
+    FILE* f = fopen(test_blk_topo_path(tree, rel), "w");
+    ASSERT(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static void test_blk_topo_link(test_blk_topo_tree_t* tree, const char* target, const char* rel) {
+    ASSERT(symlink(target, test_blk_topo_path(tree, rel)) == 0);
+}
+
+static const blk_node_t* test_blk_topo_find(blk_topo_t* topo, const char* name) {
+    blk_node_t* node;
+    VECTOR_FOREACH(&topo->nodes, node) {
+        if (string_comparez(node->name, name) == ST_OK)
+            return node;
+    }
+
+    return NULL;
+}
+
+void test_blk_topo(void) {
+    ASSERT(blk_type_classify("nvme0n1", 7) == BLK_TYPE_NVME);
+    ASSERT(blk_type_classify("dm-3", 4) == BLK_TYPE_DM);
+    ASSERT(blk_type_classify("md127", 5) == BLK_TYPE_MD);
+    ASSERT(blk_type_classify("mmcblk0", 7) == BLK_TYPE_MMC);
+    ASSERT(blk_type_classify("zram0", 5) == BLK_TYPE_ZRAM);
+    ASSERT(blk_type_classify("sd", 2) == BLK_TYPE_OTHER);
+    ASSERT(blk_type_classify("nbd0", 4) == BLK_TYPE_OTHER);
+    ASSERT(strcmp(blk_type_name(BLK_TYPE_LOOP), "loop") == 0);
+
+    u64 parent_len;
+    const char* link = "../../devices/pci0000:00/0000:00:01.0/nvme/nvme0/nvme0n1/nvme0n1p2";
+    const char* parent = blk_topo_parent(link, strlen(link), &parent_len);
+    ASSERT(parent && parent_len == 7 && memcmp(parent, "nvme0n1", 7) == 0);
+
+    link = "../../devices/virtual/block/dm-0";
+    ASSERT(!blk_topo_parent(link, strlen(link), &parent_len));
+
+    // a class directory the way sysfs lays it out, with the links pointing into a devices tree
+    test_blk_topo_tree_t tree;
+    memset(&tree, 0, sizeof(tree));
+    strcpy(tree.root, "/tmp/hwmon_blk_topo_XXXXXX");
+    ASSERT(mkdtemp(tree.root));
+
+    test_blk_topo_dir(&tree, "class");
+    test_blk_topo_dir(&tree, "block");
+    test_blk_topo_dir(&tree, "block/nvme0n1");
+    test_blk_topo_file(&tree, "block/nvme0n1/size", "2000409264\n");
+    test_blk_topo_dir(&tree, "block/nvme0n1/nvme0n1p2");
+    test_blk_topo_file(&tree, "block/nvme0n1/nvme0n1p2/size", "1048576\n");
+    test_blk_topo_file(&tree, "block/nvme0n1/nvme0n1p2/partition", "2\n");
+    test_blk_topo_file(&tree, "block/nvme0n1/nvme0n1p2/dev", "259:2\n");
+    test_blk_topo_dir(&tree, "block/dm-0");
+    test_blk_topo_file(&tree, "block/dm-0/size", "8192\n");
+    test_blk_topo_file(&tree, "block/dm-0/dev", "253:0\n");
+    test_blk_topo_dir(&tree, "block/loop0");
+    test_blk_topo_file(&tree, "block/loop0/size", "0\n");
+    test_blk_topo_link(&tree, "../block/nvme0n1", "class/nvme0n1");
+    test_blk_topo_link(&tree, "../block/nvme0n1/nvme0n1p2", "class/nvme0n1p2");
+    test_blk_topo_link(&tree, "../block/dm-0", "class/dm-0");
+    test_blk_topo_link(&tree, "../block/loop0", "class/loop0");
+
+    char classdir[128];
+    snprintf(classdir, sizeof(classdir), "%s/class/", tree.root);
+
+    blk_topo_t* topo = NULL;
+    blk_topo_init(&topo, classdir);
+
+    ASSERT(blk_topo_refresh(topo));
+    ASSERT(!blk_topo_refresh(topo));
+    ASSERT(topo->generation == 1);
+
+    // the detached loop device has no sectors, the rest comes sorted
+    ASSERT(topo->nodes.size == 3);
+    ASSERT(string_comparez(topo->nodes.data[0].name, "dm-0") == ST_OK);
+    ASSERT(string_comparez(topo->nodes.data[1].name, "nvme0n1") == ST_OK);
+    ASSERT(string_comparez(topo->nodes.data[2].name, "nvme0n1p2") == ST_OK);
+
+    const blk_node_t* disk = test_blk_topo_find(topo, "nvme0n1");
+    const blk_node_t* part = test_blk_topo_find(topo, "nvme0n1p2");
+    const blk_node_t* dm = test_blk_topo_find(topo, "dm-0");
+    ASSERT(disk && part && dm);
+    ASSERT(disk->parent_hash == 0 && disk->partno == 0 && disk->type == BLK_TYPE_NVME);
+    ASSERT(part->parent_hash == disk->name_hash && part->partno == 2 && part->type == BLK_TYPE_NVME);
+    ASSERT(dm->parent_hash == 0 && dm->type == BLK_TYPE_DM);
+    ASSERT(disk->devno == 0);
+    ASSERT(part->devno == makedev(259, 2));
+    ASSERT(dm->devno == makedev(253, 0));
+
+    char sysfolder[PATH_MAX];
+    snprintf(sysfolder, sizeof(sysfolder), "%snvme0n1p2/", classdir);
+    ASSERT(string_comparez(part->sysfolder, sysfolder) == ST_OK);
+
+    // a device shows up once the topology has been invalidated
+    test_blk_topo_file(&tree, "block/loop0/size", "2048\n");
+    ASSERT(!blk_topo_refresh(topo));
+    ASSERT(topo->nodes.size == 3);
+
+    blk_topo_invalidate(topo);
+    ASSERT(blk_topo_refresh(topo));
+    ASSERT(topo->generation == 2);
+    ASSERT(topo->nodes.size == 4);
+    ASSERT(test_blk_topo_find(topo, "loop0")->type == BLK_TYPE_LOOP);
+
+    blk_topo_release(topo);
+
+    // the links and files go first, the directories deepest first
+    for (u64 i = tree.count; i-- > 0;) {
+        if (unlink(tree.paths[i]) != 0)
+            rmdir(tree.paths[i]);
+    }
+
+    ASSERT(rmdir(tree.root) == 0);
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+#include "string.h"
+#include "arena.h"
+#include "vector.h"
+
+//============================================================================================================
+// BLOCK DEVICE TOPOLOGY
+//============================================================================================================
+
+/// The block devices of the system as /sys/class/block lists them, whole disks and partitions alike.
+/// It's rebuilt only when it's been invalidated, the samplers read the counters of the listed devices
+/// and never walk sysfs on their own.
+
+typedef enum blk_type {
+    BLK_TYPE_OTHER = 0,
+    BLK_TYPE_SD,
+    BLK_TYPE_NVME,
+    BLK_TYPE_VD,
+    BLK_TYPE_XVD,
+    BLK_TYPE_MMC,
+    BLK_TYPE_DM,
+    BLK_TYPE_MD,
+    BLK_TYPE_LOOP,
+    BLK_TYPE_ZRAM,
+    BLK_TYPE_RAM,
+    BLK_TYPE_SR,
+    BLK_TYPE_COUNT
+} blk_type_t;
+
+/// classifies a device by its kernel name, partitions get the type of their disk
+blk_type_t blk_type_classify(const char* name, u64 len);
+
+const char* blk_type_name(blk_type_t type);
+
+typedef struct blk_node {
+    // both live in the arena of the topology
+    string* name;
+    // <classdir><name>/, ends with a slash
+    string* sysfolder;
+    u64 name_hash;
+    // name hash of the disk a partition belongs to, 0 for a whole disk
+    u64 parent_hash;
+    // dev_t of the "dev" attribute, 0 if it couldn't be read
+    u64 devno;
+    u32 type;
+    // partition number, 0 for a whole disk
+    u32 partno;
+} blk_node_t;
+
+VECTOR_DECLARE(blk_nodes, blk_node_t)
+
+typedef struct blk_topo {
+    string* classdir;
+    // sorted by name, so a partition follows its disk
+    blk_nodes_t nodes;
+    // the strings of the nodes, rewound on every rescan
+    arena_t* arena;
+    // bumped on every rescan
+    u32 generation;
+    bool stale;
+    u8 reserved[3];
+} blk_topo_t;
+
+/// @classdir is /sys/class/block/ or a directory laid out like it, the first refresh scans it
+ret_t blk_topo_init(blk_topo_t** topo, const char* classdir);
+
+void blk_topo_release(blk_topo_t* topo);
+
+/// the next refresh rescans, call it when a device has been added, removed or changed
+void blk_topo_invalidate(blk_topo_t* topo);
+
+/// Rescans the class directory if the topology has been invalidated. Devices without any sectors
+/// (detached loop devices, unconfigured zram, empty drives) are left out.
+/// \return true if the nodes were rebuilt
+bool blk_topo_refresh(blk_topo_t* topo);
+
+#ifndef NDEBUG
+
+void test_blk_topo(void);
+
+#endif
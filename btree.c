@@ -0,0 +1,645 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <memory.h>
+#include "btree.h"
+#include "hash.h"
+#include "allocators.h"
+#include "log.h"
+
+_Static_assert(sizeof(btree_node_t) == BTREE_NODE_SIZE, "a node must fill its cache lines");
+
+static btree_node_t* btree_node_new(bool leaf) {
+    btree_node_t* n = zalloc(sizeof(btree_node_t));
+    n->leaf = leaf;
+
+    return n;
+}
+
+static void btree_node_release(btree_node_t* n, data_release_cb cb) {
+    if (n->leaf) {
+        if (cb) {
+            for (u32 i = 0; i < n->nkeys; ++i)
+                cb(n->u.l.values[i]);
+        }
+    } else {
+        for (u32 i = 0; i <= n->nkeys; ++i)
+            btree_node_release(n->u.children[i], cb);
+    }
+
+    zfree(n);
+}
+
+/// the first key >= @key in a node, 15 keys span two cache lines and a linear scan beats a binary search
+static inline u32 btree_lower_bound(const btree_node_t* n, u64 key) {
+    u32 i = 0;
+    while (i < n->nkeys && n->keys[i] < key)
+        ++i;
+
+    return i;
+}
+
+/// the child of an inner node that holds @key
+static inline u32 btree_child_index(const btree_node_t* n, u64 key) {
+    u32 i = 0;
+    while (i < n->nkeys && key >= n->keys[i])
+        ++i;
+
+    return i;
+}
+
+static btree_node_t* btree_find_leaf(btree_t* t, u64 key) {
+    btree_node_t* n = t->root;
+
+    while (n && !n->leaf)
+        n = n->u.children[btree_child_index(n, key)];
+
+    return n;
+}
+
+ret_t btree_init(btree_t** t, data_release_cb cb) {
+    *t = zalloc(sizeof(btree_t));
+    (*t)->rel_cb = cb;
+
+    return ST_OK;
+}
+
+void btree_release(btree_t* t, bool release_data) {
+    if (!t)
+        return;
+
+    if (t->root)
+        btree_node_release(t->root, release_data ? t->rel_cb : NULL);
+
+    zfree(t);
+}
+
+//============================================================================================================
+// INSERTION
+//============================================================================================================
+
+/// inserts (@key, @right) right after child @pos of inner @n, which isn't full
+static void btree_inner_insert(btree_node_t* n, u32 pos, u64 key, btree_node_t* right) {
+    memmove(&n->keys[pos + 1], &n->keys[pos], (n->nkeys - pos) * sizeof(u64));
+    memmove(&n->u.children[pos + 2], &n->u.children[pos + 1], (n->nkeys - pos) * sizeof(btree_node_t*));
+
+    n->keys[pos] = key;
+    n->u.children[pos + 1] = right;
+    ++n->nkeys;
+}
+
+static void btree_leaf_insert(btree_node_t* n, u32 pos, u64 key, void* value) {
+    memmove(&n->keys[pos + 1], &n->keys[pos], (n->nkeys - pos) * sizeof(u64));
+    memmove(&n->u.l.values[pos + 1], &n->u.l.values[pos], (n->nkeys - pos) * sizeof(void*));
+
+    n->keys[pos] = key;
+    n->u.l.values[pos] = value;
+    ++n->nkeys;
+}
+
+/// splits the full leaf @n while inserting into it
+/// \return the new right half, @sep is its smallest key
+static btree_node_t* btree_leaf_split(btree_node_t* n, u32 pos, u64 key, void* value, u64* sep) {
+    u64 keys[BTREE_MAX_KEYS + 1];
+    void* values[BTREE_MAX_KEYS + 1];
+
+    memcpy(keys, n->keys, pos * sizeof(u64));
+    memcpy(values, n->u.l.values, pos * sizeof(void*));
+    keys[pos] = key;
+    values[pos] = value;
+    memcpy(&keys[pos + 1], &n->keys[pos], (BTREE_MAX_KEYS - pos) * sizeof(u64));
+    memcpy(&values[pos + 1], &n->u.l.values[pos], (BTREE_MAX_KEYS - pos) * sizeof(void*));
+
+    const u32 left = (BTREE_MAX_KEYS + 1) / 2;
+    const u32 right = BTREE_MAX_KEYS + 1 - left;
+
+    btree_node_t* r = btree_node_new(true);
+
+    memcpy(n->keys, keys, left * sizeof(u64));
+    memcpy(n->u.l.values, values, left * sizeof(void*));
+    n->nkeys = left;
+
+    memcpy(r->keys, &keys[left], right * sizeof(u64));
+    memcpy(r->u.l.values, &values[left], right * sizeof(void*));
+    r->nkeys = right;
+
+    r->u.l.next = n->u.l.next;
+    n->u.l.next = r;
+
+    *sep = r->keys[0];
+
+    return r;
+}
+
+/// splits the full inner @n while inserting (@key, @child) after child @pos
+/// \return the new right half, @sep is the key that moves up
+static btree_node_t* btree_inner_split(btree_node_t* n, u32 pos, u64 key, btree_node_t* child, u64* sep) {
+    u64 keys[BTREE_MAX_KEYS + 1];
+    btree_node_t* children[BTREE_MAX_KEYS + 2];
+
+    memcpy(keys, n->keys, pos * sizeof(u64));
+    keys[pos] = key;
+    memcpy(&keys[pos + 1], &n->keys[pos], (BTREE_MAX_KEYS - pos) * sizeof(u64));
+
+    memcpy(children, n->u.children, (pos + 1) * sizeof(btree_node_t*));
+    children[pos + 1] = child;
+    memcpy(&children[pos + 2], &n->u.children[pos + 1], (BTREE_MAX_KEYS - pos) * sizeof(btree_node_t*));
+
+    // 16 keys: 8 stay, one moves up, 7 go right
+    const u32 left = (BTREE_MAX_KEYS + 1) / 2;
+    const u32 right = BTREE_MAX_KEYS - left;
+
+    btree_node_t* r = btree_node_new(false);
+
+    memcpy(n->keys, keys, left * sizeof(u64));
+    memcpy(n->u.children, children, (left + 1) * sizeof(btree_node_t*));
+    n->nkeys = left;
+
+    *sep = keys[left];
+
+    memcpy(r->keys, &keys[left + 1], right * sizeof(u64));
+    memcpy(r->u.children, &children[left + 1], (right + 1) * sizeof(btree_node_t*));
+    r->nkeys = right;
+
+    return r;
+}
+
+ret_t btree_set(btree_t* t, u64 key, void* value) {
+    if (!t->root) {
+        t->root = btree_node_new(true);
+        t->height = 1;
+    }
+
+    btree_node_t* path[BTREE_MAX_HEIGHT];
+    u32 slot[BTREE_MAX_HEIGHT];
+    u64 depth = 0;
+
+    btree_node_t* n = t->root;
+    while (!n->leaf) {
+        u32 i = btree_child_index(n, key);
+        path[depth] = n;
+        slot[depth] = i;
+        ++depth;
+        n = n->u.children[i];
+    }
+
+    u32 pos = btree_lower_bound(n, key);
+
+    if (pos < n->nkeys && n->keys[pos] == key) {
+        if (t->rel_cb && n->u.l.values[pos] != value)
+            t->rel_cb(n->u.l.values[pos]);
+
+        n->u.l.values[pos] = value;
+        return ST_OK;
+    }
+
+    ++t->size;
+
+    if (n->nkeys < BTREE_MAX_KEYS) {
+        btree_leaf_insert(n, pos, key, value);
+        return ST_OK;
+    }
+
+    u64 sep;
+    btree_node_t* right = btree_leaf_split(n, pos, key, value, &sep);
+
+    // the split goes up as long as the parents are full
+    while (depth > 0) {
+        --depth;
+        btree_node_t* p = path[depth];
+
+        if (p->nkeys < BTREE_MAX_KEYS) {
+            btree_inner_insert(p, slot[depth], sep, right);
+            return ST_OK;
+        }
+
+        right = btree_inner_split(p, slot[depth], sep, right, &sep);
+    }
+
+    if (t->height == BTREE_MAX_HEIGHT) {
+        LOG_ERROR("btree is too deep");
+        return ST_SIZE_EXCEED;
+    }
+
+    btree_node_t* root = btree_node_new(false);
+    root->nkeys = 1;
+    root->keys[0] = sep;
+    root->u.children[0] = t->root;
+    root->u.children[1] = right;
+
+    t->root = root;
+    ++t->height;
+
+    return ST_OK;
+}
+
+//============================================================================================================
+// LOOKUP
+//============================================================================================================
+
+ret_t btree_get(btree_t* t, u64 key, void** value) {
+    btree_node_t* n = btree_find_leaf(t, key);
+    if (!n)
+        return ST_NOT_FOUND;
+
+    u32 pos = btree_lower_bound(n, key);
+    if (pos == n->nkeys || n->keys[pos] != key)
+        return ST_NOT_FOUND;
+
+    *value = n->u.l.values[pos];
+
+    return ST_OK;
+}
+
+u64 btree_size(btree_t* t) {
+    return t->size;
+}
+
+ret_t btree_first(btree_t* t, u64* key, void** value) {
+    btree_node_t* n = t->root;
+    if (!n || n->nkeys == 0)
+        return ST_EMPTY;
+
+    while (!n->leaf)
+        n = n->u.children[0];
+
+    *key = n->keys[0];
+    *value = n->u.l.values[0];
+
+    return ST_OK;
+}
+
+ret_t btree_last(btree_t* t, u64* key, void** value) {
+    btree_node_t* n = t->root;
+    if (!n || n->nkeys == 0)
+        return ST_EMPTY;
+
+    while (!n->leaf)
+        n = n->u.children[n->nkeys];
+
+    *key = n->keys[n->nkeys - 1];
+    *value = n->u.l.values[n->nkeys - 1];
+
+    return ST_OK;
+}
+
+void btree_seek(btree_t* t, u64 from, u64 to, btree_iter_t* it) {
+    it->node = btree_find_leaf(t, from);
+    it->pos = it->node ? btree_lower_bound(it->node, from) : 0;
+    it->to = to;
+}
+
+bool btree_iter_next(btree_iter_t* it, u64* key, void** value) {
+    while (it->node && it->pos == it->node->nkeys) {
+        it->node = it->node->u.l.next;
+        it->pos = 0;
+    }
+
+    if (!it->node || it->node->keys[it->pos] > it->to) {
+        it->node = NULL;
+        return false;
+    }
+
+    *key = it->node->keys[it->pos];
+    *value = it->node->u.l.values[it->pos];
+    ++it->pos;
+
+    return true;
+}
+
+//============================================================================================================
+// DELETION
+//============================================================================================================
+
+static void btree_remove_at(btree_node_t* n, u32 pos) {
+    memmove(&n->keys[pos], &n->keys[pos + 1], (n->nkeys - pos - 1) * sizeof(u64));
+
+    if (n->leaf)
+        memmove(&n->u.l.values[pos], &n->u.l.values[pos + 1], (n->nkeys - pos - 1) * sizeof(void*));
+    else
+        memmove(&n->u.children[pos + 1], &n->u.children[pos + 2], (n->nkeys - pos - 1) * sizeof(btree_node_t*));
+
+    --n->nkeys;
+}
+
+/// appends @r to its left sibling @l, @sep is the parent key between them
+static void btree_merge(btree_node_t* l, btree_node_t* r, u64 sep) {
+    if (l->leaf) {
+        memcpy(&l->keys[l->nkeys], r->keys, r->nkeys * sizeof(u64));
+        memcpy(&l->u.l.values[l->nkeys], r->u.l.values, r->nkeys * sizeof(void*));
+        l->nkeys += r->nkeys;
+        l->u.l.next = r->u.l.next;
+    } else {
+        l->keys[l->nkeys] = sep;
+        memcpy(&l->keys[l->nkeys + 1], r->keys, r->nkeys * sizeof(u64));
+        memcpy(&l->u.children[l->nkeys + 1], r->u.children, (r->nkeys + 1) * sizeof(btree_node_t*));
+        l->nkeys += r->nkeys + 1;
+    }
+
+    zfree(r);
+}
+
+/// moves the last entry of @l to the front of its right sibling @n
+static void btree_borrow_left(btree_node_t* p, u32 i, btree_node_t* l, btree_node_t* n) {
+    memmove(&n->keys[1], n->keys, n->nkeys * sizeof(u64));
+
+    if (n->leaf) {
+        memmove(&n->u.l.values[1], n->u.l.values, n->nkeys * sizeof(void*));
+        n->keys[0] = l->keys[l->nkeys - 1];
+        n->u.l.values[0] = l->u.l.values[l->nkeys - 1];
+        p->keys[i - 1] = n->keys[0];
+    } else {
+        memmove(&n->u.children[1], n->u.children, (n->nkeys + 1) * sizeof(btree_node_t*));
+        n->keys[0] = p->keys[i - 1];
+        n->u.children[0] = l->u.children[l->nkeys];
+        p->keys[i - 1] = l->keys[l->nkeys - 1];
+    }
+
+    ++n->nkeys;
+    --l->nkeys;
+}
+
+/// moves the first entry of @r to the back of its left sibling @n
+static void btree_borrow_right(btree_node_t* p, u32 i, btree_node_t* n, btree_node_t* r) {
+    if (n->leaf) {
+        n->keys[n->nkeys] = r->keys[0];
+        n->u.l.values[n->nkeys] = r->u.l.values[0];
+        ++n->nkeys;
+
+        memmove(r->keys, &r->keys[1], (r->nkeys - 1) * sizeof(u64));
+        memmove(r->u.l.values, &r->u.l.values[1], (r->nkeys - 1) * sizeof(void*));
+        p->keys[i] = r->keys[0];
+    } else {
+        n->keys[n->nkeys] = p->keys[i];
+        n->u.children[n->nkeys + 1] = r->u.children[0];
+        ++n->nkeys;
+
+        p->keys[i] = r->keys[0];
+        memmove(r->keys, &r->keys[1], (r->nkeys - 1) * sizeof(u64));
+        memmove(r->u.children, &r->u.children[1], r->nkeys * sizeof(btree_node_t*));
+    }
+
+    --r->nkeys;
+}
+
+ret_t btree_del(btree_t* t, u64 key, bool release_data) {
+    if (!t->root)
+        return ST_NOT_FOUND;
+
+    btree_node_t* path[BTREE_MAX_HEIGHT];
+    u32 slot[BTREE_MAX_HEIGHT];
+    u64 depth = 0;
+
+    btree_node_t* n = t->root;
+    while (!n->leaf) {
+        u32 i = btree_child_index(n, key);
+        path[depth] = n;
+        slot[depth] = i;
+        ++depth;
+        n = n->u.children[i];
+    }
+
+    u32 pos = btree_lower_bound(n, key);
+    if (pos == n->nkeys || n->keys[pos] != key)
+        return ST_NOT_FOUND;
+
+    if (release_data && t->rel_cb)
+        t->rel_cb(n->u.l.values[pos]);
+
+    btree_remove_at(n, pos);
+    --t->size;
+
+    // the separators above may keep the deleted key, it's still a valid bound
+    while (depth > 0 && n->nkeys < BTREE_MIN_KEYS) {
+        --depth;
+        btree_node_t* p = path[depth];
+        u32 i = slot[depth];
+        btree_node_t* l = i > 0 ? p->u.children[i - 1] : NULL;
+        btree_node_t* r = i < p->nkeys ? p->u.children[i + 1] : NULL;
+
+        if (l && l->nkeys > BTREE_MIN_KEYS) {
+            btree_borrow_left(p, i, l, n);
+            return ST_OK;
+        }
+
+        if (r && r->nkeys > BTREE_MIN_KEYS) {
+            btree_borrow_right(p, i, n, r);
+            return ST_OK;
+        }
+
+        if (l) {
+            btree_merge(l, n, p->keys[i - 1]);
+            btree_remove_at(p, i - 1);
+        } else {
+            btree_merge(n, r, p->keys[i]);
+            btree_remove_at(p, i);
+        }
+
+        n = p;
+    }
+
+    // the root goes once it's left with a single child or no key at all
+    if (!t->root->leaf && t->root->nkeys == 0) {
+        btree_node_t* root = t->root;
+        t->root = root->u.children[0];
+        --t->height;
+        zfree(root);
+    } else if (t->root->leaf && t->root->nkeys == 0) {
+        zfree(t->root);
+        t->root = NULL;
+        t->height = 0;
+    }
+
+    return ST_OK;
+}
+
+#ifndef NDEBUG
+
+/// walks the whole tree and checks the key order, the fill and the depth of every leaf
+static u64 test_btree_check_node(btree_node_t* n, u64 depth, u64 height, u64 lo, u64 hi, bool root) {
+    ASSERT(root || n->nkeys >= BTREE_MIN_KEYS);
+    ASSERT(n->nkeys <= BTREE_MAX_KEYS);
+
+    for (u32 i = 0; i < n->nkeys; ++i) {
+        ASSERT(n->keys[i] >= lo && n->keys[i] < hi);
+        ASSERT(i == 0 || n->keys[i - 1] < n->keys[i]);
+    }
+
+    if (n->leaf) {
+        ASSERT(depth + 1 == height);
+        return n->nkeys;
+    }
+
+    u64 count = 0;
+    for (u32 i = 0; i <= n->nkeys; ++i) {
+        u64 clo = i == 0 ? lo : n->keys[i - 1];
+        u64 chi = i == n->nkeys ? hi : n->keys[i];
+        count += test_btree_check_node(n->u.children[i], depth + 1, height, clo, chi, false);
+    }
+
+    return count;
+}
+
+static void test_btree_check(btree_t* t) {
+    if (!t->root) {
+        ASSERT(t->size == 0 && t->height == 0);
+        return;
+    }
+
+    ASSERT(test_btree_check_node(t->root, 0, t->height, 0, UINT64_MAX, true) == t->size);
+
+    // the leaf chain sees every key in order
+    u64 key = 0;
+    void* value = NULL;
+    ASSERT(btree_first(t, &key, &value) == ST_OK);
+
+    btree_iter_t it;
+    btree_seek(t, 0, UINT64_MAX - 1, &it);
+
+    u64 n = 0;
+    u64 prev = 0;
+    while (btree_iter_next(&it, &key, &value)) {
+        ASSERT(n == 0 || prev < key);
+        prev = key;
+        ++n;
+    }
+
+    ASSERT(n == t->size);
+}
+
+static void test_btree_release_cb(void* p) {
+    zfree(p);
+}
+
+static u64* test_btree_u64(u64 v) {
+    u64* p = zalloc(sizeof(u64));
+    *p = v;
+
+    return p;
+}
+
+#define TEST_BTREE_KEYS 20000UL
+
+void test_btree(void) {
+    btree_t* t = NULL;
+    void* value = NULL;
+    u64 key = 0;
+
+    // string keys by their hash, what the binary tree used to be tested with
+    const char* names[] = {"1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15"};
+    const u64 nnames = sizeof(names) / sizeof(names[0]);
+
+    btree_init(&t, &test_btree_release_cb);
+
+    for (u64 i = 0; i < nnames; ++i)
+        CHECK_RETURN(btree_set(t, hash_str(names[i]), test_btree_u64(i + 1)));
+
+    for (u64 i = 0; i < nnames; ++i) {
+        ASSERT(btree_get(t, hash_str(names[i]), &value) == ST_OK);
+        ASSERT(*(u64*)value == i + 1);
+    }
+
+    // overwriting releases the old values
+    for (u64 i = 0; i < nnames; ++i)
+        CHECK_RETURN(btree_set(t, hash_str(names[i]), test_btree_u64(0)));
+
+    for (u64 i = 0; i < nnames; ++i) {
+        ASSERT(btree_get(t, hash_str(names[i]), &value) == ST_OK);
+        ASSERT(*(u64*)value == 0);
+    }
+
+    ASSERT(btree_size(t) == nnames);
+    ASSERT(btree_get(t, hash_str("16"), &value) == ST_NOT_FOUND);
+    test_btree_check(t);
+
+    btree_release(t, true);
+
+    // monotonic keys, like timestamps, keep the tree shallow
+    btree_init(&t, NULL);
+    ASSERT(btree_first(t, &key, &value) == ST_EMPTY);
+
+    for (u64 i = 0; i < TEST_BTREE_KEYS; ++i)
+        CHECK_RETURN(btree_set(t, i * 10, (void*)(i + 1)));
+
+    ASSERT(btree_size(t) == TEST_BTREE_KEYS && t->height <= 6);
+    test_btree_check(t);
+
+    ASSERT(btree_first(t, &key, &value) == ST_OK && key == 0);
+    ASSERT(btree_last(t, &key, &value) == ST_OK && key == (TEST_BTREE_KEYS - 1) * 10);
+
+    // range scans start between the keys and stop at the bound
+    btree_iter_t it;
+    btree_seek(t, 995, 2000, &it);
+
+    u64 n = 0;
+    while (btree_iter_next(&it, &key, &value)) {
+        ASSERT(key == 1000 + n * 10 && value == (void*)(key / 10 + 1));
+        ++n;
+    }
+    ASSERT(n == 101);
+
+    btree_seek(t, TEST_BTREE_KEYS * 10, UINT64_MAX, &it);
+    ASSERT(!btree_iter_next(&it, &key, &value));
+
+    // trimming the oldest half, the rest in a pseudo random order
+    for (u64 i = 0; i < TEST_BTREE_KEYS / 2; ++i)
+        ASSERT(btree_del(t, i * 10, false) == ST_OK);
+
+    ASSERT(btree_del(t, 0, false) == ST_NOT_FOUND);
+    ASSERT(btree_del(t, 5, false) == ST_NOT_FOUND);
+    test_btree_check(t);
+
+    ASSERT(btree_first(t, &key, &value) == ST_OK && key == TEST_BTREE_KEYS / 2 * 10);
+
+    u64 left = TEST_BTREE_KEYS / 2;
+    for (u64 i = 0; i < TEST_BTREE_KEYS; ++i) {
+        // an odd multiplier walks every residue once
+        u64 k = (TEST_BTREE_KEYS / 2 + (i * 7919) % (TEST_BTREE_KEYS / 2)) * 10;
+
+        if (btree_del(t, k, false) == ST_OK)
+            --left;
+
+        if (i % 1000 == 0)
+            test_btree_check(t);
+    }
+
+    ASSERT(left == 0 && btree_size(t) == 0 && t->root == NULL);
+    test_btree_check(t);
+
+    btree_release(t, false);
+
+    // descending and interleaved inserts against deletes
+    btree_init(&t, &test_btree_release_cb);
+
+    for (u64 i = TEST_BTREE_KEYS; i > 0; --i)
+        CHECK_RETURN(btree_set(t, hash_u64(i), test_btree_u64(i)));
+
+    for (u64 i = 1; i <= TEST_BTREE_KEYS; i += 2)
+        ASSERT(btree_del(t, hash_u64(i), true) == ST_OK);
+
+    test_btree_check(t);
+    ASSERT(btree_size(t) == TEST_BTREE_KEYS / 2);
+
+    for (u64 i = 2; i <= TEST_BTREE_KEYS; i += 2) {
+        ASSERT(btree_get(t, hash_u64(i), &value) == ST_OK && *(u64*)value == i);
+        ASSERT(btree_get(t, hash_u64(i - 1), &value) == ST_NOT_FOUND);
+    }
+
+    btree_release(t, true);
+}
+
+#endif
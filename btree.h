@@ -0,0 +1,95 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// B+TREE ORDERED INDEX
+//============================================================================================================
+
+/// Ordered map from u64 keys to pointers. Every node takes four cache lines, the keys come first so a
+/// lookup reads two lines per level, and every path from the root to a leaf has the same length, which
+/// stays logarithmic whatever the order of the keys. The values only live in the leaves, which are
+/// chained in key order for range scans. Nothing is recursive but the release, as deep as the tree.
+/// It isn't thread safe.
+
+#define BTREE_NODE_SIZE (4 * CACHE_LINE_SIZE)
+#define BTREE_MAX_KEYS 15
+#define BTREE_MIN_KEYS (BTREE_MAX_KEYS / 2)
+// 8^16 keys at the smallest fanout
+#define BTREE_MAX_HEIGHT 16
+
+typedef struct btree_node {
+    u32 nkeys;
+    u32 leaf;
+    u64 keys[BTREE_MAX_KEYS];
+    union {
+        // inner nodes: children[i] holds the keys below keys[i], the last one the rest
+        struct btree_node* children[BTREE_MAX_KEYS + 1];
+        // leaves
+        struct {
+            void* values[BTREE_MAX_KEYS];
+            struct btree_node* next;
+        } l;
+    } u;
+} btree_node_t;
+
+typedef struct btree {
+    btree_node_t* root;
+    u64 size;
+    u64 height;
+    data_release_cb rel_cb;
+} btree_t;
+
+/// in key order from a btree_seek position up to the key it has been given
+typedef struct btree_iter {
+    btree_node_t* node;
+    u64 pos;
+    u64 to;
+} btree_iter_t;
+
+/// @cb (if any) releases the values that are replaced or deleted
+ret_t btree_init(btree_t** t, data_release_cb cb);
+
+void btree_release(btree_t* t, bool release_data);
+
+/// inserts or replaces, the replaced value goes to the release callback
+ret_t btree_set(btree_t* t, u64 key, void* value);
+
+ret_t btree_get(btree_t* t, u64 key, void** value);
+
+ret_t btree_del(btree_t* t, u64 key, bool release_data);
+
+u64 btree_size(btree_t* t);
+
+/// the smallest and the largest key, ST_EMPTY on an empty tree
+ret_t btree_first(btree_t* t, u64* key, void** value);
+
+ret_t btree_last(btree_t* t, u64* key, void** value);
+
+/// positions @it on the first key >= @from, the scan stops past @to
+void btree_seek(btree_t* t, u64 from, u64 to, btree_iter_t* it);
+
+/// \return false once the range is over, the tree must not change during a scan
+bool btree_iter_next(btree_iter_t* it, u64* key, void** value);
+
+#ifndef NDEBUG
+
+void test_btree(void);
+
+#endif
@@ -34,28 +34,157 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+#include <sys/param.h>
 
 #include "concurrent_hashtable.h"
+#include "hash.h"
 #include "log.h"
 
+// marks an old bucket whose items have been moved to the new array
+static ht_item_t ht_moved;
+#define HT_MOVED (&ht_moved)
+
+// migrate_next holds the resize round in the top bits and the next old bucket to claim below
+#define HT_CLAIM_ROUND_SHIFT 40
+#define HT_CLAIM_INDEX_MASK ((1UL << HT_CLAIM_ROUND_SHIFT) - 1)
+
+// 2^64 / golden ratio, spreads the hash over the top bits
+#define HT_MIX 0x9E3779B97F4A7C15UL
+
+// a reader spins this many times on a held stripe before it yields to the writer
+#define HT_READ_SPINS 128
+
+// a reader walking a chain checks every this many items whether it has been changed under it
+#define HT_READ_CHECK_STEPS 64
+
+static inline u64 ht_mix(u64 hash) {
+    return hash * HT_MIX;
+}
+
+static inline u64 ht_bin_of(u64 mixed, u64 bits) {
+    return mixed >> (64 - bits);
+}
+
+static inline ht_stripe_t* ht_stripe_of(hashtable_t* ht, u64 mixed) {
+    return &ht->stripes[mixed >> (64 - HT_STRIPE_BITS)];
+}
+
+static inline u64 ht_reader_hint(void) {
+    pthread_t self = pthread_self();
+    return ((u64)self * HT_MIX) >> 32;
+}
+
+static inline ht_item_t* ht_load(ht_bin_t* p) {
+    return atomic_load_explicit(p, memory_order_acquire);
+}
+
+static inline void ht_publish(ht_bin_t* p, ht_item_t* item) {
+    atomic_store_explicit(p, item, memory_order_release);
+}
+
+//============================================================================================================
+// STRIPES
+//============================================================================================================
+
+static inline void ht_stripe_lock(ht_stripe_t* st) {
+    pthread_spin_lock(&st->lock);
+
+    u64 seq = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    atomic_store_explicit(&st->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void ht_stripe_unlock(ht_stripe_t* st) {
+    u64 seq = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    atomic_store_explicit(&st->seq, seq + 1, memory_order_release);
+
+    pthread_spin_unlock(&st->lock);
+}
+
+static void ht_lock_all(hashtable_t* ht) {
+    for (u64 i = 0; i < HT_STRIPES; ++i)
+        ht_stripe_lock(&ht->stripes[i]);
+}
+
+static void ht_unlock_all(hashtable_t* ht) {
+    for (u64 i = HT_STRIPES; i > 0; --i)
+        ht_stripe_unlock(&ht->stripes[i - 1]);
+}
+
+static inline u64 ht_read_begin(ht_stripe_t* st) {
+    u64 seq;
+    u64 spins = 0;
+
+    // a preempted writer won't finish while we spin on its CPU
+    while ((seq = atomic_load_explicit(&st->seq, memory_order_acquire)) & 1) {
+        if (++spins == HT_READ_SPINS) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+
+    return seq;
+}
+
+static inline bool ht_read_retry(ht_stripe_t* st, u64 seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&st->seq, memory_order_relaxed) != seq;
+}
+
+/// a chain that is being rewritten can be walked for ever, a reader gives up once it notices
+static inline bool ht_read_torn(ht_stripe_t* st, u64 seq, u64 steps) {
+    return st && (steps % HT_READ_CHECK_STEPS) == 0 && ht_read_retry(st, seq);
+}
+
+//============================================================================================================
+// LIFETIME
+//============================================================================================================
+
+static ht_array_t* ht_array_alloc(u64 bits) {
+    u64 size = 1UL << bits;
+    ht_array_t* a = calloc(1, sizeof(ht_array_t) + size * (sizeof(ht_bin_t) + sizeof(u64)));
+    if (!a)
+        return NULL;
+
+    a->bits = bits;
+    a->size = size;
+    a->bin_size = (u64*)(void*)&a->bins[size];
+
+    return a;
+}
+
 ret_t ht_init(hashtable_t** ht,
                      u64 table_size,
                      ht_key_hasher hasher,
+                     ht_key_comparator comparator,
                      ht_data_releaser key_releaser,
                      ht_data_releaser value_releaser) {
+    u64 bits = HT_STRIPE_BITS;
+    while ((1UL << bits) < table_size)
+        ++bits;
+
     *ht = calloc(sizeof(hashtable_t), 1);
     hashtable_t* pht = *ht;
-    pht->table_size = table_size;
     pht->hasher = hasher;
+    pht->comparator = comparator;
     pht->key_releaser = key_releaser;
     pht->value_releaser = value_releaser;
-    pht->table = (ht_item_t**)calloc(table_size, sizeof(ht_item_t*));
-    pht->bin_locks = (pthread_spinlock_t*)calloc(table_size, sizeof(pthread_spinlock_t));
-    atomic_store_explicit(&pht->size, 0, memory_order_relaxed);
-    pht->bin_size = (u64*)calloc(table_size, sizeof(u64));
 
-    for (u64 i = 0; i < table_size; ++i) {
-        pthread_spin_init(&pht->bin_locks[i], 0);
+    ht_array_t* table = ht_array_alloc(bits);
+    atomic_init(&pht->table, table);
+    atomic_init(&pht->old_table, NULL);
+    atomic_init(&pht->old_size, 0);
+    atomic_init(&pht->migrate_next, 0);
+    atomic_init(&pht->migrated, 0);
+    atomic_init(&pht->size, 0);
+    atomic_init(&pht->grow_at, table->size * HT_MAX_LOAD);
+    pthread_mutex_init(&pht->resize_mtx, NULL);
+    epoch_init(&pht->epoch);
+
+    for (u64 i = 0; i < HT_STRIPES; ++i) {
+        pthread_spin_init(&pht->stripes[i].lock, 0);
+        atomic_init(&pht->stripes[i].seq, 0);
     }
 
     return ST_OK;
@@ -64,7 +193,7 @@ ret_t ht_init(hashtable_t** ht,
 void ht_destroy_item(hashtable_t* ht, ht_item_t* item) {
     if (item) {
         ht->key_releaser((item)->key);
-        ht->value_releaser((item)->value);
+        ht->value_releaser(atomic_load_explicit(&item->value, memory_order_relaxed));
         free(item);
     }
 }
@@ -72,141 +201,352 @@ void ht_destroy_item(hashtable_t* ht, ht_item_t* item) {
 void ht_destroy_items_line(hashtable_t* ht, ht_item_t* start_item) {
     ht_item_t* next = start_item;
     ht_item_t* tmp = NULL;
-    while (next) {
+    while (next && next != HT_MOVED) {
         tmp = next;
-        next = next->next;
+        next = atomic_load_explicit(&next->next, memory_order_relaxed);
 
         ht_destroy_item(ht, tmp);
     }
 }
 
+/// a deleted item goes with its key and value once the readers are done
+static void ht_item_retire_cb(void* p) {
+    ht_item_t* item = (ht_item_t*)p;
+
+    item->owner->key_releaser(item->key);
+    item->owner->value_releaser(atomic_load_explicit(&item->value, memory_order_relaxed));
+    free(item);
+}
+
 void ht_destroy(hashtable_t* ht) {
-    for (u64 i = 0; i < ht->table_size; ++i) {
-        ht_destroy_items_line(ht, ht->table[i]);
-        pthread_spin_destroy(&ht->bin_locks[i]);
+    // the retired items still need the table for their key releaser
+    epoch_release(ht->epoch);
+
+    ht_array_t* arrays[2] = {atomic_load(&ht->table), atomic_load(&ht->old_table)};
+
+    for (u64 a = 0; a < 2; ++a) {
+        if (!arrays[a])
+            continue;
+
+        for (u64 i = 0; i < arrays[a]->size; ++i)
+            ht_destroy_items_line(ht, atomic_load_explicit(&arrays[a]->bins[i], memory_order_relaxed));
+
+        free(arrays[a]);
     }
 
-    free((void*)ht->bin_size);
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcast-qual"
-    free((void*)ht->bin_locks);
-#pragma clang diagnostic pop
-    free((void*)ht->table);
+    for (u64 i = 0; i < HT_STRIPES; ++i)
+        pthread_spin_destroy(&ht->stripes[i].lock);
+
+    pthread_mutex_destroy(&ht->resize_mtx);
     free(ht);
 }
 
-ret_t ht_set(hashtable_t* ht, void* key, void* value) {
-    u64 hash = ht->hasher(key);
-    u64 bin = hash % ht->table_size;
+//============================================================================================================
+// INCREMENTAL RESIZE
+//============================================================================================================
+
+/// under the stripe lock of old bucket @i
+/// \return true if it was the last old bucket
+static bool ht_migrate_bin(hashtable_t* ht, ht_array_t* old, u64 i) {
+    ht_item_t* item = atomic_load_explicit(&old->bins[i], memory_order_relaxed);
+    if (item == HT_MOVED)
+        return false;
 
-    pthread_spin_lock(&ht->bin_locks[bin]);
+    ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_relaxed);
 
-    ht_item_t* item = ht->table[bin];
-    ht_item_t* prev = NULL;
+    // a reader walking the old chain lands in a new one, the stripe counter sends it back
     while (item) {
-        if (item->hash == hash)
-            break;
+        ht_item_t* next = atomic_load_explicit(&item->next, memory_order_relaxed);
+        u64 bin = ht_bin_of(ht_mix(item->hash), table->bits);
+
+        atomic_store_explicit(&item->next, atomic_load_explicit(&table->bins[bin], memory_order_relaxed),
+                              memory_order_relaxed);
+        ht_publish(&table->bins[bin], item);
+        ++table->bin_size[bin];
 
-        prev = item;
-        item = item->next;
+        item = next;
     }
 
-    if (item && item->hash == hash) {
-        ht->value_releaser(item->value);
-        item->value = value;
-        free(key);
-    } else {
-        ht_item_t* new_item = NULL;
-        if ((new_item = calloc(1, sizeof(ht_item_t))) == NULL) {
-            pthread_spin_unlock(&ht->bin_locks[bin]);
+    ht_publish(&old->bins[i], HT_MOVED);
+
+    return atomic_fetch_add(&ht->migrated, 1) + 1 == old->size;
+}
+
+/// under the stripe lock of @mixed, moves the old bucket of the key first
+static bool ht_migrate_key(hashtable_t* ht, u64 mixed) {
+    ht_array_t* old = atomic_load_explicit(&ht->old_table, memory_order_relaxed);
+    if (!old)
+        return false;
+
+    return ht_migrate_bin(ht, old, ht_bin_of(mixed, old->bits));
+}
 
-            LOG_ERROR("can't alloc");
-            return ST_ERR;
+/// moves old buckets [@first, @last) if they still belong to resize @round, taking each stripe once
+/// \return true if one of them was the last old bucket
+static bool ht_migrate_range(hashtable_t* ht, u64 round, u64 first, u64 last, u64 old_size) {
+    u64 span_bits = (u64)__builtin_ctzl(old_size) - HT_STRIPE_BITS;
+    bool done = false;
+
+    for (u64 i = first; i < last;) {
+        u64 stripe = i >> span_bits;
+        u64 end = MIN(last, (stripe + 1) << span_bits);
+
+        ht_stripe_lock(&ht->stripes[stripe]);
+
+        // a later round means this one has been finished by the grower
+        ht_array_t* old = atomic_load_explicit(&ht->old_table, memory_order_relaxed);
+        if (ht->round == round && old) {
+            for (u64 j = i; j < end; ++j)
+                done |= ht_migrate_bin(ht, old, j);
         }
 
-        new_item->hash = hash;
-        new_item->key = key;
-        new_item->value = value;
+        ht_stripe_unlock(&ht->stripes[stripe]);
 
-        if (prev)
-            prev->next = new_item;
-        else
-            ht->table[bin] = new_item;
+        i = end;
+    }
 
-        ++ht->bin_size[bin];
-        atomic_fetch_add(&ht->size, 1);
+    return done;
+}
+
+static void ht_finish_resize(hashtable_t* ht) {
+    ht_lock_all(ht);
+
+    ht_array_t* old = atomic_load_explicit(&ht->old_table, memory_order_relaxed);
+    if (old && atomic_load(&ht->migrated) == old->size) {
+        atomic_store_explicit(&ht->old_table, NULL, memory_order_release);
+        atomic_store(&ht->old_size, 0);
+    } else {
+        old = NULL;
     }
 
-    pthread_spin_unlock(&ht->bin_locks[bin]);
+    ht_unlock_all(ht);
 
-    return ST_OK;
+    if (old)
+        epoch_retire(ht->epoch, old, &free);
 }
 
-ret_t ht_get(hashtable_t* ht, void* key, void** value) {
+static void ht_help_migrate(hashtable_t* ht) {
+    // claims are tagged with their round, a claim that outlives its round is just dropped
+    u64 claim = atomic_fetch_add(&ht->migrate_next, HT_MIGRATE_BATCH);
+    u64 first = claim & HT_CLAIM_INDEX_MASK;
+    u64 old_size = atomic_load(&ht->old_size);
+
+    if (first >= old_size)
+        return;
+
+    if (ht_migrate_range(ht, claim >> HT_CLAIM_ROUND_SHIFT, first, MIN(first + HT_MIGRATE_BATCH, old_size),
+                         old_size))
+        ht_finish_resize(ht);
+}
+
+static void ht_grow(hashtable_t* ht) {
+    // somebody else is on it
+    if (pthread_mutex_trylock(&ht->resize_mtx) != 0)
+        return;
+
+    if (atomic_load(&ht->size) <= atomic_load(&ht->grow_at)) {
+        pthread_mutex_unlock(&ht->resize_mtx);
+        return;
+    }
+
+    // the previous resize has to be over before the arrays are swapped again
+    u64 old_size = atomic_load(&ht->old_size);
+    if (old_size) {
+        ht_migrate_range(ht, ht->round, 0, old_size, old_size);
+        // whoever moved the last bucket may not have released the old array yet
+        ht_finish_resize(ht);
+    }
+
+    // only the owner of resize_mtx swaps the current array
+    ht_array_t* cur = atomic_load_explicit(&ht->table, memory_order_relaxed);
+    ht_array_t* table = ht_array_alloc(cur->bits + 1);
+
+    if (!table) {
+        pthread_mutex_unlock(&ht->resize_mtx);
+
+        LOG_ERROR("can't alloc");
+        return;
+    }
+
+    ht_lock_all(ht);
+
+    ht->round += 1;
+    atomic_store(&ht->migrate_next, ht->round << HT_CLAIM_ROUND_SHIFT);
+    atomic_store(&ht->migrated, 0);
+    atomic_store(&ht->old_size, cur->size);
+    atomic_store_explicit(&ht->old_table, cur, memory_order_release);
+    atomic_store_explicit(&ht->table, table, memory_order_release);
+    atomic_store(&ht->grow_at, table->size * HT_MAX_LOAD);
+
+    ht_unlock_all(ht);
+
+    pthread_mutex_unlock(&ht->resize_mtx);
+}
+
+/// every write finishes with a share of the resize work, without any lock held
+static void ht_after_write(hashtable_t* ht, bool migration_done) {
+    if (migration_done)
+        ht_finish_resize(ht);
+    else if (atomic_load_explicit(&ht->old_size, memory_order_relaxed))
+        ht_help_migrate(ht);
+
+    if (atomic_load_explicit(&ht->size, memory_order_relaxed) > atomic_load(&ht->grow_at))
+        ht_grow(ht);
+}
+
+//============================================================================================================
+// OPERATIONS
+//============================================================================================================
+
+ret_t ht_set(hashtable_t* ht, void* key, void* value) {
     u64 hash = ht->hasher(key);
-    u64 bin = hash % ht->table_size;
+    u64 mixed = ht_mix(hash);
+    ht_stripe_t* st = ht_stripe_of(ht, mixed);
+
+    // ready before it's published, readers may pick it up as soon as it's linked
+    ht_item_t* new_item = NULL;
+    if ((new_item = calloc(1, sizeof(ht_item_t))) == NULL) {
+        LOG_ERROR("can't alloc");
+        return ST_ERR;
+    }
 
-    pthread_spin_lock(&ht->bin_locks[bin]);
-    ht_item_t* item = ht->table[bin];
+    new_item->hash = hash;
+    new_item->key = key;
+    new_item->owner = ht;
+    atomic_init(&new_item->value, value);
 
+    ht_stripe_lock(st);
+
+    bool migration_done = ht_migrate_key(ht, mixed);
+    ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_relaxed);
+    u64 bin = ht_bin_of(mixed, table->bits);
+
+    ht_item_t* item = atomic_load_explicit(&table->bins[bin], memory_order_relaxed);
     while (item) {
-        if (item->hash == hash) {
-            *value = item->value;
-            pthread_spin_unlock(&ht->bin_locks[bin]);
+        if (item->hash == hash && ht->comparator(item->key, key))
+            break;
+
+        item = atomic_load_explicit(&item->next, memory_order_relaxed);
+    }
+
+    void* old_value = NULL;
+
+    if (item) {
+        old_value = atomic_exchange_explicit(&item->value, value, memory_order_acq_rel);
+    } else {
+        atomic_init(&new_item->next, atomic_load_explicit(&table->bins[bin], memory_order_relaxed));
+        ht_publish(&table->bins[bin], new_item);
+
+        ++table->bin_size[bin];
+        atomic_fetch_add(&ht->size, 1);
+    }
+
+    ht_stripe_unlock(st);
+
+    if (item) {
+        // a reader or a foreach callback may still hold the old value
+        epoch_retire(ht->epoch, old_value, ht->value_releaser);
+        ht->key_releaser(key);
+        free(new_item);
+    }
+
+    ht_after_write(ht, migration_done);
 
+    return ST_OK;
+}
+
+/// inside a read section or under the stripe lock (@st is NULL then)
+static ret_t ht_lookup(hashtable_t* ht, ht_stripe_t* st, u64 seq, u64 hash, u64 mixed, void* key, void** value) {
+    // a bucket that hasn't been moved yet is still the only place the key can be
+    ht_item_t* item = HT_MOVED;
+    ht_array_t* old = atomic_load_explicit(&ht->old_table, memory_order_acquire);
+    if (old)
+        item = ht_load(&old->bins[ht_bin_of(mixed, old->bits)]);
+
+    if (item == HT_MOVED) {
+        ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_acquire);
+        item = ht_load(&table->bins[ht_bin_of(mixed, table->bits)]);
+    }
+
+    for (u64 steps = 1; item; ++steps) {
+        if (item->hash == hash && ht->comparator(item->key, key)) {
+            *value = atomic_load_explicit(&item->value, memory_order_acquire);
             return ST_OK;
         }
 
-        item = item->next;
-    }
+        if (ht_read_torn(st, seq, steps))
+            return ST_NOT_FOUND;
 
-    pthread_spin_unlock(&ht->bin_locks[bin]);
+        item = ht_load(&item->next);
+    }
 
     return ST_NOT_FOUND;
 }
 
+ret_t ht_get(hashtable_t* ht, void* key, void** value) {
+    u64 hash = ht->hasher(key);
+    u64 mixed = ht_mix(hash);
+    ht_stripe_t* st = ht_stripe_of(ht, mixed);
+    void* found = NULL;
+    ret_t ret;
+
+    epoch_reader_t* reader = epoch_enter_transient(ht->epoch, ht_reader_hint());
+
+    if (reader) {
+        u64 seq;
+        do {
+            seq = ht_read_begin(st);
+            ret = ht_lookup(ht, st, seq, hash, mixed, key, &found);
+        } while (ht_read_retry(st, seq));
+
+        epoch_exit_transient(reader);
+    } else {
+        // every reader slot is taken
+        pthread_spin_lock(&st->lock);
+        ret = ht_lookup(ht, NULL, 0, hash, mixed, key, &found);
+        pthread_spin_unlock(&st->lock);
+    }
+
+    if (ret == ST_OK)
+        *value = found;
+
+    return ret;
+}
+
 ret_t ht_del(hashtable_t* ht, void* key) {
     u64 hash = ht->hasher(key);
-    u64 bin = hash % ht->table_size;
+    u64 mixed = ht_mix(hash);
+    ht_stripe_t* st = ht_stripe_of(ht, mixed);
 
-    pthread_spin_lock(&ht->bin_locks[bin]);
+    ht_stripe_lock(st);
 
-    ht_item_t* item = ht->table[bin];
-    ht_item_t* prev = NULL;
-    while (item) {
-        if ((item)->hash == hash) {
-
-            if (prev && (item)->next) {
-                prev->next = (item)->next;
-                ht_destroy_item(ht, item);
-            } else if (prev) {
-                prev->next = NULL;
-                ht_destroy_item(ht, item);
-            } else if (item->next) {
-                ASSERT_EQ(item, ht->table[bin]);
-
-                ht->table[bin] = item->next;
-
-                ht_destroy_item(ht, item);
-            } else {
-                ASSERT_EQ(item, ht->table[bin]);
-                ht_destroy_item(ht, item);
-                ht->table[bin] = NULL;
-            }
+    bool migration_done = ht_migrate_key(ht, mixed);
+    ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_relaxed);
+    u64 bin = ht_bin_of(mixed, table->bits);
 
-            --ht->bin_size[bin];
-            atomic_fetch_sub(&ht->size, 1);
+    ht_bin_t* link = &table->bins[bin];
+    ht_item_t* item = NULL;
+    while ((item = atomic_load_explicit(link, memory_order_relaxed))) {
+        if (item->hash == hash && ht->comparator(item->key, key)) {
+            // the item keeps its next, a reader standing on it carries on
+            ht_publish(link, atomic_load_explicit(&item->next, memory_order_relaxed));
 
-            pthread_spin_unlock(&ht->bin_locks[bin]);
-            return ST_OK;
+            --table->bin_size[bin];
+            atomic_fetch_sub(&ht->size, 1);
+            break;
         }
 
-        prev = item;
-        item = (item)->next;
+        link = &item->next;
     }
 
-    pthread_spin_unlock(&ht->bin_locks[bin]);
-    return ST_NOT_FOUND;
+    ht_stripe_unlock(st);
+
+    if (item)
+        epoch_retire(ht->epoch, item, &ht_item_retire_cb);
+
+    ht_after_write(ht, migration_done);
+
+    return item ? ST_OK : ST_NOT_FOUND;
 }
 
 u64 ht_size(hashtable_t* ht) {
@@ -214,21 +554,31 @@ u64 ht_size(hashtable_t* ht) {
 }
 
 u64 ht_table_size(hashtable_t* ht) {
-    return ht->table_size;
+    pthread_spin_lock(&ht->stripes[0].lock);
+    u64 size = atomic_load_explicit(&ht->table, memory_order_relaxed)->size;
+    pthread_spin_unlock(&ht->stripes[0].lock);
+
+    return size;
 }
 
 u64 ht_bin_size(hashtable_t* ht, u64 bin) {
-    if (bin >= ht->table_size) {
-        LOG_ERROR("out of range");
-        return 0;
-    }
-
     u64 size = 0;
-    pthread_spin_lock(&ht->bin_locks[bin]);
+    bool in_range = false;
+
+    ht_lock_all(ht);
 
-    size = ht->bin_size[bin];
+    ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_relaxed);
+    if (bin < table->size) {
+        size = table->bin_size[bin];
+        in_range = true;
+    }
 
-    pthread_spin_unlock(&ht->bin_locks[bin]);
+    ht_unlock_all(ht);
+
+    if (!in_range) {
+        LOG_ERROR("out of range");
+        return 0;
+    }
 
     return size;
 }
@@ -238,38 +588,409 @@ ret_t ht_hist_dump_csv(hashtable_t* ht, const char* filename) {
     if (!f) {
         char* err = strerror(errno);
         LOG_ERROR("can't open the file %s, error=", filename, err);
-        free(err);
         return ST_ERR;
     }
 
-    char buff[4096];
-    memset(buff, 0, 4096);
+    // a copy, the table keeps going while the file is written
+    ht_lock_all(ht);
 
-    char* s = buff;
+    ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_relaxed);
+    u64 table_size = table->size;
+    u64* bin_size = (u64*)malloc(table_size * sizeof(u64));
+    if (bin_size)
+        memcpy(bin_size, table->bin_size, table_size * sizeof(u64));
 
-    for (u64 i = 0; i < ht->table_size; ++i) {
-        int n = sprintf(s, "%lu,%lu\n", i, ht_bin_size(ht, i));
-        s += n;
+    ht_unlock_all(ht);
+
+    if (!bin_size) {
+        fclose(f);
+        LOG_ERROR("can't alloc");
+        return ST_ERR;
     }
 
-    fwrite(buff, sizeof(char), sizeof(buff), f);
+    for (u64 i = 0; i < table_size; ++i)
+        fprintf(f, "%lu,%lu\n", i, bin_size[i]);
 
+    free(bin_size);
     fclose(f);
 
     return ST_OK;
 }
 
+//============================================================================================================
+// FOREACH
+//============================================================================================================
+
+typedef struct ht_entry {
+    u64 hash;
+    void* key;
+    void* value;
+} ht_entry_t;
+
+typedef struct ht_snapshot {
+    ht_entry_t* entries;
+    u64 size;
+    u64 capacity;
+} ht_snapshot_t;
+
+/// copies the buckets of @stripe in @a, stops early if the chains have been changed under the reader
+/// \return false if there's no memory
+static bool ht_snapshot_array(ht_snapshot_t* snap, ht_array_t* a, u64 stripe, ht_stripe_t* st, u64 seq) {
+    u64 span = 1UL << (a->bits - HT_STRIPE_BITS);
+    u64 steps = 0;
+
+    for (u64 i = stripe * span; i < (stripe + 1) * span; ++i) {
+        ht_item_t* item = ht_load(&a->bins[i]);
+
+        for (; item && item != HT_MOVED; item = ht_load(&item->next)) {
+            // the caller sees the counter has moved and starts over
+            if (ht_read_torn(st, seq, ++steps))
+                return true;
+
+            if (snap->size == snap->capacity) {
+                u64 capacity = snap->capacity ? snap->capacity * 2 : 64;
+                ht_entry_t* entries = realloc(snap->entries, capacity * sizeof(ht_entry_t));
+                if (!entries)
+                    return false;
+
+                snap->entries = entries;
+                snap->capacity = capacity;
+            }
+
+            ht_entry_t* e = &snap->entries[snap->size++];
+            e->hash = item->hash;
+            e->key = item->key;
+            e->value = atomic_load_explicit(&item->value, memory_order_acquire);
+        }
+    }
+
+    return true;
+}
+
+static bool ht_snapshot_stripe(hashtable_t* ht, ht_snapshot_t* snap, u64 stripe, ht_stripe_t* st, u64 seq) {
+    snap->size = 0;
+
+    ht_array_t* table = atomic_load_explicit(&ht->table, memory_order_acquire);
+    ht_array_t* old = atomic_load_explicit(&ht->old_table, memory_order_acquire);
+
+    return ht_snapshot_array(snap, table, stripe, st, seq) && (!old || ht_snapshot_array(snap, old, stripe, st, seq));
+}
 
 ret_t ht_foreach(hashtable_t* ht, ht_foreach_cb cb, void* ctx) {
-    for (u64 i = 0; i < ht->table_size; ++i) {
-        pthread_spin_lock(&ht->bin_locks[i]);
-        ht_item_t* next = ht->table[i];
-        while (next) {
-            cb(next->hash, next->key, next->value, ctx);
-            next = next->next;
+    ht_snapshot_t snap = {NULL, 0, 0};
+    ret_t ret = ST_OK;
+
+    // the keys and values the copied pointers refer to stay alive until the end of the read section
+    epoch_reader_t* reader = epoch_enter_transient(ht->epoch, ht_reader_hint());
+
+    for (u64 s = 0; s < HT_STRIPES; ++s) {
+        ht_stripe_t* st = &ht->stripes[s];
+
+        if (reader) {
+            u64 seq;
+            bool copied;
+            do {
+                seq = ht_read_begin(st);
+                copied = ht_snapshot_stripe(ht, &snap, s, st, seq);
+            } while (copied && ht_read_retry(st, seq));
+
+            if (!copied) {
+                ret = ST_ERR;
+                break;
+            }
+        } else {
+            // every reader slot is taken, the callbacks run under the stripe lock
+            pthread_spin_lock(&st->lock);
+            bool copied = ht_snapshot_stripe(ht, &snap, s, NULL, 0);
+
+            for (u64 i = 0; copied && i < snap.size; ++i)
+                cb(snap.entries[i].hash, snap.entries[i].key, snap.entries[i].value, ctx);
+
+            pthread_spin_unlock(&st->lock);
+
+            if (!copied) {
+                ret = ST_ERR;
+                break;
+            }
+
+            continue;
         }
-        pthread_spin_unlock(&ht->bin_locks[i]);
+
+        for (u64 i = 0; i < snap.size; ++i)
+            cb(snap.entries[i].hash, snap.entries[i].key, snap.entries[i].value, ctx);
     }
 
-    return ST_OK;
+    if (reader)
+        epoch_exit_transient(reader);
+
+    free(snap.entries);
+
+    if (ret != ST_OK)
+        LOG_ERROR("can't alloc");
+
+    return ret;
+}
+
+//============================================================================================================
+// KEY TYPES
+//============================================================================================================
+
+u64 ht_hasher_u64(void* key) {
+    return hash_u64(*(u64*)key);
+}
+
+bool ht_comparator_u64(void* a, void* b) {
+    return *(u64*)a == *(u64*)b;
+}
+
+bool ht_comparator_str(void* a, void* b) {
+    return strcmp((const char*)a, (const char*)b) == 0;
+}
+
+//============================================================================================================
+// TESTS
+//============================================================================================================
+
+#ifndef NDEBUG
+
+static u64 test_ht_collide_hasher(void* key) {
+    // every key lands in one chain, only the comparator tells them apart
+    return 7;
+}
+
+static void test_ht_release_cb(void* p) {
+    free(p);
+}
+
+static void test_ht_count_cb(u64 hash, void* key, void* value, void* ctx) {
+    *(u64*)ctx += *(u64*)value;
+}
+
+static u64* test_ht_u64(u64 v) {
+    u64* p = (u64*)malloc(sizeof(u64));
+    *p = v;
+    return p;
+}
+
+static atomic_u64 test_ht_released;
+
+static void test_ht_counted_release_cb(void* p) {
+    atomic_fetch_add(&test_ht_released, 1);
+    free(p);
 }
+
+typedef struct test_ht_overwrite {
+    hashtable_t* ht;
+    u64 sum;
+    u64 released_early;
+} test_ht_overwrite_t;
+
+static void test_ht_overwrite_cb(u64 hash, void* key, void* value, void* ctx) {
+    test_ht_overwrite_t* ow = (test_ht_overwrite_t*)ctx;
+
+    ht_set(ow->ht, test_ht_u64(*(u64*)key), test_ht_u64(2));
+
+    // still readable, it's only been retired
+    ow->sum += *(u64*)value;
+    ow->released_early += atomic_load(&test_ht_released);
+}
+
+typedef struct test_ht_writer {
+    hashtable_t* ht;
+    u64 first;
+    u64 count;
+} test_ht_writer_t;
+
+static void* test_ht_writer(void* p) {
+    test_ht_writer_t* w = (test_ht_writer_t*)p;
+
+    for (u64 i = w->first; i < w->first + w->count; ++i)
+        ht_set(w->ht, test_ht_u64(i), test_ht_u64(1));
+
+    return p;
+}
+
+typedef struct test_ht_reader {
+    hashtable_t* ht;
+    atomic_bool* stop;
+    u64 stable;
+    u64 misses;
+    u64 lookups;
+} test_ht_reader_t;
+
+static void* test_ht_reader(void* p) {
+    test_ht_reader_t* r = (test_ht_reader_t*)p;
+    void* value = NULL;
+
+    // the stable keys are never touched by the writers, they must be found through every resize
+    while (!atomic_load(r->stop)) {
+        for (u64 i = 0; i < r->stable; ++i) {
+            u64 key = i;
+            if (ht_get(r->ht, &key, &value) != ST_OK || *(u64*)value != i)
+                ++r->misses;
+
+            ++r->lookups;
+        }
+    }
+
+    return p;
+}
+
+void test_hashtable(void) {
+    hashtable_t* ht = NULL;
+    void* value = NULL;
+
+    CHECK_RETURN(ht_init(&ht, 4, &test_ht_collide_hasher, &ht_comparator_u64, &test_ht_release_cb,
+                         &test_ht_release_cb));
+    ASSERT(ht_table_size(ht) == HT_STRIPES);
+
+    for (u64 i = 0; i < 16; ++i)
+        CHECK_RETURN(ht_set(ht, test_ht_u64(i), test_ht_u64(i * 10)));
+
+    ASSERT(ht_size(ht) == 16);
+
+    u64 key = 5;
+    ASSERT(ht_get(ht, &key, &value) == ST_OK && *(u64*)value == 50);
+    ASSERT(ht_del(ht, &key) == ST_OK);
+    ASSERT(ht_get(ht, &key, &value) == ST_NOT_FOUND);
+    key = 6;
+    ASSERT(ht_get(ht, &key, &value) == ST_OK && *(u64*)value == 60);
+
+    ht_destroy(ht);
+
+    // grows through several resizes, lookups have to work in the middle of every migration
+    CHECK_RETURN(ht_init(&ht, 64, &ht_hasher_u64, &ht_comparator_u64, &test_ht_release_cb,
+                         &test_ht_release_cb));
+
+    const u64 n = 5000;
+    for (u64 i = 0; i < n; ++i) {
+        CHECK_RETURN(ht_set(ht, test_ht_u64(i), test_ht_u64(1)));
+
+        key = i / 2;
+        ASSERT(ht_get(ht, &key, &value) == ST_OK);
+    }
+
+    ASSERT(ht_size(ht) == n);
+    ASSERT(ht_table_size(ht) >= n / HT_MAX_LOAD);
+
+    // overwriting keeps the size
+    CHECK_RETURN(ht_set(ht, test_ht_u64(0), test_ht_u64(1)));
+    ASSERT(ht_size(ht) == n);
+
+    u64 sum = 0;
+    ht_foreach(ht, &test_ht_count_cb, &sum);
+    ASSERT(sum == n);
+
+    for (u64 i = 0; i < n; i += 2) {
+        key = i;
+        ASSERT(ht_del(ht, &key) == ST_OK);
+    }
+
+    ASSERT(ht_size(ht) == n / 2);
+
+    for (u64 i = 0; i < n; ++i) {
+        key = i;
+        ASSERT(ht_get(ht, &key, &value) == (i % 2 ? ST_OK : ST_NOT_FOUND));
+    }
+
+    ht_destroy(ht);
+
+    // the callbacks overwrite what they are looking at, the old values live until the section is over
+    CHECK_RETURN(ht_init(&ht, 64, &ht_hasher_u64, &ht_comparator_u64, &test_ht_release_cb,
+                         &test_ht_counted_release_cb));
+
+    for (u64 i = 0; i < 256; ++i)
+        CHECK_RETURN(ht_set(ht, test_ht_u64(i), test_ht_u64(1)));
+
+    atomic_store(&test_ht_released, 0);
+    test_ht_overwrite_t ow = {ht, 0, 0};
+    ht_foreach(ht, &test_ht_overwrite_cb, &ow);
+    ASSERT(ow.sum == 256 && ow.released_early == 0);
+
+    // a retired pointer needs the epoch to move on twice
+    for (u64 i = 0; i < 3; ++i)
+        epoch_reclaim(ht->epoch);
+
+    ASSERT(atomic_load(&test_ht_released) == 256);
+
+    key = 3;
+    ASSERT(ht_get(ht, &key, &value) == ST_OK && *(u64*)value == 2);
+
+    ht_destroy(ht);
+
+    // writers racing through the resizes
+    CHECK_RETURN(ht_init(&ht, 64, &ht_hasher_u64, &ht_comparator_u64, &test_ht_release_cb,
+                         &test_ht_release_cb));
+
+    pthread_t thrd[4];
+    test_ht_writer_t writers[4];
+    for (u64 i = 0; i < 4; ++i) {
+        writers[i].ht = ht;
+        writers[i].first = i * n;
+        writers[i].count = n;
+        pthread_create(&thrd[i], NULL, &test_ht_writer, &writers[i]);
+    }
+
+    for (u64 i = 0; i < 4; ++i)
+        pthread_join(thrd[i], NULL);
+
+    ASSERT(ht_size(ht) == 4 * n);
+
+    for (u64 i = 0; i < 4 * n; ++i) {
+        key = i;
+        ASSERT(ht_get(ht, &key, &value) == ST_OK);
+    }
+
+    ht_destroy(ht);
+
+    // lock free readers against writers that insert, overwrite and delete through the resizes
+    CHECK_RETURN(ht_init(&ht, 64, &ht_hasher_u64, &ht_comparator_u64, &test_ht_release_cb,
+                         &test_ht_release_cb));
+
+    const u64 stable = 256;
+    for (u64 i = 0; i < stable; ++i)
+        CHECK_RETURN(ht_set(ht, test_ht_u64(i), test_ht_u64(i)));
+
+    atomic_bool stop;
+    atomic_init(&stop, false);
+
+    pthread_t rthrd[2];
+    test_ht_reader_t readers[2];
+    for (u64 i = 0; i < 2; ++i) {
+        readers[i] = (test_ht_reader_t){ht, &stop, stable, 0, 0};
+        pthread_create(&rthrd[i], NULL, &test_ht_reader, &readers[i]);
+    }
+
+    for (u64 i = 0; i < 2; ++i) {
+        writers[i].ht = ht;
+        writers[i].first = stable + i * n;
+        writers[i].count = n;
+        pthread_create(&thrd[i], NULL, &test_ht_writer, &writers[i]);
+    }
+
+    for (u64 i = 0; i < 2; ++i)
+        pthread_join(thrd[i], NULL);
+
+    for (u64 i = stable; i < stable + 2 * n; i += 2) {
+        key = i;
+        ASSERT(ht_del(ht, &key) == ST_OK);
+        CHECK_RETURN(ht_set(ht, test_ht_u64(i + 1), test_ht_u64(1)));
+    }
+
+    // foreach walks a copy while the readers are still going
+    sum = 0;
+    ht_foreach(ht, &test_ht_count_cb, &sum);
+    ASSERT(sum == stable * (stable - 1) / 2 + n);
+
+    atomic_store(&stop, true);
+    for (u64 i = 0; i < 2; ++i) {
+        pthread_join(rthrd[i], NULL);
+        ASSERT(readers[i].lookups > 0 && readers[i].misses == 0);
+    }
+
+    ASSERT(ht_size(ht) == stable + n);
+
+    ht_destroy(ht);
+}
+
+#endif
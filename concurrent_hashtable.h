@@ -19,37 +19,100 @@
 #include <pthread.h>
 
 #include "globals.h"
+#include "epoch.h"
 
 
 
 //============================================================================================================
 // CONCURRENT HASH TABLE
 //============================================================================================================
+
+/// Chained buckets guarded by a fixed set of stripe locks. The number of buckets is a power of two and it
+/// doubles once there are more items than buckets. A resize only swaps the bucket arrays under every
+/// stripe, the items are moved over afterwards by the writers a few buckets at a time, and a lookup
+/// checks the old bucket until it has been moved.
+///
+/// A bucket is picked by the top bits of the multiplied hash and its stripe by the top HT_STRIPE_BITS,
+/// so an old bucket and both buckets it's split into are always guarded by the same lock.
+///
+/// Readers don't take the locks. Every stripe has a sequence counter that is odd while a writer holds it,
+/// a read retries if the counter has moved under it, and the items and bucket arrays a reader may still
+/// be walking are released through an epoch_t once no read section can see them.
+
+#define HT_STRIPE_BITS 6
+#define HT_STRIPES (1UL << HT_STRIPE_BITS)
+
+// items per bucket before the table doubles
+#define HT_MAX_LOAD 1
+
+// old buckets moved by every write while a resize is in progress
+#define HT_MIGRATE_BATCH 8
+
 typedef u64(* ht_key_hasher)(void* key);
 
+/// only called for the keys with equal hashes
+typedef bool(* ht_key_comparator)(void* a, void* b);
+
 typedef void(* ht_data_releaser)(void* key);
 
+struct _hashtable_t;
+
 typedef struct _ht_item_t {
     void* key;
-    void* value;
+    _Atomic(void*) value;
     u64 hash;
-    struct _ht_item_t* next;
+    _Atomic(struct _ht_item_t*) next;
+    // a deleted key outlives its table entry until the readers are gone
+    struct _hashtable_t* owner;
 } ht_item_t;
 
+typedef _Atomic(ht_item_t*) ht_bin_t;
+
+/// the buckets and their sizes in one block, a reader always sees an array with its own size
+typedef struct _ht_array_t {
+    u64 bits;
+    u64 size;
+    // writers only
+    u64* bin_size;
+    ht_bin_t bins[];
+} ht_array_t;
+
+typedef struct _ht_stripe_t {
+    pthread_spinlock_t lock;
+    u32 reserved;
+    atomic_u64 seq;
+    // a stripe per cache line
+    u8 pad[48];
+} ht_stripe_t;
+
 typedef struct _hashtable_t {
-    u64 table_size;
+    // swapped under every stripe lock
+    _Atomic(ht_array_t*) table;
+    // the array being migrated away from, NULL when no resize is in progress
+    _Atomic(ht_array_t*) old_table;
+    atomic_u64 old_size;
+    // bumped by every resize
+    u64 round;
+    atomic_u64 migrate_next;
+    atomic_u64 migrated;
+
     atomic_u64 size;
-    u64* bin_size;
-    ht_item_t** table;
-    pthread_spinlock_t* bin_locks;
+    atomic_u64 grow_at;
+    epoch_t* epoch;
+    pthread_mutex_t resize_mtx;
+    ht_stripe_t stripes[HT_STRIPES];
+
     ht_key_hasher hasher;
+    ht_key_comparator comparator;
     ht_data_releaser key_releaser;
     ht_data_releaser value_releaser;
 } hashtable_t;
 
+/// \param table_size initial number of buckets, rounded up to a power of two and at least HT_STRIPES
 ret_t ht_init(hashtable_t** ht,
                      u64 table_size,
                      ht_key_hasher hasher,
+                     ht_key_comparator comparator,
                      ht_data_releaser key_releaser,
                      ht_data_releaser value_releaser);
 
@@ -59,8 +122,11 @@ void ht_destroy_items_line(hashtable_t* ht, ht_item_t* start_item);
 
 void ht_destroy(hashtable_t* ht);
 
+/// the table takes @key, it's released right away if the key is already there
 ret_t ht_set(hashtable_t* ht, void* key, void* value);
 
+/// lock free, the value is only guaranteed to stay alive as long as nobody deletes or overwrites it,
+/// overwritten and deleted values are retired through the table epoch
 ret_t ht_get(hashtable_t* ht, void* key, void** value);
 
 ret_t ht_del(hashtable_t* ht, void* key);
@@ -75,4 +141,21 @@ ret_t ht_hist_dump_csv(hashtable_t* ht, const char* filename);
 
 typedef void(* ht_foreach_cb)(u64, void*, void*, void*);
 
+/// @cb runs without any lock held over the hash, key and value pointers of every stripe as they were
+/// at one point in time, writers carry on meanwhile. Only the pointers are copied, an overwritten or
+/// deleted key and value are retired through the epoch and stay alive until ht_foreach returns.
 ret_t ht_foreach(hashtable_t* ht, ht_foreach_cb cb, void* ctx);
+
+/// hasher and comparator for u64 keys
+u64 ht_hasher_u64(void* key);
+
+bool ht_comparator_u64(void* a, void* b);
+
+/// comparator for NUL terminated string keys
+bool ht_comparator_str(void* a, void* b);
+
+#ifndef NDEBUG
+
+void test_hashtable(void);
+
+#endif
@@ -16,70 +16,466 @@
 *************************************************************************************************************/
 
 #include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "cpu_dev.h"
 #include "utils.h"
 #include "allocators.h"
+#include "scanner.h"
+#include "log.h"
 
 void cpu_dev_release_cb(void* p) {
     zfree(p);
 }
 
-void cpu_dev_get(cpu_dev_t** cpu_dev) {
-    *cpu_dev = zalloc(sizeof(cpu_dev_t));
-    cpu_dev_t* cpu = *cpu_dev;
-    string* stat_s = NULL;
-    string_init(&stat_s);
+void cpu_dev_ctx_init(cpu_dev_ctx_t* ctx) {
+    memset(ctx, 0, sizeof(cpu_dev_ctx_t));
+    string_init(&ctx->buf);
+    string_init(&ctx->info_buf);
+}
+
+void cpu_dev_ctx_release(cpu_dev_ctx_t* ctx) {
+    string_release(ctx->buf);
+    string_release(ctx->info_buf);
+    cpu_clocks_release(&ctx->info_mhz);
+}
+
+void cpu_dev_ctx_release_cb(void* p) {
+    cpu_dev_ctx_t* ctx = (cpu_dev_ctx_t*)p;
+
+    cpu_dev_ctx_release(ctx);
+    zfree(ctx);
+}
+
+ret_t cpu_dev_alloc(u64 rows, cpu_dev_t** cpu) {
+    u64 stride = (rows + CPU_DEV_ROW_ALIGN - 1) & ~(CPU_DEV_ROW_ALIGN - 1);
+    u64 column = stride * sizeof(u64);
+
+    // id + counters + 5 shares + clock, sizeof(double) == sizeof(u64)
+    u64 ncolumns = 1 + CPU_STAT_COUNT + 6;
 
-    file_read_line("/proc/stat", stat_s);
-    string_strip(stat_s);
+    *cpu = zalloc(sizeof(cpu_dev_t) + ncolumns * column);
+    cpu_dev_t* c = *cpu;
+    if (!c)
+        return ST_ERR;
 
-    list_t* cpu_stats = NULL;
-    string_split(stat_s, ' ', &cpu_stats);
-    string_release(stat_s);
+    c->rows = rows;
+    c->stride = stride;
 
-    list_iter_t* stat_it = NULL;
-    list_iter_init(cpu_stats, &stat_it);
-    list_iter_next(stat_it);
+    u8* p = (u8*)(c + 1);
 
-    string* stat = NULL;
-    u64 istats[10];
-    u64 idx = 0;
-    while ((stat = list_iter_next(stat_it))) {
-        string_to_u64(stat, &istats[idx++]);
+    c->id = (u64*)(void*)p;
+    p += column;
+
+    for (u64 i = 0; i < CPU_STAT_COUNT; ++i) {
+        c->stat[i] = (u64*)(void*)p;
+        p += column;
     }
 
-    cpu->user = istats[0];
-    cpu->nice = istats[1];
-    cpu->system = istats[2];
-    cpu->idle = istats[3];
-    cpu->iowait = istats[4];
-    cpu->irc = istats[5];
-    cpu->softirc = istats[6];
-    cpu->steal = istats[7];
-    cpu->guest = istats[8];
-    cpu->guest_nice = istats[9];
+    c->usage = (double*)(void*)p;
+    p += column;
+    c->user = (double*)(void*)p;
+    p += column;
+    c->system = (double*)(void*)p;
+    p += column;
+    c->iowait = (double*)(void*)p;
+    p += column;
+    c->steal = (double*)(void*)p;
+    p += column;
+    c->mhz = (double*)(void*)p;
+
+    return ST_OK;
+}
+
+static bool cpu_dev_line(scanner_t* sc) {
+    return sc->end - sc->cur > 3 && memcmp(sc->cur, "cpu", 3) == 0;
+}
+
+/// the cpu lines come first, everything after them is skipped
+static u64 cpu_dev_count_rows(const char* data, u64 size) {
+    scanner_t sc;
+    scanner_init(&sc, data, size);
+
+    u64 rows = 0;
+    while (cpu_dev_line(&sc)) {
+        ++rows;
+
+        if (!scanner_next_line(&sc))
+            break;
+    }
+
+    return rows;
+}
+
+static ret_t cpu_dev_parse(cpu_dev_t* cpu, const char* data, u64 size) {
+    scanner_t sc;
+    scanner_init(&sc, data, size);
+
+    u64 row = 0;
+    while (cpu_dev_line(&sc)) {
+        if (row == cpu->stride)
+            return ST_SIZE_EXCEED;
+
+        // "cpu  user nice system ..." then "cpuN user nice system ..."
+        sc.cur += 3;
+
+        u64 id = 0;
+        if (row > 0)
+            scanner_u64(&sc, &id);
+
+        u64 v[CPU_STAT_COUNT] = {0};
+        if (scanner_u64s(&sc, v, CPU_STAT_COUNT) < 4)
+            return ST_ERR;
+
+        cpu->id[row] = id;
+        for (u64 i = 0; i < CPU_STAT_COUNT; ++i)
+            cpu->stat[i][row] = v[i];
+
+        ++row;
+
+        if (!scanner_next_line(&sc))
+            break;
+    }
+
+    cpu->rows = row;
+
+    return row ? ST_OK : ST_ERR;
+}
+
+ret_t cpu_dev_read(cpu_dev_ctx_t* ctx, cpu_dev_t* cpu) {
+    ret_t ret = fd_cache_read("/proc/stat", ctx->buf);
+    if (ret != ST_OK)
+        return ret;
 
-    list_iter_release(stat_it);
-    list_release(cpu_stats, true);
+    return cpu_dev_parse(cpu, string_cdata(ctx->buf), string_size(ctx->buf));
 }
 
-double cpu_dev_diff_usage(cpu_dev_t* a, cpu_dev_t* b) {
+//============================================================================================================
+// CLOCKS
+//============================================================================================================
 
-    u64 prev_idle = a->idle + a->iowait;
-    u64 idle = b->idle + b->iowait;
+/// scaling_cur_freq is in kHz, the descriptor stays open between samples
+static bool cpu_freq_read_cpufreq(u64 id, double* mhz) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%lu/cpufreq/scaling_cur_freq", id);
 
-    u64 prev_non_idle = a->user + a->nice + a->system + a->irc + a->softirc + a->steal;
-    u64 non_idle = b->user + b->nice + b->system + b->irc + b->softirc + b->steal;
+    char buf[32];
+    u64 size = 0;
+    if (fd_cache_read_buf(path, buf, sizeof(buf), &size) != ST_OK)
+        return false;
 
-    u64 prev_total = prev_idle + prev_non_idle;
-    u64 total = idle + non_idle;
+    scanner_t sc;
+    scanner_init(&sc, buf, size);
 
-    u64 totald = total - prev_total;
-    u64 idled = idle - prev_idle;
+    u64 khz = 0;
+    if (!scanner_u64(&sc, &khz))
+        return false;
 
-    double usage = (double)(totald - idled) / (double)totald;
+    *mhz = (double)khz / 1000.0;
 
-    return usage;
+    return true;
+}
+
+/// "2893.412" of a cpuinfo line, the scanner only knows integers
+static bool cpu_freq_scan_mhz(scanner_t* sc, double* mhz) {
+    u64 whole = 0;
+    if (!scanner_u64(sc, &whole))
+        return false;
+
+    double frac = 0.0;
+    if (sc->cur < sc->end && *sc->cur == '.') {
+        ++sc->cur;
+
+        double scale = 0.1;
+        while (sc->cur < sc->end && (u8)(*sc->cur - '0') < 10) {
+            frac += (double)(*sc->cur - '0') * scale;
+            scale *= 0.1;
+            ++sc->cur;
+        }
+    }
+
+    *mhz = (double)whole + frac;
+
+    return true;
+}
+
+/// the "cpu MHz" of every "processor" block into @clocks indexed by the processor number,
+/// the numbers that didn't show up are 0.0
+static ret_t cpu_freq_parse_cpuinfo(const char* data, u64 size, cpu_clocks_t* clocks) {
+    scanner_t sc;
+    scanner_init(&sc, data, size);
+
+    cpu_clocks_clear(clocks);
+
+    u64 id = 0;
+    u64 found = 0;
+
+    do {
+        const char* key;
+        u64 len;
+        if (!scanner_key(&sc, &key, &len))
+            continue;
+
+        if (SCANNER_KEY_IS(key, len, "processor")) {
+            if (!scanner_u64(&sc, &id))
+                id = clocks->size;
+        } else if (SCANNER_KEY_IS(key, len, "cpu MHz")) {
+            double mhz = 0.0;
+            if (!cpu_freq_scan_mhz(&sc, &mhz))
+                continue;
+
+            if (id >= clocks->size) {
+                u64 n = id + 1 - clocks->size;
+                if (cpu_clocks_grow(clocks, n) != ST_OK)
+                    return ST_ERR;
+
+                memset(clocks->data + clocks->size, 0, n * sizeof(double));
+                clocks->size += n;
+            }
+
+            clocks->data[id] = mhz;
+            ++found;
+        }
+    } while (scanner_next_line(&sc));
+
+    return found ? ST_OK : ST_EMPTY;
+}
+
+static ret_t cpu_freq_refresh_cpuinfo(cpu_dev_ctx_t* ctx) {
+    ret_t ret = fd_cache_read("/proc/cpuinfo", ctx->info_buf);
+    if (ret != ST_OK)
+        return ret;
+
+    return cpu_freq_parse_cpuinfo(string_cdata(ctx->info_buf), string_size(ctx->info_buf), &ctx->info_mhz);
+}
+
+/// min/avg/max over the cores with a known clock
+static void cpu_dev_freq_stats(cpu_dev_t* cpu) {
+    double lo = 0.0;
+    double hi = 0.0;
+    double sum = 0.0;
+    u64 n = 0;
+
+    for (u64 i = 1; i < cpu->rows; ++i) {
+        double mhz = cpu->mhz[i];
+        if (mhz <= 0.0)
+            continue;
+
+        lo = (n == 0 || mhz < lo) ? mhz : lo;
+        hi = mhz > hi ? mhz : hi;
+        sum += mhz;
+        ++n;
+    }
+
+    cpu->mhz_min = lo;
+    cpu->mhz_avg = n ? sum / (double)n : 0.0;
+    cpu->mhz_max = hi;
+}
+
+void cpu_dev_read_freq(cpu_dev_ctx_t* ctx, cpu_dev_t* cpu) {
+    if (cpu->rows < 2)
+        return;
+
+    // cpufreq is either there for all the cores or not at all, probing the first one is enough
+    if (ctx->freq_source == CPU_FREQ_UNKNOWN) {
+        double mhz = 0.0;
+        ctx->freq_source = cpu_freq_read_cpufreq(cpu->id[1], &mhz) ? CPU_FREQ_CPUFREQ : CPU_FREQ_CPUINFO;
+    }
+
+    if (ctx->freq_source == CPU_FREQ_CPUFREQ) {
+        // an offline or driverless core keeps 0.0 and is left out of the stats
+        for (u64 i = 1; i < cpu->rows; ++i)
+            cpu_freq_read_cpufreq(cpu->id[i], &cpu->mhz[i]);
+    } else if (ctx->freq_source == CPU_FREQ_CPUINFO) {
+        if (ctx->samples % CPU_FREQ_CPUINFO_SAMPLES == 0 && cpu_freq_refresh_cpuinfo(ctx) != ST_OK) {
+            LOG_WARN("no cpufreq and no clock in /proc/cpuinfo, the core clocks are unknown");
+            ctx->freq_source = CPU_FREQ_NONE;
+            return;
+        }
+
+        const cpu_clocks_t* clocks = &ctx->info_mhz;
+        for (u64 i = 1; i < cpu->rows; ++i)
+            cpu->mhz[i] = cpu->id[i] < clocks->size ? clocks->data[cpu->id[i]] : 0.0;
+    } else {
+        return;
+    }
+
+    ++ctx->samples;
+
+    cpu_dev_freq_stats(cpu);
+}
+
+void cpu_dev_get(cpu_dev_ctx_t* ctx, cpu_dev_t** cpu_dev) {
+    u64 rows = 1;
+
+    if (fd_cache_read("/proc/stat", ctx->buf) == ST_OK)
+        rows = cpu_dev_count_rows(string_cdata(ctx->buf), string_size(ctx->buf));
+
+    cpu_dev_alloc(rows ? rows : 1, cpu_dev);
+
+    if (rows && cpu_dev_parse(*cpu_dev, string_cdata(ctx->buf), string_size(ctx->buf)) == ST_OK)
+        cpu_dev_read_freq(ctx, *cpu_dev);
+}
+
+// b - a, or 0 if the counter went backwards (iowait does on NO_HZ kernels), a mask keeps the loop branch-free
+#define CPU_DELTA(b, a) (((b) - (a)) & (0 - (u64)((b) >= (a))))
+
+void cpu_dev_diff_usage(cpu_dev_t* __restrict a, cpu_dev_t* __restrict b) {
+    u64 n = b->stride;
+
+    double* __restrict usage = b->usage;
+    double* __restrict user = b->user;
+    double* __restrict system = b->system;
+    double* __restrict iowait = b->iowait;
+    double* __restrict steal = b->steal;
+
+    // a core went on or offline, the rows don't match until the next sample
+    if (a->rows != b->rows || memcmp(a->id, b->id, b->rows * sizeof(u64)) != 0) {
+        // the share columns are adjacent, see cpu_dev_alloc
+        memset(usage, 0, 5 * n * sizeof(double));
+        return;
+    }
+
+    const u64* __restrict a_user = a->stat[CPU_USER];
+    const u64* __restrict a_nice = a->stat[CPU_NICE];
+    const u64* __restrict a_system = a->stat[CPU_SYSTEM];
+    const u64* __restrict a_idle = a->stat[CPU_IDLE];
+    const u64* __restrict a_iowait = a->stat[CPU_IOWAIT];
+    const u64* __restrict a_irq = a->stat[CPU_IRQ];
+    const u64* __restrict a_softirq = a->stat[CPU_SOFTIRQ];
+    const u64* __restrict a_steal = a->stat[CPU_STEAL];
+
+    const u64* __restrict b_user = b->stat[CPU_USER];
+    const u64* __restrict b_nice = b->stat[CPU_NICE];
+    const u64* __restrict b_system = b->stat[CPU_SYSTEM];
+    const u64* __restrict b_idle = b->stat[CPU_IDLE];
+    const u64* __restrict b_iowait = b->stat[CPU_IOWAIT];
+    const u64* __restrict b_irq = b->stat[CPU_IRQ];
+    const u64* __restrict b_softirq = b->stat[CPU_SOFTIRQ];
+    const u64* __restrict b_steal = b->stat[CPU_STEAL];
+
+    // guest time is already accounted in user, the padding rows are zero on both sides
+    for (u64 i = 0; i < n; ++i) {
+        u64 d_user = CPU_DELTA(b_user[i], a_user[i]) + CPU_DELTA(b_nice[i], a_nice[i]);
+        u64 d_system = CPU_DELTA(b_system[i], a_system[i]) + CPU_DELTA(b_irq[i], a_irq[i]) +
+                       CPU_DELTA(b_softirq[i], a_softirq[i]);
+        u64 d_idle = CPU_DELTA(b_idle[i], a_idle[i]);
+        u64 d_iowait = CPU_DELTA(b_iowait[i], a_iowait[i]);
+        u64 d_steal = CPU_DELTA(b_steal[i], a_steal[i]);
+
+        u64 total = d_user + d_system + d_idle + d_iowait + d_steal;
+        double inv = 1.0 / (double)(total + (total == 0));
+
+        usage[i] = (double)(d_user + d_system + d_steal) * inv;
+        user[i] = (double)d_user * inv;
+        system[i] = (double)d_system * inv;
+        iowait[i] = (double)d_iowait * inv;
+        steal[i] = (double)d_steal * inv;
+    }
+}
+
+static void cpu_dev_scan_cb(void* ctx, void** snapshot) {
+    cpu_dev_get((cpu_dev_ctx_t*)ctx, (cpu_dev_t**)snapshot);
+}
+
+void cpu_dev_diff(void* ctx, void* __restrict prev, void* __restrict cur, double sample_size_sec) {
+    cpu_dev_diff_usage((cpu_dev_t*)prev, (cpu_dev_t*)cur);
+}
+
+ret_t cpu_dev_sampler_init(sampler_t** s, sampler_publish_cb cb) {
+    cpu_dev_ctx_t* ctx = zalloc(sizeof(cpu_dev_ctx_t));
+    cpu_dev_ctx_init(ctx);
+
+    return sampler_init(s, ctx, &cpu_dev_ctx_release_cb, &cpu_dev_scan_cb, &cpu_dev_diff, cb, &cpu_dev_release_cb);
+}
+
+//============================================================================================================
+// CPU INFO
+//============================================================================================================
+
+VECTOR_DECLARE(cpu_core_keys, u64)
+
+static int cpu_core_key_cmp(const void* a, const void* b) {
+    u64 x = *(const u64*)a;
+    u64 y = *(const u64*)b;
+
+    return (x > y) - (x < y);
+}
+
+/// the rest of the line with the blanks around it stripped
+static void cpu_info_scan_value(scanner_t* sc, const char** value, u64* len) {
+    scanner_skip_blanks(sc);
+
+    const char* end = memchr(sc->cur, '\n', (u64)(sc->end - sc->cur));
+    if (!end)
+        end = sc->end;
+
+    while (end > sc->cur && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+
+    *value = sc->cur;
+    *len = (u64)(end - sc->cur);
+    sc->cur = end;
+}
+
+static ret_t cpu_info_parse(cpu_info_t* info, const char* data, u64 size) {
+    scanner_t sc;
+    scanner_init(&sc, data, size);
+
+    // (physical id << 32) | core id of every processor, counted once sorted
+    cpu_core_keys_t keys = VECTOR_EMPTY;
+    u64 physical_id = 0;
+
+    do {
+        const char* key;
+        u64 len;
+        if (!scanner_key(&sc, &key, &len))
+            continue;
+
+        if (SCANNER_KEY_IS(key, len, "processor")) {
+            ++info->cores;
+            physical_id = 0;
+        } else if (SCANNER_KEY_IS(key, len, "model name") && !info->name) {
+            const char* value;
+            u64 value_len;
+            cpu_info_scan_value(&sc, &value, &value_len);
+
+            string_init(&info->name);
+            string_appendn(info->name, value, value_len);
+        } else if (SCANNER_KEY_IS(key, len, "physical id")) {
+            scanner_u64(&sc, &physical_id);
+        } else if (SCANNER_KEY_IS(key, len, "core id")) {
+            u64 core_id = 0;
+            if (!scanner_u64(&sc, &core_id))
+                continue;
+
+            if (cpu_core_keys_push(&keys, (physical_id << 32) | (core_id & 0xFFFFFFFF)) != ST_OK) {
+                cpu_core_keys_release(&keys);
+                return ST_ERR;
+            }
+        }
+    } while (scanner_next_line(&sc));
+
+    if (keys.size) {
+        qsort(keys.data, keys.size, sizeof(u64), &cpu_core_key_cmp);
+
+        info->physical_cores = 1;
+        info->sockets = 1;
+
+        for (u64 i = 1; i < keys.size; ++i) {
+            info->physical_cores += keys.data[i] != keys.data[i - 1];
+            info->sockets += (keys.data[i] >> 32) != (keys.data[i - 1] >> 32);
+        }
+    } else {
+        // no topology in cpuinfo (arm mostly)
+        info->physical_cores = info->cores;
+        info->sockets = info->cores ? 1 : 0;
+    }
+
+    cpu_core_keys_release(&keys);
+
+    return info->cores ? ST_OK : ST_ERR;
 }
 
 void cpu_info_release_cb(void* p) {
@@ -90,8 +486,6 @@ void cpu_info_release_cb(void* p) {
 
     if (cpui->name)
         string_release(cpui->name);
-    if (cpui->clock)
-        string_release(cpui->clock);
 
     zfree(cpui);
 }
@@ -99,41 +493,183 @@ void cpu_info_release_cb(void* p) {
 void cpu_info_get(cpu_info_t** cpu_info) {
     *cpu_info = zalloc(sizeof(cpu_info_t));
     cpu_info_t* cpu = *cpu_info;
-    string* info_s = NULL;
-    string_init(&info_s);
 
-    file_read_all_buffered_s("/proc/cpuinfo", info_s);
+    string* text = NULL;
+    string_init(&text);
 
-    list_t* lines = NULL;
-    string_split(info_s, '\n', &lines);
+    // read once at startup, not worth a cached descriptor
+    if (file_read_uncached("/proc/cpuinfo", text) != ST_OK ||
+        cpu_info_parse(cpu, string_cdata(text), string_size(text)) != ST_OK)
+        LOG_ERROR("can't parse /proc/cpuinfo");
 
-    list_iter_t* lines_it = NULL;
-    list_iter_init(lines, &lines_it);
+    if (!cpu->name)
+        string_create(&cpu->name, "Unknown CPU");
 
-    string* line;
-    u64 n_cpu = 0;
-    while ((line = list_iter_next(lines_it))) {
-        if (string_starts_with(line, "model name") == ST_OK) {
-            if (n_cpu > 0)
-                continue;
-            string_crop_tail(line, strlen("model name\t:"));
-            string_strip(line);
-            string_dub(line, &cpu->name);
-        }
+    string_release(text);
+}
 
-        if (string_starts_with(line, "cpu MHz") == ST_OK) {
-            if (n_cpu++ > 0)
-                continue;
-            string_crop_tail(line, strlen("cpu MHz\t: "));
-            string_strip(line);
-            string_dub(line, &cpu->clock);
-        }
+#ifndef NDEBUG
+
+void test_cpu_dev(void) {
+    const char* a_text =
+            "cpu  400 0 200 1400 0 0 0 0 0 0\n"
+            "cpu0 100 0 100 800 0 0 0 0 0 0\n"
+            "cpu2 300 0 100 600 0 0 0 0 0 0\n"
+            "intr 12345 0 0\n";
+    const char* b_text =
+            "cpu  600 0 300 1500 100 0 0 0 0 0\n"
+            "cpu0 100 0 100 900 0 0 0 0 0 0\n"
+            "cpu2 500 0 200 600 100 0 0 0 0 0\n"
+            "intr 12345 0 0\n";
+
+    ASSERT(cpu_dev_count_rows(a_text, strlen(a_text)) == 3);
+
+    cpu_dev_t* a = NULL;
+    cpu_dev_t* b = NULL;
+    cpu_dev_alloc(3, &a);
+    cpu_dev_alloc(3, &b);
+    ASSERT(a->stride == CPU_DEV_ROW_ALIGN);
+
+    CHECK_RETURN(cpu_dev_parse(a, a_text, strlen(a_text)));
+    CHECK_RETURN(cpu_dev_parse(b, b_text, strlen(b_text)));
+    ASSERT(b->rows == 3);
+    ASSERT(b->id[1] == 0 && b->id[2] == 2);
+    ASSERT(b->stat[CPU_IOWAIT][2] == 100);
+
+    cpu_dev_diff_usage(a, b);
+
+    // aggregate: 200 user, 100 system, 100 idle, 100 iowait
+    ASSERT(b->usage[0] > 0.599 && b->usage[0] < 0.601);
+    ASSERT(b->iowait[0] > 0.199 && b->iowait[0] < 0.201);
+    // cpu0 was idle, cpu2 was saturated
+    ASSERT(b->usage[1] > -0.001 && b->usage[1] < 0.001);
+    ASSERT(b->usage[2] > 0.749 && b->usage[2] < 0.751);
+    ASSERT(b->user[2] > 0.499 && b->user[2] < 0.501);
+    // the padding rows stay zero
+    ASSERT(b->usage[3] > -0.001 && b->usage[3] < 0.001);
+
+    // iowait of cpu2 went backwards, the core reads as busy with user time only
+    a->stat[CPU_IOWAIT][2] = 200;
+    cpu_dev_diff_usage(a, b);
+    ASSERT(b->iowait[2] > -0.001 && b->iowait[2] < 0.001);
+    ASSERT(b->usage[2] > 0.999 && b->usage[2] <= 1.0);
+    ASSERT(b->user[2] > 0.666 && b->user[2] < 0.667);
+    a->stat[CPU_IOWAIT][2] = 0;
+
+    // more cores than allocated rows
+    cpu_dev_t* c = NULL;
+    cpu_dev_alloc(1, &c);
+    c->stride = 2;
+    ASSERT(cpu_dev_parse(c, b_text, strlen(b_text)) == ST_SIZE_EXCEED);
+
+    // clocks from cpuinfo, cpu1 is offline and cpu2 has no clock
+    const char cpuinfo[] =
+            "processor\t: 0\nmodel name\t: Intel(R) Xeon(R) CPU  \ncpu MHz\t\t: 2893.412\n\n"
+            "processor\t: 2\nmodel name\t: Intel(R) Xeon(R) CPU\ncpu MHz\t\t: 1200.5\n\n"
+            "processor\t: 3\nmodel name\t: Intel(R) Xeon(R) CPU\n";
+
+    cpu_clocks_t clocks = VECTOR_EMPTY;
+    CHECK_RETURN(cpu_freq_parse_cpuinfo(cpuinfo, sizeof(cpuinfo) - 1, &clocks));
+    ASSERT(clocks.size == 3);
+    ASSERT(clocks.data[0] > 2893.411 && clocks.data[0] < 2893.413);
+    ASSERT(clocks.data[1] <= 0.0);
+    ASSERT(clocks.data[2] > 1200.49 && clocks.data[2] < 1200.51);
+    ASSERT(cpu_freq_parse_cpuinfo("processor\t: 0\n", strlen("processor\t: 0\n"), &clocks) == ST_EMPTY && clocks.size == 0);
+    cpu_clocks_release(&clocks);
+
+    // cpu2 at 3000, cpu0 unknown, the padding rows don't count
+    b->mhz[1] = 0.0;
+    b->mhz[2] = 3000.0;
+    cpu_dev_freq_stats(b);
+    ASSERT(b->mhz_min > 2999.9 && b->mhz_max < 3000.1 && b->mhz_avg > 2999.9 && b->mhz_avg < 3000.1);
+
+    b->mhz[1] = 1000.0;
+    cpu_dev_freq_stats(b);
+    ASSERT(b->mhz_min > 999.9 && b->mhz_min < 1000.1);
+    ASSERT(b->mhz_avg > 1999.9 && b->mhz_avg < 2000.1);
+    ASSERT(b->mhz_max > 2999.9 && b->mhz_max < 3000.1);
+
+    cpu_dev_release_cb(c);
+    cpu_dev_release_cb(b);
+    cpu_dev_release_cb(a);
+}
 
+void test_cpu_info(void) {
+    // two sockets of two cores with hyperthreading, the siblings share a core id
+    const char* text =
+            "processor\t: 0\nmodel name\t: AMD EPYC 7B13  \nphysical id\t: 0\ncore id\t\t: 0\n\n"
+            "processor\t: 1\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 0\ncore id\t\t: 1\n\n"
+            "processor\t: 2\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 1\ncore id\t\t: 0\n\n"
+            "processor\t: 3\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 1\ncore id\t\t: 1\n\n"
+            "processor\t: 4\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 0\ncore id\t\t: 0\n\n"
+            "processor\t: 5\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 0\ncore id\t\t: 1\n\n"
+            "processor\t: 6\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 1\ncore id\t\t: 0\n\n"
+            "processor\t: 7\nmodel name\t: AMD EPYC 7B13\nphysical id\t: 1\ncore id\t\t: 1\n";
+
+    cpu_info_t info;
+    memset(&info, 0, sizeof(info));
+    CHECK_RETURN(cpu_info_parse(&info, text, strlen(text)));
+    ASSERT(info.cores == 8 && info.physical_cores == 4 && info.sockets == 2);
+    ASSERT(string_comparez(info.name, "AMD EPYC 7B13") == ST_OK);
+    string_release(info.name);
+
+    // no topology lines
+    const char* arm = "processor\t: 0\nBogoMIPS\t: 48.00\n\nprocessor\t: 1\nBogoMIPS\t: 48.00\n";
+    memset(&info, 0, sizeof(info));
+    CHECK_RETURN(cpu_info_parse(&info, arm, strlen(arm)));
+    ASSERT(info.cores == 2 && info.physical_cores == 2 && info.sockets == 1);
+    ASSERT(info.name == NULL);
+
+    memset(&info, 0, sizeof(info));
+    ASSERT(cpu_info_parse(&info, "", 0) == ST_ERR);
+
+    // 64 processors take several pages, none of them may be cut off by the readers
+    char filename[] = "/tmp/hwmonitor_cpuinfo_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT(fd >= 0);
+
+    for (u64 i = 0; i < 64; ++i) {
+        char block[256];
+        int len = snprintf(block, sizeof(block),
+                           "processor\t: %lu\nmodel name\t: AMD EPYC 7B13\nphysical id\t: %lu\n"
+                           "core id\t\t: %lu\ncpu MHz\t\t: %lu.5\nflags\t\t: fpu vme de pse tsc msr pae mce\n\n",
+                           i, i / 32, i % 32, 1000 + i);
+        ASSERT(write(fd, block, (u64)len) == len);
     }
 
-    cpu->cores = n_cpu;
+    close(fd);
+
+    string* buf = NULL;
+    string_init(&buf);
 
-    list_iter_release(lines_it);
-    list_release(lines, true);
-    string_release(info_s);
+    CHECK_RETURN(file_read_uncached(filename, buf));
+    ASSERT(string_size(buf) > 4 * KiB);
+
+    memset(&info, 0, sizeof(info));
+    CHECK_RETURN(cpu_info_parse(&info, string_cdata(buf), string_size(buf)));
+    ASSERT(info.cores == 64 && info.physical_cores == 64 && info.sockets == 2);
+    string_release(info.name);
+
+    cpu_clocks_t clocks = VECTOR_EMPTY;
+    for (u64 i = 0; i < 2; ++i) {
+        CHECK_RETURN(fd_cache_read(filename, buf));
+        CHECK_RETURN(cpu_freq_parse_cpuinfo(string_cdata(buf), string_size(buf), &clocks));
+        ASSERT(clocks.size == 64);
+        ASSERT(clocks.data[63] > 1063.49 && clocks.data[63] < 1063.51);
+    }
+
+    cpu_clocks_release(&clocks);
+    unlink(filename);
+
+    // the live file has a block for every online cpu, however many pages that is
+    CHECK_RETURN(file_read_uncached("/proc/cpuinfo", buf));
+    memset(&info, 0, sizeof(info));
+    CHECK_RETURN(cpu_info_parse(&info, string_cdata(buf), string_size(buf)));
+    ASSERT(info.cores == (u64)sysconf(_SC_NPROCESSORS_ONLN));
+    if (info.name)
+        string_release(info.name);
+
+    string_release(buf);
 }
+
+#endif
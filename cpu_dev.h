@@ -19,36 +19,133 @@
 
 #include "globals.h"
 #include "string.h"
+#include "sampler.h"
+#include "vector.h"
 
 //============================================================================================================
 // CPU DEVICE
 //============================================================================================================
 
+enum {
+    CPU_USER = 0,
+    CPU_NICE,
+    CPU_SYSTEM,
+    CPU_IDLE,
+    CPU_IOWAIT,
+    CPU_IRQ,
+    CPU_SOFTIRQ,
+    CPU_STEAL,
+    CPU_GUEST,
+    CPU_GUEST_NICE,
+    CPU_STAT_COUNT
+};
+
+// the columns are padded to a multiple of this, the delta pass runs over whole vectors
+#define CPU_DEV_ROW_ALIGN 8UL
+
+/// /proc/stat counters stored as structure of arrays: row 0 is the aggregate "cpu" line and
+/// row i is the i-th "cpuN" line, so every column is contiguous over all the cores.
 typedef struct cpu_dev {
-    u64 user;
-    u64 nice;
-    u64 system;
-    u64 idle;
-    u64 iowait;
-    u64 irc;
-    u64 softirc;
-    u64 steal;
-    u64 guest;
-    u64 guest_nice;
+    // rows in use, the aggregate one included
+    u64 rows;
+    // allocated rows
+    u64 stride;
+    // N of "cpuN", offline cores leave gaps
+    u64* id;
+    u64* stat[CPU_STAT_COUNT];
+
+    // shares of the last sample, 0.0 - 1.0
+    double* usage;
+    double* user;
+    double* system;
+    double* iowait;
+    double* steal;
+
+    // current clock of each core in MHz, 0.0 if unknown, the aggregate row is unused
+    double* mhz;
+    // over the cores with a known clock, all 0.0 if there is none
+    double mhz_min;
+    double mhz_avg;
+    double mhz_max;
 } cpu_dev_t;
 
+enum {
+    CPU_FREQ_UNKNOWN = 0,
+    // /sys/devices/system/cpu/cpuN/cpufreq/scaling_cur_freq
+    CPU_FREQ_CPUFREQ,
+    // "cpu MHz" of /proc/cpuinfo, no cpufreq driver (VMs mostly)
+    CPU_FREQ_CPUINFO,
+    CPU_FREQ_NONE
+};
+
+// the fallback reads the whole of /proc/cpuinfo, it's refreshed once in this many samples
+#define CPU_FREQ_CPUINFO_SAMPLES 4
+
+VECTOR_DECLARE(cpu_clocks, double)
+
+typedef struct cpu_dev_ctx {
+    // /proc/stat read buffer, kept between samples
+    string* buf;
+    // /proc/cpuinfo read buffer of the fallback clock source
+    string* info_buf;
+    // fallback clocks indexed by core id
+    cpu_clocks_t info_mhz;
+    u64 samples;
+    u32 freq_source;
+    u8 reserved[4];
+} cpu_dev_ctx_t;
+
+void cpu_dev_ctx_init(cpu_dev_ctx_t* ctx);
+
+void cpu_dev_ctx_release(cpu_dev_ctx_t* ctx);
+
+void cpu_dev_ctx_release_cb(void* p);
+
 void cpu_dev_release_cb(void* p);
 
-void cpu_dev_get(cpu_dev_t** cpu_dev);
+/// allocates a snapshot of @rows rows, all the columns live in the same block
+ret_t cpu_dev_alloc(u64 rows, cpu_dev_t** cpu);
 
-double cpu_dev_diff_usage(cpu_dev_t* a, cpu_dev_t* b);
+/// refills the counters of @cpu in place, nothing is allocated
+/// \return ST_SIZE_EXCEED if the cores don't fit anymore (hotplug)
+ret_t cpu_dev_read(cpu_dev_ctx_t* ctx, cpu_dev_t* cpu);
 
+/// fills the mhz column of @cpu and its min/avg/max from the clock source picked on the first call
+void cpu_dev_read_freq(cpu_dev_ctx_t* ctx, cpu_dev_t* cpu);
+
+void cpu_dev_get(cpu_dev_ctx_t* ctx, cpu_dev_t** cpu_dev);
+
+/// computes the usage/user/system/iowait/steal columns of @b from the deltas against @a in a single
+/// branch-free pass over all the rows
+void cpu_dev_diff_usage(cpu_dev_t* __restrict a, cpu_dev_t* __restrict b);
+
+void cpu_dev_diff(void* ctx, void* __restrict prev, void* __restrict cur, double sample_size_sec);
+
+ret_t cpu_dev_sampler_init(sampler_t** s, sampler_publish_cb cb);
+
+#ifndef NDEBUG
+
+void test_cpu_dev(void);
+
+#endif
+
+/// model and topology of the processor, they don't change while running so it's parsed once
 typedef struct cpu_info {
     string* name;
-    string* clock;
+    // logical cpus
     u64 cores;
+    // distinct "physical id"/"core id" pairs, same as cores if cpuinfo doesn't tell
+    u64 physical_cores;
+    u64 sockets;
 } cpu_info_t;
 
 void cpu_info_release_cb(void* p);
 
+/// parses /proc/cpuinfo once, the result is meant to be kept until shutdown
 void cpu_info_get(cpu_info_t** cpu_info);
+
+#ifndef NDEBUG
+
+void test_cpu_info(void);
+
+#endif
@@ -16,6 +16,7 @@
 *************************************************************************************************************/
 
 #include <string.h>
+#include <pthread.h>
 #include "crc64.h"
 
 static const u64 crc64_tab[256] = {
@@ -149,7 +150,23 @@ static const u64 crc64_tab[256] = {
         UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-u64 crc64(u64 crc, const u8* s, u64 l) {
+// the same polynomial eight bytes at a time, crc64_slice[k][b] is crc64_tab[b] followed by k zero bytes
+static u64 crc64_slice[8][256];
+static pthread_once_t crc64_slice_once = PTHREAD_ONCE_INIT;
+
+static void crc64_slice_init(void) {
+    for (u64 b = 0; b < 256; ++b)
+        crc64_slice[0][b] = crc64_tab[b];
+
+    for (u64 k = 1; k < 8; ++k) {
+        for (u64 b = 0; b < 256; ++b) {
+            u64 prev = crc64_slice[k - 1][b];
+            crc64_slice[k][b] = crc64_tab[(u8)prev] ^ (prev >> 8);
+        }
+    }
+}
+
+u64 crc64_bytewise(u64 crc, const u8* s, u64 l) {
     u64 j;
 
     for (j = 0; j < l; j++) {
@@ -159,6 +176,31 @@ u64 crc64(u64 crc, const u8* s, u64 l) {
     return crc;
 }
 
+u64 crc64(u64 crc, const u8* s, u64 l) {
+    pthread_once(&crc64_slice_once, &crc64_slice_init);
+
+    // the polynomial is reflected, so a little endian word lines up with the low byte of the crc
+    while (l >= 8) {
+        u64 w;
+        memcpy(&w, s, sizeof(w));
+        w ^= crc;
+
+        crc = crc64_slice[7][(u8)w] ^
+              crc64_slice[6][(u8)(w >> 8)] ^
+              crc64_slice[5][(u8)(w >> 16)] ^
+              crc64_slice[4][(u8)(w >> 24)] ^
+              crc64_slice[3][(u8)(w >> 32)] ^
+              crc64_slice[2][(u8)(w >> 40)] ^
+              crc64_slice[1][(u8)(w >> 48)] ^
+              crc64_slice[0][(u8)(w >> 56)];
+
+        s += 8;
+        l -= 8;
+    }
+
+    return crc64_bytewise(crc, s, l);
+}
+
 u64 crc64s(const char* str) {
     u64 l = strlen(str);
     return crc64(0, (const u8*)str, l);
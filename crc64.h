@@ -23,7 +23,11 @@
 // CRC64
 //============================================================================================================
 
-
+/// CRC-64/Jones, reflected, 8 bytes per step (slice-by-8)
+/// only worth it where the CRC value itself is needed, hash.h has faster hashes for table keys
 u64 crc64(u64 crc, const u8* s, u64 l);
 
+/// the same CRC one byte per step, the reference for the tests and the bench
+u64 crc64_bytewise(u64 crc, const u8* s, u64 l);
+
 u64 crc64s(const char* str);
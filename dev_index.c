@@ -0,0 +1,208 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <stdio.h>
+#include <memory.h>
+#include "dev_index.h"
+#include "allocators.h"
+#include "hash.h"
+#include "log.h"
+
+#define DEV_INDEX_INITIAL_CAPACITY 64UL
+
+u64 dev_index_hash(const char* name, u64 len) {
+    return hash_bytes(name, len);
+}
+
+ret_t dev_index_init(dev_index_t** idx, dev_index_key_cb key, dev_index_name_cb name) {
+    *idx = zalloc(sizeof(dev_index_t));
+    dev_index_t* p = *idx;
+
+    p->key = key;
+    p->name = name;
+
+    return flat_map_init(&p->map, sizeof(void*), DEV_INDEX_INITIAL_CAPACITY);
+}
+
+void dev_index_release(dev_index_t* idx) {
+    if (!idx)
+        return;
+
+    flat_map_release(idx->map);
+    zfree(idx);
+}
+
+void dev_index_clear(dev_index_t* idx) {
+    flat_map_clear(idx->map);
+}
+
+static bool dev_index_match(dev_index_t* idx, void* dev, const char* name, u64 len) {
+    if (!idx->name)
+        return true;
+
+    string* s = idx->name(dev);
+
+    return string_size(s) == len && memcmp(string_cdata(s), name, len) == 0;
+}
+
+/// the key after @key in the chain of the devices whose hashes collide, hash_u64(0) is 0
+static inline u64 dev_index_next_key(u64 key) {
+    return hash_u64(key + 1);
+}
+
+void dev_index_put(dev_index_t* idx, void* dev) {
+    u64 key = idx->key(dev);
+    string* name = idx->name ? idx->name(dev) : NULL;
+    const char* data = name ? string_cdata(name) : NULL;
+    u64 len = name ? string_size(name) : 0;
+
+    // the same device of another snapshot takes its slot over
+    for (u64 i = 0; i <= flat_map_size(idx->map); ++i) {
+        void** slot = flat_map_get(idx->map, key);
+
+        if (!slot || dev_index_match(idx, *slot, data, len)) {
+            flat_map_put(idx->map, key, &dev);
+            return;
+        }
+
+        key = dev_index_next_key(key);
+    }
+
+    LOG_ERROR("no free key in the chain of %p", dev);
+}
+
+void* dev_index_get(dev_index_t* idx, u64 hash, const char* name, u64 len) {
+    u64 key = hash;
+
+    for (u64 i = 0; i <= flat_map_size(idx->map); ++i) {
+        void** dev = flat_map_get(idx->map, key);
+
+        if (!dev)
+            return NULL;
+
+        if (dev_index_match(idx, *dev, name, len))
+            return *dev;
+
+        key = dev_index_next_key(key);
+    }
+
+    return NULL;
+}
+
+void dev_index_build(dev_index_t* idx, list_t* devs) {
+    dev_index_clear(idx);
+
+    list_iter_t it;
+    list_iter_begin(devs, &it);
+
+    void* dev;
+    while ((dev = list_iter_next(&it)))
+        dev_index_put(idx, dev);
+}
+
+#ifndef NDEBUG
+
+typedef struct test_dev {
+    u64 hash;
+    u64 id;
+    string* name;
+} test_dev_t;
+
+static u64 test_dev_key(void* dev) {
+    return ((test_dev_t*)dev)->hash;
+}
+
+static string* test_dev_name(void* dev) {
+    return ((test_dev_t*)dev)->name;
+}
+
+#define TEST_DEV_GET(idx, dev) dev_index_get(idx, (dev)->hash, string_cdata((dev)->name), string_size((dev)->name))
+
+void test_dev_index(void) {
+    dev_index_t* idx = NULL;
+    dev_index_init(&idx, &test_dev_key, &test_dev_name);
+
+    char name[32];
+    test_dev_t devs[200];
+    for (u64 i = 0; i < 200; ++i) {
+        int len = snprintf(name, sizeof(name), "veth%lu", i);
+        string_create(&devs[i].name, name);
+        devs[i].hash = dev_index_hash(name, (u64)len);
+        devs[i].id = i;
+        dev_index_put(idx, &devs[i]);
+    }
+
+    ASSERT(flat_map_size(idx->map) == 200);
+    ASSERT(flat_map_capacity(idx->map) >= 250);
+
+    for (u64 i = 0; i < 200; ++i) {
+        test_dev_t* dev = TEST_DEV_GET(idx, &devs[i]);
+        ASSERT(dev && dev->id == i);
+    }
+
+    ASSERT(dev_index_get(idx, dev_index_hash("eth0", 4), "eth0", 4) == NULL);
+
+    // another name under the hash of veth3 is not veth3
+    ASSERT(dev_index_get(idx, devs[3].hash, "eth0", 4) == NULL);
+
+    // colliding hashes, veth0 stays where it is, the others chain on, the same name replaces its device
+    test_dev_t crafted[3];
+    for (u64 i = 0; i < 3; ++i) {
+        snprintf(name, sizeof(name), "crafted%lu", i);
+        string_create(&crafted[i].name, name);
+        crafted[i].hash = devs[0].hash;
+        crafted[i].id = 1000 + i;
+        dev_index_put(idx, &crafted[i]);
+    }
+
+    test_dev_t again = {devs[5].hash, 5000, devs[5].name};
+    dev_index_put(idx, &again);
+
+    ASSERT(flat_map_size(idx->map) == 203);
+    ASSERT(TEST_DEV_GET(idx, &devs[0]) == &devs[0]);
+    for (u64 i = 0; i < 3; ++i)
+        ASSERT(TEST_DEV_GET(idx, &crafted[i]) == &crafted[i]);
+    ASSERT(TEST_DEV_GET(idx, &devs[5]) == &again);
+    ASSERT(dev_index_get(idx, devs[0].hash, "crafted3", 8) == NULL);
+
+    // a clear drops everything and keeps the slots
+    u64 capacity = flat_map_capacity(idx->map);
+    dev_index_clear(idx);
+    ASSERT(flat_map_size(idx->map) == 0);
+    ASSERT(flat_map_capacity(idx->map) == capacity);
+    ASSERT(TEST_DEV_GET(idx, &devs[0]) == NULL);
+
+    dev_index_put(idx, &devs[7]);
+    ASSERT(TEST_DEV_GET(idx, &devs[7]) == &devs[7]);
+    ASSERT(TEST_DEV_GET(idx, &devs[8]) == NULL);
+
+    // exact keys aren't compared by name
+    dev_index_t* exact = NULL;
+    dev_index_init(&exact, &test_dev_key, NULL);
+    dev_index_put(exact, &devs[9]);
+    ASSERT(dev_index_get(exact, devs[9].hash, NULL, 0) == &devs[9]);
+    dev_index_release(exact);
+
+    for (u64 i = 0; i < 3; ++i)
+        string_release(crafted[i].name);
+    for (u64 i = 0; i < 200; ++i)
+        string_release(devs[i].name);
+
+    dev_index_release(idx);
+}
+
+#endif
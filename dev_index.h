@@ -0,0 +1,65 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+#include "string.h"
+#include "double_linked_list.h"
+#include "flat_map.h"
+
+//============================================================================================================
+// DEVICE INDEX
+//============================================================================================================
+
+/// Map from a device name hash to the device of the latest snapshot, a flat_map with the device pointer
+/// inline. It lives as long as the sampler context, a rebuild keeps the slots of the previous snapshot.
+/// A hash alone never joins two devices, the name is compared and the devices whose hashes collide are
+/// chained on through rehashed keys.
+
+typedef u64(* dev_index_key_cb)(void* dev);
+
+/// the name the key of @dev was hashed from, NULL for an index whose keys are exact (dev_t)
+typedef string*(* dev_index_name_cb)(void* dev);
+
+typedef struct dev_index {
+    flat_map_t* map;
+    dev_index_key_cb key;
+    dev_index_name_cb name;
+} dev_index_t;
+
+u64 dev_index_hash(const char* name, u64 len);
+
+ret_t dev_index_init(dev_index_t** idx, dev_index_key_cb key, dev_index_name_cb name);
+
+void dev_index_release(dev_index_t* idx);
+
+void dev_index_clear(dev_index_t* idx);
+
+void dev_index_put(dev_index_t* idx, void* dev);
+
+/// the device named @name of @len bytes, @hash is dev_index_hash of the name or the exact key
+void* dev_index_get(dev_index_t* idx, u64 hash, const char* name, u64 len);
+
+/// clears the index and puts every device of the list
+void dev_index_build(dev_index_t* idx, list_t* devs);
+
+#ifndef NDEBUG
+
+void test_dev_index(void);
+
+#endif
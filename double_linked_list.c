@@ -29,6 +29,10 @@ void list_iter_release(list_iter_t* it) {
     SAFE_RELEASE(it);
 }
 
+void list_iter_begin(list_t* l, list_iter_t* it) {
+    it->node = l->head;
+}
+
 void* list_iter_next(list_iter_t* it) {
     if (it->node == NULL)
         return NULL;
@@ -44,41 +48,131 @@ void list_init(list_t** l, data_release_cb cb) {
     (*l)->rel_cb = cb;
 }
 
+void list_init_arena(list_t** l, arena_t* arena, data_release_cb cb) {
+    if (!arena) {
+        list_init(l, cb);
+        return;
+    }
+
+    *l = arena_alloc(arena, sizeof(list_t));
+    (*l)->rel_cb = cb;
+    (*l)->arena = arena;
+}
+
+void list_init_pool(list_t** l, list_pool_t* pool, data_release_cb cb) {
+    list_init(l, cb);
+    (*l)->pool = pool;
+}
+
+void list_init_intrusive(list_t** l, arena_t* arena, data_release_cb cb) {
+    list_init_arena(l, arena, cb);
+    (*l)->intrusive = true;
+}
+
 void list_node_init(list_node_t** node) {
     *node = zalloc(sizeof(list_node_t));
 }
 
-void list_push(list_t* l, void* s) {
+//============================================================================================================
+// NODE POOL
+//============================================================================================================
 
-    if (!l->head) {
-        list_node_init(&l->head);
+void list_pool_init(list_pool_t** pool) {
+    *pool = zalloc(sizeof(list_pool_t));
+}
 
-        list_node_t* node = l->head;
+void list_pool_release(list_pool_t* pool) {
+    if (!pool)
+        return;
 
-        node->data = s;
+    list_node_t* block = pool->blocks;
+    while (block) {
+        list_node_t* next = block->next;
+        zfree(block);
+        block = next;
+    }
 
-        l->tail = l->head;
-    } else {
-        list_node_t* node = NULL;
-        list_node_init(&node);
-        node->data = s;
+    zfree(pool);
+}
+
+static list_node_t* list_pool_get(list_pool_t* pool) {
+    if (!pool->free) {
+        list_node_t* block = zalloc(LIST_POOL_BLOCK * sizeof(list_node_t));
 
-        list_node_t* tail = l->head;
-        while (tail->next) {
-            tail = tail->next;
+        block->next = pool->blocks;
+        pool->blocks = block;
+        ++pool->nblocks;
+
+        for (u64 i = 1; i < LIST_POOL_BLOCK; ++i) {
+            block[i].next = pool->free;
+            pool->free = &block[i];
         }
+    }
 
-        tail->next = node;
+    list_node_t* node = pool->free;
+    pool->free = node->next;
 
-        node->prev = tail;
+    return node;
+}
 
-        l->tail = node;
+static void list_pool_put(list_pool_t* pool, list_node_t* node) {
+    node->next = pool->free;
+    pool->free = node;
+}
 
-    }
+//============================================================================================================
+// LIST
+//============================================================================================================
+
+static list_node_t* list_node_alloc(list_t* l) {
+    if (l->arena)
+        return arena_alloc(l->arena, sizeof(list_node_t));
+
+    if (l->pool)
+        return list_pool_get(l->pool);
+
+    list_node_t* node = NULL;
+    list_node_init(&node);
+
+    return node;
+}
+
+static void list_node_free(list_t* l, list_node_t* node) {
+    if (l->intrusive || l->arena)
+        return;
 
+    if (l->pool)
+        list_pool_put(l->pool, node);
+    else
+        zfree(node);
+}
+
+static void list_link_tail(list_t* l, list_node_t* node, void* data) {
+    node->data = data;
+    node->next = NULL;
+    node->prev = l->tail;
+
+    if (l->tail)
+        l->tail->next = node;
+    else
+        l->head = node;
+
+    l->tail = node;
     ++l->size;
 }
 
+void list_push(list_t* l, void* s) {
+    ASSERT(!l->intrusive);
+
+    list_link_tail(l, list_node_alloc(l), s);
+}
+
+void list_push_node(list_t* l, list_node_t* node, void* data) {
+    ASSERT(l->intrusive);
+
+    list_link_tail(l, node, data);
+}
+
 void* list_pop_head(list_t* l) {
     if (l->size == 0)
         return NULL;
@@ -87,8 +181,13 @@ void* list_pop_head(list_t* l) {
     l->head = tmp->next;
     l->size--;
 
+    if (l->head)
+        l->head->prev = NULL;
+    else
+        l->tail = NULL;
+
     void* data = tmp->data;
-    zfree(tmp);
+    list_node_free(l, tmp);
 
     return data;
 }
@@ -101,8 +200,13 @@ void* list_crop_tail(list_t* l) {
     l->tail = tmp->prev;
     l->size--;
 
+    if (l->tail)
+        l->tail->next = NULL;
+    else
+        l->head = NULL;
+
     void* data = tmp->data;
-    zfree(tmp);
+    list_node_free(l, tmp);
 
     return data;
 }
@@ -116,20 +220,33 @@ ret_t list_release(list_t* l, bool release_data) {
 
         list_node_t* tmp = head;
 
-        if (release_data)
+        if (release_data && l->rel_cb)
             l->rel_cb(tmp->data);
 
         head = head->next;
 
-        zfree(tmp);
+        list_node_free(l, tmp);
     }
 
-    zfree(l);
+    if (!l->arena)
+        zfree(l);
 
     return ST_OK;
 
 }
 
+void list_release_cb(void* p) {
+    list_release((list_t*)p, true);
+}
+
+void list_arena_release_cb(void* p) {
+    list_t* l = (list_t*)p;
+    arena_t* arena = l->arena;
+
+    list_release(l, true);
+    arena_release(arena);
+}
+
 ret_t list_merge(list_t* __restrict a, list_t* __restrict b) {
     if (a->size == 0 && b->size == 0)
         return ST_ERR;
@@ -154,7 +271,7 @@ ret_t list_remove(list_t* l, const void* data) {
             hn->prev->next = hp;
             hp->next->prev = hn;
 
-            zfree(head);
+            list_node_free(l, head);
             --l->size;
 
             return ST_OK;
@@ -358,4 +475,66 @@ void test_list() {
     ASSERT(l2 == NULL);
 }
 
+typedef struct test_list_item {
+    u64 v;
+    list_node_t link;
+} test_list_item_t;
+
+void test_list_modes() {
+    test_list_item_t items[100];
+
+    // intrusive, nothing allocated beyond the list itself
+    list_t* l = NULL;
+    list_init_intrusive(&l, NULL, NULL);
+
+    for (u64 i = 0; i < 100; ++i) {
+        items[i].v = i;
+        list_push_node(l, &items[i].link, &items[i]);
+    }
+
+    ASSERT(l->size == 100 && l->head == &items[0].link && l->tail == &items[99].link);
+
+    list_iter_t it;
+    list_iter_begin(l, &it);
+
+    u64 n = 0;
+    test_list_item_t* item;
+    while ((item = list_iter_next(&it)))
+        ASSERT(item->v == n++);
+
+    ASSERT(n == 100);
+    ASSERT(list_pop_head(l) == &items[0] && l->head->prev == NULL);
+    ASSERT(list_crop_tail(l) == &items[99] && l->tail->next == NULL);
+
+    list_release(l, false);
+
+    // pooled, the nodes are recycled across the lists
+    list_pool_t* pool = NULL;
+    list_pool_init(&pool);
+
+    for (u64 round = 0; round < 4; ++round) {
+        list_init_pool(&l, pool, NULL);
+
+        for (u64 i = 0; i < 100; ++i)
+            list_push(l, &items[i]);
+
+        while (l->size > 50)
+            list_pop_head(l);
+
+        ASSERT(list_pop_head(l) == &items[50]);
+
+        list_release(l, false);
+    }
+
+    // 100 nodes take two blocks of 63
+    ASSERT(pool->nblocks == 2);
+
+    list_init_pool(&l, pool, NULL);
+    list_push(l, &items[0]);
+    ASSERT(list_pop_head(l) == &items[0] && l->head == NULL && l->tail == NULL);
+    list_release(l, false);
+
+    list_pool_release(pool);
+}
+
 #endif
@@ -22,6 +22,7 @@
 //============================================================================================================
 
 #include "globals.h"
+#include "arena.h"
 
 typedef struct list_node {
     void* data;
@@ -30,11 +31,33 @@ typedef struct list_node {
 
 } list_node_t;
 
+// nodes per pool block, the first one of a block links the blocks
+#define LIST_POOL_BLOCK 64
+
+/// recycles the nodes of the lists drawn from it, it's not thread safe
+typedef struct list_pool {
+    list_node_t* free;
+    list_node_t* blocks;
+    u64 nblocks;
+} list_pool_t;
+
+void list_pool_init(list_pool_t** pool);
+
+/// the lists drawn from the pool must be released before
+void list_pool_release(list_pool_t* pool);
+
 typedef struct list {
     list_node_t* head;
     list_node_t* tail;
     u64 size;
     data_release_cb rel_cb;
+    // the list and its nodes are drawn from it when set
+    arena_t* arena;
+    // the nodes are taken from it and given back to it when set
+    list_pool_t* pool;
+    // the nodes are embedded into the items, the list never allocates nor frees them
+    bool intrusive;
+    u8 reserved[7];
 
 } list_t;
 
@@ -46,20 +69,43 @@ void list_iter_init(list_t* l, list_iter_t** it);
 
 void list_iter_release(list_iter_t* it);
 
+/// for an iterator on the stack, nothing to release
+void list_iter_begin(list_t* l, list_iter_t* it);
+
 void* list_iter_next(list_iter_t* it);
 
 void list_init(list_t** l, data_release_cb cb);
 
+/// list_release only calls @cb (if any) on the items, the memory goes with the arena, NULL is the heap
+void list_init_arena(list_t** l, arena_t* arena, data_release_cb cb);
+
+/// nodes come from @pool and go back to it, NULL is the heap
+void list_init_pool(list_t** l, list_pool_t* pool, data_release_cb cb);
+
+/// the items carry their own node, see list_push_node, the list itself is drawn from @arena, NULL is the heap
+void list_init_intrusive(list_t** l, arena_t* arena, data_release_cb cb);
+
 void list_node_init(list_node_t** node);
 
+/// O(1), not for intrusive lists
 void list_push(list_t* l, void* s);
 
+/// links @node embedded into @data, intrusive lists only
+void list_push_node(list_t* l, list_node_t* node, void* data);
+
 void* list_pop_head(list_t* l);
 
 void* list_crop_tail(list_t* l);
 
 ret_t list_release(list_t* l, bool release_data);
 
+/// releases the list together with its data
+void list_release_cb(void* p);
+
+/// releases the arena of a list that was drawn from an arena of its own, and with it the list, the nodes
+/// and everything the items have taken from the same arena
+void list_arena_release_cb(void* p);
+
 ret_t list_merge(list_t* __restrict a, list_t* __restrict b);
 
 //TODO segfault
@@ -73,4 +119,6 @@ ret_t list_traverse(list_t* l, bool forward, list_traverse_cb cb);
 
 void test_list(void);
 
+void test_list_modes(void);
+
 #endif
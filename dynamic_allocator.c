@@ -24,6 +24,36 @@
 #define DA_TRACE(a) (LOG_TRACE("[0x%08lX] ptr=[0x%08lX] size=%lu used=%lu mul=%lu", \
 a, a->ptr, a->size, a->used, a->mul))
 
+static void* da_mem_alloc(dynamic_allocator_t* a, u64 size) {
+    return a->arena ? arena_alloc(a->arena, size) : zalloc(size);
+}
+
+static void da_mem_free(dynamic_allocator_t* a, void* p) {
+    if (!a->arena && p != a->small)
+        zfree(p);
+}
+
+/// a buffer of @size bytes that starts with the first MIN(size, a->size) bytes of the current one
+static char* da_mem_resize(dynamic_allocator_t* a, u64 size) {
+    bool small = a->ptr == a->small;
+
+    if (size <= DA_SMALL_SIZE) {
+        if (!small) {
+            memcpy(a->small, a->ptr, MIN(size, a->size));
+            da_mem_free(a, a->ptr);
+        }
+
+        return a->small;
+    }
+
+    if (small) {
+        char* p = da_mem_alloc(a, size);
+        memcpy(p, a->small, a->size);
+        return p;
+    }
+
+    return a->arena ? arena_realloc(a->arena, a->ptr, a->size, size) : zrealloc(a->ptr, size);
+}
 
 ret_t da_realloc(dynamic_allocator_t* a, u64 size) {
     if (a == NULL) {
@@ -38,13 +68,12 @@ ret_t da_realloc(dynamic_allocator_t* a, u64 size) {
     } else if (size < a->size || size == 0) {
         u64 ds = a->size - size;
         memset(a->ptr + size, 0, ds);
-        a->ptr = zrealloc(a->ptr, size);
+        a->ptr = da_mem_resize(a, size);
         a->size = size;
         a->used = size;
-        a->mul = 1;
     } else if (size > a->size) {
         u64 ds = size - a->size;
-        a->ptr = zrealloc(a->ptr, size);
+        a->ptr = da_mem_resize(a, size);
         memset(a->ptr + a->size, 0, ds);
         a->size = size;
     }
@@ -55,9 +84,9 @@ ret_t da_realloc(dynamic_allocator_t* a, u64 size) {
 ret_t da_init_n(dynamic_allocator_t** a, u64 size) {
     *a = zalloc(sizeof(dynamic_allocator_t));
 
-    (*a)->ptr = zalloc(size);
+    (*a)->ptr = size <= DA_SMALL_SIZE ? (*a)->small : zalloc(size);
     (*a)->size = size;
-    (*a)->mul = 1;
+    (*a)->mul = DA_GROWTH_MUL;
 
     LOG_TRACE("b a[0x%08lX] ptr=[0x%08lX] size=%lu used=%lu mul=%lu",
               (*a), (*a)->ptr, (*a)->size, (*a)->used, (*a)->mul);
@@ -65,6 +94,20 @@ ret_t da_init_n(dynamic_allocator_t** a, u64 size) {
     return ST_OK;
 }
 
+ret_t da_init_arena(dynamic_allocator_t** a, arena_t* arena, u64 size) {
+    if (!arena)
+        return da_init_n(a, size);
+
+    *a = arena_alloc(arena, sizeof(dynamic_allocator_t));
+
+    (*a)->arena = arena;
+    (*a)->ptr = size <= DA_SMALL_SIZE ? (*a)->small : arena_alloc(arena, size);
+    (*a)->size = size;
+    (*a)->mul = DA_GROWTH_MUL;
+
+    return ST_OK;
+}
+
 ret_t da_init(dynamic_allocator_t** a) {
 
     return da_init_n(a, STRING_INIT_BUFFER);
@@ -78,7 +121,10 @@ ret_t da_release(dynamic_allocator_t* a) {
         LOG_TRACE("a[0x%08lX] size=%lu used=%lu mul=%lu",
                   a->ptr, a->size, a->used, a->mul);
 
-        SAFE_RELEASE(a->ptr);
+        if (a->arena)
+            return ST_OK;
+
+        da_mem_free(a, a->ptr);
         SAFE_RELEASE(a);
     }
 
@@ -109,13 +155,11 @@ ret_t da_crop_tail(dynamic_allocator_t* a, u64 n) {
         return ST_OUT_OF_RANGE;
     }
 
+    // in place, the buffer is only shrunk afterwards
     u64 nsize = a->used - n;
-    char* newbuff = zalloc(nsize);
-    memcpy(newbuff, a->ptr + n, nsize);
-    zfree(a->ptr);
-    a->ptr = newbuff;
-    a->size = nsize;
-    a->used = a->size;
+    memmove(a->ptr, a->ptr + n, nsize);
+    da_realloc(a, nsize);
+    a->used = nsize;
 
     LOG_TRACE("e a[0x%08lX] ptr=[0x%08lX] size=%lu used=%lu mul=%lu",
               a, a->ptr, a->size, a->used, a->mul);
@@ -144,8 +188,9 @@ ret_t da_pop_head(dynamic_allocator_t* a, u64 n) {
 }
 
 ret_t da_check_size(dynamic_allocator_t* a, u64 new_size) {
+    // geometric, a string built by many small appends is copied O(log n) times
     if (a->size < a->used + new_size)
-        da_realloc(a, a->used + new_size);
+        da_realloc(a, MAX(a->used + new_size, a->size * a->mul));
 
     return ST_OK;
 }
@@ -388,5 +433,35 @@ void test_da() {
 
     da_release(df);
     df = NULL;
+
+#ifndef NDEBUG
+    // short contents stay inside the allocator, one allocation in all
+    u64 allocs = alloc_count();
+    CHECK_RETURN(da_init(&da));
+    CHECK_RETURN(da_append(da, "nvme0n1p1", 9));
+    ASSERT(da->ptr == da->small && alloc_count() == allocs + 1);
+
+    // past the inline buffer it moves to the heap and keeps doubling
+    CHECK_RETURN(da_append(da, "/sys/block/nvme0n1/", 19));
+    ASSERT(da->ptr != da->small && da_comparez(da, "nvme0n1p1/sys/block/nvme0n1/") == ST_OK);
+
+    u64 size = da->size;
+    while (da->size == size)
+        CHECK_RETURN(da_append(da, "x", 1));
+    ASSERT(da->size >= size * DA_GROWTH_MUL);
+
+    u64 used = da->used;
+    allocs = alloc_count();
+    for (u64 i = 0; i < 1000; ++i)
+        CHECK_RETURN(da_append(da, "x", 1));
+    ASSERT(alloc_count() - allocs < 10 && da->used == used + 1000);
+
+    // and it comes back once it fits again
+    CHECK_RETURN(da_crop_tail(da, da->used - 4));
+    ASSERT(da->ptr == da->small && da->used == 4 && da_comparez(da, "xxxx") == ST_OK);
+
+    da_release(da);
+    da = NULL;
+#endif
 }
 
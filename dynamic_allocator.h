@@ -22,12 +22,25 @@
 //============================================================================================================
 
 #include "globals.h"
+#include "arena.h"
 
+// up to this many bytes are kept inside the allocator itself, the whole thing is one cache line
+#define DA_SMALL_SIZE 24UL
+
+// a buffer that runs out of room grows at least by this factor
+#define DA_GROWTH_MUL 2UL
+
+/// @ptr points to @small as long as @size fits into it, so a short string is a single allocation
+/// and @ptr must not be kept across a resize or a copy of the allocator
 typedef struct dynamic_allocator {
     char* ptr;
     u64 size;
     u64 used;
+    // growth factor of da_check_size
     u64 mul;
+    // the buffer is drawn from it when set and only goes away with the arena
+    arena_t* arena;
+    char small[DA_SMALL_SIZE];
 
 } dynamic_allocator_t;
 
@@ -37,6 +50,9 @@ ret_t da_init_n(dynamic_allocator_t** a, u64 size);
 
 ret_t da_init(dynamic_allocator_t** a);
 
+/// the allocator and its buffer live in @arena, da_release leaves them to the arena, NULL is the heap
+ret_t da_init_arena(dynamic_allocator_t** a, arena_t* arena, u64 size);
+
 ret_t da_release(dynamic_allocator_t* a);
 
 ret_t da_fit(dynamic_allocator_t* a);
@@ -0,0 +1,319 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include "epoch.h"
+#include "allocators.h"
+#include "timer.h"
+#include "log.h"
+
+//============================================================================================================
+// EPOCH BASED RECLAMATION
+//============================================================================================================
+
+#define EPOCH_ACTIVE 1UL
+
+ret_t epoch_init(epoch_t** e) {
+    *e = zalloc(sizeof(epoch_t));
+    epoch_t* ep = *e;
+
+    atomic_init(&ep->global, 0);
+
+    for (u64 i = 0; i < EPOCH_MAX_READERS; ++i) {
+        atomic_init(&ep->readers[i].state, 0);
+        atomic_init(&ep->readers[i].used, 0);
+        ep->readers[i].owner = ep;
+    }
+
+    pthread_mutex_init(&ep->retire_mtx, NULL);
+
+    return ST_OK;
+}
+
+static void epoch_release_list(epoch_retired_t* r) {
+    while (r) {
+        epoch_retired_t* next = r->next;
+        r->rel_cb(r->p);
+        zfree(r);
+        r = next;
+    }
+}
+
+void epoch_release(epoch_t* e) {
+    if (!e)
+        return;
+
+    epoch_release_list(e->limbo);
+    pthread_mutex_destroy(&e->retire_mtx);
+    zfree(e);
+}
+
+static epoch_reader_t* epoch_claim(epoch_t* e, u64 hint) {
+    for (u64 n = 0; n < EPOCH_MAX_READERS; ++n) {
+        epoch_reader_t* r = &e->readers[(hint + n) & (EPOCH_MAX_READERS - 1)];
+        u64 expected = 0;
+
+        if (atomic_load_explicit(&r->used, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&r->used, &expected, 1))
+            return r;
+    }
+
+    return NULL;
+}
+
+ret_t epoch_register(epoch_t* e, epoch_reader_t** r) {
+    *r = epoch_claim(e, 0);
+
+    if (!*r) {
+        LOG_ERROR("too many epoch readers");
+        return ST_SIZE_EXCEED;
+    }
+
+    return ST_OK;
+}
+
+void epoch_enter(epoch_reader_t* r) {
+    // seq_cst: the announcement must be visible before any pointer load of the section
+    u64 g = atomic_load(&r->owner->global);
+    atomic_store(&r->state, (g << 1) | EPOCH_ACTIVE);
+}
+
+void epoch_exit(epoch_reader_t* r) {
+    atomic_store_explicit(&r->state, 0, memory_order_release);
+}
+
+epoch_reader_t* epoch_enter_transient(epoch_t* e, u64 hint) {
+    epoch_reader_t* r = epoch_claim(e, hint);
+
+    if (r)
+        epoch_enter(r);
+
+    return r;
+}
+
+void epoch_exit_transient(epoch_reader_t* r) {
+    epoch_exit(r);
+    atomic_store_explicit(&r->used, 0, memory_order_release);
+}
+
+/// under retire_mtx
+static bool epoch_try_advance(epoch_t* e) {
+    u64 g = atomic_load(&e->global);
+
+    // slots that were never claimed are just 0
+    for (u64 i = 0; i < EPOCH_MAX_READERS; ++i) {
+        u64 st = atomic_load(&e->readers[i].state);
+
+        if ((st & EPOCH_ACTIVE) && (st >> 1) != g)
+            return false;
+    }
+
+    return atomic_compare_exchange_strong(&e->global, &g, g + 1);
+}
+
+/// under retire_mtx, unlinks the retired pointers no reader can reach any more
+static epoch_retired_t* epoch_collect(epoch_t* e) {
+    u64 g = atomic_load(&e->global);
+    epoch_retired_t* freed = NULL;
+    epoch_retired_t** link = &e->limbo;
+
+    while (*link) {
+        epoch_retired_t* r = *link;
+
+        if (r->epoch + 2 <= g) {
+            *link = r->next;
+            r->next = freed;
+            freed = r;
+            --e->pending;
+        } else {
+            link = &r->next;
+        }
+    }
+
+    return freed;
+}
+
+void epoch_reclaim(epoch_t* e) {
+    pthread_mutex_lock(&e->retire_mtx);
+
+    epoch_try_advance(e);
+    epoch_retired_t* freed = epoch_collect(e);
+
+    pthread_mutex_unlock(&e->retire_mtx);
+
+    // release callbacks may be slow, they run without the lock
+    epoch_release_list(freed);
+}
+
+void epoch_retire(epoch_t* e, void* p, data_release_cb rel_cb) {
+    if (!p)
+        return;
+
+    epoch_retired_t* r = zalloc(sizeof(epoch_retired_t));
+    r->p = p;
+    r->rel_cb = rel_cb;
+
+    pthread_mutex_lock(&e->retire_mtx);
+
+    // read after @p has been unlinked by the caller
+    r->epoch = atomic_load(&e->global);
+    r->next = e->limbo;
+    e->limbo = r;
+    ++e->pending;
+
+    pthread_mutex_unlock(&e->retire_mtx);
+
+    epoch_reclaim(e);
+}
+
+u64 epoch_pending(epoch_t* e) {
+    pthread_mutex_lock(&e->retire_mtx);
+    u64 n = e->pending;
+    pthread_mutex_unlock(&e->retire_mtx);
+
+    return n;
+}
+
+//============================================================================================================
+// SNAPSHOT PUBLICATION
+//============================================================================================================
+
+static inline u64 snapshot_now_ns() {
+    struct timespec t = timer_start();
+    return (u64)t.tv_sec * 1000000000UL + (u64)t.tv_nsec;
+}
+
+void snapshot_init(snapshot_t* s) {
+    atomic_init(&s->ptr, NULL);
+    atomic_init(&s->published_ns, 0);
+    s->acquired_ns = 0;
+    s->rendered_ns = 0;
+}
+
+void* snapshot_publish(snapshot_t* s, void* p) {
+    // the stamp goes first, a reader that sees @p sees at least its stamp. It also tells publications
+    // apart, so it must never repeat
+    u64 prev = atomic_load(&s->published_ns);
+    u64 now = snapshot_now_ns();
+    atomic_store(&s->published_ns, now > prev ? now : prev + 1);
+    return atomic_exchange(&s->ptr, p);
+}
+
+void* snapshot_acquire(snapshot_t* s) {
+    void* p = atomic_load(&s->ptr);
+    s->acquired_ns = p ? atomic_load(&s->published_ns) : 0;
+
+    return p;
+}
+
+void snapshot_rendered(snapshot_t* s, snapshot_latency_t* lat) {
+    if (!s->acquired_ns || s->acquired_ns == s->rendered_ns)
+        return;
+
+    u64 now = snapshot_now_ns();
+    u64 ns = now > s->acquired_ns ? now - s->acquired_ns : 0;
+
+    s->rendered_ns = s->acquired_ns;
+
+    lat->last_ns = ns;
+    lat->total_ns += ns;
+    lat->max_ns = ns > lat->max_ns ? ns : lat->max_ns;
+    ++lat->samples;
+}
+
+//============================================================================================================
+// TESTS
+//============================================================================================================
+
+#ifndef NDEBUG
+
+static atomic_u64 test_epoch_released = 0;
+
+static void test_epoch_release_cb(void* p) {
+    atomic_fetch_add(&test_epoch_released, 1);
+    zfree(p);
+}
+
+void test_epoch(void) {
+    epoch_t* e = NULL;
+    epoch_reader_t* r = NULL;
+
+    CHECK_RETURN(epoch_init(&e));
+    CHECK_RETURN(epoch_register(e, &r));
+
+    snapshot_t s;
+    snapshot_init(&s);
+    snapshot_latency_t lat = {0};
+
+    ASSERT(snapshot_publish(&s, zalloc(sizeof(u64))) == NULL);
+
+    // a reader holds the first snapshot while the writer replaces it
+    epoch_enter(r);
+    u64* held = snapshot_acquire(&s);
+    ASSERT(held != NULL);
+
+    epoch_retire(e, snapshot_publish(&s, zalloc(sizeof(u64))), &test_epoch_release_cb);
+
+    for (int i = 0; i < 4; ++i)
+        epoch_reclaim(e);
+
+    ASSERT(atomic_load(&test_epoch_released) == 0);
+    ASSERT(epoch_pending(e) == 1);
+    *held = 42;
+
+    snapshot_rendered(&s, &lat);
+    epoch_exit(r);
+
+    for (int i = 0; i < 4; ++i)
+        epoch_reclaim(e);
+
+    ASSERT(atomic_load(&test_epoch_released) == 1);
+    ASSERT(epoch_pending(e) == 0);
+
+    // one sample per publication however many frames render it
+    epoch_enter(r);
+    ASSERT(snapshot_acquire(&s) != held);
+    snapshot_rendered(&s, &lat);
+    snapshot_rendered(&s, &lat);
+    epoch_exit(r);
+    ASSERT(lat.samples == 2);
+
+    // a transient reader holds a retired pointer back the same way and gives its slot back
+    epoch_reader_t* t = epoch_enter_transient(e, 5);
+    ASSERT(t && t != r);
+    epoch_retire(e, zalloc(sizeof(u64)), &test_epoch_release_cb);
+
+    for (int i = 0; i < 4; ++i)
+        epoch_reclaim(e);
+
+    ASSERT(atomic_load(&test_epoch_released) == 1);
+    epoch_exit_transient(t);
+
+    for (int i = 0; i < 4; ++i)
+        epoch_reclaim(e);
+
+    ASSERT(atomic_load(&test_epoch_released) == 2);
+    ASSERT(epoch_enter_transient(e, 5) == t);
+    epoch_exit_transient(t);
+
+    epoch_retire(e, snapshot_publish(&s, NULL), &test_epoch_release_cb);
+    epoch_release(e);
+
+    ASSERT(atomic_load(&test_epoch_released) == 3);
+    ASSERT(snapshot_acquire(&s) == NULL);
+}
+
+#endif
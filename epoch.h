@@ -0,0 +1,133 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include <pthread.h>
+
+#include "globals.h"
+
+//============================================================================================================
+// EPOCH BASED RECLAMATION
+//============================================================================================================
+
+/// Readers announce the global epoch they've entered with and never wait on anything. A retired
+/// pointer is tagged with the epoch it was retired in and is released once the global epoch has moved
+/// two steps past it: the epoch only moves when every reader inside a read section has seen the current
+/// one, so nobody can still hold a pointer that was unlinked before that.
+
+// a power of two
+#define EPOCH_MAX_READERS 64
+
+struct epoch;
+
+typedef struct epoch_reader {
+    // (epoch << 1) | 1 inside a read section, 0 outside
+    atomic_u64 state;
+    // claimed by a thread, for good or for one read section
+    atomic_u64 used;
+    struct epoch* owner;
+    // keeps every reader on its own cache line
+    u64 pad[5];
+} epoch_reader_t;
+
+typedef struct epoch_retired {
+    void* p;
+    data_release_cb rel_cb;
+    u64 epoch;
+    struct epoch_retired* next;
+} epoch_retired_t;
+
+typedef struct epoch {
+    atomic_u64 global;
+    epoch_reader_t readers[EPOCH_MAX_READERS];
+    // writers only, readers never touch it
+    pthread_mutex_t retire_mtx;
+    epoch_retired_t* limbo;
+    u64 pending;
+} epoch_t;
+
+ret_t epoch_init(epoch_t** e);
+
+/// releases everything still retired, no reader may be inside a read section
+void epoch_release(epoch_t* e);
+
+/// a reader slot per thread, they live as long as @e
+ret_t epoch_register(epoch_t* e, epoch_reader_t** r);
+
+/// read sections don't nest
+void epoch_enter(epoch_reader_t* r);
+
+void epoch_exit(epoch_reader_t* r);
+
+/// claims a free reader slot and enters it, for threads that aren't registered. The search starts from
+/// @hint so threads with different hints don't share a slot.
+/// \return NULL if every slot is taken
+epoch_reader_t* epoch_enter_transient(epoch_t* e, u64 hint);
+
+/// leaves the section and gives the slot back
+void epoch_exit_transient(epoch_reader_t* r);
+
+/// @rel_cb(@p) is called once no reader can see @p any more, from whichever writer reclaims it
+void epoch_retire(epoch_t* e, void* p, data_release_cb rel_cb);
+
+/// tries to move the epoch on and releases what has become unreachable
+void epoch_reclaim(epoch_t* e);
+
+/// retired pointers still waiting for the readers
+u64 epoch_pending(epoch_t* e);
+
+//============================================================================================================
+// SNAPSHOT PUBLICATION
+//============================================================================================================
+
+/// One immutable snapshot behind an atomic pointer. The writer swaps in a new one and retires the old one
+/// through an epoch_t, a reader takes the current one inside a read section. The reader also measures
+/// how long a published snapshot waits until it's rendered.
+
+typedef struct snapshot_latency {
+    u64 samples;
+    u64 total_ns;
+    u64 max_ns;
+    u64 last_ns;
+} snapshot_latency_t;
+
+typedef struct snapshot {
+    _Atomic(void*) ptr;
+    // CLOCK_MONOTONIC of the last publish
+    atomic_u64 published_ns;
+    // reader side, touched by a single reader only
+    u64 acquired_ns;
+    u64 rendered_ns;
+} snapshot_t;
+
+void snapshot_init(snapshot_t* s);
+
+/// \return the previous snapshot, it's up to the caller to retire it
+void* snapshot_publish(snapshot_t* s, void* p);
+
+/// only valid until the end of the enclosing read section
+void* snapshot_acquire(snapshot_t* s);
+
+/// accounts the snapshot last acquired from @s in @lat, once per publication
+void snapshot_rendered(snapshot_t* s, snapshot_latency_t* lat);
+
+#ifndef NDEBUG
+
+void test_epoch(void);
+
+#endif
@@ -0,0 +1,346 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "flat_map.h"
+#include "hash.h"
+#include "log.h"
+
+#define FLAT_MAP_MIN_CAPACITY 16UL
+
+// keys past 80% of the slots make the probe sequences grow fast
+#define FLAT_MAP_LOAD_NUM 4
+#define FLAT_MAP_LOAD_DEN 5
+
+#define FLAT_MAP_HEADER (2 * sizeof(u64))
+
+typedef struct flat_map_slot {
+    u64 key;
+    u64 dist;
+} flat_map_slot_t;
+
+static inline flat_map_slot_t* flat_map_slot(u8* slots, u64 slot_size, u64 i) {
+    return (flat_map_slot_t*)(void*)(slots + i * slot_size);
+}
+
+static inline void* flat_map_value(flat_map_slot_t* s) {
+    return (u8*)s + FLAT_MAP_HEADER;
+}
+
+ret_t flat_map_init(flat_map_t** m, u64 value_size, u64 capacity) {
+    u64 cap = FLAT_MAP_MIN_CAPACITY;
+    while (cap < capacity)
+        cap <<= 1;
+
+    flat_map_t* map = calloc(1, sizeof(flat_map_t));
+    if (!map) {
+        LOG_ERROR("can't alloc");
+        return ST_ERR;
+    }
+
+    map->capacity = cap;
+    map->value_size = value_size;
+    map->slot_size = FLAT_MAP_HEADER + ((value_size + 7) & ~7UL);
+    map->slots = calloc(cap, map->slot_size);
+    map->scratch = calloc(2, map->slot_size);
+
+    if (!map->slots || !map->scratch) {
+        flat_map_release(map);
+        LOG_ERROR("can't alloc");
+        return ST_ERR;
+    }
+
+    *m = map;
+
+    return ST_OK;
+}
+
+void flat_map_release(flat_map_t* m) {
+    if (!m)
+        return;
+
+    free(m->scratch);
+    free(m->slots);
+    free(m);
+}
+
+void flat_map_clear(flat_map_t* m) {
+    for (u64 i = 0; i < m->capacity; ++i)
+        flat_map_slot(m->slots, m->slot_size, i)->dist = 0;
+
+    m->size = 0;
+}
+
+/// @key must not be in the map, @carry is a whole slot and gets clobbered
+static void flat_map_insert(u8* slots, u64 capacity, u64 slot_size, u8* carry, u8* tmp) {
+    u64 mask = capacity - 1;
+    flat_map_slot_t* c = (flat_map_slot_t*)(void*)carry;
+    u64 i = hash_u64(c->key) & mask;
+    c->dist = 1;
+
+    while (true) {
+        flat_map_slot_t* s = flat_map_slot(slots, slot_size, i);
+
+        if (!s->dist) {
+            memcpy(s, carry, slot_size);
+            return;
+        }
+
+        // the one further from home keeps the slot, the other one goes on
+        if (s->dist < c->dist) {
+            memcpy(tmp, s, slot_size);
+            memcpy(s, carry, slot_size);
+            memcpy(carry, tmp, slot_size);
+        }
+
+        i = (i + 1) & mask;
+        ++c->dist;
+    }
+}
+
+static ret_t flat_map_grow(flat_map_t* m) {
+    u64 capacity = m->capacity * 2;
+    u8* slots = calloc(capacity, m->slot_size);
+    if (!slots) {
+        LOG_ERROR("can't alloc");
+        return ST_ERR;
+    }
+
+    u8* carry = m->scratch;
+    u8* tmp = m->scratch + m->slot_size;
+
+    for (u64 i = 0; i < m->capacity; ++i) {
+        flat_map_slot_t* s = flat_map_slot(m->slots, m->slot_size, i);
+        if (!s->dist)
+            continue;
+
+        memcpy(carry, s, m->slot_size);
+        flat_map_insert(slots, capacity, m->slot_size, carry, tmp);
+    }
+
+    free(m->slots);
+    m->slots = slots;
+    m->capacity = capacity;
+
+    return ST_OK;
+}
+
+static flat_map_slot_t* flat_map_find(flat_map_t* m, u64 key, u64* pos) {
+    u64 mask = m->capacity - 1;
+    u64 i = hash_u64(key) & mask;
+
+    for (u64 dist = 1;; ++dist) {
+        flat_map_slot_t* s = flat_map_slot(m->slots, m->slot_size, i);
+
+        // a key can't sit closer to home than any key it has been probed past
+        if (s->dist < dist)
+            return NULL;
+
+        if (s->key == key) {
+            *pos = i;
+            return s;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+ret_t flat_map_put(flat_map_t* m, u64 key, const void* value) {
+    u64 pos = 0;
+    flat_map_slot_t* s = flat_map_find(m, key, &pos);
+
+    if (!s) {
+        if ((m->size + 1) * FLAT_MAP_LOAD_DEN > m->capacity * FLAT_MAP_LOAD_NUM && flat_map_grow(m) != ST_OK)
+            return ST_ERR;
+
+        flat_map_slot_t* carry = (flat_map_slot_t*)(void*)m->scratch;
+        carry->key = key;
+
+        if (value)
+            memcpy(flat_map_value(carry), value, m->value_size);
+        else
+            memset(flat_map_value(carry), 0, m->value_size);
+
+        flat_map_insert(m->slots, m->capacity, m->slot_size, m->scratch, m->scratch + m->slot_size);
+        ++m->size;
+
+        return ST_OK;
+    }
+
+    if (value)
+        memcpy(flat_map_value(s), value, m->value_size);
+    else
+        memset(flat_map_value(s), 0, m->value_size);
+
+    return ST_OK;
+}
+
+void* flat_map_get(flat_map_t* m, u64 key) {
+    u64 pos = 0;
+    flat_map_slot_t* s = flat_map_find(m, key, &pos);
+
+    return s ? flat_map_value(s) : NULL;
+}
+
+ret_t flat_map_del(flat_map_t* m, u64 key) {
+    u64 i = 0;
+    flat_map_slot_t* s = flat_map_find(m, key, &i);
+    if (!s)
+        return ST_NOT_FOUND;
+
+    u64 mask = m->capacity - 1;
+
+    // shifts the rest of the cluster one slot back, no tombstones
+    while (true) {
+        flat_map_slot_t* next = flat_map_slot(m->slots, m->slot_size, (i + 1) & mask);
+
+        if (next->dist <= 1)
+            break;
+
+        memcpy(s, next, m->slot_size);
+        --s->dist;
+
+        s = next;
+        i = (i + 1) & mask;
+    }
+
+    s->dist = 0;
+    --m->size;
+
+    return ST_OK;
+}
+
+u64 flat_map_size(flat_map_t* m) {
+    return m->size;
+}
+
+u64 flat_map_capacity(flat_map_t* m) {
+    return m->capacity;
+}
+
+void flat_map_foreach(flat_map_t* m, flat_map_foreach_cb cb, void* ctx) {
+    for (u64 i = 0; i < m->capacity; ++i) {
+        flat_map_slot_t* s = flat_map_slot(m->slots, m->slot_size, i);
+
+        if (s->dist)
+            cb(s->key, flat_map_value(s), ctx);
+    }
+}
+
+ret_t flat_map_hist_dump_csv(flat_map_t* m, const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        char* err = strerror(errno);
+        LOG_ERROR("can't open the file %s, error=%s", filename, err);
+        return ST_ERR;
+    }
+
+    u64 max_dist = 0;
+    for (u64 i = 0; i < m->capacity; ++i) {
+        u64 dist = flat_map_slot(m->slots, m->slot_size, i)->dist;
+        max_dist = dist > max_dist ? dist : max_dist;
+    }
+
+    for (u64 d = 1; d <= max_dist; ++d) {
+        u64 n = 0;
+        for (u64 i = 0; i < m->capacity; ++i)
+            n += flat_map_slot(m->slots, m->slot_size, i)->dist == d;
+
+        fprintf(f, "%lu,%lu\n", d - 1, n);
+    }
+
+    fclose(f);
+
+    return ST_OK;
+}
+
+//============================================================================================================
+// TESTS
+//============================================================================================================
+
+#ifndef NDEBUG
+
+typedef struct test_flat_value {
+    u64 a;
+    u32 b;
+    u32 c;
+    u64 d;
+} test_flat_value_t;
+
+static void test_flat_map_sum_cb(u64 key, void* value, void* ctx) {
+    *(u64*)ctx += ((test_flat_value_t*)value)->a;
+}
+
+void test_flat_map(void) {
+    flat_map_t* m = NULL;
+    CHECK_RETURN(flat_map_init(&m, sizeof(test_flat_value_t), 4));
+    ASSERT(flat_map_capacity(m) == FLAT_MAP_MIN_CAPACITY);
+
+    // pointer-like keys, the low bits never change
+    const u64 n = 3000;
+    for (u64 i = 0; i < n; ++i) {
+        test_flat_value_t v = {i, (u32)i, 7, ~i};
+        CHECK_RETURN(flat_map_put(m, i << 4, &v));
+    }
+
+    ASSERT(flat_map_size(m) == n);
+    ASSERT(flat_map_size(m) * FLAT_MAP_LOAD_DEN <= flat_map_capacity(m) * FLAT_MAP_LOAD_NUM);
+
+    for (u64 i = 0; i < n; ++i) {
+        test_flat_value_t* v = flat_map_get(m, i << 4);
+        ASSERT(v && v->a == i && v->b == (u32)i && v->c == 7 && v->d == ~i);
+    }
+
+    ASSERT(flat_map_get(m, 1) == NULL);
+
+    // overwrite in place
+    CHECK_RETURN(flat_map_put(m, 0, NULL));
+    ASSERT(flat_map_size(m) == n);
+    ASSERT(((test_flat_value_t*)flat_map_get(m, 0))->d == 0);
+
+    for (u64 i = 0; i < n; i += 3)
+        ASSERT(flat_map_del(m, i << 4) == ST_OK);
+
+    ASSERT(flat_map_del(m, 0) == ST_NOT_FOUND);
+
+    u64 sum = 0;
+    u64 expected = 0;
+    for (u64 i = 0; i < n; ++i) {
+        bool present = i % 3 != 0;
+        ASSERT((flat_map_get(m, i << 4) != NULL) == present);
+
+        if (present)
+            expected += i;
+    }
+
+    flat_map_foreach(m, &test_flat_map_sum_cb, &sum);
+    ASSERT(sum == expected);
+
+    u64 capacity = flat_map_capacity(m);
+    flat_map_clear(m);
+    ASSERT(flat_map_size(m) == 0);
+    ASSERT(flat_map_capacity(m) == capacity);
+    ASSERT(flat_map_get(m, 8 << 4) == NULL);
+
+    flat_map_release(m);
+}
+
+#endif
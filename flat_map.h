@@ -0,0 +1,73 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// FLAT MAP
+//============================================================================================================
+
+/// Open addressing map from u64 keys to fixed size values stored inline in the slots, Robin Hood probing
+/// with backward shift deletion. One array for everything, nothing is allocated per entry.
+/// It isn't thread safe, and it allocates with calloc so the allocator tracker can sit on top of it.
+
+typedef struct flat_map {
+    // capacity slots of slot_size bytes: key, probe distance + 1 (0 is empty), value
+    u8* slots;
+    // swap space for two slots
+    u8* scratch;
+    u64 capacity;
+    u64 size;
+    u64 value_size;
+    u64 slot_size;
+} flat_map_t;
+
+typedef void(* flat_map_foreach_cb)(u64 key, void* value, void* ctx);
+
+/// \param value_size bytes kept inline for every key
+/// \param capacity initial number of slots, rounded up to a power of two
+ret_t flat_map_init(flat_map_t** m, u64 value_size, u64 capacity);
+
+void flat_map_release(flat_map_t* m);
+
+/// drops every entry and keeps the capacity
+void flat_map_clear(flat_map_t* m);
+
+/// inserts or overwrites, a NULL @value zeroes the inline value
+ret_t flat_map_put(flat_map_t* m, u64 key, const void* value);
+
+/// \return the inline value, valid until the next put or del
+void* flat_map_get(flat_map_t* m, u64 key);
+
+ret_t flat_map_del(flat_map_t* m, u64 key);
+
+u64 flat_map_size(flat_map_t* m);
+
+u64 flat_map_capacity(flat_map_t* m);
+
+void flat_map_foreach(flat_map_t* m, flat_map_foreach_cb cb, void* ctx);
+
+/// probe distance histogram: distance,number of keys
+ret_t flat_map_hist_dump_csv(flat_map_t* m, const char* filename);
+
+#ifndef NDEBUG
+
+void test_flat_map(void);
+
+#endif
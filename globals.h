@@ -46,6 +46,9 @@
 #define MiB 1048576UL
 #define GiB 1073741824UL
 
+// what the shared counters are padded to so the threads don't contend on a line
+#define CACHE_LINE_SIZE 64
+
 
 //global return codes
 enum {
@@ -0,0 +1,127 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hash.h"
+#include "crc64.h"
+#include "log.h"
+
+// 2^64 / golden ratio
+#define HASH_SEED 0x9E3779B97F4A7C15UL
+#define HASH_MUL 0xff51afd7ed558ccdUL
+
+/// one word in, the multiply carries it up and the shift brings the high half back down
+static inline u64 hash_step(u64 h, u64 w) {
+    h = (h ^ w) * HASH_MUL;
+    return h ^ (h >> 32);
+}
+
+static inline u64 hash_load64(const u8* s) {
+    u64 w;
+    memcpy(&w, s, sizeof(w));
+    return w;
+}
+
+static inline u64 hash_load32(const u8* s) {
+    u32 w;
+    memcpy(&w, s, sizeof(w));
+    return w;
+}
+
+u64 hash_bytes(const void* p, u64 len) {
+    const u8* s = (const u8*)p;
+    u64 h = HASH_SEED ^ len;
+
+    // the tail is the last word read again from the end, overlapping bytes are fine since len is in the seed
+    if (len > 8) {
+        const u8* last = s + len - 8;
+        for (; s < last; s += 8)
+            h = hash_step(h, hash_load64(s));
+
+        return hash_u64(hash_step(h, hash_load64(last)));
+    }
+
+    u64 w = 0;
+    if (len >= 4)
+        w = hash_load32(s) | hash_load32(s + len - 4) << 32;
+    else if (len)
+        w = (u64)s[0] << 16 | (u64)s[len / 2] << 8 | s[len - 1];
+
+    return hash_u64(hash_step(h, w));
+}
+
+u64 hash_str(const char* str) {
+    return hash_bytes(str, strlen(str));
+}
+
+//============================================================================================================
+// TESTS
+//============================================================================================================
+
+#ifndef NDEBUG
+
+void test_hash(void) {
+    // the CRC-64/Jones check value
+    ASSERT(crc64(0, (const u8*)"123456789", 9) == 0xe9c6d914c4b8d9caUL);
+    ASSERT(crc64_bytewise(0, (const u8*)"123456789", 9) == 0xe9c6d914c4b8d9caUL);
+
+    // slice-by-8 against the bytewise loop at every alignment and every tail length
+    u8 buf[80];
+    for (u64 i = 0; i < sizeof(buf); ++i)
+        buf[i] = (u8)(i * 37 + 11);
+
+    for (u64 off = 0; off < 8; ++off) {
+        for (u64 len = 0; len + off <= sizeof(buf); ++len) {
+            ASSERT(crc64(0, buf + off, len) == crc64_bytewise(0, buf + off, len));
+            // and it can be continued in pieces
+            ASSERT(crc64(crc64(0, buf + off, len / 2), buf + off + len / 2, len - len / 2) ==
+                   crc64_bytewise(0, buf + off, len));
+        }
+    }
+
+    ASSERT(hash_str("sda") == hash_bytes("sda", 3));
+    ASSERT(hash_str("sda") != hash_str("sdb"));
+    ASSERT(hash_str("nvme0n1p1") != hash_str("nvme0n1p2"));
+    // the length is part of the hash, zero padding of the tail can't make two keys equal
+    ASSERT(hash_bytes("a\0", 2) != hash_bytes("a", 1));
+    ASSERT(hash_bytes("", 0) != hash_bytes("\0", 1));
+
+    // sequential and aligned keys spread over the low bits
+    u64 buckets[256];
+    memset(buckets, 0, sizeof(buckets));
+
+    for (u64 i = 0; i < 256 * 64; ++i)
+        ++buckets[hash_u64(i * 64) & 255];
+
+    for (u64 i = 0; i < 256; ++i)
+        ASSERT(buckets[i] > 32 && buckets[i] < 96);
+
+    memset(buckets, 0, sizeof(buckets));
+
+    char name[16];
+    for (u64 i = 0; i < 256 * 64; ++i) {
+        snprintf(name, sizeof(name), "sd%lu", i);
+        ++buckets[hash_str(name) & 255];
+    }
+
+    for (u64 i = 0; i < 256; ++i)
+        ASSERT(buckets[i] > 32 && buckets[i] < 96);
+}
+
+#endif
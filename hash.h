@@ -0,0 +1,54 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// HASH
+//============================================================================================================
+
+/// Hash kernels for table keys. None of them is stable across versions, nothing may be persisted.
+///
+/// hash_u64 is the murmur3 finalizer, a handful of cycles for integer and pointer keys.
+/// hash_bytes eats a word at a time and ends with the same finalizer, for names and other short keys.
+/// crc64 (crc64.h) is only for the places that need the CRC value itself.
+
+typedef u64(* hash_bytes_fn)(const void* p, u64 len);
+
+/// every bit of @key affects every bit of the result, low bits of aligned pointers included
+static inline u64 hash_u64(u64 key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53UL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+u64 hash_bytes(const void* p, u64 len);
+
+/// hash_bytes of a NUL terminated string
+u64 hash_str(const char* str);
+
+#ifndef NDEBUG
+
+void test_hash(void);
+
+#endif
@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <locale.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "globals.h"
 #include "log.h"
@@ -38,6 +40,11 @@
 #include "utils.h"
 #include "mem_dev.h"
 #include "cpu_dev.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "epoch.h"
+#include "mpsc_queue.h"
+#include "bench.h"
 
 
 //============================================================================================================
@@ -45,19 +52,21 @@
 //============================================================================================================
 
 static atomic_bool programm_exit = false;
-static list_t* ldevices = NULL;
-static pthread_mutex_t ldevices_mtx;
 
-static list_t* lnet_devs = NULL;
-static pthread_mutex_t lnet_devs_mtx;
+// immutable snapshots published by the sampling thread, the UI reads them inside an epoch read section
+static epoch_t* g_epoch = NULL;
+static snapshot_t g_blk_devs;
+static snapshot_t g_net_devs;
+static snapshot_t g_cpu_info;
+static snapshot_t g_mem_info;
+static snapshot_t g_cpu_dev;
 
-static cpu_info_t* g_cpu_info = NULL;
-static pthread_mutex_t cpu_info_mtx;
-
-static mem_info_t* g_mem_info = NULL;
-static pthread_mutex_t mem_info_mtx;
+// UI thread only
+static snapshot_latency_t g_render_latency;
 
 static atomic_u64 sample_rate_mul = 100;
+
+static scheduler_t* g_scheduler = NULL;
 static atomic_u64 cpu_usage = 0;
 
 static u64 g_nframe = 0;
@@ -66,6 +75,49 @@ static inline double device_get_sample_rate() {
     return DEVICE_BASE_SAMPLE_RATE * atomic_load(&sample_rate_mul);
 }
 
+static inline u64 device_get_sample_period_ns() {
+    return (u64)(device_get_sample_rate() * NANOSEC_IN_SEC);
+}
+
+//============================================================================================================
+// UI EVENTS
+//============================================================================================================
+
+// the sampling and the keypad threads post to the UI thread, which drains the queue after every wait
+#define UI_EVENTS_CAPACITY 256
+#define UI_EVENT_TYPE_SHIFT 32
+#define UI_EVENT_ARG_MASK 0xFFFFFFFFUL
+
+enum {
+    // a scheduler tick has published its samples, the arg is the tick
+    UI_EVENT_SAMPLE = 1,
+    // the arg is the curses key code
+    UI_EVENT_KEY
+};
+
+static mpsc_queue_t* g_ui_events = NULL;
+// rung after a post so the UI draws right after a tick instead of on a clock of its own
+static int g_ui_wake_fd = -1;
+
+static void ui_post(u64 type, u64 arg) {
+    // a full queue drops the event, the frame timeout still catches up
+    if (!mpsc_push(g_ui_events, (type << UI_EVENT_TYPE_SHIFT) | (arg & UI_EVENT_ARG_MASK)))
+        return;
+
+    u64 one = 1;
+    if (write(g_ui_wake_fd, &one, sizeof(one)) < 0)
+        LOG_DEBUG("can't wake up the UI");
+}
+
+/// the UI thread only, returns on a post, on the scheduler stop or after @timeout_ns
+static void ui_wait(u64 timeout_ns) {
+    scheduler_wait_fd(g_scheduler, g_ui_wake_fd, timeout_ns);
+
+    u64 n;
+    if (read(g_ui_wake_fd, &n, sizeof(n)) < 0)
+        LOG_DEBUG("no post, the wait has timed out or the scheduler has stopped");
+}
+
 //============================================================================================================
 // GUI
 //============================================================================================================
@@ -87,41 +139,78 @@ static inline double device_get_sample_rate() {
 #define COLON_MOUNT (75 + COLON_OFFSET)
 #define COLON_MODEL (83 + COLON_OFFSET)
 
+#define COLON_IO_NAME (COLON_DEVICE)
+#define COLON_IO_RPS (COLON_READ)
+#define COLON_IO_WPS (19 + COLON_OFFSET)
+#define COLON_IO_RMERGE (28 + COLON_OFFSET)
+#define COLON_IO_WMERGE (37 + COLON_OFFSET)
+#define COLON_IO_RAWAIT (46 + COLON_OFFSET)
+#define COLON_IO_WAWAIT (55 + COLON_OFFSET)
+#define COLON_IO_AQU (64 + COLON_OFFSET)
+#define COLON_IO_UTIL (73 + COLON_OFFSET)
+
 #define COLON_NET_NAME (COLON_DEVICE)
 #define COLON_NET_READ (COLON_READ)
 #define COLON_NET_WRITE (COLON_WRITE)
 #define COLON_NET_MTU (COLON_PERC-3)
 #define COLON_NET_SPEED (COLON_USE-3)
 #define COLON_NET_PERC (COLON_SIZE)
+#define COLON_NET_RX_PKTS (63 + COLON_OFFSET)
+#define COLON_NET_TX_PKTS (72 + COLON_OFFSET)
+#define COLON_NET_ERRS (81 + COLON_OFFSET)
+#define COLON_NET_DROPS (88 + COLON_OFFSET)
+#define COLON_NET_FIFO (95 + COLON_OFFSET)
+#define COLON_NET_CARRIER (102 + COLON_OFFSET)
+#define COLON_NET_QUEUE (3 + COLON_OFFSET)
+
+// wgetch gives up after it so the keypad thread sees the exit
+#define KEYPAD_POLL_MS 100
 
 static void* ncurses_keypad(void* p) {
     int c;
-    while (true) {
+    while (!atomic_load(&programm_exit)) {
         c = wgetch(stdscr);
         switch (c) {
+            case ERR:
+                break;
             case KEY_F(10):
                 atomic_store(&programm_exit, true);
+                scheduler_stop(g_scheduler);
                 return p;
-            case KEY_UP:
-                atomic_fetch_add(&sample_rate_mul, 1);
+            default:
+                ui_post(UI_EVENT_KEY, (u64)c);
                 break;
-            case KEY_DOWN: {
-                while (true) {
-                    u64 mul = atomic_load(&sample_rate_mul);
-                    if (mul > 1) {
-                        if (atomic_compare_exchange_strong(&sample_rate_mul, &mul, mul - 1))
-                            break;
-                    } else {
-                        break;
-                    }
-                }
+        }
+    }
 
-                break;
+    return p;
+}
+
+/// the UI thread is the only writer of the sample rate
+static void ncurses_key(int c) {
+    switch (c) {
+        case KEY_UP:
+            atomic_fetch_add(&sample_rate_mul, 1);
+            scheduler_set_tick(g_scheduler, device_get_sample_period_ns());
+            break;
+        case KEY_DOWN:
+            if (atomic_load(&sample_rate_mul) > 1) {
+                atomic_fetch_sub(&sample_rate_mul, 1);
+                scheduler_set_tick(g_scheduler, device_get_sample_period_ns());
             }
+            break;
+        default:
+            break;
+    }
+}
 
-            default:
-                break;
-        }
+static void ncurses_events() {
+    u64 ev;
+    while (mpsc_pop(g_ui_events, &ev)) {
+        if (ev >> UI_EVENT_TYPE_SHIFT == UI_EVENT_KEY)
+            ncurses_key((int)(ev & UI_EVENT_ARG_MASK));
+
+        // a new sample needs nothing but the next frame
     }
 }
 
@@ -325,7 +414,59 @@ static void ncurses_bar_render(int row, int col, int64_t progress) {
     zfree(rbar);
 }
 
-static void ncurses_cpu_bar_render(int row, int col) {
+static void ncurses_addstrf(int row, int col, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    char buf[2048];
+    memset(buf, 0, 2048);
+    vsnprintf(buf, 2048, fmt, args);
+
+    va_end(args);
+
+    mvaddstr(row, col, buf);
+}
+
+// width of a core cell: "127 [❯❯❯❯❯❯❯❯❯❯] "
+#define CPU_CORE_BAR_WIDTH 10
+#define CPU_CORE_CELL_WIDTH (4 + 2 + CPU_CORE_BAR_WIDTH + 1)
+
+static void ncurses_core_bar_render(int row, int col, u64 id, double usage) {
+    // a bar of "❯", 3 bytes each
+    static const char bar[] = "❯❯❯❯❯❯❯❯❯❯";
+    const int lit = (int)(sizeof(bar) - 1) / CPU_CORE_BAR_WIDTH;
+
+    int fill = (int)(usage * CPU_CORE_BAR_WIDTH + 0.5);
+    fill = MAX(0, MIN(fill, CPU_CORE_BAR_WIDTH));
+
+    // same thresholds as ncurses_bar_render: 60% green, 30% yellow, 10% red
+    int green = MIN(fill, 6);
+    int yellow = MIN(fill - green, 3);
+    int red = fill - green - yellow;
+
+    char id_s[8];
+    snprintf(id_s, sizeof(id_s), "%3lu", id);
+    mvaddstr(row, col, id_s);
+    mvaddstr(row, col + 4, "[");
+
+    attron(COLOR_PAIR(NCOLOR_PAIR_GREEN_ON_BLACK));
+    mvaddnstr(row, col + 5, bar, green * lit);
+    attroff(COLOR_PAIR(NCOLOR_PAIR_GREEN_ON_BLACK));
+
+    attron(COLOR_PAIR(NCOLOR_PAIR_YELLOW_ON_BLACK));
+    mvaddnstr(row, col + 5 + green, bar, yellow * lit);
+    attroff(COLOR_PAIR(NCOLOR_PAIR_YELLOW_ON_BLACK));
+
+    attron(COLOR_PAIR(NCOLOR_PAIR_RED_ON_BLACK));
+    mvaddnstr(row, col + 5 + green + yellow, bar, red * lit);
+    attroff(COLOR_PAIR(NCOLOR_PAIR_RED_ON_BLACK));
+
+    mvaddstr(row, col + 5 + CPU_CORE_BAR_WIDTH, "]");
+}
+
+/// the aggregate bar and a grid of per-core bars that wraps to the screen width
+/// \return the next free row
+static int ncurses_cpu_bar_render(int row, int col) {
 
     ulong cpus = atomic_load(&cpu_usage);
     int64_t cu = (int64_t)cpus / 2;
@@ -336,21 +477,37 @@ static void ncurses_cpu_bar_render(int row, int col) {
     sprintf(load_s, "%02lu%% CPU", cpus);
     mvaddstr(row, col + 53, load_s);
 
-}
+    ++row;
 
-static void ncurses_addstrf(int row, int col, const char* fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+    cpu_dev_t* cpu = snapshot_acquire(&g_cpu_dev);
 
-    char buf[2048];
-    memset(buf, 0, 2048);
-    vsnprintf(buf, 2048, fmt, args);
+    if (cpu && cpu->rows > 1) {
 
-    va_end(args);
+        ncurses_addstrf(row++, col, "user %.1f%%  system %.1f%%  iowait %.1f%%  steal %.1f%%",
+                        cpu->user[0] * 100.0, cpu->system[0] * 100.0,
+                        cpu->iowait[0] * 100.0, cpu->steal[0] * 100.0);
 
-    mvaddstr(row, col, buf);
+        int per_row = MAX(1, (COLS - col) / CPU_CORE_CELL_WIDTH);
+        int cell = 0;
+
+        attron(COLOR_PAIR(NCOLOR_PAIR_WHITE_ON_BLACK));
+
+        for (u64 i = 1; i < cpu->rows; ++i) {
+            ncurses_core_bar_render(row + cell / per_row, col + (cell % per_row) * CPU_CORE_CELL_WIDTH,
+                                    cpu->id[i], cpu->usage[i]);
+            ++cell;
+        }
+
+        attroff(COLOR_PAIR(NCOLOR_PAIR_WHITE_ON_BLACK));
+
+        row += (cell + per_row - 1) / per_row;
+    }
+
+    return row;
 }
 
+#define UI_FRAME_TIMEOUT_PERIODS 2
+
 static void ncurses_window() {
     initscr();            /* Start curses mode 		  */
 
@@ -365,11 +522,17 @@ static void ncurses_window() {
     noecho();
     start_color();
     curs_set(0); //invisible cursor
+    wtimeout(stdscr, KEYPAD_POLL_MS);
 
     pthread_t keypad__thrd;
     pthread_create(&keypad__thrd, NULL, &ncurses_keypad, NULL);
     pthread_setname_np(keypad__thrd, "keypad");
-    pthread_detach(keypad__thrd);
+
+    epoch_reader_t* reader = NULL;
+    if (epoch_register(g_epoch, &reader) != ST_OK) {
+        endwin();
+        exit(EXIT_FAILURE);
+    }
 
     init_pair(NCOLOR_PAIR_WHITE_ON_BLACK, COLOR_WHITE, COLOR_BLACK);
     init_pair(NCOLOR_PAIR_GREEN_ON_BLACK, COLOR_GREEN, COLOR_BLACK);
@@ -409,60 +572,74 @@ static void ncurses_window() {
         ncurses_addstrf(row++, 1, "Frame time: %.3f ms", frame_time);
         ncurses_addstrf(row++, 1, "FPS: %.2f", (1000.0 / frame_time));
 
+        if (g_render_latency.samples)
+            ncurses_addstrf(row++, 1, "Publish to render: %.3f ms avg, %.3f ms max",
+                            (double)g_render_latency.total_ns / (double)g_render_latency.samples / NANOSEC_IN_MILLISEC,
+                            (double)g_render_latency.max_ns / NANOSEC_IN_MILLISEC);
+        else
+            row++;
+
         row++;
         mvaddstr(row++, 1,
                  "_______________________________________________________________________________________________");
         row++;
 
-        pthread_mutex_lock(&cpu_info_mtx);
+        // snapshots acquired from here on stay valid until epoch_exit
+        epoch_enter(reader);
+
+        cpu_info_t* cpu_info = snapshot_acquire(&g_cpu_info);
 
-        if (g_cpu_info) {
+        if (cpu_info) {
 
-            char* cpu_name = string_makez(g_cpu_info->name);
-            char* cpu_clock = string_makez(g_cpu_info->clock);
+            char* cpu_name = string_makez(cpu_info->name);
 
-            ncurses_addstrf(row++, 1, "%dx %s (%s MHz)", g_cpu_info->cores, cpu_name, cpu_clock);
+            ncurses_addstrf(row++, 1, "%lux %s (%lu cores, %lu sockets)", cpu_info->cores, cpu_name,
+                            cpu_info->physical_cores, cpu_info->sockets);
 
-            zfree(cpu_clock);
             zfree(cpu_name);
         }
 
-        pthread_mutex_unlock(&cpu_info_mtx);
+        cpu_dev_t* cpu_clock = snapshot_acquire(&g_cpu_dev);
+
+        if (cpu_clock && cpu_clock->mhz_max > 0.0)
+            ncurses_addstrf(row++, 1, "%.0f / %.0f / %.0f MHz min/avg/max", cpu_clock->mhz_min,
+                            cpu_clock->mhz_avg, cpu_clock->mhz_max);
 
         row++;
 
         attroff(COLOR_PAIR(NCOLOR_PAIR_WHITE_ON_BLACK));
-        ncurses_cpu_bar_render(row++, 1);
+        row = ncurses_cpu_bar_render(row, 1);
         attron(COLOR_PAIR(NCOLOR_PAIR_WHITE_ON_BLACK));
 
-        pthread_mutex_lock(&mem_info_mtx);
+        mem_info_t* mem_info = snapshot_acquire(&g_mem_info);
 
-        if (g_mem_info) {
+        if (mem_info) {
 
-            double mem_load_perc = 100.0 - g_mem_info->mem_free / (double)g_mem_info->mem_total * 100.0;
+            double mem_load_perc = 100.0 - mem_info->mem_free / (double)mem_info->mem_total * 100.0;
             int64_t mem_load = (int64_t)(mem_load_perc / 2.0);
 
             ncurses_bar_render(row, 1, mem_load);
-            u64 mem_total = g_mem_info->mem_total / 1024 / 1024;
-            u64 mem_used = (g_mem_info->mem_total - g_mem_info->mem_free) / 1024 / 1024;
+            u64 mem_total = mem_info->mem_total / 1024 / 1024;
+            u64 mem_used = (mem_info->mem_total - mem_info->mem_free) / 1024 / 1024;
             char load_s[64];
             sprintf(load_s, "%02lu%% Memory [%lu/%lu Mb]", (ulong)mem_load_perc, mem_used, mem_total);
             mvaddstr(row++, 54, load_s);
 
-            double swap_load_perc = 100.0 - g_mem_info->swap_free / (double)g_mem_info->swap_total * 100.0;
+            // no swap at all would be 0/0, the NaN bar never stops drawing
+            double swap_load_perc = mem_info->swap_total
+                                    ? 100.0 - mem_info->swap_free / (double)mem_info->swap_total * 100.0
+                                    : 0.0;
             int64_t swap_load = (int64_t)(swap_load_perc / 2.0);
 
             ncurses_bar_render(row, 1, swap_load);
-            u64 swap_total = g_mem_info->swap_total / 1024 / 1024;
-            u64 swap_used = (g_mem_info->swap_total - g_mem_info->swap_free) / 1024 / 1024;
+            u64 swap_total = mem_info->swap_total / 1024 / 1024;
+            u64 swap_used = (mem_info->swap_total - mem_info->swap_free) / 1024 / 1024;
             char sload_s[64];
             sprintf(sload_s, "%02lu%% Swap   [%lu/%lu Mb]", (ulong)swap_load_perc, swap_used, swap_total);
             mvaddstr(row++, 54, sload_s);
 
         }
 
-        pthread_mutex_unlock(&mem_info_mtx);
-
         mvaddstr(row++, 1,
                  "_______________________________________________________________________________________________");
 
@@ -479,14 +656,14 @@ static void ncurses_window() {
         attroff(COLOR_PAIR(NCOLOR_PAIR_WHITE_ON_BLACK));
 
         attroff(A_BOLD);
-        pthread_mutex_lock(&ldevices_mtx);
+        list_t* blk_devs = snapshot_acquire(&g_blk_devs);
 
-        if (ldevices) {
+        if (blk_devs) {
 
-            list_iter_t* it = NULL;
-            list_iter_init(ldevices, &it);
+            list_iter_t it;
+            list_iter_begin(blk_devs, &it);
             blk_dev_t* dev = NULL;
-            while ((dev = list_iter_next(it))) {
+            while ((dev = list_iter_next(&it))) {
                 attron(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
 
                 char* name = string_makez(dev->name);
@@ -522,11 +699,65 @@ static void ncurses_window() {
 
                 attroff(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
             }
-
-            list_iter_release(it);
         }
 
-        pthread_mutex_unlock(&ldevices_mtx);
+        attron(A_BOLD);
+
+        row++;
+        mvaddstr(row++, 1,
+                 "_______________________________________________________________________________________________");
+        mvaddstr(++row, COLON_IO_NAME, "Device");
+        mvaddstr(row, COLON_IO_RPS, "r/s");
+        mvaddstr(row, COLON_IO_WPS, "w/s");
+        mvaddstr(row, COLON_IO_RMERGE, "rrqm/s");
+        mvaddstr(row, COLON_IO_WMERGE, "wrqm/s");
+        mvaddstr(row, COLON_IO_RAWAIT, "r_await");
+        mvaddstr(row, COLON_IO_WAWAIT, "w_await");
+        mvaddstr(row, COLON_IO_AQU, "aqu-sz");
+        mvaddstr(row++, COLON_IO_UTIL, "%util");
+
+        attroff(A_BOLD);
+
+        if (blk_devs) {
+            list_iter_t it;
+            list_iter_begin(blk_devs, &it);
+            blk_dev_t* dev = NULL;
+            while ((dev = list_iter_next(&it))) {
+                attron(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
+
+                char* name = string_makez(dev->name);
+                mvaddstr(row, COLON_IO_NAME, name);
+                zfree(name);
+
+                const blk_iostat_t* io = &dev->io;
+                char s[32];
+                sprintf(s, "%7.1f", io->rps);
+                mvaddstr(row, COLON_IO_RPS, s);
+                sprintf(s, "%7.1f", io->wps);
+                mvaddstr(row, COLON_IO_WPS, s);
+                sprintf(s, "%7.1f", io->rmerge);
+                mvaddstr(row, COLON_IO_RMERGE, s);
+                sprintf(s, "%7.1f", io->wmerge);
+                mvaddstr(row, COLON_IO_WMERGE, s);
+                sprintf(s, "%7.2f", io->r_await);
+                mvaddstr(row, COLON_IO_RAWAIT, s);
+                sprintf(s, "%7.2f", io->w_await);
+                mvaddstr(row, COLON_IO_WAWAIT, s);
+                sprintf(s, "%6.2f", io->aqu);
+                mvaddstr(row, COLON_IO_AQU, s);
+
+                attroff(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
+
+                // a saturated device is what the table is read for
+                int color = io->util >= 90.0 ? NCOLOR_PAIR_RED_ON_BLACK
+                          : io->util >= 50.0 ? NCOLOR_PAIR_YELLOW_ON_BLACK
+                          : NCOLOR_PAIR_GREEN_ON_BLACK;
+                sprintf(s, "%5.1f%%", io->util);
+                attron(COLOR_PAIR(color));
+                mvaddstr(row++, COLON_IO_UTIL, s);
+                attroff(COLOR_PAIR(color));
+            }
+        }
 
         attron(A_BOLD);
 
@@ -539,57 +770,117 @@ static void ncurses_window() {
         mvaddstr(row, COLON_NET_MTU, "MTU");
         mvaddstr(row, COLON_NET_SPEED, "Speed");
         mvaddstr(row, COLON_NET_PERC, "%");
+        mvaddstr(row, COLON_NET_RX_PKTS, "RXpk/s");
+        mvaddstr(row, COLON_NET_TX_PKTS, "TXpk/s");
+        mvaddstr(row, COLON_NET_ERRS, "Err/s");
+        mvaddstr(row, COLON_NET_DROPS, "Drop/s");
+        mvaddstr(row, COLON_NET_FIFO, "Fifo/s");
+        mvaddstr(row, COLON_NET_CARRIER, "Carrier");
 
         attroff(A_BOLD);
-        pthread_mutex_lock(&lnet_devs_mtx);
+        list_t* net_devs = snapshot_acquire(&g_net_devs);
 
-        if (lnet_devs) {
+        if (net_devs) {
 
-            list_iter_t* it = NULL;
-            list_iter_init(lnet_devs, &it);
+            list_iter_t it;
+            list_iter_begin(net_devs, &it);
             net_dev_t* ndev = NULL;
-            while ((ndev = list_iter_next(it))) {
+            while ((ndev = list_iter_next(&it))) {
                 attron(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
 
                 char* name = string_makez(ndev->name);
-                char* mtu = string_makez(ndev->mtu);
-                char* speed = string_makez(ndev->speed);
+
+                char mtu[16];
+                sprintf(mtu, "%u", ndev->mtu);
+                char speed[32];
+                sprintf(speed, "%lu Mbits", ndev->speed);
 
                 char perc[64] = {0};
                 sprintf(perc, "%04.1f%%", ndev->bandwidth_use);
 
                 mvaddstr(++row, COLON_NET_NAME, name);
                 attroff(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
-                ncruses_print_hr_speed(row, COLON_NET_READ, ndev->rx_speed, 1.5);
-                ncruses_print_hr_speed(row, COLON_NET_WRITE, ndev->tx_speed, 1.5);
+                const double* r = ndev->rates.v;
+                ncruses_print_hr_speed(row, COLON_NET_READ, r[NET_RX_BYTES], 1.5);
+                ncruses_print_hr_speed(row, COLON_NET_WRITE, r[NET_TX_BYTES], 1.5);
                 attron(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
                 mvaddstr(row, COLON_NET_MTU, mtu);
                 mvaddstr(row, COLON_NET_SPEED, speed);
                 mvaddstr(row, COLON_NET_PERC, perc);
 
-                zfree(speed);
-                zfree(mtu);
+                char s[32];
+                sprintf(s, "%8.0f", r[NET_RX_PACKETS]);
+                mvaddstr(row, COLON_NET_RX_PKTS, s);
+                sprintf(s, "%8.0f", r[NET_TX_PACKETS]);
+                mvaddstr(row, COLON_NET_TX_PKTS, s);
+                sprintf(s, "%lu", ndev->stats.v[NET_CARRIER_CHANGES]);
+                mvaddstr(row, COLON_NET_CARRIER, s);
+
                 zfree(name);
 
                 attroff(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
-            }
 
-            list_iter_release(it);
+                // a dropping link stands out from a busy one
+                double errs = r[NET_RX_ERRORS] + r[NET_TX_ERRORS];
+                double drops = r[NET_RX_DROPPED] + r[NET_TX_DROPPED] + r[NET_RX_MISSED_ERRORS];
+                double fifo = r[NET_RX_FIFO_ERRORS] + r[NET_TX_FIFO_ERRORS] + r[NET_RX_OVER_ERRORS];
+                int color = errs + drops + fifo > 0.0 ? NCOLOR_PAIR_RED_ON_BLACK : NCOLOR_PAIR_CYAN_ON_BLACK;
+
+                attron(COLOR_PAIR(color));
+                sprintf(s, "%6.1f", errs);
+                mvaddstr(row, COLON_NET_ERRS, s);
+                sprintf(s, "%6.1f", drops);
+                mvaddstr(row, COLON_NET_DROPS, s);
+                sprintf(s, "%6.1f", fifo);
+                mvaddstr(row, COLON_NET_FIFO, s);
+                attroff(COLOR_PAIR(color));
+
+                for (u32 q = 0; q < ndev->nqueues; ++q) {
+                    const double* qr = ndev->queues[q].rate;
+
+                    attron(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
+                    sprintf(s, "q%u", q);
+                    mvaddstr(++row, COLON_NET_QUEUE, s);
+                    attroff(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
+
+                    ncruses_print_hr_speed(row, COLON_NET_READ, qr[NET_QUEUE_RX_BYTES], 1.5);
+                    ncruses_print_hr_speed(row, COLON_NET_WRITE, qr[NET_QUEUE_TX_BYTES], 1.5);
+
+                    attron(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
+                    sprintf(s, "%8.0f", qr[NET_QUEUE_RX_PACKETS]);
+                    mvaddstr(row, COLON_NET_RX_PKTS, s);
+                    sprintf(s, "%8.0f", qr[NET_QUEUE_TX_PACKETS]);
+                    mvaddstr(row, COLON_NET_TX_PKTS, s);
+                    attroff(COLOR_PAIR(NCOLOR_PAIR_CYAN_ON_BLACK));
+                }
+            }
 
         }
 
-        pthread_mutex_unlock(&lnet_devs_mtx);
+        // everything has been copied into the curses buffers, a slow terminal doesn't hold the epoch back
+        epoch_exit(reader);
 
         attroff(A_BOLD);
 
         refresh(); // Print to the screen
+
+        snapshot_rendered(&g_cpu_info, &g_render_latency);
+        snapshot_rendered(&g_cpu_dev, &g_render_latency);
+        snapshot_rendered(&g_mem_info, &g_render_latency);
+        snapshot_rendered(&g_blk_devs, &g_render_latency);
+        snapshot_rendered(&g_net_devs, &g_render_latency);
 #ifndef HW_NO_SLEEP
-        nsleep((u64)scr_upd);
+        // woken up by the tick that follows, the timeout only matters if the sampling stalls
+        ui_wait(UI_FRAME_TIMEOUT_PERIODS * scr_upd);
 #endif
+        ncurses_events();
 
         frame_time = timer_end_ms(tm_start);
     }
 
+    // it posts to the queue, it has to be gone before the queue is
+    pthread_join(keypad__thrd, NULL);
+
     endwin();
 }
 
@@ -597,123 +888,120 @@ static void ncurses_window() {
 // BLACK DEV RUN
 //============================================================================================================
 
-static void blk_dev_set_globals(list_t* devs)
+static void blk_dev_set_globals(void* devs)
 {
-    pthread_mutex_lock(&ldevices_mtx);
-    if (ldevices)
-        list_release(ldevices, true);
-    ldevices = devs;
-    pthread_mutex_unlock(&ldevices_mtx);
+    // the list stays owned by the sampler, it's retired once the next one is published
+    snapshot_publish(&g_blk_devs, devs);
 }
 
-static void* start_blkdev_sample(void* p) {
-    while (!atomic_load(&programm_exit)) {
-
-        double sample_rate = device_get_sample_rate();
-        blkdev_sample(sample_rate, &blk_dev_set_globals);
-    }
-
-    return p;
-}
-
-
 //============================================================================================================
 // NET DEV RUN
 //============================================================================================================
 
-static void net_dev_set_globals(list_t* devs)
+static void net_dev_set_globals(void* devs)
 {
-    pthread_mutex_lock(&lnet_devs_mtx);
-    if (lnet_devs)
-        list_release(lnet_devs, true);
-    lnet_devs = devs;
-    pthread_mutex_unlock(&lnet_devs_mtx);
-}
-
-static void* start_net_dev_sample(void* p) {
-    while (!atomic_load(&programm_exit)) {
-        double sample_rate = device_get_sample_rate();
-
-        net_dev_sample(sample_rate, &net_dev_set_globals);
-    }
-
-    return p;
+    snapshot_publish(&g_net_devs, devs);
 }
 
 //============================================================================================================
 // CPU PROC SAMPLING
 //============================================================================================================
-static void cpu_dev_sample(double sample_size_sec) {
-    cpu_dev_t* cpu_a = NULL;
-    cpu_dev_t* cpu_b = NULL;
-
-    pthread_mutex_lock(&cpu_info_mtx);
-
-    if (g_cpu_info) {
-        cpu_info_release_cb(g_cpu_info);
-        g_cpu_info = NULL;
-    }
-
-    cpu_info_get(&g_cpu_info);
-
-    pthread_mutex_unlock(&cpu_info_mtx);
+static void cpu_dev_set_globals(void* cpu) {
+    cpu_dev_t* c = (cpu_dev_t*)cpu;
 
-    cpu_dev_get(&cpu_a);
+    if (c)
+        atomic_store(&cpu_usage, (ulong)(c->usage[0] * 100.0));
 
-#ifndef HW_NO_SLEEP
-    nsleepd(sample_size_sec);
-#endif
-
-    cpu_dev_get(&cpu_b);
-
-    double usage = cpu_dev_diff_usage(cpu_a, cpu_b) * 100.0;
-
-    atomic_store(&cpu_usage, (ulong)usage);
-
-    cpu_dev_release_cb(cpu_a);
-    cpu_dev_release_cb(cpu_b);
+    // the snapshot stays owned by the sampler, it's retired once the next one is published
+    snapshot_publish(&g_cpu_dev, c);
 }
 
-static void* start_cpu_dev_sample(void* p) {
-    while (!atomic_load(&programm_exit)) {
-        double sample_rate = device_get_sample_rate();
-
-        cpu_dev_sample(sample_rate);
-    }
-
-    return p;
+static void ui_sampled(void* p) {
+    ui_post(UI_EVENT_SAMPLE, g_scheduler->tick);
 }
 
 //============================================================================================================
 // MEM INFO SAMPLING
 //============================================================================================================
-static void mem_info_sample(double sample_size_sec) {
+static void mem_info_set_globals(void* mem) {
+    snapshot_publish(&g_mem_info, mem);
+}
 
-    pthread_mutex_lock(&mem_info_mtx);
+//============================================================================================================
+// SAMPLING
+//============================================================================================================
 
-    if (g_mem_info) {
-        mem_info_release_cb(g_mem_info);
-        g_mem_info = NULL;
+enum {
+    SAMPLER_BLK,
+    SAMPLER_NET,
+    SAMPLER_CPU,
+    SAMPLER_MEM,
+    SAMPLER_COUNT
+};
+
+static sampler_t* g_samplers[SAMPLER_COUNT];
+
+static void sampling_init() {
+    mpsc_init(&g_ui_events, UI_EVENTS_CAPACITY);
+    g_ui_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoch_init(&g_epoch);
+    snapshot_init(&g_blk_devs);
+    snapshot_init(&g_net_devs);
+    snapshot_init(&g_cpu_info);
+    snapshot_init(&g_mem_info);
+    snapshot_init(&g_cpu_dev);
+
+    // the model and topology don't change, the live clocks come with the cpu samples
+    cpu_info_t* cpu_info = NULL;
+    cpu_info_get(&cpu_info);
+    snapshot_publish(&g_cpu_info, cpu_info);
+
+    scheduler_init(&g_scheduler, device_get_sample_period_ns());
+
+    blkdev_sampler_init(&g_samplers[SAMPLER_BLK], &blk_dev_set_globals);
+    net_dev_sampler_init(&g_samplers[SAMPLER_NET], &net_dev_set_globals);
+    cpu_dev_sampler_init(&g_samplers[SAMPLER_CPU], &cpu_dev_set_globals);
+    mem_info_sampler_init(&g_samplers[SAMPLER_MEM], &mem_info_set_globals);
+
+    for (u64 i = 0; i < SAMPLER_COUNT; ++i) {
+        sampler_set_epoch(g_samplers[i], g_epoch);
+        scheduler_add_sampler(g_scheduler, g_samplers[i], 1);
     }
 
-    mem_info_get(&g_mem_info);
+    // the last task of a tick, everything above has been published by then
+    scheduler_add(g_scheduler, &ui_sampled, NULL, 1);
+}
 
-    pthread_mutex_unlock(&mem_info_mtx);
+static void* start_sampling(void* p) {
+    scheduler_run(g_scheduler);
 
-#ifndef HW_NO_SLEEP
-    nsleepd(sample_size_sec);
-#endif
+    return p;
 }
 
-static void* start_mem_info_sample(void* p) {
-    while (!atomic_load(&programm_exit)) {
-        double sample_rate = device_get_sample_rate();
+/// must be called once the sampling thread and the UI have finished
+static void sampling_shutdown() {
+    blk_dev_set_globals(NULL);
+    net_dev_set_globals(NULL);
+    cpu_dev_set_globals(NULL);
+    mem_info_set_globals(NULL);
 
-        mem_info_sample(sample_rate);
+    for (u64 i = 0; i < SAMPLER_COUNT; ++i)
+        sampler_release(g_samplers[i]);
 
-    }
+    epoch_retire(g_epoch, snapshot_publish(&g_cpu_info, NULL), &cpu_info_release_cb);
 
-    return p;
+    scheduler_release(g_scheduler);
+    g_scheduler = NULL;
+
+    // the UI has returned, nobody is left inside a read section
+    epoch_release(g_epoch);
+    g_epoch = NULL;
+
+    mpsc_release(g_ui_events);
+    g_ui_events = NULL;
+    close(g_ui_wake_fd);
+    g_ui_wake_fd = -1;
 }
 
 //============================================================================================================
@@ -723,6 +1011,9 @@ static void* start_mem_info_sample(void* p) {
 static void sig_handler(int signo) {
     if (signo == SIGTERM || signo == SIGINT) {
         atomic_store(&programm_exit, true);
+
+        if (g_scheduler)
+            scheduler_stop(g_scheduler);
     }
 
     if (signo == SIGUSR1) {
@@ -818,33 +1109,26 @@ int main() {
 #endif
 #endif
 
+    fd_cache_init();
+    regex_cache_init();
 
 #ifndef NDEBUG
     check_style_defines();
     tests_run();
 #endif
 
-    pthread_mutex_init(&ldevices_mtx, NULL);
-    pthread_mutex_init(&lnet_devs_mtx, NULL);
-    pthread_mutex_init(&cpu_info_mtx, NULL);
-    pthread_mutex_init(&mem_info_mtx, NULL);
-
-    pthread_t blk_dev_thr;
-
-    pthread_create(&blk_dev_thr, NULL, &start_blkdev_sample, NULL);
-    pthread_setname_np(blk_dev_thr, "blkdev_sample");
-
-    pthread_t net_dev_thr;
-    pthread_create(&net_dev_thr, NULL, &start_net_dev_sample, NULL);
-    pthread_setname_np(net_dev_thr, "netdev_sample");
+#ifdef HW_BENCH
+    bench_run();
+    fd_cache_shutdown();
+    regex_cache_shutdown();
+    return 0;
+#endif
 
-    pthread_t cpu_dev_thr;
-    pthread_create(&cpu_dev_thr, NULL, &start_cpu_dev_sample, NULL);
-    pthread_setname_np(cpu_dev_thr, "cpudev_sample");
+    sampling_init();
 
-    pthread_t mem_info_thr;
-    pthread_create(&mem_info_thr, NULL, &start_mem_info_sample, NULL);
-    pthread_setname_np(mem_info_thr, "meminfo_sample");
+    pthread_t sampling_thr;
+    pthread_create(&sampling_thr, NULL, &start_sampling, NULL);
+    pthread_setname_np(sampling_thr, "sampling");
 
     signal(SIGINT, &sig_handler);
     signal(SIGTERM, &sig_handler);
@@ -852,15 +1136,14 @@ int main() {
 
     ncurses_window();
 
-    pthread_join(blk_dev_thr, NULL);
-    pthread_join(net_dev_thr, NULL);
-    pthread_join(cpu_dev_thr, NULL);
-    pthread_join(mem_info_thr, NULL);
+    // the window has returned on F10 or a signal, make sure the scheduler has been told too
+    scheduler_stop(g_scheduler);
+    pthread_join(sampling_thr, NULL);
+
+    sampling_shutdown();
 
-    pthread_mutex_destroy(&ldevices_mtx);
-    pthread_mutex_destroy(&lnet_devs_mtx);
-    pthread_mutex_destroy(&cpu_info_mtx);
-    pthread_mutex_destroy(&mem_info_mtx);
+    fd_cache_shutdown();
+    regex_cache_shutdown();
 
 #ifndef NDEBUG
     alloc_dump_summary();
@@ -16,10 +16,10 @@
 *************************************************************************************************************/
 
 #include "mem_dev.h"
-#include "double_linked_list.h"
-#include "string.h"
 #include "utils.h"
 #include "allocators.h"
+#include "scanner.h"
+#include "log.h"
 
 void mem_info_release_cb(void* p) {
     if (!p)
@@ -30,57 +30,65 @@ void mem_info_release_cb(void* p) {
     zfree(mem);
 }
 
-void mem_info_get(mem_info_t** mem_info) {
-    *mem_info = zalloc(sizeof(mem_info_t));
-    mem_info_t* m = *mem_info;
-
-    string* mem_info_s = NULL;
-    string_init(&mem_info_s);
-    file_read_all_buffered_s("/proc/meminfo", mem_info_s);
-
-    list_t* pairs = NULL;
-
-    string_re_search(mem_info_s, "([a-zA-Z]+):\\s+([0-9]+)", &pairs);
-
-    string_release(mem_info_s);
-
-    u64 i = 0;
-
-    while (i < pairs->size) {
-        ++i;
-        string* key = (string*)list_pop_head(pairs);
-        string* val = (string*)list_pop_head(pairs);
-
-        if (string_comparez(key, "MemTotal") == ST_OK) {
-            string_to_u64(val, &m->mem_total);
-            m->mem_total *= 1024;
-        } else if (string_comparez(key, "MemFree") == ST_OK) {
-            string_to_u64(val, &m->mem_free);
-            m->mem_free *= 1024;
-        } else if (string_comparez(key, "MemAvailable") == ST_OK) {
-            string_to_u64(val, &m->mem_avail);
-            m->mem_avail *= 1024;
-        } else if (string_comparez(key, "Cached") == ST_OK) {
-            string_to_u64(val, &m->cached);
-            m->cached *= 1024;
-        } else if (string_comparez(key, "SwapCached") == ST_OK) {
-            string_to_u64(val, &m->swap_cached);
-            m->swap_cached *= 1024;
-        } else if (string_comparez(key, "SwapTotal") == ST_OK) {
-            string_to_u64(val, &m->swap_total);
-            m->swap_total *= 1024;
-        } else if (string_comparez(key, "SwapFree") == ST_OK) {
-            string_to_u64(val, &m->swap_free);
-            m->swap_free *= 1024;
-
-            string_release(key);
-            string_release(val);
+#define MEMINFO_BUFFER_SIZE 8192
+
+ret_t mem_info_read(mem_info_t* m) {
+    char buf[MEMINFO_BUFFER_SIZE];
+    u64 size = 0;
+
+    ret_t ret = fd_cache_read_buf("/proc/meminfo", buf, sizeof(buf), &size);
+    if (ret != ST_OK)
+        return ret;
+
+    if (size == sizeof(buf))
+        LOG_WARN("/proc/meminfo doesn't fit into %lu bytes", sizeof(buf));
+
+    scanner_t sc;
+    scanner_init(&sc, buf, size);
+
+    // the fields we need are at the top, stop at the last of them
+    do {
+        const char* key;
+        u64 len;
+        u64 val;
+
+        if (!scanner_key(&sc, &key, &len) || !scanner_u64(&sc, &val))
+            continue;
+
+        // all of them are in kB
+        val *= 1024;
+
+        if (SCANNER_KEY_IS(key, len, "MemTotal")) {
+            m->mem_total = val;
+        } else if (SCANNER_KEY_IS(key, len, "MemFree")) {
+            m->mem_free = val;
+        } else if (SCANNER_KEY_IS(key, len, "MemAvailable")) {
+            m->mem_avail = val;
+        } else if (SCANNER_KEY_IS(key, len, "Cached")) {
+            m->cached = val;
+        } else if (SCANNER_KEY_IS(key, len, "SwapCached")) {
+            m->swap_cached = val;
+        } else if (SCANNER_KEY_IS(key, len, "SwapTotal")) {
+            m->swap_total = val;
+        } else if (SCANNER_KEY_IS(key, len, "SwapFree")) {
+            m->swap_free = val;
             break;
         }
+    } while (scanner_next_line(&sc));
+
+    return ST_OK;
+}
+
+void mem_info_get(mem_info_t** mem_info) {
+    *mem_info = zalloc(sizeof(mem_info_t));
 
-        string_release(key);
-        string_release(val);
-    }
+    mem_info_read(*mem_info);
+}
+
+static void mem_info_scan_cb(void* ctx, void** snapshot) {
+    mem_info_get((mem_info_t**)snapshot);
+}
 
-    list_release(pairs, true);
+ret_t mem_info_sampler_init(sampler_t** s, sampler_publish_cb cb) {
+    return sampler_init(s, NULL, NULL, &mem_info_scan_cb, NULL, cb, &mem_info_release_cb);
 }
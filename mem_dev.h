@@ -18,6 +18,7 @@
 #pragma once
 
 #include "globals.h"
+#include "sampler.h"
 
 //============================================================================================================
 // MEMORY
@@ -48,4 +49,10 @@ typedef struct mem_info {
 
 void mem_info_release_cb(void* p);
 
+/// fills @m from /proc/meminfo in place, nothing is allocated
+ret_t mem_info_read(mem_info_t* m);
+
 void mem_info_get(mem_info_t** mem_info);
+
+/// meminfo has nothing to diff, the sampler only takes and publishes the snapshots
+ret_t mem_info_sampler_init(sampler_t** s, sampler_publish_cb cb);
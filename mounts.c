@@ -0,0 +1,368 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <memory.h>
+#include "mounts.h"
+#include "allocators.h"
+#include "utils.h"
+#include "log.h"
+
+#define MOUNTINFO_PATH "/proc/self/mountinfo"
+
+// a table that keeps changing under the read is taken as it is after this many tries
+#define MNT_TABLE_READ_ATTEMPTS 4
+
+void mnt_entry_release(mnt_entry_t* e) {
+    if (e->source)
+        string_release(e->source);
+    if (e->target)
+        string_release(e->target);
+    if (e->fstype)
+        string_release(e->fstype);
+}
+
+static void mnt_entries_release_all(mnt_entries_t* entries) {
+    mnt_entry_t* e;
+    VECTOR_FOREACH(entries, e)
+        mnt_entry_release(e);
+
+    mnt_entries_release(entries);
+}
+
+/// mountinfo escapes spaces, tabs, newlines and backslashes as \ooo
+static void mnt_append_unescaped(string* s, const char* b, const char* e) {
+    while (b < e) {
+        if (*b == '\\' && e - b >= 4 &&
+            b[1] >= '0' && b[1] <= '7' && b[2] >= '0' && b[2] <= '7' && b[3] >= '0' && b[3] <= '7') {
+            char ch = (char)(((b[1] - '0') << 6) | ((b[2] - '0') << 3) | (b[3] - '0'));
+            string_appendn(s, &ch, 1);
+            b += 4;
+            continue;
+        }
+
+        const char* run = b;
+        while (b < e && *b != '\\')
+            ++b;
+
+        if (b == run)
+            ++b;
+
+        string_appendn(s, run, (u64)(b - run));
+    }
+}
+
+/// "259:3" to a dev_t, 0 if it isn't one
+static u64 mnt_parse_devno(const char* b, const char* e) {
+    u64 v[2] = {0, 0};
+    u64 i = 0;
+
+    for (; b < e; ++b) {
+        if (*b == ':' && i == 0) {
+            ++i;
+            continue;
+        }
+
+        if ((u8)(*b - '0') >= 10)
+            return 0;
+
+        v[i] = v[i] * 10 + (u64)(*b - '0');
+    }
+
+    return i == 1 ? (u64)makedev((unsigned)v[0], (unsigned)v[1]) : 0;
+}
+
+static const char* mnt_next_field(const char* p, const char* end, const char** fe) {
+    while (p < end && *p == ' ')
+        ++p;
+
+    const char* f = p;
+    while (p < end && *p != ' ')
+        ++p;
+
+    *fe = p;
+    return f;
+}
+
+ret_t mnt_table_parse(mnt_table_t* t, const char* text, u64 size) {
+    // sized like the previous table, a reparse rarely changes more than an entry or two
+    mnt_entries_t entries = VECTOR_EMPTY;
+    mnt_entries_reserve(&entries, t->entries.size);
+
+    const char* p = text;
+    const char* end = text + size;
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', (u64)(end - p));
+        if (!eol)
+            eol = end;
+
+        // 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+        const char* fe = NULL;
+        const char* f = p;
+        const char* target = NULL;
+        const char* target_end = NULL;
+        u64 devno = 0;
+        u64 n = 0;
+
+        while (f < eol) {
+            f = mnt_next_field(f, eol, &fe);
+            if (f == fe)
+                break;
+
+            if (n == 2)
+                devno = mnt_parse_devno(f, fe);
+
+            if (n == 4) {
+                target = f;
+                target_end = fe;
+            }
+
+            // the optional fields end with a single "-"
+            if (n > 5 && fe - f == 1 && *f == '-')
+                break;
+
+            f = fe;
+            ++n;
+        }
+
+        if (target && f < eol) {
+            const char* fstype_end = NULL;
+            const char* fstype = mnt_next_field(fe, eol, &fstype_end);
+            const char* source_end = NULL;
+            const char* source = mnt_next_field(fstype_end, eol, &source_end);
+
+            mnt_entry_t* e = source != source_end ? mnt_entries_emplace(&entries) : NULL;
+
+            if (e) {
+                string_init(&e->target);
+                string_init(&e->fstype);
+                string_init(&e->source);
+
+                mnt_append_unescaped(e->target, target, target_end);
+                mnt_append_unescaped(e->fstype, fstype, fstype_end);
+                mnt_append_unescaped(e->source, source, source_end);
+                e->devno = devno;
+            }
+        }
+
+        p = eol + 1;
+    }
+
+    mnt_entries_release_all(&t->entries);
+    t->entries = entries;
+    ++t->generation;
+
+    return ST_OK;
+}
+
+/// mountinfo is a seq_file, it comes a page or so per read and only a read of 0 is the end of it
+static ret_t mnt_table_read(mnt_table_t* t, string* text) {
+    dynamic_allocator_t* da = _da(text);
+    da->used = 0;
+
+    while (true) {
+        if (da->used == da->size)
+            da_realloc(da, da->size ? da->size * 2 : 4096);
+
+        ssize_t n = pread(t->fd, da->ptr + da->used, da->size - da->used, (off_t)da->used);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return ST_ERR;
+        }
+
+        if (n == 0)
+            return ST_OK;
+
+        da->used += (u64)n;
+    }
+}
+
+/// the kernel raises POLLPRI once the mount table has changed since the last poll
+static bool mnt_table_changed(mnt_table_t* t) {
+    struct pollfd pfd;
+    pfd.fd = t->fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) <= 0)
+        return false;
+
+    return (pfd.revents & (POLLPRI | POLLERR)) != 0;
+}
+
+static ret_t mnt_table_load(mnt_table_t* t) {
+    string* text = NULL;
+    string_init(&text);
+
+    // a mount or umount between the reads of the pages mixes two tables, read it again then
+    ret_t ret = ST_ERR;
+    for (u64 attempt = 0; attempt < MNT_TABLE_READ_ATTEMPTS; ++attempt) {
+        ret = mnt_table_read(t, text);
+        if (ret != ST_OK || !mnt_table_changed(t))
+            break;
+    }
+
+    if (ret == ST_OK)
+        ret = mnt_table_parse(t, string_cdata(text), string_size(text));
+
+    string_release(text);
+
+    return ret;
+}
+
+ret_t mnt_table_init(mnt_table_t** t) {
+    *t = zalloc(sizeof(mnt_table_t));
+    mnt_table_t* mt = *t;
+
+    mt->fd = open(MOUNTINFO_PATH, O_RDONLY | O_CLOEXEC);
+    if (mt->fd < 0) {
+        LOG_ERROR("can't open %s", MOUNTINFO_PATH);
+        return ST_NOT_FOUND;
+    }
+
+    return mnt_table_load(mt);
+}
+
+void mnt_table_release(mnt_table_t* t) {
+    if (!t)
+        return;
+
+    if (t->fd >= 0)
+        close(t->fd);
+
+    mnt_entries_release_all(&t->entries);
+    zfree(t);
+}
+
+bool mnt_table_update(mnt_table_t* t) {
+    if (t->fd < 0 || !mnt_table_changed(t))
+        return false;
+
+    return mnt_table_load(t) == ST_OK;
+}
+
+#ifndef NDEBUG
+
+static u64 test_count_lines(string* s) {
+    u64 lines = 0;
+    for (u64 i = 0; i < string_size(s); ++i)
+        lines += string_cdata(s)[i] == '\n';
+
+    return lines;
+}
+
+void test_mnt_table(void) {
+    const char* text =
+            "22 1 8:3 / / rw,relatime shared:1 - ext4 /dev/sda3 rw\n"
+            "23 22 8:4 / /home rw,relatime shared:2 master:7 - ext4 /dev/sda4 rw,data=ordered\n"
+            "24 22 0:21 / /proc rw,nosuid - proc proc rw\n"
+            "25 22 8:17 / /mnt/my\\040disk rw - ext4 /dev/sdb1 rw\n";
+
+    mnt_table_t t;
+    memset(&t, 0, sizeof(t));
+    t.fd = -1;
+
+    CHECK_RETURN(mnt_table_parse(&t, text, strlen(text)));
+    ASSERT(t.entries.size == 4);
+    ASSERT(t.generation == 1);
+
+    mnt_entry_t* e = &t.entries.data[0];
+    ASSERT(string_comparez(e->source, "/dev/sda3") == ST_OK);
+    ASSERT(string_comparez(e->target, "/") == ST_OK);
+    ASSERT(string_comparez(e->fstype, "ext4") == ST_OK);
+    ASSERT(e->devno == makedev(8, 3));
+
+    e = &t.entries.data[1];
+    ASSERT(string_comparez(e->source, "/dev/sda4") == ST_OK);
+    ASSERT(string_comparez(e->target, "/home") == ST_OK);
+
+    e = &t.entries.data[2];
+    ASSERT(string_comparez(e->source, "proc") == ST_OK);
+    ASSERT(e->devno == makedev(0, 21));
+
+    e = &t.entries.data[3];
+    ASSERT(string_comparez(e->target, "/mnt/my disk") == ST_OK);
+    ASSERT(string_comparez(e->source, "/dev/sdb1") == ST_OK);
+
+    // a reparse swaps the whole table
+    CHECK_RETURN(mnt_table_parse(&t, text, strlen(text)));
+    ASSERT(t.entries.size == 4 && t.generation == 2);
+
+    mnt_entries_release_all(&t.entries);
+
+    // a table of several pages is read whole
+    char filename[] = "/tmp/hwmonitor_mountinfo_XXXXXX";
+    t.fd = mkstemp(filename);
+    ASSERT(t.fd >= 0);
+
+    for (u64 i = 0; i < 200; ++i) {
+        char line[128];
+        int len = snprintf(line, sizeof(line), "%lu 22 0:%lu / /run/container/%lu rw - tmpfs tmpfs rw\n",
+                           100 + i, 100 + i, i);
+        ASSERT(write(t.fd, line, (u64)len) == len);
+    }
+
+    CHECK_RETURN(mnt_table_load(&t));
+    ASSERT(t.entries.size == 200);
+    ASSERT(string_comparez(t.entries.data[199].target, "/run/container/199") == ST_OK);
+
+    mnt_entries_release_all(&t.entries);
+    close(t.fd);
+    unlink(filename);
+
+    // a seq_file of several pages through the same reader, the mountinfo here may fit into one
+    string* seq = NULL;
+    string* seq_ref = NULL;
+    string_init(&seq);
+    string_init(&seq_ref);
+
+    t.fd = open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+    ASSERT(t.fd >= 0);
+    CHECK_RETURN(file_read_uncached("/proc/self/smaps", seq_ref));
+    CHECK_RETURN(mnt_table_read(&t, seq));
+    ASSERT(string_size(seq_ref) > 4096);
+    ASSERT(string_size(seq) > string_size(seq_ref) / 2 && string_cdata(seq)[string_size(seq) - 1] == '\n');
+    ASSERT(test_count_lines(seq) == test_count_lines(seq_ref));
+    close(t.fd);
+
+    string_release(seq_ref);
+    string_release(seq);
+
+    // the live table, every line is an entry
+    mnt_table_t* live = NULL;
+    CHECK_RETURN(mnt_table_init(&live));
+
+    string* text_live = NULL;
+    string_init(&text_live);
+    CHECK_RETURN(file_read_uncached(MOUNTINFO_PATH, text_live));
+
+    ASSERT(live->entries.size == test_count_lines(text_live));
+
+    string_release(text_live);
+    mnt_table_release(live);
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+#include "string.h"
+#include "vector.h"
+
+//============================================================================================================
+// MOUNT TABLE
+//============================================================================================================
+
+typedef struct mnt_entry {
+    string* source;
+    string* target;
+    string* fstype;
+    // st_dev of the filesystem, the major:minor field of mountinfo
+    u64 devno;
+} mnt_entry_t;
+
+VECTOR_DECLARE(mnt_entries, mnt_entry_t)
+
+typedef struct mnt_table {
+    // in mountinfo order, scanned once per df
+    mnt_entries_t entries;
+    int fd;
+    // bumped on every reparse
+    u32 generation;
+} mnt_table_t;
+
+/// releases the strings, the entry itself lives in the table
+void mnt_entry_release(mnt_entry_t* e);
+
+ret_t mnt_table_init(mnt_table_t** t);
+
+void mnt_table_release(mnt_table_t* t);
+
+/// Reparses /proc/self/mountinfo only when the kernel has reported a change of the mount table since
+/// the last call (POLLPRI on the mountinfo descriptor).
+/// \return true if the entries were reloaded
+bool mnt_table_update(mnt_table_t* t);
+
+ret_t mnt_table_parse(mnt_table_t* t, const char* text, u64 size);
+
+#ifndef NDEBUG
+
+void test_mnt_table(void);
+
+#endif
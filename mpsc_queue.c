@@ -0,0 +1,182 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <pthread.h>
+#include <sched.h>
+#include "mpsc_queue.h"
+#include "log.h"
+#include "allocators.h"
+
+#define MPSC_MIN_CAPACITY 2
+
+ret_t mpsc_init(mpsc_queue_t** q, u64 capacity) {
+    u64 cap = MPSC_MIN_CAPACITY;
+    while (cap < capacity)
+        cap <<= 1;
+
+    *q = zalloc(sizeof(mpsc_queue_t));
+    mpsc_queue_t* mq = *q;
+
+    mq->mask = cap - 1;
+    mq->cells = zalloc(cap * sizeof(mpsc_cell_t));
+
+    // a cell at position pos is free for the producer that claims pos while its seq is pos
+    for (u64 i = 0; i < cap; ++i)
+        atomic_init(&mq->cells[i].seq, i);
+
+    atomic_init(&mq->tail, 0);
+
+    return ST_OK;
+}
+
+void mpsc_release(mpsc_queue_t* q) {
+    if (!q)
+        return;
+
+    zfree(q->cells);
+    zfree(q);
+}
+
+bool mpsc_push(mpsc_queue_t* q, u64 value) {
+    u64 pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    mpsc_cell_t* cell;
+
+    while (true) {
+        cell = &q->cells[pos & q->mask];
+        u64 seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int64_t dif = (int64_t)(seq - pos);
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            // the consumer hasn't taken the value a lap behind yet
+            return false;
+        } else {
+            // another producer has claimed it
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->value = value;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+bool mpsc_pop(mpsc_queue_t* q, u64* value) {
+    u64 pos = q->head;
+    mpsc_cell_t* cell = &q->cells[pos & q->mask];
+
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + 1)
+        return false;
+
+    *value = cell->value;
+    // free for the producer that claims it on the next lap
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+    q->head = pos + 1;
+
+    return true;
+}
+
+u64 mpsc_capacity(mpsc_queue_t* q) {
+    return q->mask + 1;
+}
+
+#ifndef NDEBUG
+
+#define TEST_MPSC_PRODUCERS 4
+#define TEST_MPSC_ITEMS 20000UL
+
+typedef struct test_mpsc_producer {
+    mpsc_queue_t* q;
+    u64 id;
+    u64 full;
+} test_mpsc_producer_t;
+
+static void* test_mpsc_producer(void* p) {
+    test_mpsc_producer_t* t = (test_mpsc_producer_t*)p;
+
+    for (u64 i = 0; i < TEST_MPSC_ITEMS; ++i) {
+        while (!mpsc_push(t->q, (t->id << 32) | i)) {
+            ++t->full;
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+void test_mpsc() {
+    mpsc_queue_t* q = NULL;
+    CHECK_RETURN(mpsc_init(&q, 5));
+    ASSERT(mpsc_capacity(q) == 8);
+
+    u64 v = 0;
+    ASSERT(!mpsc_pop(q, &v));
+
+    // a few laps around the ring from one thread
+    for (u64 lap = 0; lap < 3; ++lap) {
+        for (u64 i = 0; i < 8; ++i)
+            ASSERT(mpsc_push(q, lap * 8 + i));
+
+        ASSERT(!mpsc_push(q, 100));
+
+        for (u64 i = 0; i < 8; ++i)
+            ASSERT(mpsc_pop(q, &v) && v == lap * 8 + i);
+
+        ASSERT(!mpsc_pop(q, &v));
+    }
+
+    mpsc_release(q);
+
+    // every value gets through once and in the order of its producer
+    CHECK_RETURN(mpsc_init(&q, 64));
+
+    pthread_t thrd[TEST_MPSC_PRODUCERS];
+    test_mpsc_producer_t producers[TEST_MPSC_PRODUCERS];
+    for (u64 i = 0; i < TEST_MPSC_PRODUCERS; ++i) {
+        producers[i] = (test_mpsc_producer_t){q, i, 0};
+        pthread_create(&thrd[i], NULL, &test_mpsc_producer, &producers[i]);
+    }
+
+    u64 next[TEST_MPSC_PRODUCERS] = {0};
+    u64 received = 0;
+    while (received < TEST_MPSC_PRODUCERS * TEST_MPSC_ITEMS) {
+        if (!mpsc_pop(q, &v)) {
+            sched_yield();
+            continue;
+        }
+
+        u64 id = v >> 32;
+        ASSERT(id < TEST_MPSC_PRODUCERS && (v & 0xFFFFFFFF) == next[id]);
+        next[id] = (v & 0xFFFFFFFF) + 1;
+        ++received;
+    }
+
+    for (u64 i = 0; i < TEST_MPSC_PRODUCERS; ++i) {
+        pthread_join(thrd[i], NULL);
+        ASSERT(next[i] == TEST_MPSC_ITEMS);
+    }
+
+    ASSERT(!mpsc_pop(q, &v));
+
+    mpsc_release(q);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// BOUNDED MPSC QUEUE
+//============================================================================================================
+
+/// A fixed ring of cells for many producers and one consumer. Every cell carries a sequence number: a
+/// producer claims a position with one CAS on the tail and publishes the value by bumping the sequence
+/// of its cell, the consumer takes the cell once its sequence says it's been filled. Nothing is
+/// allocated past mpsc_init and a push never blocks, so it may be done from a signal handler as well.
+/// A producer preempted between the claim and the publish holds back the consumer until it resumes.
+
+typedef struct mpsc_cell {
+    atomic_u64 seq;
+    u64 value;
+} mpsc_cell_t;
+
+typedef struct mpsc_queue {
+    // claimed by the producers
+    atomic_u64 tail;
+    u8 pad0[CACHE_LINE_SIZE - sizeof(atomic_u64)];
+    // the consumer only
+    u64 head;
+    u8 pad1[CACHE_LINE_SIZE - sizeof(u64)];
+    u64 mask;
+    mpsc_cell_t* cells;
+} mpsc_queue_t;
+
+/// @capacity is rounded up to a power of two
+ret_t mpsc_init(mpsc_queue_t** q, u64 capacity);
+
+void mpsc_release(mpsc_queue_t* q);
+
+/// any thread, @value is a pointer (PTR_TO_U64) or a plain value
+/// \return false if the queue is full
+bool mpsc_push(mpsc_queue_t* q, u64 value);
+
+/// the consumer thread only
+/// \return false if the queue is empty
+bool mpsc_pop(mpsc_queue_t* q, u64* value);
+
+u64 mpsc_capacity(mpsc_queue_t* q);
+
+#ifndef NDEBUG
+
+void test_mpsc(void);
+
+#endif
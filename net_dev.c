@@ -15,34 +15,132 @@
     along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
 *************************************************************************************************************/
 
+#include <stdio.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 #include <memory.h>
+#include <limits.h>
 #include <math.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+// after net/if.h, the uapi header then leaves out what libc has defined
+#include <linux/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
 #include "net_dev.h"
 #include "allocators.h"
 #include "timer.h"
 #include "utils.h"
+#include "scanner.h"
+#include "log.h"
 
 void net_dev_release_cb(void* p) {
     net_dev_t* dev = (net_dev_t*)p;
     if (dev) {
         if (dev->name)
             string_release(dev->name);
-        if (dev->sysdir)
-            string_release(dev->sysdir);
-        if (dev->mtu)
-            string_release(dev->mtu);
-        if (dev->speed)
-            string_release(dev->speed);
         zfree(dev);
     }
 }
 
+u64 net_dev_key_cb(void* p) {
+    return ((net_dev_t*)p)->name_hash;
+}
+
+string* net_dev_name_cb(void* p) {
+    return ((net_dev_t*)p)->name;
+}
+
+
+// a counter file holds a single number
+#define NET_COUNTER_BUFFER_SIZE 32
+#define NET_SYSFS_DIR "/sys/class/net/"
+
+// the sysfs files of the counters, for the fallback
+static const char* const g_net_stat_files[NET_STAT_COUNT] = {
+        "statistics/rx_packets", "statistics/tx_packets", "statistics/rx_bytes", "statistics/tx_bytes",
+        "statistics/rx_errors", "statistics/tx_errors", "statistics/rx_dropped", "statistics/tx_dropped",
+        "statistics/multicast", "statistics/collisions", "statistics/rx_over_errors",
+        "statistics/rx_fifo_errors", "statistics/rx_missed_errors", "statistics/tx_fifo_errors",
+        "statistics/tx_carrier_errors", "carrier_changes"
+};
+
+/// reads a counter of /sys/class/net/<name>/<file> in place, 0 if it can't be read
+static u64 net_dev_read_u64(string* name, const char* file) {
+    char path[PATH_MAX];
+    u64 name_len = string_size(name);
+    u64 file_len = strlen(file);
+    u64 dir_len = sizeof(NET_SYSFS_DIR) - 1;
+
+    if (dir_len + name_len + 1 + file_len >= sizeof(path))
+        return 0;
+
+    memcpy(path, NET_SYSFS_DIR, dir_len);
+    memcpy(path + dir_len, string_cdata(name), name_len);
+    path[dir_len + name_len] = '/';
+    memcpy(path + dir_len + name_len + 1, file, file_len + 1);
+
+    char buf[NET_COUNTER_BUFFER_SIZE];
+    u64 size = 0;
+    u64 value = 0;
+
+    if (fd_cache_read_buf(path, buf, sizeof(buf), &size) == ST_OK) {
+        scanner_t sc;
+        scanner_init(&sc, buf, size);
+        scanner_u64(&sc, &value);
+    }
+
+    return value;
+}
+
+/// The link speed in Mbit/s, the only thing rtnetlink doesn't carry. It changes with the link state
+/// only, so it's read without keeping a descriptor. Down links and virtual devices report -1 or
+/// fail with EINVAL, both are 0.
+static u64 net_dev_read_speed(string* name) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), NET_SYSFS_DIR "%.*s/speed", (int)string_size(name), string_cdata(name));
+    if (len < 0 || (u64)len >= sizeof(path))
+        return 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    char buf[NET_COUNTER_BUFFER_SIZE];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    u64 speed = 0;
+    if (n > 0 && buf[0] != '-') {
+        scanner_t sc;
+        scanner_init(&sc, buf, (u64)n);
+        scanner_u64(&sc, &speed);
+    }
+
+    return speed;
+}
+
+static net_dev_t* net_dev_alloc(list_t* devs, const char* name, u64 len) {
+    net_dev_t* dev = devs->arena ? arena_alloc(devs->arena, sizeof(net_dev_t)) : zalloc(sizeof(net_dev_t));
+
+    string_init_arena(&dev->name, devs->arena);
+    string_append_se(dev->name, name, name + len);
+    dev->name_hash = dev_index_hash(name, len);
+
+    return dev;
+}
 
 void net_dev_scan(list_t* devs) {
     struct dirent* dir = NULL;
 
-    DIR* d = opendir("/sys/class/net/");
+    DIR* d = opendir(NET_SYSFS_DIR);
 
     if (d) {
         while ((dir = readdir(d))) {
@@ -53,116 +151,742 @@ void net_dev_scan(list_t* devs) {
             if (strcmp(dir->d_name, "..") == 0)
                 continue;
 
-            string* dir_name = NULL;
-            string_create(&dir_name, dir->d_name);
+            net_dev_t* dev = net_dev_alloc(devs, dir->d_name, strlen(dir->d_name));
 
-            net_dev_t* dev = zalloc(sizeof(net_dev_t));
+            dev->ifindex = (u32)net_dev_read_u64(dev->name, "ifindex");
+            dev->mtu = (u32)net_dev_read_u64(dev->name, "mtu");
+            dev->speed = net_dev_read_speed(dev->name);
 
-            // create sysdir
-            string* sysdir = NULL;
-            string_init(&sysdir);
-            string_append(sysdir, "/sys/class/net/");
-            string_add(sysdir, dir_name);
-            string_append(sysdir, "/");
+            for (u64 i = 0; i < NET_STAT_COUNT; ++i)
+                dev->stats.v[i] = net_dev_read_u64(dev->name, g_net_stat_files[i]);
 
-            // set name and sysdir
-            string_dub(dir_name, &dev->name);
-            dev->sysdir = sysdir;
+            // add dev to list
+            list_push_node(devs, &dev->link, dev);
+        }
+
+        closedir(d);
+    }
+}
 
-            // getting stats
+void net_stats_rates(const net_stats_t* __restrict a, const net_stats_t* __restrict b, net_rates_t* rates,
+                     double sample_size) {
+    double per_sec = 1.0 / sample_size;
 
-            dev->mtu = file_read_subdir(sysdir, "mtu");
-            dev->speed = file_read_subdir(sysdir, "speed");
-            string* rx_bytes_s = file_read_subdir(sysdir, "statistics/rx_bytes");
-            string* tx_bytes_s = file_read_subdir(sysdir, "statistics/tx_bytes");
+    // a mask instead of a branch, so the delta loop over the 16 counters is vectorized, the conversion
+    // is kept apart as only AVX-512 has a vector u64 to double
+    u64 delta[NET_STAT_COUNT];
+    for (u64 i = 0; i < NET_STAT_COUNT; ++i)
+        delta[i] = (b->v[i] - a->v[i]) & (0 - (u64)(b->v[i] >= a->v[i]));
 
-            string_to_u64(rx_bytes_s, &dev->rx_bytes);
-            string_to_u64(tx_bytes_s, &dev->tx_bytes);
+    for (u64 i = 0; i < NET_STAT_COUNT; ++i)
+        rates->v[i] = (double)delta[i] * per_sec;
+}
 
-            string_release(rx_bytes_s);
-            string_release(tx_bytes_s);
+static void net_queues_rates(const net_dev_t* a, net_dev_t* b, double sample_size) {
+    if (!a->queues || !b->queues || a->nqueues != b->nqueues)
+        return;
 
-            // add dev to list
-            list_push(devs, dev);
+    double per_sec = 1.0 / sample_size;
 
-            string_release(dir_name);
-        }
+    for (u64 q = 0; q < b->nqueues; ++q) {
+        const u64* va = a->queues[q].v;
+        net_queue_t* qb = &b->queues[q];
 
-        closedir(d);
+        for (u64 i = 0; i < NET_QUEUE_STAT_COUNT; ++i)
+            qb->rate[i] = (double)(qb->v[i] >= va[i] ? qb->v[i] - va[i] : 0) * per_sec;
     }
 }
 
 void net_dev_diff(net_dev_t* __restrict a, net_dev_t* __restrict b, double sample_rate) {
-    u64 drx = b->rx_bytes - a->rx_bytes;
-    u64 dtx = b->tx_bytes - a->tx_bytes;
+    net_stats_rates(&a->stats, &b->stats, &b->rates, sample_rate);
+    net_queues_rates(a, b, sample_rate);
 
-    u64 ispeed = 0;
-    string_to_u64(b->speed, &ispeed);
+    u64 ispeed = b->speed;
     ispeed /= 8; // to megabytes
     ispeed *= 1024 * 1024; // to bytes
 
-    if (!ispeed)
-        string_append(b->speed, "0 Mbits");
+    double pure_rxtx = b->rates.v[NET_RX_BYTES] + b->rates.v[NET_TX_BYTES];
+    b->bandwidth_use = ispeed ? pure_rxtx / (double)ispeed * 100.0 : 0.0;
+}
+
+//============================================================================================================
+// PER-QUEUE COUNTERS
+//============================================================================================================
+
+// a queue index past it is not a queue counter
+#define NET_MAX_QUEUES 1024U
+#define NET_QUEUE_SLOT_NONE 0xFFFFFFFFU
+#define NET_LAYOUTS_CAPACITY 16UL
+// stale layouts dropped per sample, the rest goes with the next one
+#define NET_LAYOUTS_SWEEP 64
+
+bool net_queue_stat_parse(const char* name, u64 len, u32* queue, u32* counter) {
+    const char* p = name;
+    const char* end = name + len;
+
+    if (len < 2)
+        return false;
+
+    bool tx;
+    if (memcmp(p, "rx", 2) == 0)
+        tx = false;
+    else if (memcmp(p, "tx", 2) == 0)
+        tx = true;
     else
-        string_append(b->speed, " Mbits");
+        return false;
+
+    p += 2;
+
+    if (end - p > 7 && memcmp(p, "_queue_", 7) == 0)
+        p += 7;
+    else if (p < end && *p == '-')
+        ++p;
+
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+
+    u32 q = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        q = q * 10 + (u32)(*p++ - '0');
+        if (q >= NET_MAX_QUEUES)
+            return false;
+    }
+
+    if (p == end || (*p != '_' && *p != '.'))
+        return false;
+
+    ++p;
+
+    u64 rest = (u64)(end - p);
+    if (rest == strlen("packets") && memcmp(p, "packets", rest) == 0)
+        *counter = tx ? NET_QUEUE_TX_PACKETS : NET_QUEUE_RX_PACKETS;
+    else if (rest == strlen("bytes") && memcmp(p, "bytes", rest) == 0)
+        *counter = tx ? NET_QUEUE_TX_BYTES : NET_QUEUE_RX_BYTES;
+    else
+        return false;
+
+    *queue = q;
+
+    return true;
+}
+
+static void net_queue_layout_release(net_queue_layout_t* layout) {
+    zfree(layout->slots);
+    zfree(layout->stats);
+    zfree(layout);
+}
+
+static int net_ethtool(net_dev_ctx_t* ctx, net_dev_t* dev, void* cmd) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+
+    u64 len = string_size(dev->name);
+    if (len >= sizeof(ifr.ifr_name))
+        return -1;
+
+    memcpy(ifr.ifr_name, string_cdata(dev->name), len);
+    ifr.ifr_data = cmd;
+
+    return ioctl(ctx->ethtool_fd, SIOCETHTOOL, &ifr);
+}
+
+/// an empty layout is kept as well, a driver without queue counters isn't asked again
+static net_queue_layout_t* net_queue_layout_load(net_dev_ctx_t* ctx, net_dev_t* dev) {
+    net_queue_layout_t* layout = zalloc(sizeof(net_queue_layout_t));
+
+    struct ethtool_drvinfo info;
+    memset(&info, 0, sizeof(info));
+    info.cmd = ETHTOOL_GDRVINFO;
+
+    if (net_ethtool(ctx, dev, &info) != 0 || info.n_stats == 0)
+        return layout;
+
+    struct ethtool_gstrings* strings = zalloc(sizeof(struct ethtool_gstrings) + info.n_stats * ETH_GSTRING_LEN);
+    strings->cmd = ETHTOOL_GSTRINGS;
+    strings->string_set = ETH_SS_STATS;
+    strings->len = info.n_stats;
+
+    if (net_ethtool(ctx, dev, strings) == 0 && strings->len == info.n_stats) {
+        layout->slots = zalloc(info.n_stats * sizeof(u32));
+
+        for (u32 i = 0; i < info.n_stats; ++i) {
+            const char* name = (const char*)strings->data + (u64)i * ETH_GSTRING_LEN;
+            u32 queue;
+            u32 counter;
+
+            if (net_queue_stat_parse(name, strnlen(name, ETH_GSTRING_LEN), &queue, &counter)) {
+                layout->slots[i] = queue * NET_QUEUE_STAT_COUNT + counter;
+                if (queue >= layout->nqueues)
+                    layout->nqueues = queue + 1;
+            } else {
+                layout->slots[i] = NET_QUEUE_SLOT_NONE;
+            }
+        }
+    }
+
+    zfree(strings);
+
+    if (layout->nqueues) {
+        layout->n_stats = info.n_stats;
+        // the kernel writes as many values as the driver has now, not as many as asked for,
+        // the slack covers a driver that has grown its stats since the names were read
+        layout->stats = zalloc(sizeof(struct ethtool_stats) + 2 * info.n_stats * sizeof(u64));
+    } else {
+        zfree(layout->slots);
+        layout->slots = NULL;
+    }
+
+    return layout;
+}
+
+typedef struct net_layouts_sweep {
+    u64 keys[NET_LAYOUTS_SWEEP];
+    u64 count;
+    u32 generation;
+    u32 reserved;
+} net_layouts_sweep_t;
+
+static void net_layouts_stale_cb(u64 key, void* value, void* ctx) {
+    net_layouts_sweep_t* sweep = (net_layouts_sweep_t*)ctx;
+    net_queue_layout_t* layout = *(net_queue_layout_t**)value;
+
+    if (layout->seen != sweep->generation && sweep->count < NET_LAYOUTS_SWEEP)
+        sweep->keys[sweep->count++] = key;
+}
+
+static void net_layouts_release_cb(u64 key, void* value, void* ctx) {
+    net_queue_layout_release(*(net_queue_layout_t**)value);
+}
+
+static void net_queues_read(net_dev_ctx_t* ctx, net_dev_t* dev, arena_t* arena) {
+    net_queue_layout_t** slot = flat_map_get(ctx->layouts, dev->ifindex);
+    net_queue_layout_t* layout = slot ? *slot : NULL;
+
+    if (!layout) {
+        layout = net_queue_layout_load(ctx, dev);
+        flat_map_put(ctx->layouts, dev->ifindex, &layout);
+    }
+
+    layout->seen = ctx->generation;
+
+    if (!layout->nqueues)
+        return;
+
+    layout->stats->cmd = ETHTOOL_GSTATS;
+    layout->stats->n_stats = layout->n_stats;
+
+    if (net_ethtool(ctx, dev, layout->stats) != 0 || layout->stats->n_stats != layout->n_stats) {
+        // the channels have changed, the names are read again on the next sample
+        layout->seen = 0;
+        return;
+    }
+
+    dev->nqueues = layout->nqueues;
+    dev->queues = arena ? arena_alloc(arena, dev->nqueues * sizeof(net_queue_t))
+                        : zalloc(dev->nqueues * sizeof(net_queue_t));
+
+    for (u32 i = 0; i < layout->n_stats; ++i) {
+        u32 s = layout->slots[i];
+        if (s != NET_QUEUE_SLOT_NONE)
+            dev->queues[s / NET_QUEUE_STAT_COUNT].v[s % NET_QUEUE_STAT_COUNT] = layout->stats->data[i];
+    }
+}
 
-    double pure_rxtx = (double)(drx + dtx) / sample_rate;
-    b->bandwidth_use = pure_rxtx / (double)ispeed;
+void net_queues_update(net_dev_ctx_t* ctx, list_t* devs) {
+    if (ctx->ethtool_fd < 0)
+        return;
 
-    if (isnan(b->bandwidth_use))
-        b->bandwidth_use = 0.0;
+    ++ctx->generation;
 
-    b->rx_speed = drx / sample_rate;
-    b->tx_speed = dtx / sample_rate;
+    list_iter_t it;
+    list_iter_begin(devs, &it);
+
+    net_dev_t* dev;
+    while ((dev = list_iter_next(&it))) {
+        // a veth or a single queue NIC has nothing to add to the link counters
+        if (dev->rx_queues > 1 || dev->tx_queues > 1)
+            net_queues_read(ctx, dev, devs->arena);
+    }
+
+    net_layouts_sweep_t sweep;
+    sweep.count = 0;
+    sweep.generation = ctx->generation;
+    flat_map_foreach(ctx->layouts, &net_layouts_stale_cb, &sweep);
+
+    for (u64 i = 0; i < sweep.count; ++i) {
+        net_queue_layout_t** slot = flat_map_get(ctx->layouts, sweep.keys[i]);
+        net_queue_layout_release(*slot);
+        flat_map_del(ctx->layouts, sweep.keys[i]);
+    }
+}
+
+//============================================================================================================
+// RTNETLINK LINK DUMP
+//============================================================================================================
+
+// the kernel fills a dump message up to 32K, a larger buffer takes a few of them per recv
+#define NET_LINK_BUFFER_SIZE (64 * KiB)
+
+typedef struct net_link_request {
+    struct nlmsghdr hdr;
+    struct ifinfomsg ifi;
+} net_link_request_t;
+
+/// the attributes of an RTM_NEWLINK payload, the headers are copied out as the buffer has no alignment
+/// guarantee past the netlink header
+static void net_link_parse_link(const u8* msg, u64 size, list_t* devs) {
+    if (size < NLMSG_ALIGN(sizeof(struct ifinfomsg)))
+        return;
+
+    struct ifinfomsg ifi;
+    memcpy(&ifi, msg, sizeof(ifi));
+
+    const char* name = NULL;
+    u64 name_len = 0;
+    u32 mtu = 0;
+    u32 carrier_changes = 0;
+    u32 rx_queues = 0;
+    u32 tx_queues = 0;
+    u8 operstate = IF_OPER_UNKNOWN;
+    struct rtnl_link_stats64 stats;
+    memset(&stats, 0, sizeof(stats));
+
+    u64 off = NLMSG_ALIGN(sizeof(struct ifinfomsg));
+    while (off + sizeof(struct rtattr) <= size) {
+        struct rtattr rta;
+        memcpy(&rta, msg + off, sizeof(rta));
+
+        if (rta.rta_len < sizeof(struct rtattr) || off + rta.rta_len > size)
+            break;
+
+        const u8* data = msg + off + RTA_LENGTH(0);
+        u64 len = rta.rta_len - RTA_LENGTH(0);
+
+        switch (rta.rta_type & NLA_TYPE_MASK) {
+            case IFLA_IFNAME:
+                name = (const char*)data;
+                name_len = strnlen(name, len);
+                break;
+            case IFLA_MTU:
+                if (len >= sizeof(mtu))
+                    memcpy(&mtu, data, sizeof(mtu));
+                break;
+            case IFLA_OPERSTATE:
+                if (len >= sizeof(operstate))
+                    operstate = *data;
+                break;
+            case IFLA_CARRIER_CHANGES:
+                if (len >= sizeof(carrier_changes))
+                    memcpy(&carrier_changes, data, sizeof(carrier_changes));
+                break;
+            case IFLA_NUM_RX_QUEUES:
+                if (len >= sizeof(rx_queues))
+                    memcpy(&rx_queues, data, sizeof(rx_queues));
+                break;
+            case IFLA_NUM_TX_QUEUES:
+                if (len >= sizeof(tx_queues))
+                    memcpy(&tx_queues, data, sizeof(tx_queues));
+                break;
+            case IFLA_STATS64:
+                // older kernels send a shorter struct, the missing counters stay 0
+                memcpy(&stats, data, len < sizeof(stats) ? len : sizeof(stats));
+                break;
+            default:
+                break;
+        }
+
+        off += RTA_ALIGN(rta.rta_len);
+    }
+
+    if (!name || name_len == 0)
+        return;
+
+    net_dev_t* dev = net_dev_alloc(devs, name, name_len);
+    dev->ifindex = (u32)ifi.ifi_index;
+    dev->mtu = mtu;
+    dev->operstate = operstate;
+    dev->rx_queues = rx_queues;
+    dev->tx_queues = tx_queues;
+
+    // the first ten are laid out the same
+    _Static_assert(offsetof(struct rtnl_link_stats64, collisions) == NET_COLLISIONS * sizeof(u64),
+                   "net_stats_t doesn't follow rtnl_link_stats64");
+    memcpy(dev->stats.v, &stats, (NET_COLLISIONS + 1) * sizeof(u64));
+    dev->stats.v[NET_RX_OVER_ERRORS] = stats.rx_over_errors;
+    dev->stats.v[NET_RX_FIFO_ERRORS] = stats.rx_fifo_errors;
+    dev->stats.v[NET_RX_MISSED_ERRORS] = stats.rx_missed_errors;
+    dev->stats.v[NET_TX_FIFO_ERRORS] = stats.tx_fifo_errors;
+    dev->stats.v[NET_TX_CARRIER_ERRORS] = stats.tx_carrier_errors;
+    dev->stats.v[NET_CARRIER_CHANGES] = carrier_changes;
+
+    list_push_node(devs, &dev->link, dev);
+}
+
+ret_t net_link_parse(const u8* buf, u64 size, u32 seq, list_t* devs, int* error) {
+    u64 off = 0;
+    *error = 0;
+
+    while (off + sizeof(struct nlmsghdr) <= size) {
+        struct nlmsghdr hdr;
+        memcpy(&hdr, buf + off, sizeof(hdr));
+
+        if (hdr.nlmsg_len < sizeof(struct nlmsghdr) || off + hdr.nlmsg_len > size)
+            return ST_ERR;
+
+        // skips what's left of a dump that has been given up on
+        if (hdr.nlmsg_seq == seq) {
+            if (hdr.nlmsg_type == NLMSG_DONE)
+                return ST_EMPTY;
+
+            if (hdr.nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr err;
+                memset(&err, 0, sizeof(err));
+                memcpy(&err, buf + off + NLMSG_HDRLEN,
+                       hdr.nlmsg_len - NLMSG_HDRLEN < sizeof(err) ? hdr.nlmsg_len - NLMSG_HDRLEN : sizeof(err));
+                *error = err.error ? -err.error : EPROTO;
+                return ST_ERR;
+            }
+
+            if (hdr.nlmsg_type == RTM_NEWLINK)
+                net_link_parse_link(buf + off + NLMSG_HDRLEN, hdr.nlmsg_len - NLMSG_HDRLEN, devs);
+        }
+
+        off += NLMSG_ALIGN(hdr.nlmsg_len);
+    }
+
+    return ST_OK;
+}
+
+ret_t net_link_dump(net_dev_ctx_t* ctx, list_t* devs) {
+    net_link_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.hdr.nlmsg_type = RTM_GETLINK;
+    req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.hdr.nlmsg_seq = ++ctx->seq;
+    req.ifi.ifi_family = AF_UNSPEC;
+
+    if (send(ctx->nl_fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+        LOG_WARN("RTM_GETLINK send failed: %s", strerror(errno));
+        return ST_ERR;
+    }
+
+    while (true) {
+        ssize_t n = recv(ctx->nl_fd, ctx->buf, NET_LINK_BUFFER_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_WARN("RTM_GETLINK recv failed: %s", strerror(errno));
+            return ST_ERR;
+        }
+
+        if (n == 0)
+            return ST_ERR;
+
+        int error = 0;
+        ret_t ret = net_link_parse(ctx->buf, (u64)n, ctx->seq, devs, &error);
+        if (ret == ST_EMPTY)
+            return ST_OK;
+
+        // the answer won't change, asking again every sample only costs a round trip
+        if (error) {
+            LOG_WARN("RTM_GETLINK failed: %s, the interfaces are read from sysfs", strerror(error));
+            close(ctx->nl_fd);
+            ctx->nl_fd = -1;
+        }
+
+        if (ret != ST_OK)
+            return ret;
+    }
 }
 
 //============================================================================================================
 // NET DEVICE SAMPLING
 //============================================================================================================
 
-void net_dev_get(list_t** devs) {
-    list_init(devs, &net_dev_release_cb);
+void net_dev_ctx_release_cb(void* p) {
+    net_dev_ctx_t* ctx = (net_dev_ctx_t*)p;
+
+    if (ctx->nl_fd >= 0)
+        close(ctx->nl_fd);
+
+    if (ctx->ethtool_fd >= 0)
+        close(ctx->ethtool_fd);
 
-    net_dev_scan(*devs);
+    flat_map_foreach(ctx->layouts, &net_layouts_release_cb, NULL);
+    flat_map_release(ctx->layouts);
+
+    zfree(ctx->buf);
+    dev_index_release(ctx->index);
+    zfree(ctx);
 }
 
-void net_dev_sample(double sample_size_sec, sampled_device_cb cb) {
-    list_t* devs_a = NULL;
-    list_t* devs_b = NULL;
+// a dozen interfaces fit into one chunk
+#define NET_ARENA_CHUNK_SIZE (8 * KiB)
+
+void net_dev_get(net_dev_ctx_t* ctx, list_t** devs) {
+    arena_t* arena = NULL;
+    arena_init(&arena, NET_ARENA_CHUNK_SIZE);
+
+    // the devices go with the arena, there's nothing to release one by one
+    list_init_intrusive(devs, arena, NULL);
+
+    if (ctx->nl_fd < 0 || net_link_dump(ctx, *devs) != ST_OK) {
+        // a dump that failed half way leaves its interfaces behind, start over
+        list_arena_release_cb(*devs);
+        arena_init(&arena, NET_ARENA_CHUNK_SIZE);
+        list_init_intrusive(devs, arena, NULL);
+
+        net_dev_scan(*devs);
+    } else {
+        // the index still points at the previous snapshot, the speed of a link that kept its state is reused
+        list_iter_t it;
+        list_iter_begin(*devs, &it);
+
+        net_dev_t* dev;
+        while ((dev = list_iter_next(&it))) {
+            net_dev_t* prev = dev_index_get(ctx->index, dev->name_hash,
+                                            string_cdata(dev->name), string_size(dev->name));
+
+            if (prev && prev->ifindex == dev->ifindex && prev->operstate == dev->operstate)
+                dev->speed = prev->speed;
+            else
+                dev->speed = net_dev_read_speed(dev->name);
+        }
 
-    net_dev_get(&devs_a);
+        net_queues_update(ctx, *devs);
+    }
 
-#ifndef HW_NO_SLEEP
-    nsleepd(sample_size_sec);
-#endif
+    dev_index_build(ctx->index, *devs);
+}
 
-    net_dev_get(&devs_b);
+static void net_dev_scan_cb(void* ctx, void** snapshot) {
+    net_dev_get((net_dev_ctx_t*)ctx, (list_t**)snapshot);
+}
 
-    list_iter_t* it = NULL;
-    list_iter_init(devs_a, &it);
+void net_devs_diff(void* ctx, void* __restrict prev, void* __restrict cur, double sample_size_sec) {
+    // the index has been built over cur by the scan that produced it
+    dev_index_t* index = ((net_dev_ctx_t*)ctx)->index;
+    list_t* devs_a = (list_t*)prev;
+
+    list_iter_t it;
+    list_iter_begin(devs_a, &it);
 
     net_dev_t* dev_a;
-    net_dev_t* dev_b;
-    while ((dev_a = list_iter_next(it))) {
-        list_iter_t* it2 = NULL;
-        list_iter_init(devs_b, &it2);
-
-        while ((dev_b = list_iter_next(it2))) {
-            if (string_compare(dev_a->name, dev_b->name) == ST_OK) {
-                net_dev_diff(dev_a, dev_b, sample_size_sec);
-                break;
-            }
+    while ((dev_a = list_iter_next(&it))) {
+        net_dev_t* dev_b = dev_index_get(index, dev_a->name_hash, string_cdata(dev_a->name), string_size(dev_a->name));
+        if (dev_b)
+            net_dev_diff(dev_a, dev_b, sample_size_sec);
+    }
+}
 
-        }
+ret_t net_dev_sampler_init(sampler_t** s, sampler_publish_cb cb) {
+    net_dev_ctx_t* ctx = zalloc(sizeof(net_dev_ctx_t));
+    dev_index_init(&ctx->index, &net_dev_key_cb, &net_dev_name_cb);
+
+    ctx->nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (ctx->nl_fd < 0)
+        LOG_WARN("can't open rtnetlink socket, the interfaces are read from sysfs");
+    else
+        ctx->buf = zalloc(NET_LINK_BUFFER_SIZE);
+
+    ctx->ethtool_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    flat_map_init(&ctx->layouts, sizeof(net_queue_layout_t*), NET_LAYOUTS_CAPACITY);
+
+    return sampler_init(s, ctx, &net_dev_ctx_release_cb, &net_dev_scan_cb, &net_devs_diff, cb, &list_arena_release_cb);
+}
+
+#ifndef NDEBUG
 
-        list_iter_release(it2);
+static u64 test_net_link_attr(u8* buf, u64 off, u16 type, const void* data, u64 len) {
+    struct rtattr rta;
+    rta.rta_len = (u16)RTA_LENGTH(len);
+    rta.rta_type = type;
+    memcpy(buf + off, &rta, sizeof(rta));
+    memcpy(buf + off + RTA_LENGTH(0), data, len);
+
+    return off + RTA_ALIGN(rta.rta_len);
+}
+
+static u64 test_net_link_msg(u8* buf, u64 off, u32 seq, int index, const char* name, u32 mtu, u64 rx, u64 tx) {
+    u64 start = off;
+    off += NLMSG_HDRLEN;
+
+    struct ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_index = index;
+    memcpy(buf + off, &ifi, sizeof(ifi));
+    off += NLMSG_ALIGN(sizeof(ifi));
+
+    struct rtnl_link_stats64 stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.rx_bytes = rx;
+    stats.tx_bytes = tx;
+    stats.rx_packets = 5;
+    stats.tx_fifo_errors = 3;
+    u8 operstate = IF_OPER_UP;
+    u32 carrier_changes = 2;
+    u32 queues = 4;
+
+    off = test_net_link_attr(buf, off, IFLA_IFNAME, name, strlen(name) + 1);
+    off = test_net_link_attr(buf, off, IFLA_MTU, &mtu, sizeof(mtu));
+    off = test_net_link_attr(buf, off, IFLA_OPERSTATE, &operstate, sizeof(operstate));
+    off = test_net_link_attr(buf, off, IFLA_STATS64, &stats, sizeof(stats));
+    off = test_net_link_attr(buf, off, IFLA_CARRIER_CHANGES, &carrier_changes, sizeof(carrier_changes));
+    off = test_net_link_attr(buf, off, IFLA_NUM_RX_QUEUES, &queues, sizeof(queues));
+
+    struct nlmsghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.nlmsg_len = (u32)(off - start);
+    hdr.nlmsg_type = RTM_NEWLINK;
+    hdr.nlmsg_seq = seq;
+    memcpy(buf + start, &hdr, sizeof(hdr));
+
+    return off;
+}
+
+static u64 test_net_link_done(u8* buf, u64 off, u32 seq, u16 type, int error) {
+    struct nlmsghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.nlmsg_len = NLMSG_LENGTH(sizeof(int));
+    hdr.nlmsg_type = type;
+    hdr.nlmsg_seq = seq;
+    memcpy(buf + off, &hdr, sizeof(hdr));
+    memcpy(buf + off + NLMSG_HDRLEN, &error, sizeof(error));
+
+    return off + NLMSG_ALIGN(hdr.nlmsg_len);
+}
+
+void test_net_link_parse(void) {
+    u8 buf[2048];
+    memset(buf, 0, sizeof(buf));
+
+    // a stale message of the previous dump, two interfaces, then the end of the dump
+    u64 off = test_net_link_msg(buf, 0, 6, 9, "old0", 1500, 1, 1);
+    off = test_net_link_msg(buf, off, 7, 1, "lo", 65536, 1000, 1000);
+    u64 first = off;
+    off = test_net_link_msg(buf, off, 7, 42, "veth1234", 1500, 5000000000ULL, 77);
+    off = test_net_link_done(buf, off, 7, NLMSG_DONE, 0);
+
+    arena_t* arena = NULL;
+    arena_init(&arena, 4 * KiB);
+    list_t* devs = NULL;
+    list_init_intrusive(&devs, arena, NULL);
+
+    // a dump spans several reads
+    int error = 0;
+    ASSERT(net_link_parse(buf, first, 7, devs, &error) == ST_OK);
+    ASSERT(devs->size == 1);
+    ASSERT(net_link_parse(buf + first, off - first, 7, devs, &error) == ST_EMPTY);
+    ASSERT(error == 0);
+    ASSERT(devs->size == 2);
+
+    net_dev_t* lo = list_pop_head(devs);
+    ASSERT(string_comparez(lo->name, "lo") == ST_OK);
+    ASSERT(lo->ifindex == 1 && lo->mtu == 65536 && lo->stats.v[NET_RX_BYTES] == 1000);
+
+    net_dev_t* veth = list_pop_head(devs);
+    ASSERT(string_comparez(veth->name, "veth1234") == ST_OK);
+    ASSERT(veth->name_hash == dev_index_hash("veth1234", 8));
+    ASSERT(veth->ifindex == 42 && veth->operstate == IF_OPER_UP);
+    ASSERT(veth->stats.v[NET_RX_BYTES] == 5000000000ULL && veth->stats.v[NET_TX_BYTES] == 77);
+    ASSERT(veth->stats.v[NET_RX_PACKETS] == 5 && veth->stats.v[NET_TX_FIFO_ERRORS] == 3);
+    ASSERT(veth->stats.v[NET_CARRIER_CHANGES] == 2 && veth->rx_queues == 4);
+
+    // an error answer and a truncated message fail the dump
+    off = test_net_link_done(buf, 0, 8, NLMSG_ERROR, -EPERM);
+    ASSERT(net_link_parse(buf, off, 8, devs, &error) == ST_ERR);
+    ASSERT(error == EPERM);
+
+    off = test_net_link_msg(buf, 0, 9, 3, "eth0", 1500, 0, 0);
+    ASSERT(net_link_parse(buf, off - 8, 9, devs, &error) == ST_ERR);
+    ASSERT(error == 0);
+
+    // a refused dump closes the socket, a socket pair plays the kernel
+    int pair[2];
+    ASSERT(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == 0);
+
+    net_dev_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.nl_fd = pair[0];
+    ctx.seq = 10;
+    ctx.buf = zalloc(NET_LINK_BUFFER_SIZE);
+
+    off = test_net_link_done(buf, 0, 11, NLMSG_ERROR, -EPERM);
+    ASSERT(send(pair[1], buf, off, 0) == (ssize_t)off);
+
+    ASSERT(net_link_dump(&ctx, devs) == ST_ERR);
+    ASSERT(ctx.nl_fd == -1);
+
+    zfree(ctx.buf);
+    close(pair[1]);
+
+    list_arena_release_cb(devs);
+}
+
+void test_net_stats_rates(void) {
+    net_dev_t a;
+    net_dev_t b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+
+    for (u64 i = 0; i < NET_STAT_COUNT; ++i) {
+        a.stats.v[i] = 1000 * i;
+        b.stats.v[i] = 1000 * i + 4 * i;
+    }
+
+    // a counter reset by the driver
+    b.stats.v[NET_RX_DROPPED] = 0;
+    // 1 Gbit/s
+    b.speed = 1000;
+
+    net_queue_t qa[2];
+    net_queue_t qb[2];
+    memset(qa, 0, sizeof(qa));
+    memset(qb, 0, sizeof(qb));
+    qb[1].v[NET_QUEUE_RX_BYTES] = 1024;
+    a.queues = qa;
+    b.queues = qb;
+    a.nqueues = b.nqueues = 2;
+
+    net_dev_diff(&a, &b, 2.0);
+
+    for (u64 i = 0; i < NET_STAT_COUNT; ++i) {
+        if (i != NET_RX_DROPPED)
+            ASSERT((u64)b.rates.v[i] == 2 * i);
     }
 
-    list_iter_release(it);
+    ASSERT((u64)b.rates.v[NET_RX_DROPPED] == 0);
+    ASSERT((u64)qb[1].rate[NET_QUEUE_RX_BYTES] == 512 && (u64)qb[0].rate[NET_QUEUE_RX_BYTES] == 0);
+
+    // 10 B/s of 125 MiB/s
+    ASSERT(b.bandwidth_use > 0.0 && b.bandwidth_use < 0.0001);
+
+    b.speed = 0;
+    net_dev_diff(&a, &b, 2.0);
+    ASSERT((u64)b.bandwidth_use == 0);
+}
+
+void test_net_queue_stat_parse(void) {
+    u32 q;
+    u32 c;
+
+#define TEST_QUEUE_STAT(name) net_queue_stat_parse(name, strlen(name), &q, &c)
 
-    list_release(devs_a, true);
+    ASSERT(TEST_QUEUE_STAT("rx_queue_3_packets") && q == 3 && c == NET_QUEUE_RX_PACKETS);
+    ASSERT(TEST_QUEUE_STAT("tx-12.bytes") && q == 12 && c == NET_QUEUE_TX_BYTES);
+    ASSERT(TEST_QUEUE_STAT("rx0_bytes") && q == 0 && c == NET_QUEUE_RX_BYTES);
+    ASSERT(TEST_QUEUE_STAT("tx_queue_0_packets") && q == 0 && c == NET_QUEUE_TX_PACKETS);
 
-    if (cb)
-        cb(devs_b);
+    ASSERT(!TEST_QUEUE_STAT("rx_packets"));
+    ASSERT(!TEST_QUEUE_STAT("rx0_drops"));
+    ASSERT(!TEST_QUEUE_STAT("rx_queue_0_xdp_packets"));
+    ASSERT(!TEST_QUEUE_STAT("rx_queue_99999_bytes"));
+    ASSERT(!TEST_QUEUE_STAT("tx"));
+    ASSERT(!TEST_QUEUE_STAT("mc_packets"));
 
+#undef TEST_QUEUE_STAT
 }
+
+#endif
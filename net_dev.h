@@ -18,35 +18,180 @@
 #pragma once
 
 #include "string.h"
+#include "double_linked_list.h"
+#include "sampler.h"
+#include "dev_index.h"
+#include "flat_map.h"
 
 //============================================================================================================
 // NET DEVICE
 //============================================================================================================
 
+/// the interface counters, the first ten in the order of struct rtnl_link_stats64
+enum {
+    NET_RX_PACKETS = 0,
+    NET_TX_PACKETS,
+    NET_RX_BYTES,
+    NET_TX_BYTES,
+    NET_RX_ERRORS,
+    NET_TX_ERRORS,
+    NET_RX_DROPPED,
+    NET_TX_DROPPED,
+    NET_MULTICAST,
+    NET_COLLISIONS,
+    // the errors that tell an overrun ring from a bad link
+    NET_RX_OVER_ERRORS,
+    NET_RX_FIFO_ERRORS,
+    NET_RX_MISSED_ERRORS,
+    NET_TX_FIFO_ERRORS,
+    NET_TX_CARRIER_ERRORS,
+    NET_CARRIER_CHANGES,
+    NET_STAT_COUNT
+};
+
+/// all 64-bit, so the delta and rate stage is one loop over the array
+typedef struct net_stats {
+    u64 v[NET_STAT_COUNT];
+} net_stats_t;
+
+/// per second over the last sample
+typedef struct net_rates {
+    double v[NET_STAT_COUNT];
+} net_rates_t;
+
+enum {
+    NET_QUEUE_RX_PACKETS = 0,
+    NET_QUEUE_RX_BYTES,
+    NET_QUEUE_TX_PACKETS,
+    NET_QUEUE_TX_BYTES,
+    NET_QUEUE_STAT_COUNT
+};
+
+/// the counters of one queue pair as the driver reports them through ethtool
+typedef struct net_queue {
+    u64 v[NET_QUEUE_STAT_COUNT];
+    double rate[NET_QUEUE_STAT_COUNT];
+} net_queue_t;
+
+/// a scanned interface and all of its strings live in the arena of the snapshot list
 typedef struct net_dev {
     string* name;
-    string* sysdir;
-    u64 rx_bytes;
-    u64 tx_bytes;
-    double tx_speed;
-    double rx_speed;
-    string* speed;
-    string* mtu;
+    u64 name_hash;
+    net_stats_t stats;
+    net_rates_t rates;
+    // nqueues of them in the arena, NULL unless it's a multiqueue NIC with per-queue counters
+    net_queue_t* queues;
+    u32 nqueues;
+    u32 rx_queues;
+    u32 tx_queues;
+    u32 mtu;
+    // Mbit/s as sysfs reports it, 0 when the driver doesn't know
+    u64 speed;
+    u32 ifindex;
+    // IF_OPER_* of linux/if.h
+    u8 operstate;
+    u8 reserved[3];
     double bandwidth_use;
+    // the device lists are intrusive
+    list_node_t link;
 } net_dev_t;
 
 void net_dev_release_cb(void* p);
 
+u64 net_dev_key_cb(void* p);
+
+string* net_dev_name_cb(void* p);
+
+/// the sysfs fallback when there's no rtnetlink, @devs must be intrusive,
+/// the interfaces are linked through their own node
 void net_dev_scan(list_t* devs);
 
+/// b - a per second over all the counters, a counter that went backwards (the driver reset it) is 0
+void net_stats_rates(const net_stats_t* __restrict a, const net_stats_t* __restrict b, net_rates_t* rates,
+                     double sample_size);
+
 void net_dev_diff(net_dev_t* __restrict a, net_dev_t* __restrict b, double sample_rate);
 
+#ifndef NDEBUG
+
+void test_net_stats_rates(void);
+
+#endif
+
 //============================================================================================================
 // NET DEVICE SAMPLING
 //============================================================================================================
 
-void net_dev_get(list_t** devs);
+typedef struct net_dev_ctx {
+    // devices of the latest scan by name hash, the previous snapshot while the next one is scanned
+    dev_index_t* index;
+    // receives the RTM_GETLINK dumps, -1 falls back to sysfs
+    u8* buf;
+    int nl_fd;
+    u32 seq;
+    // ethtool ioctls go through it
+    int ethtool_fd;
+    u32 generation;
+    // the per-queue counter layouts by ifindex
+    flat_map_t* layouts;
+} net_dev_ctx_t;
+
+//============================================================================================================
+// PER-QUEUE COUNTERS
+//============================================================================================================
+
+/// Where the queue counters are among the ethtool stats of a driver. The stat names are read once per
+/// interface, a sample takes a single ETHTOOL_GSTATS.
+typedef struct net_queue_layout {
+    u32 n_stats;
+    u32 nqueues;
+    // for every ethtool stat, queue * NET_QUEUE_STAT_COUNT + counter, U32_MAX if it's not a queue counter
+    u32* slots;
+    // ETHTOOL_GSTATS request and answer, n_stats values
+    struct ethtool_stats* stats;
+    u32 seen;
+    u32 reserved;
+} net_queue_layout_t;
+
+/// recognizes rx_queue_<n>_packets (virtio, ixgbe, igb), rx-<n>.bytes (i40e, ice) and rx<n>_packets (mlx5)
+/// and the tx ones
+bool net_queue_stat_parse(const char* name, u64 len, u32* queue, u32* counter);
+
+/// fills the queues of the multiqueue interfaces, the layouts of the interfaces gone are forgotten
+void net_queues_update(net_dev_ctx_t* ctx, list_t* devs);
+
+#ifndef NDEBUG
+
+void test_net_queue_stat_parse(void);
+
+#endif
+
+//============================================================================================================
+// RTNETLINK LINK DUMP
+//============================================================================================================
+
+/// Parses one recv() worth of an RTM_GETLINK dump, an interface for every RTM_NEWLINK message of @seq.
+/// The interfaces are drawn from the arena of @devs, @error gets the errno of an error answer.
+/// \return ST_OK if more messages follow, ST_EMPTY at the end of the dump, ST_ERR on an error message
+ret_t net_link_parse(const u8* buf, u64 size, u32 seq, list_t* devs, int* error);
+
+/// The name, index, MTU, operational state and byte counters of every interface in one dump. The kernel
+/// refusing the dump (EPERM in a restricted container) closes the socket, the interfaces are read from
+/// sysfs from then on.
+ret_t net_link_dump(net_dev_ctx_t* ctx, list_t* devs);
+
+#ifndef NDEBUG
+
+void test_net_link_parse(void);
+
+#endif
+
+void net_dev_ctx_release_cb(void* p);
+
+/// the list, the interfaces and their strings are drawn from an arena of their own,
+/// list_arena_release_cb releases the lot
+void net_dev_get(net_dev_ctx_t* ctx, list_t** devs);
 
-typedef void(* sampled_device_cb)(list_t*);
+void net_devs_diff(void* ctx, void* __restrict prev, void* __restrict cur, double sample_size_sec);
 
-void net_dev_sample(double sample_size_sec, sampled_device_cb cb);
+ret_t net_dev_sampler_init(sampler_t** s, sampler_publish_cb cb);
@@ -0,0 +1,91 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include "sampler.h"
+#include "allocators.h"
+#include "timer.h"
+#include "log.h"
+
+ret_t sampler_init(sampler_t** s,
+                   void* ctx,
+                   data_release_cb ctx_rel_cb,
+                   sampler_scan_cb scan,
+                   sampler_diff_cb diff,
+                   sampler_publish_cb publish,
+                   data_release_cb rel_cb) {
+    *s = zalloc(sizeof(sampler_t));
+    sampler_t* smp = *s;
+    smp->ctx = ctx;
+    smp->ctx_rel_cb = ctx_rel_cb;
+    smp->scan = scan;
+    smp->diff = diff;
+    smp->publish = publish;
+    smp->rel_cb = rel_cb;
+
+    return ST_OK;
+}
+
+static void sampler_drop(sampler_t* s, void* snapshot) {
+    if (s->epoch)
+        epoch_retire(s->epoch, snapshot, s->rel_cb);
+    else
+        s->rel_cb(snapshot);
+}
+
+void sampler_release(sampler_t* s) {
+    if (!s)
+        return;
+
+    if (s->prev)
+        sampler_drop(s, s->prev);
+
+    if (s->ctx_rel_cb)
+        s->ctx_rel_cb(s->ctx);
+
+    zfree(s);
+}
+
+void sampler_set_epoch(sampler_t* s, epoch_t* e) {
+    s->epoch = e;
+}
+
+void sampler_step(sampler_t* s) {
+    void* cur = NULL;
+
+    struct timespec now = timer_start();
+    s->scan(s->ctx, &cur);
+
+    if (!cur) {
+        LOG_ERROR("scan returned an empty snapshot");
+        return;
+    }
+
+    if (s->prev) {
+        double elapsed = timer_diff_sec(s->prev_time, now);
+        if (elapsed > 0.0 && s->diff)
+            s->diff(s->ctx, s->prev, cur, elapsed);
+    }
+
+    if (s->publish)
+        s->publish(cur);
+
+    if (s->prev)
+        sampler_drop(s, s->prev);
+
+    s->prev = cur;
+    s->prev_time = now;
+}
@@ -0,0 +1,67 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include <time.h>
+
+#include "globals.h"
+#include "epoch.h"
+
+//============================================================================================================
+// DELTA SAMPLING ENGINE
+//============================================================================================================
+
+/// Takes a fresh snapshot of the collector's counters
+typedef void(* sampler_scan_cb)(void* ctx, void** snapshot);
+
+/// Fills the derived values (speeds, loads) of @cur from the counter deltas against @prev
+typedef void(* sampler_diff_cb)(void* ctx, void* __restrict prev, void* __restrict cur, double elapsed_sec);
+
+/// Hands a diffed snapshot to the consumer. The snapshot stays owned by the sampler and is retired right
+/// after the next one has been published, so the consumer must drop its reference on the next call.
+typedef void(* sampler_publish_cb)(void* snapshot);
+
+typedef struct sampler {
+    void* ctx;
+    data_release_cb ctx_rel_cb;
+    void* prev;
+    struct timespec prev_time;
+    sampler_scan_cb scan;
+    sampler_diff_cb diff;
+    sampler_publish_cb publish;
+    data_release_cb rel_cb;
+    // defers the release of published snapshots while readers may still hold them
+    epoch_t* epoch;
+} sampler_t;
+
+/// \param ctx collector state passed to the callbacks, released with @ctx_rel_cb (if any) with the sampler
+ret_t sampler_init(sampler_t** s,
+                   void* ctx,
+                   data_release_cb ctx_rel_cb,
+                   sampler_scan_cb scan,
+                   sampler_diff_cb diff,
+                   sampler_publish_cb publish,
+                   data_release_cb rel_cb);
+
+void sampler_release(sampler_t* s);
+
+/// published snapshots are retired to @e instead of being released right away
+void sampler_set_epoch(sampler_t* s, epoch_t* e);
+
+/// One scan per call: the new snapshot is diffed against the one kept from the previous call
+void sampler_step(sampler_t* s);
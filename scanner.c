@@ -0,0 +1,175 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <memory.h>
+#include "scanner.h"
+#include "log.h"
+
+void scanner_init(scanner_t* sc, const char* data, u64 size) {
+    sc->cur = data;
+    sc->end = data + size;
+}
+
+bool scanner_eof(scanner_t* sc) {
+    return sc->cur >= sc->end;
+}
+
+void scanner_skip_blanks(scanner_t* sc) {
+    while (sc->cur < sc->end && (*sc->cur == ' ' || *sc->cur == '\t'))
+        ++sc->cur;
+}
+
+bool scanner_token(scanner_t* sc, const char** tok, u64* len) {
+    scanner_skip_blanks(sc);
+
+    const char* start = sc->cur;
+    while (sc->cur < sc->end && *sc->cur != ' ' && *sc->cur != '\t' && *sc->cur != '\n')
+        ++sc->cur;
+
+    *tok = start;
+    *len = (u64)(sc->cur - start);
+
+    return sc->cur != start;
+}
+
+bool scanner_skip_token(scanner_t* sc) {
+    const char* tok;
+    u64 len;
+
+    return scanner_token(sc, &tok, &len);
+}
+
+bool scanner_next_line(scanner_t* sc) {
+    const char* eol = memchr(sc->cur, '\n', (u64)(sc->end - sc->cur));
+    if (!eol) {
+        sc->cur = sc->end;
+        return false;
+    }
+
+    sc->cur = eol + 1;
+
+    return sc->cur < sc->end;
+}
+
+bool scanner_u64(scanner_t* sc, u64* value) {
+    scanner_skip_blanks(sc);
+
+    const char* p = sc->cur;
+    u64 v = 0;
+
+    while (p < sc->end && (u8)(*p - '0') < 10) {
+        v = v * 10 + (u64)(*p - '0');
+        ++p;
+    }
+
+    if (p == sc->cur)
+        return false;
+
+    sc->cur = p;
+    *value = v;
+
+    return true;
+}
+
+u64 scanner_u64s(scanner_t* sc, u64* values, u64 n) {
+    u64 i = 0;
+    while (i < n && scanner_u64(sc, &values[i]))
+        ++i;
+
+    return i;
+}
+
+bool scanner_key(scanner_t* sc, const char** key, u64* len) {
+    const char* p = sc->cur;
+
+    while (p < sc->end && *p != ':' && *p != '\n')
+        ++p;
+
+    if (p >= sc->end || *p != ':')
+        return false;
+
+    *key = sc->cur;
+    *len = (u64)(p - sc->cur);
+
+    // /proc/cpuinfo pads the keys with tabs
+    while (*len && ((*key)[*len - 1] == '\t' || (*key)[*len - 1] == ' '))
+        --*len;
+
+    sc->cur = p + 1;
+
+    return true;
+}
+
+#ifndef NDEBUG
+
+void test_scanner(void) {
+    const char stat[] = "cpu  4705 356 584 3699 23 23 0 0 0 0\ncpu0 1393280 32966 572056 13343292 0 0 0 0 0 0\n";
+
+    scanner_t sc;
+    scanner_init(&sc, stat, sizeof(stat) - 1);
+
+    u64 v[10];
+    ASSERT(scanner_skip_token(&sc));
+    ASSERT(scanner_u64s(&sc, v, 10) == 10);
+    ASSERT(v[0] == 4705 && v[3] == 3699 && v[9] == 0);
+
+    // the number parser must not run over the end of the line
+    ASSERT(!scanner_u64(&sc, &v[0]));
+    ASSERT(scanner_next_line(&sc));
+    ASSERT(scanner_skip_token(&sc));
+    ASSERT(scanner_u64(&sc, &v[0]) && v[0] == 1393280);
+    ASSERT(!scanner_next_line(&sc));
+    ASSERT(scanner_eof(&sc));
+
+    const char diskstats[] = "   8       1 sda1 231 0 18682\n";
+    scanner_init(&sc, diskstats, sizeof(diskstats) - 1);
+
+    const char* tok;
+    u64 tok_len;
+    ASSERT(scanner_skip_token(&sc) && scanner_skip_token(&sc));
+    ASSERT(scanner_token(&sc, &tok, &tok_len) && tok_len == 4 && memcmp(tok, "sda1", 4) == 0);
+    ASSERT(scanner_u64s(&sc, v, 3) == 3 && v[2] == 18682);
+    ASSERT(!scanner_token(&sc, &tok, &tok_len) && tok_len == 0);
+
+    const char meminfo[] = "MemTotal:       16326068 kB\nHugePages_Total:       0\nmodel name\t: Intel\n";
+    scanner_init(&sc, meminfo, sizeof(meminfo) - 1);
+
+    const char* key;
+    u64 len;
+    ASSERT(scanner_key(&sc, &key, &len));
+    ASSERT(SCANNER_KEY_IS(key, len, "MemTotal"));
+    ASSERT(scanner_u64(&sc, &v[0]) && v[0] == 16326068);
+
+    ASSERT(scanner_next_line(&sc));
+    ASSERT(scanner_key(&sc, &key, &len));
+    ASSERT(SCANNER_KEY_IS(key, len, "HugePages_Total"));
+    ASSERT(scanner_u64(&sc, &v[0]) && v[0] == 0);
+
+    ASSERT(scanner_next_line(&sc));
+    ASSERT(scanner_key(&sc, &key, &len));
+    ASSERT(SCANNER_KEY_IS(key, len, "model name"));
+
+    // short counts of /sys/block/<dev>/stat of older kernels
+    const char blk[] = "  1 2 3\n";
+    scanner_init(&sc, blk, sizeof(blk) - 1);
+    u64 stat11[11];
+    memset(stat11, 0, sizeof(stat11));
+    ASSERT(scanner_u64s(&sc, stat11, 11) == 3);
+    ASSERT(stat11[2] == 3 && stat11[3] == 0);
+}
+
+#endif
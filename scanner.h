@@ -0,0 +1,71 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include <memory.h>
+#include "globals.h"
+
+//============================================================================================================
+// NUMERIC FIELD SCANNER
+//============================================================================================================
+
+/// Cursor over a read buffer of a /proc or /sys counter file. Fields are parsed in place,
+/// nothing is copied and nothing is allocated.
+typedef struct scanner {
+    const char* cur;
+    const char* end;
+} scanner_t;
+
+void scanner_init(scanner_t* sc, const char* data, u64 size);
+
+bool scanner_eof(scanner_t* sc);
+
+/// skips spaces and tabs, stops at the end of the line
+void scanner_skip_blanks(scanner_t* sc);
+
+/// skips the next blank separated token of the current line
+bool scanner_skip_token(scanner_t* sc);
+
+/// the next blank separated token of the current line, @tok points into the buffer and is not terminated
+bool scanner_token(scanner_t* sc, const char** tok, u64* len);
+
+/// moves to the beginning of the next line
+bool scanner_next_line(scanner_t* sc);
+
+/// parses the next unsigned decimal field of the current line
+bool scanner_u64(scanner_t* sc, u64* value);
+
+/// parses up to @n fields of the current line into @values
+/// \return the number of parsed fields
+u64 scanner_u64s(scanner_t* sc, u64* values, u64 n);
+
+/// reads a "Key:" prefix of the current line the way /proc/meminfo and /proc/cpuinfo lay them out,
+/// @key points into the buffer and is not terminated
+bool scanner_key(scanner_t* sc, const char** key, u64* len);
+
+static inline bool scanner_key_is(const char* key, u64 len, const char* expected, u64 expected_len) {
+    return len == expected_len && memcmp(key, expected, len) == 0;
+}
+
+#define SCANNER_KEY_IS(key, len, lit) scanner_key_is((key), (len), (lit), sizeof(lit) - 1)
+
+#ifndef NDEBUG
+
+void test_scanner(void);
+
+#endif
@@ -0,0 +1,235 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include "scheduler.h"
+#include "allocators.h"
+#include "timer.h"
+#include "log.h"
+
+ret_t scheduler_init(scheduler_t** s, u64 tick_ns) {
+    *s = zalloc(sizeof(scheduler_t));
+    scheduler_t* sch = *s;
+
+    sch->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    sch->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sch->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (sch->epoll_fd < 0 || sch->timer_fd < 0 || sch->stop_fd < 0) {
+        LOG_ERROR("can't create the scheduler descriptors");
+        scheduler_release(sch);
+        *s = NULL;
+        return ST_ERR;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = sch->timer_fd;
+    epoll_ctl(sch->epoll_fd, EPOLL_CTL_ADD, sch->timer_fd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.fd = sch->stop_fd;
+    epoll_ctl(sch->epoll_fd, EPOLL_CTL_ADD, sch->stop_fd, &ev);
+
+    return scheduler_set_tick(sch, tick_ns);
+}
+
+void scheduler_release(scheduler_t* s) {
+    if (!s)
+        return;
+
+    if (s->epoll_fd >= 0)
+        close(s->epoll_fd);
+    if (s->timer_fd >= 0)
+        close(s->timer_fd);
+    if (s->stop_fd >= 0)
+        close(s->stop_fd);
+
+    zfree(s);
+}
+
+ret_t scheduler_add(scheduler_t* s, sched_task_cb run, void* arg, u64 every) {
+    if (s->ntasks == SCHED_MAX_TASKS) {
+        LOG_ERROR("too many tasks");
+        return ST_SIZE_EXCEED;
+    }
+
+    sched_task_t* t = &s->tasks[s->ntasks++];
+    t->run = run;
+    t->arg = arg;
+    t->every = every ? every : 1;
+
+    return ST_OK;
+}
+
+static void scheduler_sampler_cb(void* arg) {
+    sampler_step((sampler_t*)arg);
+}
+
+ret_t scheduler_add_sampler(scheduler_t* s, sampler_t* sampler, u64 every) {
+    return scheduler_add(s, &scheduler_sampler_cb, sampler, every);
+}
+
+ret_t scheduler_set_tick(scheduler_t* s, u64 tick_ns) {
+#ifdef HW_NO_SLEEP
+    // a tick as short as the timer allows
+    tick_ns = 1;
+#endif
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = (time_t)(tick_ns / (u64)NANOSEC_IN_SEC);
+    spec.it_interval.tv_nsec = (long)(tick_ns % (u64)NANOSEC_IN_SEC);
+    spec.it_value = spec.it_interval;
+
+    if (timerfd_settime(s->timer_fd, 0, &spec, NULL) != 0) {
+        LOG_ERROR("timerfd_settime failed");
+        return ST_ERR;
+    }
+
+    return ST_OK;
+}
+
+static void scheduler_tick(scheduler_t* s) {
+    for (u32 i = 0; i < s->ntasks; ++i) {
+        sched_task_t* t = &s->tasks[i];
+
+        if (s->tick % t->every == 0)
+            t->run(t->arg);
+    }
+
+    ++s->tick;
+}
+
+void scheduler_run(scheduler_t* s) {
+    // the first samples right away, the diffs need a base
+    scheduler_tick(s);
+
+    while (true) {
+        struct epoll_event events[2];
+        int n = epoll_wait(s->epoll_fd, events, 2, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            LOG_ERROR("epoll_wait failed");
+            return;
+        }
+
+        bool fired = false;
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == s->stop_fd)
+                return;
+
+            if (events[i].data.fd == s->timer_fd) {
+                u64 expirations = 0;
+                if (read(s->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    fired = true;
+            }
+        }
+
+        // overruns are dropped, a late sample is better than a burst of them
+        if (fired)
+            scheduler_tick(s);
+    }
+}
+
+void scheduler_stop(scheduler_t* s) {
+    // the counter is never read back so the descriptor stays readable for every waiter
+    u64 one = 1;
+    ssize_t r = write(s->stop_fd, &one, sizeof(one));
+    (void)r;
+}
+
+bool scheduler_wait(scheduler_t* s, u64 timeout_ns) {
+    return scheduler_wait_fd(s, -1, timeout_ns);
+}
+
+bool scheduler_wait_fd(scheduler_t* s, int fd, u64 timeout_ns) {
+    // a negative fd is ignored by ppoll
+    struct pollfd pfd[2];
+    pfd[0].fd = s->stop_fd;
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = fd;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+
+    struct timespec timeout;
+    timeout.tv_sec = (time_t)(timeout_ns / (u64)NANOSEC_IN_SEC);
+    timeout.tv_nsec = (long)(timeout_ns % (u64)NANOSEC_IN_SEC);
+
+    int n;
+    while ((n = ppoll(pfd, 2, &timeout, NULL)) < 0 && errno == EINTR);
+
+    return n > 0 && (pfd[0].revents & POLLIN);
+}
+
+#ifndef NDEBUG
+
+typedef struct test_sched {
+    scheduler_t* s;
+    u64 fast;
+    u64 slow;
+} test_sched_t;
+
+static void test_sched_fast_cb(void* arg) {
+    test_sched_t* t = (test_sched_t*)arg;
+
+    if (++t->fast == 6)
+        scheduler_stop(t->s);
+}
+
+static void test_sched_slow_cb(void* arg) {
+    ++((test_sched_t*)arg)->slow;
+}
+
+void test_scheduler(void) {
+    test_sched_t t;
+    t.fast = 0;
+    t.slow = 0;
+
+    CHECK_RETURN(scheduler_init(&t.s, 1000000));
+    CHECK_RETURN(scheduler_add(t.s, &test_sched_fast_cb, &t, 1));
+    CHECK_RETURN(scheduler_add(t.s, &test_sched_slow_cb, &t, 3));
+
+    ASSERT(!scheduler_wait(t.s, 1000));
+
+    // a readable fd ends the wait right away without the scheduler being stopped
+    int fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct timespec start = timer_start();
+    ASSERT(!scheduler_wait_fd(t.s, fd, 1000000000));
+    ASSERT(timer_end_ms(start) < 500.0);
+    close(fd);
+
+    scheduler_run(t.s);
+
+    // ticks 0..5: the slow task runs on 0 and 3
+    ASSERT(t.fast == 6);
+    ASSERT(t.slow == 2);
+    ASSERT(scheduler_wait(t.s, 1000000000));
+
+    scheduler_release(t.s);
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#pragma once
+
+#include "globals.h"
+#include "sampler.h"
+
+//============================================================================================================
+// SAMPLING SCHEDULER
+//============================================================================================================
+
+/// All the collectors run from one thread on a shared timeline: a periodic timerfd fires every base
+/// tick and a task runs on every @every-th tick, so the samples of different collectors line up.
+/// An eventfd in the same epoll set stops the loop right away.
+
+#define SCHED_MAX_TASKS 16
+
+typedef void(* sched_task_cb)(void* arg);
+
+typedef struct sched_task {
+    sched_task_cb run;
+    void* arg;
+    // period in base ticks
+    u64 every;
+} sched_task_t;
+
+typedef struct scheduler {
+    int epoll_fd;
+    int timer_fd;
+    int stop_fd;
+    u32 ntasks;
+    // base ticks elapsed since scheduler_run
+    u64 tick;
+    sched_task_t tasks[SCHED_MAX_TASKS];
+} scheduler_t;
+
+ret_t scheduler_init(scheduler_t** s, u64 tick_ns);
+
+void scheduler_release(scheduler_t* s);
+
+/// @run is called from the scheduler thread every @every ticks, the first time on the first tick
+ret_t scheduler_add(scheduler_t* s, sched_task_cb run, void* arg, u64 every);
+
+/// sampler_step of @sampler every @every ticks
+ret_t scheduler_add_sampler(scheduler_t* s, sampler_t* sampler, u64 every);
+
+/// changes the base tick, safe to call from any thread
+ret_t scheduler_set_tick(scheduler_t* s, u64 tick_ns);
+
+/// runs the tasks until scheduler_stop
+void scheduler_run(scheduler_t* s);
+
+/// async-signal-safe, wakes up scheduler_run and every scheduler_wait
+void scheduler_stop(scheduler_t* s);
+
+/// sleeps for @timeout_ns or until the scheduler has been stopped
+/// \return true if it has been stopped
+bool scheduler_wait(scheduler_t* s, u64 timeout_ns);
+
+/// like scheduler_wait, also returns as soon as @fd is readable, it's up to the caller to drain it
+/// \return true if it has been stopped
+bool scheduler_wait_fd(scheduler_t* s, int fd, u64 timeout_ns);
+
+#ifndef NDEBUG
+
+void test_scheduler(void);
+
+#endif
@@ -0,0 +1,150 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+
+#include <pthread.h>
+#include <sched.h>
+#include "spsc_ring.h"
+#include "log.h"
+#include "allocators.h"
+
+#define SPSC_MIN_CAPACITY 2
+
+ret_t spsc_init(spsc_ring_t** r, u64 capacity) {
+    u64 cap = SPSC_MIN_CAPACITY;
+    while (cap < capacity)
+        cap <<= 1;
+
+    *r = zalloc(sizeof(spsc_ring_t));
+    spsc_ring_t* ring = *r;
+
+    ring->mask = cap - 1;
+    ring->slots = zalloc(cap * sizeof(u64));
+
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+
+    return ST_OK;
+}
+
+void spsc_release(spsc_ring_t* r) {
+    if (!r)
+        return;
+
+    zfree(r->slots);
+    zfree(r);
+}
+
+bool spsc_push(spsc_ring_t* r, u64 value) {
+    u64 tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail - r->head_cache > r->mask) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+
+        if (tail - r->head_cache > r->mask)
+            return false;
+    }
+
+    r->slots[tail & r->mask] = value;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+bool spsc_pop(spsc_ring_t* r, u64* value) {
+    u64 head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (head == r->tail_cache) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+        if (head == r->tail_cache)
+            return false;
+    }
+
+    *value = r->slots[head & r->mask];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+u64 spsc_capacity(spsc_ring_t* r) {
+    return r->mask + 1;
+}
+
+#ifndef NDEBUG
+
+#define TEST_SPSC_ITEMS 100000UL
+
+static void* test_spsc_producer(void* p) {
+    spsc_ring_t* r = (spsc_ring_t*)p;
+
+    for (u64 i = 1; i <= TEST_SPSC_ITEMS; ++i) {
+        while (!spsc_push(r, i))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+void test_spsc() {
+    spsc_ring_t* r = NULL;
+    CHECK_RETURN(spsc_init(&r, 3));
+    ASSERT(spsc_capacity(r) == 4);
+
+    u64 v = 0;
+    ASSERT(!spsc_pop(r, &v));
+
+    // the indices keep running past the capacity
+    for (u64 i = 0; i < 10; ++i) {
+        for (u64 j = 0; j < 4; ++j)
+            ASSERT(spsc_push(r, i + j));
+
+        ASSERT(!spsc_push(r, 100));
+        ASSERT(spsc_pop(r, &v) && v == i);
+        ASSERT(spsc_push(r, i + 4) && !spsc_push(r, 100));
+
+        for (u64 j = 1; j <= 4; ++j)
+            ASSERT(spsc_pop(r, &v) && v == i + j);
+
+        ASSERT(!spsc_pop(r, &v));
+    }
+
+    spsc_release(r);
+
+    // everything in order across two threads through a small ring
+    CHECK_RETURN(spsc_init(&r, 16));
+
+    pthread_t thrd;
+    pthread_create(&thrd, NULL, &test_spsc_producer, r);
+
+    u64 next = 1;
+    while (next <= TEST_SPSC_ITEMS) {
+        if (!spsc_pop(r, &v)) {
+            sched_yield();
+            continue;
+        }
+
+        ASSERT(v == next);
+        ++next;
+    }
+
+    pthread_join(thrd, NULL);
+    ASSERT(!spsc_pop(r, &v));
+
+    spsc_release(r);
+}
+
+#endif
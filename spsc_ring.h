@@ -0,0 +1,62 @@
+/*************************************************************************************************************
+    This file is part of HWMonitor.
+
+    HWMonitor is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    HWMonitor is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with HWMonitor.  If not, see <http://www.gnu.org/licenses/>.
+*************************************************************************************************************/
+#pragma once
+
+#include "globals.h"
+
+//============================================================================================================
+// SPSC RING BUFFER
+//============================================================================================================
+
+/// A fixed ring for exactly one producer and one consumer thread. Each side owns its index on a cache
+/// line of its own and keeps a copy of the other side's index, which it only reloads when the ring looks
+/// full (producer) or empty (consumer), so in the steady state the two threads don't touch a shared line
+/// but the slot itself.
+
+typedef struct spsc_ring {
+    // producer side
+    atomic_u64 tail;
+    u64 head_cache;
+    u8 pad0[CACHE_LINE_SIZE - 2 * sizeof(u64)];
+    // consumer side
+    atomic_u64 head;
+    u64 tail_cache;
+    u8 pad1[CACHE_LINE_SIZE - 2 * sizeof(u64)];
+    u64 mask;
+    u64* slots;
+} spsc_ring_t;
+
+/// @capacity is rounded up to a power of two
+ret_t spsc_init(spsc_ring_t** r, u64 capacity);
+
+void spsc_release(spsc_ring_t* r);
+
+/// the producer thread only, @value is a pointer (PTR_TO_U64) or a plain value
+/// \return false if the ring is full
+bool spsc_push(spsc_ring_t* r, u64 value);
+
+/// the consumer thread only
+/// \return false if the ring is empty
+bool spsc_pop(spsc_ring_t* r, u64* value);
+
+u64 spsc_capacity(spsc_ring_t* r);
+
+#ifndef NDEBUG
+
+void test_spsc(void);
+
+#endif
@@ -17,9 +17,13 @@
 
 #include <memory.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "string.h"
 #include "log.h"
 #include "allocators.h"
+#include "concurrent_hashtable.h"
+#include "hash.h"
 
 ret_t regex_compile(regex_t* r, const char* pattern) {
     int status = regcomp(r, pattern, REG_EXTENDED | REG_NEWLINE);
@@ -44,6 +48,128 @@ bool regex_match(regex_t* r, const char* text) {
     return true;
 }
 
+//============================================================================================================
+// REGEX CACHE
+//============================================================================================================
+
+#define REGEX_CACHE_TABLE_SIZE 64
+
+typedef struct regex_entry {
+    char* pattern;
+    regex_t re;
+} regex_entry_t;
+
+static hashtable_t* g_regex_cache = NULL;
+static pthread_mutex_t g_regex_cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static atomic_u64 g_regex_cache_hits = 0;
+static atomic_u64 g_regex_cache_misses = 0;
+
+static u64 regex_cache_hasher(void* key) {
+    return hash_str((const char*)key);
+}
+
+static void regex_cache_key_release_cb(void* p) {
+    free(p);
+}
+
+static void regex_cache_entry_release_cb(void* p) {
+    regex_entry_t* e = (regex_entry_t*)p;
+    regfree(&e->re);
+    free(e);
+}
+
+ret_t regex_cache_init(void) {
+    return ht_init(&g_regex_cache, REGEX_CACHE_TABLE_SIZE, &regex_cache_hasher, &ht_comparator_str,
+                   &regex_cache_key_release_cb, &regex_cache_entry_release_cb);
+}
+
+void regex_cache_shutdown(void) {
+    if (!g_regex_cache)
+        return;
+
+    ht_destroy(g_regex_cache);
+    g_regex_cache = NULL;
+}
+
+ret_t regex_cache_get(const char* pattern, regex_t** re) {
+    if (!g_regex_cache)
+        return ST_NOT_FOUND;
+
+    void* p = NULL;
+    regex_entry_t* e = NULL;
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-qual"
+    if (ht_get(g_regex_cache, (void*)pattern, &p) == ST_OK) {
+        e = (regex_entry_t*)p;
+        atomic_fetch_add_explicit(&g_regex_cache_hits, 1, memory_order_relaxed);
+    } else {
+        pthread_mutex_lock(&g_regex_cache_mtx);
+
+        // somebody could compile it while we were waiting for the lock
+        if (ht_get(g_regex_cache, (void*)pattern, &p) == ST_OK) {
+            e = (regex_entry_t*)p;
+            atomic_fetch_add_explicit(&g_regex_cache_hits, 1, memory_order_relaxed);
+        } else {
+            e = calloc(1, sizeof(regex_entry_t));
+
+            if (regex_compile(&e->re, pattern) != ST_OK) {
+                free(e);
+                pthread_mutex_unlock(&g_regex_cache_mtx);
+                return ST_ERR;
+            }
+
+            e->pattern = strdup(pattern);
+            atomic_fetch_add_explicit(&g_regex_cache_misses, 1, memory_order_relaxed);
+
+            if (ht_set(g_regex_cache, e->pattern, e) != ST_OK) {
+                free(e->pattern);
+                regex_cache_entry_release_cb(e);
+                pthread_mutex_unlock(&g_regex_cache_mtx);
+                return ST_ERR;
+            }
+        }
+
+        pthread_mutex_unlock(&g_regex_cache_mtx);
+    }
+#pragma clang diagnostic pop
+
+    *re = &e->re;
+
+    return ST_OK;
+}
+
+u64 regex_cache_hits(void) {
+    return atomic_load_explicit(&g_regex_cache_hits, memory_order_relaxed);
+}
+
+u64 regex_cache_misses(void) {
+    return atomic_load_explicit(&g_regex_cache_misses, memory_order_relaxed);
+}
+
+u64 regex_cache_size(void) {
+    return g_regex_cache ? ht_size(g_regex_cache) : 0;
+}
+
+/// cached pattern if possible, otherwise a private copy that has to be passed to regex_put
+static regex_t* regex_take(const char* pattern, regex_t* local) {
+    regex_t* re = NULL;
+    ret_t ret = regex_cache_get(pattern, &re);
+
+    if (ret == ST_OK)
+        return re;
+
+    if (ret == ST_ERR || regex_compile(local, pattern) != ST_OK)
+        return NULL;
+
+    return local;
+}
+
+static void regex_put(regex_t* re, regex_t* local) {
+    if (re == local)
+        regfree(local);
+}
+
 //============================================================================================================
 // STRING
 //============================================================================================================
@@ -52,6 +178,10 @@ ret_t string_init(string** sp) {
     return da_init(_dap(sp));
 }
 
+ret_t string_init_arena(string** sp, arena_t* arena) {
+    return da_init_arena(_dap(sp), arena, STRING_INIT_BUFFER);
+}
+
 ret_t string_release(string* s) {
     return da_release(_da(s));
 }
@@ -90,6 +220,14 @@ ret_t string_dub(string* s, string** ns) {
     return da_dub(_da(s), _dap(ns));
 }
 
+ret_t string_dub_arena(string* s, arena_t* arena, string** ns) {
+    if (!arena)
+        return string_dub(s, ns);
+
+    da_init_arena(_dap(ns), arena, string_size(s));
+    return da_append(_da(*ns), string_cdata(s), string_size(s));
+}
+
 ret_t string_append(string* s, const char* str) {
     u64 len = strlen(str);
     return da_append(_da(s), str, len);
@@ -137,6 +275,12 @@ ret_t string_create(string** s, const char* str) {
     return string_append(*s, str);
 }
 
+ret_t string_create_arena(string** s, arena_t* arena, const char* str) {
+    string_init_arena(s, arena);
+
+    return string_append(*s, str);
+}
+
 ret_t string_add(string* a, string* b) {
     return da_concat(_da(a), _da(b));
 }
@@ -174,7 +318,7 @@ ret_t string_remove_dubseq(string* s, char delm, uint8_t skip) {
             u64 begin = j;
             u64 end = begin;
 
-            while (cur[(++end)] == delm);
+            while (++end < string_size(s) && cur[end] == delm);
 
             //--end;// last compared position
             u64 n = end - begin;
@@ -292,15 +436,21 @@ ret_t string_starts_with(string* s, const char* str) {
 }
 
 bool string_re_match(string* s, const char* pattern) {
-    regex_t re;
-    regex_compile(&re, pattern);
+    regex_t local;
+    regex_t* re = regex_take(pattern, &local);
+    if (!re)
+        return false;
+
+    // match the string in place instead of making a terminated copy
+    regmatch_t m;
+    m.rm_so = 0;
+    m.rm_eo = (regoff_t)string_size(s);
 
-    char* text = string_makez(s);
-    bool m = regex_match(&re, text);
-    zfree(text);
-    regfree(&re);
+    bool match = regexec(re, string_cdata(s), 1, &m, REG_STARTEND) == 0;
 
-    return m;
+    regex_put(re, &local);
+
+    return match;
 }
 
 ret_t string_compare(string* a, string* b) {
@@ -366,11 +516,10 @@ void string_pair_release_cb(void* p) {
 }
 
 ret_t string_re_search(string* s, const char* pattern, list_t** pairs) {
-    regex_t re;
-    ret_t ret;
-    if ((ret = regex_compile(&re, pattern)) != ST_OK) {
-        return ret;
-    }
+    regex_t local;
+    regex_t* re = regex_take(pattern, &local);
+    if (!re)
+        return ST_ERR;
 
     list_init(pairs, &string_release_cb);
 
@@ -384,7 +533,7 @@ ret_t string_re_search(string* s, const char* pattern, list_t** pairs) {
     while (1) {
         m[0].rm_so = 0;
         m[0].rm_eo = (int)(string_size(s) - (u64)(p - tkp));
-        int nomatch = regexec(&re, p, n_matches, m, REG_STARTEND);
+        int nomatch = regexec(re, p, n_matches, m, REG_STARTEND);
         if (nomatch) {
             LOG_INFO("No more matches.");
             break;
@@ -415,7 +564,7 @@ ret_t string_re_search(string* s, const char* pattern, list_t** pairs) {
         }
     }
 
-    regfree(&re);
+    regex_put(re, &local);
 
     return ST_OK;
 #undef n_matches
@@ -541,7 +690,7 @@ ret_t string_split(string* s, char delm, list_t** l) {
     char* ccur = cb;
 
     while (ccur <= end) {
-        if (*ccur == delm || ccur == end) {
+        if (ccur == end || *ccur == delm) {
             //while(*(++ccur) == delm && ccur == end);
 
 
@@ -560,3 +709,33 @@ ret_t string_split(string* s, char delm, list_t** l) {
     return ST_OK;
 }
 
+
+#ifndef NDEBUG
+
+void test_regex_cache(void) {
+    u64 size = regex_cache_size();
+    u64 hits = regex_cache_hits();
+    u64 misses = regex_cache_misses();
+
+    regex_t* a = NULL;
+    regex_t* b = NULL;
+    CHECK_RETURN(regex_cache_get("^test_[0-9]+$", &a));
+    CHECK_RETURN(regex_cache_get("^test_[0-9]+$", &b));
+    ASSERT(a == b);
+    ASSERT(regex_cache_size() == size + 1);
+    ASSERT(regex_cache_misses() == misses + 1);
+    ASSERT(regex_cache_hits() == hits + 1);
+
+    string* s = NULL;
+    string_create(&s, "test_42");
+    ASSERT(string_re_match(s, "^test_[0-9]+$"));
+    ASSERT(regex_cache_hits() == hits + 2);
+
+    // the match is bounded by the string size, not by a terminator
+    string_append(s, "x");
+    ASSERT(!string_re_match(s, "^test_[0-9]+$"));
+
+    string_release(s);
+}
+
+#endif
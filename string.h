@@ -33,6 +33,31 @@ ret_t regex_compile(regex_t* r, const char* pattern);
 
 bool regex_match(regex_t* r, const char* text);
 
+//============================================================================================================
+// REGEX CACHE
+//============================================================================================================
+
+ret_t regex_cache_init(void);
+
+void regex_cache_shutdown(void);
+
+/// Compiles @pattern once for the life of the process, the returned regex is shared between threads
+/// and must not be freed. string_re_match and string_re_search go through it.
+/// \return ST_NOT_FOUND if the cache isn't initialized, ST_ERR if the pattern doesn't compile
+ret_t regex_cache_get(const char* pattern, regex_t** re);
+
+u64 regex_cache_hits(void);
+
+u64 regex_cache_misses(void);
+
+u64 regex_cache_size(void);
+
+#ifndef NDEBUG
+
+void test_regex_cache(void);
+
+#endif
+
 //============================================================================================================
 // STRING
 //============================================================================================================
@@ -59,6 +84,9 @@ typedef struct skey_value {
 
 ret_t string_init(string** sp);
 
+/// the string lives in @arena, string_release leaves it to the arena, NULL is the heap
+ret_t string_init_arena(string** sp, arena_t* arena);
+
 ret_t string_release(string* s);
 
 void string_release_cb(void* p);
@@ -77,6 +105,9 @@ ret_t string_create_nt(string* s, char** buff);
 /// \return return code
 ret_t string_dub(string* s, string** ns);
 
+/// deep copy into @arena
+ret_t string_dub_arena(string* s, arena_t* arena, string** ns);
+
 ret_t string_append(string* s, const char* str);
 
 ret_t string_appendf(string* s, const char* fmt, ...);
@@ -89,6 +120,8 @@ ret_t string_appendn(string* s, const char* str, u64 len);
 
 ret_t string_create(string** s, const char* str);
 
+ret_t string_create_arena(string** s, arena_t* arena, const char* str);
+
 ret_t string_add(string* a, string* b);
 
 ret_t string_pop_head(string* s, u64 n);
@@ -29,19 +29,69 @@
 
 static ret_t test_split(void);
 
-extern void test_hash_bt(void);
+extern void test_btree(void);
+extern void test_vector(void);
 extern void test_fifo(void);
 extern void test_lifo(void);
+extern void test_fd_cache(void);
+extern void test_mnt_table(void);
+extern void test_blk_meta_uevent(void);
+extern void test_blk_iostat(void);
+extern void test_blk_diskstats(void);
+extern void test_blk_df(void);
+extern void test_blk_topo(void);
+extern void test_net_link_parse(void);
+extern void test_net_stats_rates(void);
+extern void test_net_queue_stat_parse(void);
+extern void test_dev_index(void);
+extern void test_scanner(void);
+extern void test_regex_cache(void);
+extern void test_cpu_dev(void);
+extern void test_cpu_info(void);
+extern void test_scheduler(void);
+extern void test_epoch(void);
+extern void test_hashtable(void);
+extern void test_flat_map(void);
+extern void test_hash(void);
+extern void test_arena(void);
+extern void test_list_modes(void);
+extern void test_mpsc(void);
+extern void test_spsc(void);
 
 void tests_run() {
     test_da();
     test_string();
-    test_hash_bt();
+    test_btree();
+    test_vector();
     test_fifo();
     test_lifo();
+    test_mpsc();
+    test_spsc();
+    test_fd_cache();
+    test_mnt_table();
+    test_blk_meta_uevent();
+    test_blk_iostat();
+    test_blk_diskstats();
+    test_blk_df();
+    test_blk_topo();
+    test_net_link_parse();
+    test_net_stats_rates();
+    test_net_queue_stat_parse();
+    test_dev_index();
+    test_scanner();
+    test_regex_cache();
+    test_cpu_dev();
+    test_cpu_info();
+    test_scheduler();
+    test_epoch();
+    test_hashtable();
+    test_flat_map();
+    test_hash();
+    test_arena();
 
     //TODO test_list breaks the memory
     //test_list();
+    test_list_modes();
 
     test_split();
 }
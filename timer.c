@@ -34,6 +34,13 @@ double timer_end_ms(struct timespec start_time) {
     return dns / NANOSEC_IN_MILLISEC;
 }
 
+double timer_diff_sec(struct timespec start_time, struct timespec end_time) {
+    time_t ds = end_time.tv_sec - start_time.tv_sec;
+    double dns = ds * NANOSEC_IN_SEC + (end_time.tv_nsec - start_time.tv_nsec);
+
+    return dns / NANOSEC_IN_SEC;
+}
+
 void nsleep(u64 nanoseconds) {
     struct timespec req;
 
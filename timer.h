@@ -30,6 +30,8 @@ struct timespec timer_start(void);
 
 double timer_end_ms(struct timespec start_time);
 
+double timer_diff_sec(struct timespec start_time, struct timespec end_time);
+
 void nsleep(u64 nanoseconds);
 
 static inline void nsleepd(double seconds) {
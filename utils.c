@@ -21,8 +21,17 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <sys/resource.h>
 #include "utils.h"
 #include "allocators.h"
+#include "concurrent_hashtable.h"
+#include "hash.h"
+#include "log.h"
 
 //============================================================================================================
 // FILE UTILS
@@ -90,66 +99,555 @@ void file_read_all(const char* filename, char** buff, u64* size) {
 }
 
 void file_read_all_s(const char* filename, string* s) {
-    FILE* f = fopen(filename, "rb");
-    fseek(f, 0, SEEK_END);
-    u64 fsize = (u64)ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    da_realloc(_da(s), fsize);
-    fread(_da(s)->ptr, fsize, 1, f);
-    _da(s)->used = fsize;
-    fclose(f);
+    if (fd_cache_read(filename, s) != ST_OK)
+        _da(s)->used = 0;
 }
 
 int file_read_all_buffered_s(const char* filename, string* s) {
-#define FILE_READ_ALL_BUFF_SIZE 1024
-    FILE* f = fopen(filename, "rb");
-    if (!f)
-        return -1;
+    return fd_cache_read(filename, s) == ST_OK ? 0 : -1;
+}
 
-    char buff[FILE_READ_ALL_BUFF_SIZE] = {0};
-    da_realloc(_da(s), FILE_READ_ALL_BUFF_SIZE);
+void file_read_line(const char* filename, string* s) {
+    if (fd_cache_read(filename, s) != ST_OK) {
+        _da(s)->used = 0;
+        return;
+    }
 
-    while (fgets(buff, FILE_READ_ALL_BUFF_SIZE, f))
-        string_append(s, buff);
+    const char* eol = memchr(_da(s)->ptr, '\n', _da(s)->used);
+    if (eol)
+        _da(s)->used = (u64)(eol - _da(s)->ptr) + 1;
+}
 
-    fclose(f);
+string* file_read_subdir(string* subdir, const char* filepath, arena_t* arena) {
+    string* data = NULL;
+    string_init_arena(&data, arena);
+
+    char filename[PATH_MAX];
+    u64 dir_len = string_size(subdir);
+    u64 file_len = strlen(filepath);
 
-    return 0;
-#undef FILE_READ_ALL_BUFF_SIZE
+    if (dir_len + file_len >= sizeof(filename))
+        return data;
+
+    memcpy(filename, string_cdata(subdir), dir_len);
+    memcpy(filename + dir_len, filepath, file_len + 1);
+
+    file_read_all_s(filename, data);
+    string_strip(data);
+
+    return data;
 }
 
-void file_read_line(const char* filename, string* s) {
-    FILE* f = fopen(filename, "rb");
+//============================================================================================================
+// CACHED FILE DESCRIPTORS
+//============================================================================================================
 
-    char* buff = NULL;
-    u64 size = 0;
-    getline(&buff, &size, f);
+// most of /sys and /proc counter files fit into it, so a read normally takes a single pread
+#define FD_CACHE_MIN_READ 256
+#define FD_CACHE_TABLE_SIZE 1024
+
+// the cache never holds more descriptors than this, nor more than half of RLIMIT_NOFILE
+#define FD_CACHE_MAX_FILES 4096
+#define FD_CACHE_MIN_FILES 64
+
+// a full cache looks for descriptors to close once per this share of its size in uncached reads
+#define FD_CACHE_EVICT_DIV 4
+
+typedef struct fd_entry {
+    const char* path;
+    int fd;
+    u32 size_hint;
+    // the eviction pass it was last read in
+    atomic_u64 used;
+    // a short read is the end of file, see fd_short_read_is_eof
+    bool short_eof;
+    u8 reserved[7];
+} fd_entry_t;
+
+/// A sysfs attribute is produced whole by the first read, so a short read is its end.
+/// A proc seq_file hands out about a page per read and only a read of 0 is its end.
+static bool fd_short_read_is_eof(const char* filename) {
+    return strncmp(filename, "/sys/", 5) == 0;
+}
 
-    string_append(s, buff);
+/// the file isn't there, as opposed to a descriptor that couldn't be cached
+static bool fd_missing(int err) {
+    return err == ENOENT || err == ENOTDIR || err == ENODEV || err == ENXIO;
+}
 
-    free(buff);
-    fclose(f);
+/// the device behind an open descriptor has gone
+static bool fd_stale(int err) {
+    return err == ENODEV || err == ENOENT || err == ESTALE || err == ENXIO;
 }
 
-string* file_read_subdir(string* subdir, const char* filepath) {
-    string* data = NULL;
-    string_init(&data);
+static hashtable_t* g_fd_cache = NULL;
+// serializes the opens and closes, the lookups don't take it
+static pthread_mutex_t g_fd_cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static u64 g_fd_cache_cap = FD_CACHE_MAX_FILES;
+// under g_fd_cache_mtx, uncached reads since the last eviction pass
+static u64 g_fd_cache_misses = 0;
+static atomic_u64 g_fd_cache_pass = 1;
+
+static u64 fd_cache_hasher(void* key) {
+    return hash_str((const char*)key);
+}
 
-    string* filename = NULL;
-    string_dub(subdir, &filename);
-    string_append(filename, filepath);
+static void fd_cache_key_release_cb(void* p) {
+    free(p);
+}
 
-    char* filename_c = string_makez(filename);
-    file_read_all_s(filename_c, data);
-    string_strip(data);
+/// called through the table epoch, no reader can be inside a pread on it any more
+static void fd_cache_entry_release_cb(void* p) {
+    fd_entry_t* e = (fd_entry_t*)p;
+    close(e->fd);
+    free(e);
+}
 
-    zfree(filename_c);
-    string_release(filename);
+ret_t fd_cache_init(void) {
+    struct rlimit lim;
+    g_fd_cache_cap = FD_CACHE_MAX_FILES;
 
-    return data;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY)
+        g_fd_cache_cap = MAX(FD_CACHE_MIN_FILES, MIN(FD_CACHE_MAX_FILES, (u64)lim.rlim_cur / 2));
+
+    return ht_init(&g_fd_cache, FD_CACHE_TABLE_SIZE, &fd_cache_hasher, &ht_comparator_str,
+                   &fd_cache_key_release_cb, &fd_cache_entry_release_cb);
+}
+
+void fd_cache_shutdown(void) {
+    if (!g_fd_cache)
+        return;
+
+    ht_destroy(g_fd_cache);
+    g_fd_cache = NULL;
+}
+
+u64 fd_cache_size(void) {
+    return g_fd_cache ? ht_size(g_fd_cache) : 0;
+}
+
+typedef struct fd_victims {
+    const char** paths;
+    u64 size;
+    u64 capacity;
+    u64 pass;
+} fd_victims_t;
+
+static void fd_cache_pick_cb(u64 hash, void* key, void* value, void* ctx) {
+    fd_victims_t* v = (fd_victims_t*)ctx;
+    fd_entry_t* e = (fd_entry_t*)value;
+
+    if (atomic_load_explicit(&e->used, memory_order_relaxed) < v->pass && v->size < v->capacity)
+        v->paths[v->size++] = e->path;
+}
+
+/// Under g_fd_cache_mtx, closes the descriptors that haven't been read since the previous pass, the
+/// paths of the devices that are gone among them. Only the deletes take the mutex, so the picked
+/// paths stay alive until they're deleted.
+/// \return the number of closed descriptors
+static u64 fd_cache_evict(void) {
+    u64 pass = atomic_load(&g_fd_cache_pass);
+    u64 capacity = ht_size(g_fd_cache);
+
+    fd_victims_t v = {calloc(capacity ? capacity : 1, sizeof(const char*)), 0, capacity, pass};
+    if (!v.paths)
+        return 0;
+
+    ht_foreach(g_fd_cache, &fd_cache_pick_cb, &v);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-qual"
+    for (u64 i = 0; i < v.size; ++i)
+        ht_del(g_fd_cache, (void*)v.paths[i]);
+#pragma clang diagnostic pop
+
+    free(v.paths);
+    g_fd_cache_misses = 0;
+    atomic_store(&g_fd_cache_pass, pass + 1);
+
+    return v.size;
+}
+
+/// under g_fd_cache_mtx, a full cache is only swept once in a while, the misses go uncached meanwhile
+static bool fd_cache_has_room(void) {
+    if (ht_size(g_fd_cache) < g_fd_cache_cap)
+        return true;
+
+    if (++g_fd_cache_misses < MAX(1, g_fd_cache_cap / FD_CACHE_EVICT_DIV))
+        return false;
+
+    fd_cache_evict();
+
+    return ht_size(g_fd_cache) < g_fd_cache_cap;
+}
+
+static inline void fd_cache_touch(fd_entry_t* e) {
+    u64 pass = atomic_load_explicit(&g_fd_cache_pass, memory_order_relaxed);
+
+    // most reads find it stamped already, the line isn't dirtied then
+    if (atomic_load_explicit(&e->used, memory_order_relaxed) != pass)
+        atomic_store_explicit(&e->used, pass, memory_order_relaxed);
+}
+
+/// Inside a read section of the table epoch, the entry stays valid until it's left.
+/// \return NULL with errno set if the file can't be opened or there's no room to cache it
+static fd_entry_t* fd_cache_get(const char* filename) {
+    void* p = NULL;
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-qual"
+    if (ht_get(g_fd_cache, (void*)filename, &p) == ST_OK) {
+        fd_cache_touch((fd_entry_t*)p);
+        return (fd_entry_t*)p;
+    }
+
+    pthread_mutex_lock(&g_fd_cache_mtx);
+
+    // somebody could open it while we were waiting for the lock
+    if (ht_get(g_fd_cache, (void*)filename, &p) == ST_OK) {
+        pthread_mutex_unlock(&g_fd_cache_mtx);
+        fd_cache_touch((fd_entry_t*)p);
+        return (fd_entry_t*)p;
+    }
+#pragma clang diagnostic pop
+
+    if (!fd_cache_has_room()) {
+        pthread_mutex_unlock(&g_fd_cache_mtx);
+        errno = EMFILE;
+        return NULL;
+    }
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        int err = errno;
+        pthread_mutex_unlock(&g_fd_cache_mtx);
+        errno = err;
+        return NULL;
+    }
+
+    char* key = strdup(filename);
+    fd_entry_t* e = calloc(1, sizeof(fd_entry_t));
+    e->path = key;
+    e->fd = fd;
+    e->size_hint = FD_CACHE_MIN_READ;
+    e->short_eof = fd_short_read_is_eof(filename);
+    atomic_init(&e->used, atomic_load(&g_fd_cache_pass));
+
+    if (ht_set(g_fd_cache, key, e) != ST_OK) {
+        fd_cache_entry_release_cb(e);
+        free(key);
+        e = NULL;
+        errno = ENOMEM;
+    }
+
+    pthread_mutex_unlock(&g_fd_cache_mtx);
+
+    return e;
+}
+
+/// the entry is retired, whoever is still reading through it keeps a valid descriptor
+static void fd_cache_drop(const char* filename) {
+    pthread_mutex_lock(&g_fd_cache_mtx);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-qual"
+    ht_del(g_fd_cache, (void*)filename);
+#pragma clang diagnostic pop
+    pthread_mutex_unlock(&g_fd_cache_mtx);
+}
+
+static inline u64 fd_cache_reader_hint(void) {
+    return hash_u64((u64)pthread_self());
+}
+
+static ret_t fd_pread_all(int fd, u64 size_hint, bool short_eof, string* s) {
+    dynamic_allocator_t* da = _da(s);
+    da->used = 0;
+
+    if (da->size < size_hint)
+        da_realloc(da, size_hint);
+
+    while (true) {
+        u64 room = da->size - da->used;
+        ssize_t n = pread(fd, da->ptr + da->used, room, (off_t)da->used);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return ST_ERR;
+        }
+
+        if (n == 0)
+            break;
+
+        da->used += (u64)n;
+
+        if (short_eof && (u64)n < room)
+            break;
+
+        if (da->used == da->size)
+            da_realloc(da, da->size * 2);
+    }
+
+    return ST_OK;
+}
+
+ret_t file_read_uncached(const char* filename, string* s) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fd_missing(errno) ? ST_NOT_FOUND : ST_ERR;
+
+    ret_t ret = fd_pread_all(fd, FD_CACHE_MIN_READ, fd_short_read_is_eof(filename), s);
+    close(fd);
+
+    return ret;
+}
+
+/// inside a read section of the table epoch
+static ret_t fd_cache_read_entry(const char* filename, string* s) {
+    fd_entry_t* e = fd_cache_get(filename);
+    if (!e)
+        return fd_missing(errno) ? ST_NOT_FOUND : file_read_uncached(filename, s);
+
+    if (fd_pread_all(e->fd, e->size_hint, e->short_eof, s) == ST_OK) {
+        if (_da(s)->used >= e->size_hint)
+            e->size_hint = (u32)(_da(s)->used + FD_CACHE_MIN_READ);
+
+        return ST_OK;
+    }
+
+    if (!fd_stale(errno))
+        return ST_ERR;
+
+    // the device behind the descriptor is gone, try once with a fresh one
+    fd_cache_drop(filename);
+
+    e = fd_cache_get(filename);
+    if (!e)
+        return fd_missing(errno) ? ST_NOT_FOUND : file_read_uncached(filename, s);
+
+    return fd_pread_all(e->fd, e->size_hint, e->short_eof, s);
+}
+
+ret_t fd_cache_read(const char* filename, string* s) {
+    if (!g_fd_cache)
+        return file_read_uncached(filename, s);
+
+    // the entries are retired through the table epoch, a dropped one isn't closed under our pread
+    epoch_reader_t* reader = epoch_enter_transient(g_fd_cache->epoch, fd_cache_reader_hint());
+    if (!reader)
+        return file_read_uncached(filename, s);
+
+    ret_t ret = fd_cache_read_entry(filename, s);
+    epoch_exit_transient(reader);
+
+    return ret;
+}
+
+static ret_t fd_pread_buf(int fd, char* buf, u64 size, u64* read) {
+    u64 used = 0;
+
+    while (used < size) {
+        ssize_t n = pread(fd, buf + used, size - used, (off_t)used);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return ST_ERR;
+        }
+
+        used += (u64)n;
+
+        if (n == 0)
+            break;
+    }
+
+    *read = used;
+
+    return ST_OK;
 }
 
+static ret_t file_read_buf_uncached(const char* filename, char* buf, u64 size, u64* read) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return fd_missing(errno) ? ST_NOT_FOUND : ST_ERR;
+
+    ret_t ret = fd_pread_buf(fd, buf, size, read);
+    close(fd);
+
+    return ret;
+}
+
+/// inside a read section of the table epoch
+static ret_t fd_cache_read_buf_entry(const char* filename, char* buf, u64 size, u64* read) {
+    fd_entry_t* e = fd_cache_get(filename);
+    if (!e)
+        return fd_missing(errno) ? ST_NOT_FOUND : file_read_buf_uncached(filename, buf, size, read);
+
+    if (fd_pread_buf(e->fd, buf, size, read) == ST_OK)
+        return ST_OK;
+
+    if (!fd_stale(errno))
+        return ST_ERR;
+
+    fd_cache_drop(filename);
+
+    e = fd_cache_get(filename);
+    if (!e)
+        return fd_missing(errno) ? ST_NOT_FOUND : file_read_buf_uncached(filename, buf, size, read);
+
+    return fd_pread_buf(e->fd, buf, size, read);
+}
+
+ret_t fd_cache_read_buf(const char* filename, char* buf, u64 size, u64* read) {
+    if (!g_fd_cache)
+        return file_read_buf_uncached(filename, buf, size, read);
+
+    epoch_reader_t* reader = epoch_enter_transient(g_fd_cache->epoch, fd_cache_reader_hint());
+    if (!reader)
+        return file_read_buf_uncached(filename, buf, size, read);
+
+    ret_t ret = fd_cache_read_buf_entry(filename, buf, size, read);
+    epoch_exit_transient(reader);
+
+    return ret;
+}
+
+#ifndef NDEBUG
+
+static u64 test_count_lines(string* s, const char* prefix) {
+    const char* p = string_cdata(s);
+    const char* end = p + string_size(s);
+    u64 len = strlen(prefix);
+    u64 n = 0;
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', (u64)(end - p));
+        if (!eol)
+            eol = end;
+
+        n += (u64)(eol - p) >= len && memcmp(p, prefix, len) == 0;
+        p = eol + 1;
+    }
+
+    return n;
+}
+
+void test_fd_cache(void) {
+    char filename[] = "/tmp/hwmonitor_fd_cache_XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT(fd >= 0);
+
+    ASSERT(write(fd, "12345\n", 6) == 6);
+
+    string* s = NULL;
+    string_init(&s);
+
+    u64 nfiles = fd_cache_size();
+
+    CHECK_RETURN(fd_cache_read(filename, s));
+    ASSERT(string_comparez(s, "12345\n") == ST_OK);
+    ASSERT(fd_cache_size() == nfiles + 1);
+
+    // the cached descriptor must see the new content from the start of the file
+    ASSERT(pwrite(fd, "67", 2, 0) == 2);
+    CHECK_RETURN(fd_cache_read(filename, s));
+    ASSERT(string_comparez(s, "67345\n") == ST_OK);
+    ASSERT(fd_cache_size() == nfiles + 1);
+
+    file_read_line(filename, s);
+    ASSERT(string_size(s) == 6);
+
+    char buf[8];
+    u64 read = 0;
+    CHECK_RETURN(fd_cache_read_buf(filename, buf, sizeof(buf), &read));
+    ASSERT(read == 6 && memcmp(buf, "67345\n", 6) == 0);
+    ASSERT(fd_cache_size() == nfiles + 1);
+
+    // a full buffer is a prefix of the file
+    CHECK_RETURN(fd_cache_read_buf(filename, buf, 4, &read));
+    ASSERT(read == 4 && memcmp(buf, "6734", 4) == 0);
+
+    fd_cache_drop(filename);
+    ASSERT(fd_cache_size() == nfiles);
+
+    ASSERT(fd_cache_read("/nonexistent/hwmonitor", s) == ST_NOT_FOUND);
+
+    // smaps is a seq_file of several pages, it comes a page or so per read
+    string* ref = NULL;
+    string_init(&ref);
+
+    int smaps = open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+    ASSERT(smaps >= 0);
+
+    char chunk[512];
+    ssize_t n;
+    while ((n = pread(smaps, chunk, sizeof(chunk), (off_t)string_size(ref))) > 0)
+        string_appendn(ref, chunk, (u64)n);
+    close(smaps);
+
+    // the mappings are stable as long as nothing big is allocated in between
+    u64 mappings = test_count_lines(ref, "VmFlags:");
+    ASSERT(string_size(ref) > 4096 && mappings > 0);
+
+    CHECK_RETURN(fd_cache_read("/proc/self/smaps", s));
+    ASSERT(test_count_lines(s, "VmFlags:") == mappings);
+    CHECK_RETURN(fd_cache_read("/proc/self/smaps", s));
+    ASSERT(test_count_lines(s, "VmFlags:") == mappings);
+
+    CHECK_RETURN(file_read_uncached("/proc/self/smaps", s));
+    ASSERT(test_count_lines(s, "VmFlags:") == mappings);
+
+    fd_cache_drop("/proc/self/smaps");
+
+    // a full cache reads uncached, the files nobody reads any more make room for the ones in use
+    u64 cap = g_fd_cache_cap;
+    g_fd_cache_cap = fd_cache_size() + 2;
+
+    char files[4][32];
+    for (u64 i = 0; i < 4; ++i) {
+        strcpy(files[i], "/tmp/hwmonitor_fd_evict_XXXXXX");
+        int tfd = mkstemp(files[i]);
+        ASSERT(tfd >= 0);
+        ASSERT(write(tfd, "0123", 4) == 4);
+        close(tfd);
+    }
+
+    CHECK_RETURN(fd_cache_read(files[0], s));
+    CHECK_RETURN(fd_cache_read(files[1], s));
+    ASSERT(fd_cache_size() == g_fd_cache_cap);
+
+    for (u64 round = 0; round < 8; ++round) {
+        for (u64 i = 2; i < 4; ++i) {
+            CHECK_RETURN(fd_cache_read(files[i], s));
+            ASSERT(string_comparez(s, "0123") == ST_OK);
+            ASSERT(fd_cache_size() <= g_fd_cache_cap);
+        }
+    }
+
+    void* p = NULL;
+    ASSERT(ht_get(g_fd_cache, files[0], &p) == ST_NOT_FOUND);
+    ASSERT(ht_get(g_fd_cache, files[3], &p) == ST_OK);
+
+    // an uncached miss is still a miss
+    ASSERT(fd_cache_read("/nonexistent/hwmonitor", s) == ST_NOT_FOUND);
+
+    for (u64 i = 0; i < 4; ++i) {
+        fd_cache_drop(files[i]);
+        unlink(files[i]);
+    }
+
+    g_fd_cache_cap = cap;
+
+    string_release(ref);
+    string_release(s);
+    close(fd);
+    unlink(filename);
+}
+
+#endif
+
 void human_readable_size(u64 bytes, double* result, int* type) {
 
     double r = bytes / 1024.;
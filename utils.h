@@ -43,7 +43,37 @@ int file_read_all_buffered_s(const char* filename, string* s);
 
 void file_read_line(const char* filename, string* s);
 
-string* file_read_subdir(string* subdir, const char* filepath);
+/// the stripped content of <subdir><filepath>, drawn from @arena (NULL is the heap)
+string* file_read_subdir(string* subdir, const char* filepath, arena_t* arena);
+
+//============================================================================================================
+// CACHED FILE DESCRIPTORS
+//============================================================================================================
+
+ret_t fd_cache_init(void);
+
+void fd_cache_shutdown(void);
+
+/// Reads the whole file into @s with pread(2) through a descriptor that stays open between calls.
+/// The file is reopened only if the descriptor went stale (the device has gone). The cache is capped,
+/// the descriptors that aren't read any more are closed when it's full and the reads it can't take
+/// are done uncached.
+ret_t fd_cache_read(const char* filename, string* s);
+
+/// Same as fd_cache_read but into a caller buffer, nothing is allocated once the descriptor is open.
+/// Reads at most @size bytes, @read == @size means the file may have been cut.
+ret_t fd_cache_read_buf(const char* filename, char* buf, u64 size, u64* read);
+
+/// one-off read of a file that isn't worth keeping a descriptor for
+ret_t file_read_uncached(const char* filename, string* s);
+
+u64 fd_cache_size(void);
+
+#ifndef NDEBUG
+
+void test_fd_cache(void);
+
+#endif
 
 enum {
     HR_SIZE_KB,
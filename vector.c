@@ -72,3 +72,86 @@ void vector_foreach(vector_t* vec, void* ctx, vector_foreach_cb cb) {
         cb(i, vec->elem_size, ctx, v);
     }
 }
+
+#ifndef NDEBUG
+
+typedef struct test_vector_item {
+    u64 key;
+    u64 value;
+} test_vector_item_t;
+
+VECTOR_DECLARE(test_u64s, u64)
+
+VECTOR_DECLARE(test_items, test_vector_item_t)
+
+void test_vector(void) {
+    test_u64s_t v = VECTOR_EMPTY;
+
+    // doubling from the minimum, a handful of allocations for a thousand pushes
+    u64 allocs = alloc_count();
+    for (u64 i = 0; i < 1000; ++i)
+        CHECK_RETURN(test_u64s_push(&v, i));
+
+    ASSERT(v.size == 1000 && v.capacity == 1024);
+    ASSERT(alloc_count() - allocs == 8);
+
+    u64 sum = 0;
+    u64* it;
+    VECTOR_FOREACH(&v, it)
+        sum += *it;
+
+    ASSERT(sum == 999 * 1000 / 2);
+
+    // bulk append past the doubled capacity takes the exact size
+    u64 more[2000];
+    for (u64 i = 0; i < 2000; ++i)
+        more[i] = i;
+
+    CHECK_RETURN(test_u64s_append(&v, more, 2000));
+    ASSERT(v.size == 3000 && v.capacity == 3000 && v.data[2999] == 1999 && v.data[999] == 999);
+
+    test_u64s_clear(&v);
+    ASSERT(v.size == 0 && v.capacity == 3000);
+
+    test_u64s_shrink(&v);
+    ASSERT(v.data == NULL && v.capacity == 0);
+
+    CHECK_RETURN(test_u64s_reserve(&v, 100));
+    allocs = alloc_count();
+    for (u64 i = 0; i < 100; ++i)
+        CHECK_RETURN(test_u64s_push(&v, i));
+
+    ASSERT(alloc_count() == allocs && v.capacity == 100);
+
+    CHECK_RETURN(test_u64s_push(&v, 100));
+    ASSERT(v.capacity == 200);
+
+    test_u64s_shrink(&v);
+    ASSERT(v.capacity == 101 && v.data[100] == 100);
+
+    test_u64s_release(&v);
+    ASSERT(v.data == NULL && v.size == 0);
+
+    // structs by value
+    test_items_t items = VECTOR_EMPTY;
+
+    for (u64 i = 0; i < 10; ++i) {
+        test_vector_item_t* item = test_items_emplace(&items);
+        ASSERT(item->key == 0 && item->value == 0);
+        item->key = i;
+        item->value = i * 2;
+    }
+
+    test_vector_item_t* item;
+    u64 n = 0;
+    VECTOR_FOREACH(&items, item) {
+        ASSERT(item->key == n && item->value == n * 2);
+        ++n;
+    }
+
+    ASSERT(n == 10);
+
+    test_items_release(&items);
+}
+
+#endif
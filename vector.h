@@ -17,8 +17,11 @@
 
 #pragma once
 
+#include <memory.h>
 #include "globals.h"
 #include "dynamic_allocator.h"
+#include "allocators.h"
+#include "log.h"
 
 //============================================================================================================
 // GENERIC VECTOR
@@ -44,3 +47,123 @@ ret_t vector_set(vector_t* vec, u64 idx, void* elem);
 typedef void(* vector_foreach_cb)(u64, u64, void*, void*);
 
 void vector_foreach(vector_t* vec, void* ctx, vector_foreach_cb cb);
+
+#ifndef NDEBUG
+
+void test_vector(void);
+
+#endif
+
+//============================================================================================================
+// TYPED VECTOR
+//============================================================================================================
+
+/// VECTOR_DECLARE(name, type) generates name_t, a plain array of @type that grows geometrically, and the
+/// static inline functions around it, so the loops over it see the element type and can be inlined and
+/// vectorized. It lives by value, VECTOR_EMPTY is an empty one. Iterate through data[0, size) or with
+/// VECTOR_FOREACH, the pointers are valid until the next call that grows or shrinks it.
+
+#define VECTOR_MIN_CAPACITY 8
+#define VECTOR_GROWTH_MUL 2
+
+#define VECTOR_EMPTY {NULL, 0, 0}
+
+#define VECTOR_FOREACH(v, it) for ((it) = (v)->data; (it) < (v)->data + (v)->size; ++(it))
+
+#define VECTOR_DECLARE(name, type)                                                                          \
+typedef struct name {                                                                                       \
+    type* data;                                                                                             \
+    u64 size;                                                                                               \
+    u64 capacity;                                                                                           \
+} name##_t;                                                                                                 \
+                                                                                                            \
+/** room for @capacity elements without growing */                                                         \
+static inline __attribute__((unused)) ret_t name##_reserve(name##_t* v, u64 capacity) {                    \
+    if (capacity <= v->capacity)                                                                            \
+        return ST_OK;                                                                                       \
+                                                                                                            \
+    type* data = zrealloc(v->data, capacity * sizeof(type));                                                \
+    if (!data) {                                                                                            \
+        LOG_ERROR("can't alloc");                                                                           \
+        return ST_ERR;                                                                                      \
+    }                                                                                                       \
+                                                                                                            \
+    v->data = data;                                                                                         \
+    v->capacity = capacity;                                                                                 \
+                                                                                                            \
+    return ST_OK;                                                                                           \
+}                                                                                                           \
+                                                                                                            \
+/** room for @n more elements, at least doubling the capacity */                                           \
+static inline __attribute__((unused)) ret_t name##_grow(name##_t* v, u64 n) {                              \
+    u64 need = v->size + n;                                                                                 \
+    if (need <= v->capacity)                                                                                \
+        return ST_OK;                                                                                       \
+                                                                                                            \
+    u64 capacity = v->capacity * VECTOR_GROWTH_MUL;                                                         \
+    if (capacity < VECTOR_MIN_CAPACITY)                                                                     \
+        capacity = VECTOR_MIN_CAPACITY;                                                                     \
+                                                                                                            \
+    return name##_reserve(v, capacity < need ? need : capacity);                                            \
+}                                                                                                           \
+                                                                                                            \
+static inline __attribute__((unused)) ret_t name##_push(name##_t* v, type elem) {                          \
+    if (name##_grow(v, 1) != ST_OK)                                                                         \
+        return ST_ERR;                                                                                      \
+                                                                                                            \
+    v->data[v->size++] = elem;                                                                              \
+                                                                                                            \
+    return ST_OK;                                                                                           \
+}                                                                                                           \
+                                                                                                            \
+/** a zeroed element at the end, NULL if there's no memory */                                              \
+static inline __attribute__((unused)) type* name##_emplace(name##_t* v) {                                  \
+    if (name##_grow(v, 1) != ST_OK)                                                                         \
+        return NULL;                                                                                        \
+                                                                                                            \
+    type* elem = &v->data[v->size++];                                                                       \
+    memset(elem, 0, sizeof(type));                                                                          \
+                                                                                                            \
+    return elem;                                                                                            \
+}                                                                                                           \
+                                                                                                            \
+static inline __attribute__((unused)) ret_t name##_append(name##_t* v, const type* elems, u64 n) {         \
+    if (name##_grow(v, n) != ST_OK)                                                                         \
+        return ST_ERR;                                                                                      \
+                                                                                                            \
+    memcpy(&v->data[v->size], elems, n * sizeof(type));                                                     \
+    v->size += n;                                                                                           \
+                                                                                                            \
+    return ST_OK;                                                                                           \
+}                                                                                                           \
+                                                                                                            \
+/** gives back the capacity past the size */                                                               \
+static inline __attribute__((unused)) void name##_shrink(name##_t* v) {                                    \
+    if (v->size == v->capacity)                                                                             \
+        return;                                                                                             \
+                                                                                                            \
+    if (v->size == 0) {                                                                                     \
+        zfree(v->data);                                                                                     \
+        v->data = NULL;                                                                                     \
+        v->capacity = 0;                                                                                    \
+        return;                                                                                             \
+    }                                                                                                       \
+                                                                                                            \
+    type* data = zrealloc(v->data, v->size * sizeof(type));                                                 \
+    if (data) {                                                                                             \
+        v->data = data;                                                                                     \
+        v->capacity = v->size;                                                                              \
+    }                                                                                                       \
+}                                                                                                           \
+                                                                                                            \
+/** keeps the capacity */                                                                                   \
+static inline __attribute__((unused)) void name##_clear(name##_t* v) {                                     \
+    v->size = 0;                                                                                            \
+}                                                                                                           \
+                                                                                                            \
+static inline __attribute__((unused)) void name##_release(name##_t* v) {                                   \
+    zfree(v->data);                                                                                         \
+    v->data = NULL;                                                                                         \
+    v->size = 0;                                                                                            \
+    v->capacity = 0;                                                                                        \
+}